@@ -0,0 +1,39 @@
+#include <string>
+#include "Accelerator.h"
+#include "KDTree.h"
+#include "BVH.h"
+
+
+std::shared_ptr<Accelerator> Accelerator::create(AcceleratorType type){
+
+	if (type == BVHAccelerator)
+		return std::shared_ptr<Accelerator>(new BVH());
+
+	return std::shared_ptr<Accelerator>(new KDTree());
+}
+
+void Accelerator::intersect(RayPacket& packet, Hit* hits){
+
+	for (int i = 0; i < RayPacket::Size; i++){
+
+		if (!(packet.mask & (1 << i))) continue;
+
+		Hit hit;
+		hit.transformedRay = packet.getRay(i);
+		hit.t = packet.t[i];
+
+		if (intersect(hit))
+			packet.setHit(i, hit, hits);
+	}
+}
+
+bool Accelerator::parseType(const char* name, AcceleratorType& type){
+
+	std::string value(name);
+
+	if (value == "kdtree") type = KDTreeAccelerator;
+	else if (value == "bvh") type = BVHAccelerator;
+	else return false;
+
+	return true;
+}
@@ -0,0 +1,41 @@
+#ifndef _ACCELERATOR_H
+#define _ACCELERATOR_H
+
+#include <vector>
+#include <memory>
+#include "Hit.h"
+#include "RayPacket.h"
+#include "ModelCache.h"
+
+class Triangle;
+class BBox;
+
+enum AcceleratorType { KDTreeAccelerator, BVHAccelerator };
+
+// acceleration structure over the triangles of one mesh, the meshes only talk to this interface
+class Accelerator{
+
+public:
+
+	virtual ~Accelerator(){}
+
+	virtual void build(const std::vector<std::shared_ptr<Triangle>>& list, const BBox &V) = 0;
+	// finds the closest triangle in front of hit.t, its index and barycentric coordinates are returned inside the hit
+	virtual bool intersect(Hit &hit) = 0;
+	// packet version, the lanes with a closer triangle lower packet.t and get the triangle in their hit record
+	// the default traces the lanes one by one
+	virtual void intersect(RayPacket& packet, Hit* hits);
+	// true if any triangle is hit within distance, the traversal ends at the first one
+	virtual bool occluded(const Ray& ray, float distance) = 0;
+
+	// the built structure for the model cache, false if the structure can't be stored
+	virtual bool write(ModelCache::Writer& cache) const { return false; }
+	// restores a structure written for the same list instead of building it, false if the cache doesn't fit
+	virtual bool read(ModelCache::Reader& cache, const std::vector<std::shared_ptr<Triangle>>& list){ return false; }
+
+	static std::shared_ptr<Accelerator> create(AcceleratorType type);
+	// "kdtree" or "bvh", returns false for anything else
+	static bool parseType(const char* name, AcceleratorType& type);
+};
+
+#endif
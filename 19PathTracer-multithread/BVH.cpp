@@ -0,0 +1,429 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "BVH.h"
+
+
+static inline float surfaceArea(const BBox& box){
+
+	float xdim = box.m_size[0] - box.m_pos[0];
+	float ydim = box.m_size[1] - box.m_pos[1];
+	float zdim = box.m_size[2] - box.m_pos[2];
+
+	return 2 * (xdim*ydim + ydim*zdim + zdim*xdim);
+}
+
+static inline BBox emptyBox(){
+
+	return BBox(Vector3f(FLT_MAX, FLT_MAX, FLT_MAX), Vector3f(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+}
+
+static inline void unite(BBox& box, const BBox& other){
+
+	box.m_pos = Vector3f::Min(box.m_pos, other.m_pos);
+	box.m_size = Vector3f::Max(box.m_size, other.m_size);
+}
+
+static inline void setBounds(BVH::Node& node, const BBox& box){
+
+	for (int i = 0; i < 3; i++){
+		node.m_min[i] = box.m_pos[i];
+		node.m_max[i] = box.m_size[i];
+	}
+}
+
+static inline BBox getBounds(const BVH::Node& node){
+
+	return BBox(Vector3f(node.m_min[0], node.m_min[1], node.m_min[2]), Vector3f(node.m_max[0], node.m_max[1], node.m_max[2]));
+}
+
+
+BVH::BVH(){
+	m_costOfIntersection = 80;
+	m_costOfTraversal = 1;
+	m_primitivesPerBlock = 1;
+	m_statistics = Statistics();
+}
+
+BVH::~BVH(){}
+
+
+void BVH::build(const std::vector<std::shared_ptr<Triangle>>& list, const BBox &V){
+
+	std::vector<BBox> bounds(list.size());
+	for (size_t i = 0; i < list.size(); i++)
+		bounds[i] = list[i]->getBounds();
+
+	build(bounds, TriangleBuffer::BlockSize);
+
+	//the triangles are stored in leaf order, so a leaf reads them one block after the other
+	m_triangleBuffer.reserve((int)m_primitiveIndices.size());
+	for (size_t i = 0; i < m_nodes.size(); i++){
+
+		Node& node = m_nodes[i];
+		if (node.m_numberOfPrimitives == 0) continue;
+
+		int offset = node.m_primitivesOffset;
+		node.m_primitivesOffset = m_triangleBuffer.size();
+		for (int j = offset; j < offset + node.m_numberOfPrimitives; j++)
+			m_triangleBuffer.push_back(*list[m_primitiveIndices[j]], m_primitiveIndices[j]);
+		m_triangleBuffer.pad();
+	}
+
+	m_triangles.assign(m_triangleBuffer.size(), nullptr);
+	for (int i = 0; i < m_triangleBuffer.size(); i++){
+		if (m_triangleBuffer.getId(i) >= 0)
+			m_triangles[i] = list[m_triangleBuffer.getId(i)];
+	}
+	m_primitiveIndices.clear();
+
+	std::cout << "BVH: " << m_statistics.primitives << " triangles, " << m_statistics.nodes << " nodes, "
+		<< m_statistics.leaves << " leaves, depth " << m_statistics.depth << ", "
+		<< (float)m_statistics.primitives / max(m_statistics.leaves, 1) << " triangles per leaf, SAH cost "
+		<< m_statistics.sahCost << ", built in " << m_statistics.seconds << " s, "
+		<< (m_triangleBuffer.getMemoryUsage() + m_nodes.size() * sizeof(Node)) / 1024 << " KB" << std::endl;
+}
+
+bool BVH::write(ModelCache::Writer& cache) const{
+
+	cache.writeValue(m_primitivesPerBlock);
+	cache.writeValue(m_statistics);
+	cache.write(m_nodes);
+	m_triangleBuffer.write(cache);
+	return true;
+}
+
+bool BVH::read(ModelCache::Reader& cache, const std::vector<std::shared_ptr<Triangle>>& list){
+
+	m_triangles.clear();
+	m_primitiveIndices.clear();
+	if (!cache.readValue(m_primitivesPerBlock) || !cache.readValue(m_statistics) || !cache.read(m_nodes) ||
+		!m_triangleBuffer.read(cache) || m_statistics.primitives != (int)list.size() || !isValid((int)list.size())){
+
+		m_nodes.clear();
+		m_triangleBuffer.clear();
+		return false;
+	}
+
+	//refit moves the vertices of these triangles, the same as after a build
+	m_triangles.assign(m_triangleBuffer.size(), nullptr);
+	for (int i = 0; i < m_triangleBuffer.size(); i++){
+		if (m_triangleBuffer.getId(i) >= 0)
+			m_triangles[i] = list[m_triangleBuffer.getId(i)];
+	}
+
+	std::cout << "BVH: " << m_statistics.primitives << " triangles, " << m_statistics.nodes << " nodes read from the cache, "
+		<< (m_triangleBuffer.getMemoryUsage() + m_nodes.size() * sizeof(Node)) / 1024 << " KB" << std::endl;
+	return true;
+}
+
+bool BVH::isValid(int numberOfTriangles) const{
+
+	if (m_nodes.empty()) return false;
+
+	for (int i = 0; i < m_triangleBuffer.size(); i++){
+		if (m_triangleBuffer.getId(i) < -1 || m_triangleBuffer.getId(i) >= numberOfTriangles) return false;
+	}
+
+	//the same checks as for the kd tree, the children follow their parent and each level takes one entry of the stacks
+	std::vector<int> depth(m_nodes.size(), 0);
+	for (size_t i = 0; i < m_nodes.size(); i++){
+
+		const Node& node = m_nodes[i];
+		if (depth[i] >= MaxDepth) return false;
+
+		if (node.m_numberOfPrimitives > 0){
+
+			if (node.m_primitivesOffset < 0 || node.m_numberOfPrimitives > m_triangleBuffer.size() - node.m_primitivesOffset) return false;
+			continue;
+		}
+
+		if (i + 1 >= m_nodes.size() || node.m_secondChild <= (int)i || node.m_secondChild >= (int)m_nodes.size() || node.m_axis > 2) return false;
+
+		depth[i + 1] = max(depth[i + 1], depth[i] + 1);
+		depth[node.m_secondChild] = max(depth[node.m_secondChild], depth[i] + 1);
+	}
+
+	return true;
+}
+
+void BVH::build(const std::vector<BBox>& bounds, int primitivesPerBlock){
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	m_primitivesPerBlock = primitivesPerBlock;
+
+	m_nodes.clear();
+	m_triangles.clear();
+	m_triangleBuffer.clear();
+	m_primitiveIndices.clear();
+
+	int numberOfPrimitives = (int)bounds.size();
+
+	//the builder sorts these by reference, the list of boxes stays as it is
+	std::vector<BuildPrimitive> primitives(numberOfPrimitives);
+	for (int i = 0; i < numberOfPrimitives; i++){
+
+		primitives[i].bounds = bounds[i];
+		primitives[i].centroid = (primitives[i].bounds.m_pos + primitives[i].bounds.m_size) * 0.5f;
+		primitives[i].primitive = i;
+	}
+
+	if (numberOfPrimitives > 0){
+
+		m_nodes.reserve(2 * numberOfPrimitives);
+		m_primitiveIndices.reserve(numberOfPrimitives);
+		buildNode(primitives, 0, numberOfPrimitives, 0);
+	}
+
+	std::chrono::duration<float> seconds = std::chrono::steady_clock::now() - start;
+
+	m_statistics = Statistics();
+	m_statistics.primitives = numberOfPrimitives;
+	m_statistics.nodes = (int)m_nodes.size();
+	m_statistics.seconds = seconds.count();
+	m_statistics.sahCost = numberOfPrimitives > 0 ? computeStatistics(0, 0) / surfaceArea(getBounds(m_nodes[0])) : 0.0f;
+}
+
+
+int BVH::buildNode(std::vector<BuildPrimitive>& primitives, int start, int end, int depth){
+
+	int nodeIndex = (int)m_nodes.size();
+	m_nodes.push_back(Node());
+
+	int numberOfPrimitives = end - start;
+
+	//bounds of the triangles and of their centroids, the bins span the centroids
+	BBox bounds = emptyBox();
+	BBox centroidBounds = emptyBox();
+	for (int i = start; i < end; i++){
+
+		unite(bounds, primitives[i].bounds);
+		centroidBounds.extend(primitives[i].centroid);
+	}
+	setBounds(m_nodes[nodeIndex], bounds);
+
+	//split along the largest extent of the centroids
+	int axis = 0;
+	Vector3f extent = centroidBounds.m_size - centroidBounds.m_pos;
+	if (extent[1] > extent[axis]) axis = 1;
+	if (extent[2] > extent[axis]) axis = 2;
+
+	float centroidMin = centroidBounds.m_pos[axis];
+	float centroidExtent = extent[axis];
+
+	int mid = -1;
+
+	if (numberOfPrimitives > 1 && depth < MaxDepth - 1 && centroidExtent > 0.0f){
+
+		//sort the triangles into bins by their centroid
+		int binCount[NumberOfBins];
+		BBox binBounds[NumberOfBins];
+		for (int b = 0; b < NumberOfBins; b++){
+			binCount[b] = 0;
+			binBounds[b] = emptyBox();
+		}
+
+		float scale = NumberOfBins / centroidExtent;
+		for (int i = start; i < end; i++){
+
+			int b = min((int)((primitives[i].centroid[axis] - centroidMin) * scale), NumberOfBins - 1);
+			binCount[b]++;
+			unite(binBounds[b], primitives[i].bounds);
+		}
+
+		//sweep from the right to get the areas and counts of all right sides
+		float rightArea[NumberOfBins];
+		int rightCount[NumberOfBins];
+		BBox box = emptyBox();
+		int count = 0;
+		for (int b = NumberOfBins - 1; b > 0; b--){
+
+			unite(box, binBounds[b]);
+			count += binCount[b];
+			rightArea[b] = count > 0 ? surfaceArea(box) : 0.0f;
+			rightCount[b] = count;
+		}
+
+		//then from the left, the split after bin b puts the bins 0..b to the left
+		float bestCost = FLT_MAX;
+		int bestBin = -1;
+		box = emptyBox();
+		count = 0;
+		for (int b = 0; b < NumberOfBins - 1; b++){
+
+			unite(box, binBounds[b]);
+			count += binCount[b];
+
+			if (count == 0 || rightCount[b + 1] == 0) continue;
+
+			float cost = numberOfBlocks(count) * surfaceArea(box) + numberOfBlocks(rightCount[b + 1]) * rightArea[b + 1];
+			if (cost < bestCost){
+				bestCost = cost;
+				bestBin = b;
+			}
+		}
+
+		float nodeArea = surfaceArea(bounds);
+		float splitCost = m_costOfTraversal + m_costOfIntersection * (nodeArea > 0.0f ? bestCost / nodeArea : 0.0f);
+		float leafCost = (float)m_costOfIntersection * numberOfBlocks(numberOfPrimitives);
+
+		if (bestBin >= 0 && (splitCost < leafCost || numberOfPrimitives > MaxPrimitivesInLeaf)){
+
+			BuildPrimitive* pmid = std::partition(&primitives[start], &primitives[end - 1] + 1, [&](const BuildPrimitive& p){
+				return min((int)((p.centroid[axis] - centroidMin) * scale), NumberOfBins - 1) <= bestBin;
+			});
+			mid = (int)(pmid - &primitives[0]);
+		}
+	}
+
+	//the centroids coincide but there are too many triangles for one leaf, split in the middle
+	//the traversal stacks hold MaxDepth nodes, at the last level everything left becomes a leaf
+	if (mid < 0 && numberOfPrimitives > MaxPrimitivesInLeaf && depth < MaxDepth - 1)
+		mid = start + numberOfPrimitives / 2;
+
+	if (mid < 0){
+
+		m_nodes[nodeIndex].m_primitivesOffset = (int)m_primitiveIndices.size();
+		m_nodes[nodeIndex].m_numberOfPrimitives = (unsigned int)numberOfPrimitives;
+		m_nodes[nodeIndex].m_axis = 0;
+		for (int i = start; i < end; i++)
+			m_primitiveIndices.push_back(primitives[i].primitive);
+
+		return nodeIndex;
+	}
+
+	//the first child follows the node, the index of the second one is known after the first subtree is done
+	buildNode(primitives, start, mid, depth + 1);
+	int secondChild = buildNode(primitives, mid, end, depth + 1);
+
+	m_nodes[nodeIndex].m_secondChild = secondChild;
+	m_nodes[nodeIndex].m_numberOfPrimitives = 0;
+	m_nodes[nodeIndex].m_axis = (unsigned int)axis;
+
+	return nodeIndex;
+}
+
+
+BBox BVH::getRootBounds() const{
+
+	return m_nodes.empty() ? BBox() : getBounds(m_nodes[0]);
+}
+
+void BVH::refit(){
+
+	//children are stored behind their parents, so going backwards visits them first
+	for (int i = (int)m_nodes.size() - 1; i >= 0; i--){
+
+		Node& node = m_nodes[i];
+		BBox bounds = emptyBox();
+
+		if (node.m_numberOfPrimitives > 0){
+
+			for (int j = node.m_primitivesOffset; j < node.m_primitivesOffset + node.m_numberOfPrimitives; j++){
+				m_triangles[j]->calcBounds();
+				unite(bounds, m_triangles[j]->getBounds());
+				m_triangleBuffer.set(j, *m_triangles[j]);
+			}
+
+		}else{
+
+			unite(bounds, getBounds(m_nodes[i + 1]));
+			unite(bounds, getBounds(m_nodes[node.m_secondChild]));
+		}
+
+		setBounds(node, bounds);
+	}
+}
+
+
+float BVH::computeStatistics(int nodeIndex, int depth){
+
+	const Node& node = m_nodes[nodeIndex];
+	float area = surfaceArea(getBounds(node));
+
+	m_statistics.depth = max(m_statistics.depth, depth);
+
+	if (node.m_numberOfPrimitives > 0){
+
+		m_statistics.leaves++;
+		return m_costOfIntersection * numberOfBlocks(node.m_numberOfPrimitives) * area;
+	}
+
+	return m_costOfTraversal * area + computeStatistics(nodeIndex + 1, depth + 1) + computeStatistics(node.m_secondChild, depth + 1);
+}
+
+
+bool BVH::intersect(Hit &hit){
+
+	// only hits in front of the hit found so far count, the scene passes the same hit to all primitives
+	float tclosest = (float)hit.t;
+	int triangle = -1;
+	float b1 = 0.0f, b2 = 0.0f;
+
+	TriangleBuffer::ShearedRay sheared(hit.transformedRay);
+
+	traverseLeaves(hit.transformedRay, tclosest, [&](int i, int count, float& tmax){
+
+		int slot = m_triangleBuffer.intersect(i, count, sheared, tmax, b1, b2);
+		if (slot >= 0)
+			triangle = m_triangleBuffer.getId(slot);
+		return false;
+	});
+
+	hit.hitObject = triangle >= 0;
+	if (hit.hitObject){
+		hit.t = tclosest;
+		hit.triangle = triangle;
+		hit.b1 = b1;
+		hit.b2 = b2;
+	}
+
+	return hit.hitObject;
+}
+
+bool BVH::occluded(const Ray& ray, float distance){
+
+	bool occluded = false;
+	float b1, b2;
+
+	TriangleBuffer::ShearedRay sheared(ray);
+
+	traverseLeaves(ray, distance, [&](int i, int count, float& tmax){
+
+		occluded = m_triangleBuffer.intersect(i, count, sheared, tmax, b1, b2) >= 0;
+		return occluded;
+	});
+
+	return occluded;
+}
+
+void BVH::intersect(RayPacket& packet, Hit* hits){
+
+	Float4 b1(0.0f), b2(0.0f);
+	int triangle[RayPacket::Size] = { -1, -1, -1, -1 };
+
+	TriangleBuffer::ShearedPacket sheared(packet);
+
+	// packet.t is lowered by the triangles, so the traversal skips the nodes behind the closest hits
+	traverse(packet, [&](int i, int mask){
+
+		int hitMask = m_triangleBuffer.intersect(i, sheared, mask, packet.t, b1, b2);
+		for (int j = 0; j < RayPacket::Size; j++){
+			if (hitMask & (1 << j)) triangle[j] = m_triangleBuffer.getId(i);
+		}
+	});
+
+	for (int i = 0; i < RayPacket::Size; i++){
+
+		if (triangle[i] < 0) continue;
+
+		Hit hit;
+		hit.t = packet.t[i];
+		hit.transformedRay = packet.getRay(i);
+		hit.triangle = triangle[i];
+		hit.b1 = b1[i];
+		hit.b2 = b2[i];
+		packet.setHit(i, hit, hits);
+	}
+}
@@ -0,0 +1,263 @@
+#ifndef _BVH_H
+#define _BVH_H
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include "Accelerator.h"
+#include "Primitive.h"
+#include "TriangleBuffer.h"
+#include "Statistics.h"
+
+
+// binary bounding volume hierarchy built with binned SAH, unlike the kd tree every triangle is referenced once
+class BVH : public Accelerator{
+
+public:
+
+	// 32 byte node, the nodes are stored depth first so the first child follows its parent
+	struct Node{
+		float m_min[3];
+		float m_max[3];
+		union{
+			int m_primitivesOffset;		// leaf
+			int m_secondChild;			// interior
+		};
+		// a leaf takes any count the primitive indices can reach, the last level of the build can't split anymore
+		unsigned int m_numberOfPrimitives : 30;	// 0 for interior nodes
+		unsigned int m_axis : 2;
+	};
+
+	// numbers of the last build
+	struct Statistics{
+		int primitives;
+		int nodes;
+		int leaves;
+		int depth;
+		float sahCost;		// expected cost of a ray in units of one traversal step, same costs as the kd tree
+		float seconds;
+	};
+
+	BVH();
+	~BVH();
+
+	void build(const std::vector<std::shared_ptr<Triangle>>& list, const BBox &V);
+	bool intersect(Hit &hit);
+	void intersect(RayPacket& packet, Hit* hits);
+	bool occluded(const Ray& ray, float distance);
+	bool write(ModelCache::Writer& cache) const;
+	bool read(ModelCache::Reader& cache, const std::vector<std::shared_ptr<Triangle>>& list);
+
+	// builds over arbitrary (min, max) boxes, the scene uses this for its primitives
+	// the sah prices a leaf by its blocks of primitivesPerBlock primitives, which are intersected together
+	void build(const std::vector<BBox>& bounds, int primitivesPerBlock = 1);
+
+	// calls intersect(position, tmax) for the primitives of all leaves the ray enters in front of tmax, near leaves first
+	// position is the place of the primitive in getPrimitiveIndices(), intersect may lower tmax and returns true to stop
+	template <typename Intersect> void traverse(const Ray& ray, float& tmax, Intersect intersect) const;
+	// the same for whole leaves, calls intersect(position, count, tmax) with the primitives of the leaf
+	template <typename Intersect> void traverseLeaves(const Ray& ray, float& tmax, Intersect intersect) const;
+	// packet version, calls intersect(position, mask) with the rays of packet.mask that enter the leaf in front of their t
+	// the children are visited in the order of the first ray, intersect may lower packet.t
+	template <typename Intersect> void traverse(const RayPacket& packet, Intersect intersect) const;
+	// calls visit(position, count) once for every leaf with its range of getPrimitiveIndices()
+	template <typename Visit> void visitLeaves(Visit visit) const;
+
+	// the primitive indices in leaf order, a build over triangles moves them into the triangle buffer
+	const std::vector<int>& getPrimitiveIndices() const { return m_primitiveIndices; }
+
+	// recomputes the node bounds after the triangles moved, the topology is kept
+	void refit();
+
+	const Statistics& getStatistics() const { return m_statistics; }
+	// (min, max) box of the root, an empty box at the origin if nothing was built
+	BBox getRootBounds() const;
+
+private:
+
+	// bounds and centroid of a primitive while building
+	struct BuildPrimitive{
+		BBox bounds;
+		Vector3f centroid;
+		int primitive;
+	};
+
+	int buildNode(std::vector<BuildPrimitive>& primitives, int start, int end, int depth);
+	int numberOfBlocks(int numberOfPrimitives) const { return (numberOfPrimitives + m_primitivesPerBlock - 1) / m_primitivesPerBlock; }
+	float computeStatistics(int node, int depth);
+	// checks a tree read from the cache, the traversal trusts the child indices, leaf ranges and triangle ids
+	bool isValid(int numberOfTriangles) const;
+
+	static const int MaxDepth = 64;
+	static const int NumberOfBins = 16;
+	static const int MaxPrimitivesInLeaf = 255;
+
+	std::vector<Node> m_nodes;
+
+	//the triangles in leaf order, each leaf covers a range of slots starting a new block, the buffer reports the primitive indices
+	TriangleBuffer m_triangleBuffer;
+	//the same triangles as objects for each slot, refit reads their moved vertices
+	std::vector<std::shared_ptr<Triangle>> m_triangles;
+	int m_primitivesPerBlock;
+	//the index of each primitive in the list passed to build, the hits report these
+	std::vector<int> m_primitiveIndices;
+
+	//the same costs as the kd tree, so the sah values of both can be compared
+	int	m_costOfIntersection;
+	int m_costOfTraversal;
+
+	Statistics m_statistics;
+};
+
+
+template <typename Intersect> void BVH::traverse(const Ray& ray, float& tmax, Intersect intersect) const{
+
+	traverseLeaves(ray, tmax, [&](int first, int count, float& t){
+
+		for (int i = first; i < first + count; i++){
+			if (intersect(i, t)) return true;
+		}
+		return false;
+	});
+}
+
+
+template <typename Visit> void BVH::visitLeaves(Visit visit) const{
+
+	for (size_t i = 0; i < m_nodes.size(); i++){
+		if (m_nodes[i].m_numberOfPrimitives > 0)
+			visit(m_nodes[i].m_primitivesOffset, (int)m_nodes[i].m_numberOfPrimitives);
+	}
+}
+
+template <typename Intersect> void BVH::traverseLeaves(const Ray& ray, float& tmax, Intersect intersect) const{
+
+	if (m_nodes.empty()) return;
+
+	float origin[3], invDirection[3];
+	int directionIsNegative[3];
+	for (int i = 0; i < 3; i++){
+		origin[i] = ray.origin[i];
+		invDirection[i] = 1.0f / ray.direction[i];
+		directionIsNegative[i] = invDirection[i] < 0;
+
+		// a nan would pass every slab test below and the ray would visit the whole tree
+		if (std::isnan(origin[i]) || std::isnan(invDirection[i])) return;
+	}
+
+	// the second children still to visit
+	int todo[MaxDepth];
+	int todoPos = 0;
+
+	int nodeIndex = 0;
+	for (;;){
+
+		const Node& node = m_nodes[nodeIndex];
+		STATISTIC(bvhNodes, 1);
+
+		// slab test against the node bounds, the nan of a ray in a slab plane keeps the old interval
+		float t0 = 0.0f, t1 = tmax;
+		bool inside = true;
+		for (int i = 0; i < 3 && inside; i++){
+
+			float tnear = ((directionIsNegative[i] ? node.m_max[i] : node.m_min[i]) - origin[i]) * invDirection[i];
+			float tfar = ((directionIsNegative[i] ? node.m_min[i] : node.m_max[i]) - origin[i]) * invDirection[i];
+
+			// rounding of the far distance, as in pbrt
+			tfar *= 1.0f + 2.0f * 3.0f * 0.5f * FLT_EPSILON;
+
+			if (tnear > t0) t0 = tnear;
+			if (tfar < t1) t1 = tfar;
+			inside = t0 <= t1;
+		}
+
+		if (inside){
+
+			if (node.m_numberOfPrimitives > 0){
+
+				if (intersect(node.m_primitivesOffset, (int)node.m_numberOfPrimitives, tmax)) return;
+
+			}else{
+
+				// visit the child on the side the ray comes from first
+				if (directionIsNegative[node.m_axis]){
+					todo[todoPos++] = nodeIndex + 1;
+					nodeIndex = node.m_secondChild;
+				}else{
+					todo[todoPos++] = node.m_secondChild;
+					nodeIndex = nodeIndex + 1;
+				}
+				continue;
+			}
+		}
+
+		if (todoPos == 0) break;
+		nodeIndex = todo[--todoPos];
+	}
+}
+
+
+template <typename Intersect> void BVH::traverse(const RayPacket& packet, Intersect intersect) const{
+
+	if (m_nodes.empty() || packet.mask == 0) return;
+
+	int mask = packet.mask;
+	Float4 invDirection[3];
+	for (int i = 0; i < 3; i++){
+		invDirection[i] = Float4(1.0f) / packet.direction[i];
+		mask &= ~(Float4::IsNan(packet.origin[i]) | Float4::IsNan(invDirection[i])).signBits();
+	}
+	if (mask == 0) return;
+
+	int first = (mask & 1) ? 0 : (mask & 2) ? 1 : (mask & 4) ? 2 : 3;
+	int directionIsNegative[3];
+	for (int i = 0; i < 3; i++)
+		directionIsNegative[i] = invDirection[i][first] < 0;
+
+	int todo[MaxDepth];
+	int todoPos = 0;
+
+	int nodeIndex = 0;
+	for (;;){
+
+		const Node& node = m_nodes[nodeIndex];
+		STATISTIC(bvhNodes, 1);
+
+		// the same slab test as for a single ray
+		Float4 t0(0.0f), t1 = packet.t;
+		for (int i = 0; i < 3; i++){
+
+			Float4 tnear = (Float4(node.m_min[i]) - packet.origin[i]) * invDirection[i];
+			Float4 tfar = (Float4(node.m_max[i]) - packet.origin[i]) * invDirection[i];
+
+			t0 = Float4::Max(Float4::Min(tnear, tfar), t0);
+			t1 = Float4::Min(Float4::Max(tnear, tfar) * (1.0f + 2.0f * 3.0f * 0.5f * FLT_EPSILON), t1);
+		}
+
+		int inside = mask & (t0 <= t1).signBits();
+		if (inside){
+
+			if (node.m_numberOfPrimitives > 0){
+
+				for (int i = node.m_primitivesOffset; i < node.m_primitivesOffset + node.m_numberOfPrimitives; i++)
+					intersect(i, inside);
+
+			}else{
+
+				if (directionIsNegative[node.m_axis]){
+					todo[todoPos++] = nodeIndex + 1;
+					nodeIndex = node.m_secondChild;
+				}else{
+					todo[todoPos++] = node.m_secondChild;
+					nodeIndex = nodeIndex + 1;
+				}
+				continue;
+			}
+		}
+
+		if (todoPos == 0) break;
+		nodeIndex = todo[--todoPos];
+	}
+}
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef _WIN32
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "STimer.h"
+#include "Render.h"
+#include "Benchmark.h"
+
+// headless counterpart of the WinMain in main.cpp, renders one frame and writes it to disk
+// built on linux by the Makefile next to it: make (all sources but main.cpp, c++14, -pthread)
+// the scenes of the measurements in the commit messages are in scenes/, each names its command line in its first lines
+//
+// usage: PathTracer [-t threads] [-s samples] [-b bounces] [-w width] [-h height] [-tile size] [-pass samples] [-time seconds] [-adaptive error] [-roulette depth|off] [-order morton|spiral] [-seed n] [-accel kdtree|bvh] [-packets on|off] [-nee on|off] [-wavefront on|off] [-sort on|off] [-cache on|off] [-o image.bmp|image.ppm] [-benchmark results.json] [scene.txt]
+
+static void printUsage(const char* name) {
+
+	std::cout << "usage: " << name << " [options] [scene file]" << std::endl;
+	std::cout << "  -t <n>      number of threads, default hardware concurrency" << std::endl;
+	std::cout << "  -s <n>      samples per pixel, default 100" << std::endl;
+	std::cout << "  -b <n>      number of bounces, default " << c_numBounces << std::endl;
+	std::cout << "  -w <n>      image width, default " << c_imageWidth << std::endl;
+	std::cout << "  -h <n>      image height, default " << c_imageHeight << std::endl;
+	std::cout << "  -tile <n>   tile size in pixels, default 16" << std::endl;
+	std::cout << "  -pass <n>   samples per pixel added by each pass over the image after the first ones" << std::endl;
+	std::cout << "              default all samples in one pass, 16 with a time limit or adaptive sampling" << std::endl;
+	std::cout << "  -time <s>   stop after the pass running when the seconds are spent, default no limit" << std::endl;
+	std::cout << "  -adaptive <e> tiles stop taking samples when the relative error of their pixels falls below this, e.g. 0.15, default off" << std::endl;
+	std::cout << "  -roulette <d> bounces before russian roulette ends dark paths, or off, default 3 or the scene's" << std::endl;
+	std::cout << "  -order <o>  tile order, morton or spiral, default morton" << std::endl;
+	std::cout << "  -seed <n>   random seed, the image is reproducible for a given seed" << std::endl;
+	std::cout << "  -accel <a>  acceleration structure of the meshes, kdtree or bvh, default kdtree" << std::endl;
+	std::cout << "  -packets <p> trace the primary rays of a pixel in packets of four, on or off, default off" << std::endl;
+	std::cout << "  -nee <n>    sample the lights at every diffuse point, on or off, default on" << std::endl;
+	std::cout << "  -wavefront <w> extend all paths of a tile together a bounce at a time, on or off, default off" << std::endl;
+	std::cout << "  -sort <s>      sort the bounce rays of the wavefront batches by direction and origin, on or off, default off" << std::endl;
+	std::cout << "  -cache <c>  read the meshes and their trees from binary caches next to the obj files, on or off, default on" << std::endl;
+	std::cout << "  -o <file>   output image (.bmp or .ppm), default out.bmp" << std::endl;
+	std::cout << "  -benchmark <file> run the routine and scene benchmarks instead and write json" << std::endl;
+	std::cout << "without a scene file the cornell box is rendered" << std::endl;
+}
+
+static bool savePPM(const char* filename, const unsigned char* data, int width, int height) {
+
+	FILE *filePtr = fopen(filename, "wb");
+	if (filePtr == NULL)
+		return false;
+
+	fprintf(filePtr, "P6\n%d %d\n255\n", width, height);
+
+	// the render buffer is a bottom up bgr dib, ppm wants top down rgb
+	std::vector<unsigned char> row(width * 3);
+	for (int y = height - 1; y >= 0; y--) {
+		for (int x = 0; x < width; x++) {
+			row[x * 3 + 0] = data[(y * width + x) * 3 + 2];
+			row[x * 3 + 1] = data[(y * width + x) * 3 + 1];
+			row[x * 3 + 2] = data[(y * width + x) * 3 + 0];
+		}
+		fwrite(&row[0], 1, width * 3, filePtr);
+	}
+
+	fclose(filePtr);
+	return true;
+}
+
+// ppm for a .ppm extension, bmp otherwise
+static bool saveImage(const std::string& filename, const unsigned char* data) {
+
+	return filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".ppm") == 0 ?
+		savePPM(filename.c_str(), data, (int)c_imageWidth, (int)c_imageHeight) :
+		Bitmap::saveBitmap24(filename.c_str(), data, (int)c_imageWidth, (int)c_imageHeight);
+}
+
+// saves a debug image next to the output, the suffix goes before the extension
+static bool saveMap(const std::string& output, const char* suffix, const std::vector<unsigned char>& data) {
+
+	size_t dot = output.find_last_of('.');
+	std::string filename = dot == std::string::npos ? output + suffix : output.substr(0, dot) + suffix + output.substr(dot);
+	if (!saveImage(filename, &data[0])) {
+		std::cout << "Could not write " << filename << std::endl;
+		return false;
+	}
+	std::cout << "Wrote " << filename << std::endl;
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+
+	size_t numThreads = std::thread::hardware_concurrency();
+	std::string output = "out.bmp";
+	std::string benchmark;
+	int samplesPerPass = 0;
+	float timeBudget = 0.0f;
+	float adaptiveThreshold = 0.0f;
+	const char* roulette = NULL;
+	const char* sceneFile = NULL;
+
+	c_samplesPerPixel = 100;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+
+		if (arg == "--help") {
+			printUsage(argv[0]);
+			return 0;
+		}else if (arg[0] == '-' && i + 1 < argc) {
+			const char* value = argv[++i];
+
+			if (arg == "-t") numThreads = atoi(value);
+			else if (arg == "-s") c_samplesPerPixel = atoi(value);
+			else if (arg == "-b") c_numBounces = atoi(value);
+			else if (arg == "-w") c_imageWidth = atoi(value);
+			else if (arg == "-h") c_imageHeight = atoi(value);
+			else if (arg == "-tile") task.setTileSize(atoi(value));
+			else if (arg == "-pass") samplesPerPass = atoi(value);
+			else if (arg == "-time") timeBudget = (float)atof(value);
+			else if (arg == "-adaptive") adaptiveThreshold = (float)atof(value);
+			else if (arg == "-roulette") roulette = value;
+			else if (arg == "-order" && std::string(value) == "morton") task.setTileOrder(Morton);
+			else if (arg == "-order" && std::string(value) == "spiral") task.setTileOrder(Spiral);
+			else if (arg == "-seed") c_seed = strtoull(value, NULL, 10);
+			else if (arg == "-accel" && std::string(value) == "kdtree") c_accelerator = KDTreeAccelerator;
+			else if (arg == "-accel" && std::string(value) == "bvh") c_accelerator = BVHAccelerator;
+			else if (arg == "-packets" && std::string(value) == "on") c_packets = true;
+			else if (arg == "-packets" && std::string(value) == "off") c_packets = false;
+			else if (arg == "-nee" && std::string(value) == "on") c_nextEventEstimation = true;
+			else if (arg == "-nee" && std::string(value) == "off") c_nextEventEstimation = false;
+			else if (arg == "-wavefront" && std::string(value) == "on") c_wavefront = true;
+			else if (arg == "-wavefront" && std::string(value) == "off") c_wavefront = false;
+			else if (arg == "-sort" && std::string(value) == "on") c_sortRays = true;
+			else if (arg == "-sort" && std::string(value) == "off") c_sortRays = false;
+			else if (arg == "-cache" && std::string(value) == "on") c_modelCache = true;
+			else if (arg == "-cache" && std::string(value) == "off") c_modelCache = false;
+			else if (arg == "-o") output = value;
+			else if (arg == "-benchmark") benchmark = value;
+			else {
+				printUsage(argv[0]);
+				return 1;
+			}
+		}else if (arg[0] != '-') {
+			sceneFile = argv[i];
+		}else {
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (numThreads == 0 || c_samplesPerPixel == 0 || c_imageWidth == 0 || c_imageHeight == 0) {
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	// the benchmarks set up their own scenes, a scene file given with them is the statue to use
+	if (!benchmark.empty()) {
+
+		Benchmark bench(numThreads);
+		if (sceneFile) bench.setStatuePath(sceneFile);
+		bench.run();
+		if (!bench.writeJson(benchmark)) {
+			std::cout << "Could not write " << benchmark << std::endl;
+			return 1;
+		}
+		std::cout << "Wrote " << benchmark << std::endl;
+		return 0;
+	}
+
+	// without a preview to show, small passes only cost time, unless the pixels are to stop early
+	bool passes = timeBudget > 0.0f || adaptiveThreshold > 0.0f;
+	task.setTimeBudget(timeBudget);
+	task.setAdaptiveThreshold(adaptiveThreshold);
+	task.setSamplesPerPass(samplesPerPass > 0 ? samplesPerPass : passes ? 16 : (int)c_samplesPerPixel);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if (sceneFile) {
+		if (!loadScene(sceneFile))
+			return 1;
+	}else {
+		createCornellBox();
+	}
+	camera->setResolution((int)c_imageWidth, (int)c_imageHeight);
+	if (roulette) scene->setRussianRoulette(std::string(roulette) == "off" ? -1 : atoi(roulette));
+
+	std::chrono::duration<float> setupSeconds = std::chrono::steady_clock::now() - start;
+
+	g_pixels.resize(c_imageWidth * c_imageHeight);
+	g_pixels2 = (unsigned char*)calloc(c_imageWidth * c_imageHeight * 3, sizeof(unsigned char));
+
+	std::cout << "Rendering " << c_imageWidth << "x" << c_imageHeight << " at " << c_samplesPerPixel << " spp, "
+		<< c_numBounces << " bounces using " << numThreads << " threads" << (c_packets ? " and ray packets" : "") << (c_wavefront ? (c_sortRays ? " in wavefront batches with sorted rays." : " in wavefront batches.") : ".") << std::endl;
+
+	STimer timer;
+	start = std::chrono::steady_clock::now();
+
+	task.start(numThreads, g_pixels, g_pixels2);
+
+	while (!task.isFinished()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		timer.ReportProgress(task.getTilesDone(), task.getTileCount());
+	}
+	task.wait();
+
+	std::chrono::duration<float> renderSeconds = std::chrono::steady_clock::now() - start;
+
+	double primaryRays = double(task.getSamplesTaken());
+	printf("\nscene setup:     %0.3f seconds\n", setupSeconds.count());
+	printf("render:          %0.3f seconds, %0.1f spp on average\n", renderSeconds.count(), primaryRays / (c_imageWidth * c_imageHeight));
+	printf("primary rays:    %0.0f (%0.3f Mrays/s)\n", primaryRays, primaryRays / renderSeconds.count() * 1e-6);
+	printf("per thread:      %0.3f Mrays/s\n", primaryRays / renderSeconds.count() * 1e-6 / numThreads);
+	task.reportTiles();
+	task.reportStatistics();
+
+	if (!saveImage(output, g_pixels2)) {
+		std::cout << "Could not write " << output << std::endl;
+		return 1;
+	}
+	std::cout << "Wrote " << output << std::endl;
+
+	// the cost and the samples of every pixel next to the render, out.bmp gets out_cost.bmp and out_spp.bmp
+	std::vector<unsigned char> heatmap;
+	if (task.getHeatmap(heatmap) && !saveMap(output, "_cost", heatmap))
+		return 1;
+
+	std::vector<unsigned char> sampleMap;
+	if (task.getSampleMap(sampleMap) && !saveMap(output, "_spp", sampleMap))
+		return 1;
+
+	return 0;
+}
+#endif
@@ -0,0 +1,493 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cfloat>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#elif defined(__APPLE__)
+#include <sys/resource.h>
+#include <mach/mach.h>
+#else
+#include <sys/resource.h>
+#include <malloc.h>
+#endif
+
+#include "Benchmark.h"
+#include "Render.h"
+#include "Model.h"
+#include "MeshTorus.h"
+#include "MeshSphere.h"
+#include "Texture.h"
+#include "Sampler.h"
+#include "SIMD.h"
+
+// rays from a sphere of three times the radius around the origin towards random points inside the radius
+// about half of them hit a unit sized object, the same seed always gives the same rays
+static std::vector<Ray> createRays(size_t count, float radius){
+
+	Random random(0, 0, c_seed);
+	std::vector<Ray> rays;
+	rays.reserve(count);
+
+	for (size_t i = 0; i < count; i++){
+
+		float z = 1.0f - 2.0f * random.nextFloat();
+		float phi = 2.0f * PI * random.nextFloat();
+		float r = sqrtf(max(0.0f, 1.0f - z * z));
+		Vector3f origin = Vector3f(r * cosf(phi), r * sinf(phi), z) * (3.0f * radius);
+
+		Vector3f target(random.nextFloat() * 2.0f - 1.0f, random.nextFloat() * 2.0f - 1.0f, random.nextFloat() * 2.0f - 1.0f);
+		target = target * radius;
+
+		rays.push_back(Ray(origin, (target - origin).normalize()));
+	}
+	return rays;
+}
+
+// a hit record as the scene passes it to the primitives
+static void setRay(Hit& hit, const Ray& ray){
+
+	hit.originalRay = ray;
+	hit.transformedRay = ray;
+}
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+// a field of /proc/self/status in megabytes, the kernel writes them in kB
+static double readStatusMB(const char* field){
+
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	size_t length = strlen(field);
+	while (std::getline(status, line)){
+		if (line.compare(0, length, field) == 0) return atof(line.c_str() + length) / 1024.0;
+	}
+	return 0.0;
+}
+#endif
+
+static double secondsSince(const std::chrono::steady_clock::time_point& start){
+
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+Benchmark::Benchmark(size_t numThreads){
+
+	m_numThreads = max(numThreads, (size_t)1);
+	m_statuePath = "../16RayTracer-reflection/objs/statue/statue.obj";
+
+	m_imageWidth = 256;
+	m_imageHeight = 256;
+	m_samplesPerPixel = 16;
+
+	m_memoryStarted = false;
+	m_peakReset = false;
+	m_memoryStartMB = 0.0;
+	m_processPeakMB = 0.0;
+}
+
+double Benchmark::getPeakMemoryMB(){
+
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0.0;
+	return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#elif defined(__APPLE__)
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+	return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+	// the high water mark follows resetPeakMemory, ru_maxrss doesn't
+	double peak = readStatusMB("VmHWM:");
+	if (peak > 0.0) return peak;
+
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+	return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+double Benchmark::getResidentMemoryMB(){
+
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0.0;
+	return counters.WorkingSetSize / (1024.0 * 1024.0);
+#elif defined(__APPLE__)
+	mach_task_basic_info_data_t info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) return 0.0;
+	return info.resident_size / (1024.0 * 1024.0);
+#else
+	return readStatusMB("VmRSS:");
+#endif
+}
+
+bool Benchmark::resetPeakMemory(){
+
+#if defined(_WIN32) || defined(__APPLE__)
+	return false;
+#else
+	// linux 4.0 and later, sets the high water mark of the process to its resident memory
+	FILE* file = fopen("/proc/self/clear_refs", "w");
+	if (!file) return false;
+	bool reset = fputs("5", file) >= 0;
+	reset = fclose(file) == 0 && reset;
+	return reset && readStatusMB("VmHWM:") > 0.0;
+#endif
+}
+
+void Benchmark::startMemory(){
+
+	m_processPeakMB = max(m_processPeakMB, getPeakMemoryMB());
+#if defined(__GLIBC__)
+	// the freed memory of the benchmarks before stays resident otherwise, and the next one grows into it unseen
+	malloc_trim(0);
+#endif
+	m_peakReset = resetPeakMemory();
+	m_memoryStartMB = getResidentMemoryMB();
+	m_memoryStarted = true;
+}
+
+double Benchmark::getProcessPeakMemoryMB(){
+
+	m_processPeakMB = max(m_processPeakMB, getPeakMemoryMB());
+	return m_processPeakMB;
+}
+
+double Benchmark::getMemoryUsedMB(){
+
+	// without a reset the peak belongs to an earlier benchmark, what is still resident after the run is the best guess
+	double used = (m_peakReset ? getPeakMemoryMB() : getResidentMemoryMB()) - m_memoryStartMB;
+	m_memoryStarted = false;
+	return max(used, 0.0);
+}
+
+void Benchmark::run(){
+
+	m_results.clear();
+	runRoutines();
+	runScenes();
+}
+
+template <typename Function> void Benchmark::measure(const std::string& name, const std::string& unit, size_t operations, double buildSeconds, Function function){
+
+	Result result;
+	result.name = name;
+	result.unit = unit;
+	result.buildSeconds = buildSeconds;
+	result.seconds = DBL_MAX;
+	result.checksum = 0.0;
+
+	if (!m_memoryStarted) startMemory();
+
+	// the fastest repetition is the one least disturbed by the rest of the system
+	for (int repetition = 0; repetition < Repetitions; repetition++){
+
+		double checksum = 0.0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < operations; i++)
+			checksum += function(i);
+
+		result.seconds = min(result.seconds, secondsSince(start));
+		result.checksum = checksum;
+	}
+
+	result.rate = operations / result.seconds * 1e-6;
+	result.peakMemoryMB = getMemoryUsedMB();
+	result.processPeakMemoryMB = getProcessPeakMemoryMB();
+	m_results.push_back(result);
+
+	printf("%-28s %9.3f %s\n", name.c_str(), result.rate, unit.c_str());
+}
+
+void Benchmark::skip(const std::string& name, const std::string& reason){
+
+	Result result;
+	result.name = name;
+	result.unit = "";
+	result.rate = 0.0;
+	result.seconds = 0.0;
+	result.buildSeconds = 0.0;
+	result.peakMemoryMB = 0.0;
+	result.processPeakMemoryMB = getProcessPeakMemoryMB();
+	m_memoryStarted = false;
+	result.checksum = 0.0;
+	result.skipped = reason;
+	m_results.push_back(result);
+
+	printf("%-28s skipped, %s\n", name.c_str(), reason.c_str());
+}
+
+void Benchmark::runRoutines(){
+
+	std::vector<Ray> rays = createRays(NumberOfRays, 1.0f);
+	std::vector<Ray> meshRays = createRays(NumberOfRays, 1.3f);
+
+	Triangle triangle(Vector3f(-1.0f, -1.0f, 0.0f), Vector3f(1.0f, -1.0f, 0.0f), Vector3f(0.0f, 1.0f, 0.0f));
+	measure("Triangle::hit", "Mrays/s", rays.size(), 0.0, [&](size_t i){
+		Hit hit;
+		setRay(hit, rays[i]);
+		triangle.hit(hit);
+		return hit.hitObject ? hit.t : 0.0;
+	});
+
+	Sphere sphere(Vector3f(0.0f, 0.0f, 0.0f), 1.0f);
+	measure("Sphere::hit", "Mrays/s", rays.size(), 0.0, [&](size_t i){
+		Hit hit;
+		setRay(hit, rays[i]);
+		sphere.hit(hit);
+		return hit.hitObject ? hit.t : 0.0;
+	});
+
+	Torus torus(1.0f, 0.3f);
+	measure("Torus::hit", "Mrays/s", meshRays.size(), 0.0, [&](size_t i){
+		Hit hit;
+		setRay(hit, meshRays[i]);
+		torus.hit(hit);
+		return hit.hitObject ? hit.t : 0.0;
+	});
+
+	BBox box(Vector3f(-1.0f, -1.0f, -1.0f), Vector3f(2.0f, 2.0f, 2.0f));
+	measure("BBox::intersect", "Mrays/s", rays.size(), 0.0, [&](size_t i){
+		float tmin, tmax;
+		return box.intersect(rays[i], tmin, tmax) ? (double)tmin : 0.0;
+	});
+
+	// a finely tessellated torus, the mesh forwards the rays straight to its acceleration structure
+	const char* names[] = { "KDTree::intersectRec", "BVH::intersect" };
+	AcceleratorType types[] = { KDTreeAccelerator, BVHAccelerator };
+	for (int k = 0; k < 2; k++){
+
+		startMemory();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		MeshTorus mesh(1.0f, 0.3f);
+		mesh.setPrecision(400, 200);
+		mesh.setAccelerator(types[k]);
+		mesh.buildMesh();
+		double buildSeconds = secondsSince(start);
+
+		measure(names[k], "Mrays/s", meshRays.size(), buildSeconds, [&](size_t i){
+			Hit hit;
+			setRay(hit, meshRays[i]);
+			mesh.hit(hit);
+			return hit.hitObject ? hit.t : 0.0;
+		});
+	}
+
+	// the same sampler as the matte materials
+	startMemory();
+	MultiJittered sampler(100, 83);
+	sampler.mapSamplesToHemisphere(1.0);
+	measure("Sampler::sampleHemisphere", "Msamples/s", NumberOfRays, 0.0, [&](size_t i){
+		if (i == 0) ThreadRandom().seed(0, 0, c_seed);
+		Vector3f s = sampler.sampleHemisphere();
+		return (double)(s[0] + s[1] + s[2]);
+	});
+
+	// a generated texture, large enough not to fit into the caches
+	startMemory();
+	const int textureSize = 1024;
+	const char* texturePath = "benchmark_texture.bmp";
+	std::vector<unsigned char> texels(textureSize * textureSize * 3);
+	for (int y = 0; y < textureSize; y++){
+		for (int x = 0; x < textureSize; x++){
+			texels[(y * textureSize + x) * 3 + 0] = (unsigned char)(x ^ y);
+			texels[(y * textureSize + x) * 3 + 1] = (unsigned char)x;
+			texels[(y * textureSize + x) * 3 + 2] = (unsigned char)y;
+		}
+	}
+
+	std::unique_ptr<ImageTexture> texture;
+	if (Bitmap::saveBitmap24(texturePath, &texels[0], textureSize, textureSize)){
+		texture = std::unique_ptr<ImageTexture>(new ImageTexture(texturePath));
+		remove(texturePath);
+	}else{
+		texture = std::unique_ptr<ImageTexture>(new ImageTexture());
+	}
+
+	Random random(1, 0, c_seed);
+	std::vector<float> coordinates(NumberOfRays * 2);
+	for (size_t i = 0; i < coordinates.size(); i++)
+		coordinates[i] = random.nextFloat();
+
+	measure("ImageTexture::getSmoothTexel", "Mlookups/s", NumberOfRays, 0.0, [&](size_t i){
+		Color color = texture->getSmoothTexel(coordinates[2 * i], coordinates[2 * i + 1]);
+		return (double)(color.r + color.g + color.b);
+	});
+}
+
+void Benchmark::renderScene(const std::string& name, double buildSeconds){
+
+	c_imageWidth = m_imageWidth;
+	c_imageHeight = m_imageHeight;
+	c_samplesPerPixel = m_samplesPerPixel;
+	camera->setResolution((int)c_imageWidth, (int)c_imageHeight);
+
+	g_pixels.assign(c_imageWidth * c_imageHeight, TPixelRGBF32());
+	std::vector<unsigned char> pixels(c_imageWidth * c_imageHeight * 3, 0);
+	g_pixels2 = &pixels[0];
+
+	// waiting on the workers instead of polling keeps the timer exact
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	task.start(m_numThreads, g_pixels, g_pixels2);
+	task.wait();
+
+	Result result;
+	result.name = name;
+	result.unit = "Mrays/s";
+	result.seconds = secondsSince(start);
+	result.rate = double(c_imageWidth) * double(c_imageHeight) * double(c_samplesPerPixel) / result.seconds * 1e-6;
+	result.buildSeconds = buildSeconds;
+	result.peakMemoryMB = getMemoryUsedMB();
+	result.processPeakMemoryMB = getProcessPeakMemoryMB();
+	result.checksum = 0.0;
+	for (size_t i = 0; i < pixels.size(); i++)
+		result.checksum += pixels[i];
+	m_results.push_back(result);
+
+	printf("%-28s %9.3f %s (primary rays)\n", name.c_str(), result.rate, result.unit.c_str());
+
+	// the primitives each wrap the shared materials in their own shared_ptr, so the scenes are left alive
+	// the memory of the next scene is measured from its own start, the ones left alive don't add to it
+	g_pixels2 = NULL;
+	delete camera;
+	scene = NULL;
+	camera = NULL;
+}
+
+void Benchmark::runScenes(){
+
+	startMemory();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	createCornellBox();
+	renderScene("cornell", secondsSince(start));
+
+	Sampler* sampler = new MultiJittered(100, 83);
+	sampler->mapSamplesToHemisphere(1.0);
+
+	Matte* matte = new Matte();
+	matte->setKa(0.25);
+	matte->setKd(0.6);
+	matte->setSampler(sampler);
+
+	// the statue of statue.scene inside the cornell box
+	FILE* file = fopen(m_statuePath.c_str(), "r");
+	if (file){
+
+		fclose(file);
+		startMemory();
+		start = std::chrono::steady_clock::now();
+		createCornellBox();
+
+		Model* model = new Model();
+		if (model->loadObject(m_statuePath.c_str(), Vector3f(0.0, 1.0, 0.0), 180.0f, Vector3f(278.0f, 0.0f, 280.0f), 90.0f, false, true)){
+
+			model->setAccelerator(c_accelerator);
+			model->buildAccelerator();
+			model->setMaterial(matte);
+			model->setColor(Color(0.8f, 0.7f, 0.6f));
+			scene->addPrimitive(model);
+			scene->finalize();
+			renderScene("statue", secondsSince(start));
+
+		}else{
+
+			delete model;
+			delete camera;
+			scene = NULL;
+			camera = NULL;
+			skip("statue", "could not load " + m_statuePath);
+		}
+	}else{
+		skip("statue", m_statuePath + " not found");
+	}
+
+	// the generated meshes, placed by instances
+	startMemory();
+	start = std::chrono::steady_clock::now();
+	createCornellBox();
+
+	MeshTorus* torus = new MeshTorus(90.0f, 30.0f);
+	torus->setPrecision(200, 100);
+	torus->setAccelerator(c_accelerator);
+	torus->buildMesh();
+	torus->setMaterial(matte);
+	torus->setColor(Color(0.8f, 0.7f, 0.6f));
+
+	Instance* _torus = new Instance(torus);
+	_torus->rotate(Vector3f(1.0, 0.0, 0.0), 60.0f);
+	_torus->translate(278.0f, 300.0f, 400.0f);
+	scene->addPrimitive(_torus);
+
+	MeshSphere* sphere = new MeshSphere(70.0f);
+	sphere->setPrecision(200, 200);
+	sphere->setAccelerator(c_accelerator);
+	sphere->buildMesh();
+	sphere->setMaterial(matte);
+	sphere->setColor(Color(0.6f, 0.7f, 0.8f));
+
+	Instance* _sphere = new Instance(sphere);
+	_sphere->translate(420.0f, 70.0f, 150.0f);
+	scene->addPrimitive(_sphere);
+
+	scene->finalize();
+	renderScene("meshes", secondsSince(start));
+}
+
+static std::string escape(const std::string& text){
+
+	std::string escaped;
+	for (size_t i = 0; i < text.size(); i++){
+		if (text[i] == '"' || text[i] == '\\') escaped += '\\';
+		escaped += text[i];
+	}
+	return escaped;
+}
+
+bool Benchmark::writeJson(const std::string& filename) const{
+
+	std::ostringstream json;
+	json << std::setprecision(10);
+	json << "{\n";
+	json << "  \"threads\": " << m_numThreads << ",\n";
+	json << "  \"width\": " << m_imageWidth << ",\n";
+	json << "  \"height\": " << m_imageHeight << ",\n";
+	json << "  \"spp\": " << m_samplesPerPixel << ",\n";
+	json << "  \"bounces\": " << c_numBounces << ",\n";
+	json << "  \"accelerator\": \"" << (c_accelerator == BVHAccelerator ? "bvh" : "kdtree") << "\",\n";
+	json << "  \"packets\": " << (c_packets ? "true" : "false") << ",\n";
+	json << "  \"simd\": \"" << (SIMD_SSE ? "sse" : "scalar") << "\",\n";
+	json << "  \"results\": [\n";
+
+	for (size_t i = 0; i < m_results.size(); i++){
+
+		const Result& result = m_results[i];
+		json << "    { \"name\": \"" << escape(result.name) << "\"";
+		if (result.skipped.empty()){
+			json << ", \"unit\": \"" << result.unit << "\"";
+			json << ", \"rate\": " << result.rate;
+			json << ", \"seconds\": " << result.seconds;
+			json << ", \"buildSeconds\": " << result.buildSeconds;
+			json << ", \"peakMemoryMB\": " << result.peakMemoryMB;
+			json << ", \"processPeakMemoryMB\": " << result.processPeakMemoryMB;
+			json << ", \"checksum\": " << result.checksum;
+		}else{
+			json << ", \"skipped\": \"" << escape(result.skipped) << "\"";
+		}
+		json << " }" << (i + 1 < m_results.size() ? "," : "") << "\n";
+	}
+	json << "  ]\n}\n";
+
+	std::ofstream file(filename.c_str());
+	if (!file) return false;
+	file << json.str();
+	return file.good();
+}
@@ -0,0 +1,77 @@
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H
+
+#include <string>
+#include <vector>
+
+// micro benchmarks of the intersection, sampling and texture routines and whole frames of a few scenes
+// the results are written as json, so the runs of two versions can be compared by a script
+class Benchmark{
+
+public:
+
+	struct Result{
+		std::string name;
+		std::string unit;		// Mrays/s, Msamples/s or Mlookups/s
+		double rate;			// of the fastest repetition
+		double seconds;			// of the fastest repetition
+		double buildSeconds;	// setup of the scene or the acceleration structure, 0 for the plain routines
+		double peakMemoryMB;	// growth of the resident memory from before the setup to the peak of the benchmark
+		double processPeakMemoryMB;	// peak of the whole process so far, so it never drops from one benchmark to the next
+		double checksum;		// sum of the results, it changes when a routine starts to compute something else
+		std::string skipped;	// why the benchmark could not run, empty if it ran
+	};
+
+	Benchmark(size_t numThreads);
+
+	// the statue of the scene benchmark, relative to the working directory
+	void setStatuePath(const std::string& path) { m_statuePath = path; }
+
+	void run();
+	bool writeJson(const std::string& filename) const;
+
+	// highest memory use of the process in megabytes, since the start or the last resetPeakMemory
+	static double getPeakMemoryMB();
+	// memory of the process in megabytes that is resident right now
+	static double getResidentMemoryMB();
+	// lowers the peak to the resident memory, false where the system only keeps the peak of the whole process
+	static bool resetPeakMemory();
+
+private:
+
+	void runRoutines();
+	void runScenes();
+
+	// calls function operations times per repetition, function returns its share of the checksum
+	template <typename Function> void measure(const std::string& name, const std::string& unit, size_t operations, double buildSeconds, Function function);
+	// renders the global scene, which took buildSeconds to set up, and releases it afterwards
+	void renderScene(const std::string& name, double buildSeconds);
+	void skip(const std::string& name, const std::string& reason);
+
+	// called before the setup of a benchmark, measure starts it itself if the benchmark has no setup
+	void startMemory();
+	// growth of the memory since startMemory, from the peak where it can be reset, otherwise from the resident memory
+	double getMemoryUsedMB();
+	// the peak of the process across the resets
+	double getProcessPeakMemoryMB();
+
+	static const int Repetitions = 5;
+	static const size_t NumberOfRays = 1 << 18;
+
+	size_t m_numThreads;
+	std::string m_statuePath;
+
+	// the frames are always rendered with the same settings, so the numbers of two versions can be compared
+	size_t m_imageWidth;
+	size_t m_imageHeight;
+	size_t m_samplesPerPixel;
+
+	std::vector<Result> m_results;
+
+	bool m_memoryStarted;
+	bool m_peakReset;
+	double m_memoryStartMB;
+	double m_processPeakMB;
+};
+
+#endif
@@ -1,13 +1,25 @@
 #define _USE_MATH_DEFINES
 #include <cmath>
-#include <atlstr.h> 
 #include <iostream>
+#include <stdio.h>
+#ifdef _WIN32
+#include <atlstr.h> 
+#endif
 
 #include "Bitmap.h"
 
+// LocalAlloc(LPTR, ...) on windows, plain calloc everywhere else
+static void* allocZeroed(size_t size){
+#ifdef _WIN32
+	return LocalAlloc(LPTR, size);
+#else
+	return calloc(1, size);
+#endif
+}
 
 Bitmap::Bitmap(){
 
+	Bitmap::hbitmap = NULL;
 	Bitmap::bmi = NULL;
 	Bitmap::data = NULL;
 	Bitmap::RGBMatrix = NULL;
@@ -16,6 +28,7 @@ Bitmap::Bitmap(){
 
 Bitmap::Bitmap(int height, int width, int bpp){
 
+	Bitmap::hbitmap = NULL;
 	Bitmap::bmi = NULL;
 	Bitmap::data = NULL;
 	Bitmap::RGBMatrix = NULL;
@@ -34,7 +47,7 @@ Bitmap::Bitmap(int height, int width, int bpp){
 
 	//LPTR: Allocates fixed memory. The return value is a pointer to the memory object
 	//		and also initializes memory contents to zero
-	Bitmap::bmi = (BITMAPINFO*)LocalAlloc(LPTR, sizeof(BITMAPINFOHEADER));
+	Bitmap::bmi = (BITMAPINFO*)allocZeroed(sizeof(BITMAPINFOHEADER));
 	bmi->bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
 	bmi->bmiHeader.biWidth = Bitmap::width;
 	bmi->bmiHeader.biHeight = Bitmap::height;
@@ -45,7 +58,7 @@ Bitmap::Bitmap(int height, int width, int bpp){
 	bmi->bmiHeader.biClrImportant = 0;
 
 	// allocate enough memory for the bitmap image data
-	Bitmap::data = (unsigned char*)LocalAlloc(LPTR, bmi->bmiHeader.biSizeImage);
+	Bitmap::data = (unsigned char*)allocZeroed(bmi->bmiHeader.biSizeImage);
 
 
 	// make sure bitmap image data was allocated
@@ -63,7 +76,9 @@ Bitmap::Bitmap(int height, int width, int bpp){
 	yourself after calling DeleteObject to delete the bitmap.
 	*/
 
+#ifdef _WIN32
 	Bitmap::hbitmap = CreateDIBSection(NULL, bmi, DIB_RGB_COLORS, (VOID**)&data, NULL, 0);
+#endif
 
 }
 
@@ -71,11 +86,13 @@ Bitmap::Bitmap(int height, int width, int bpp){
 Bitmap::~Bitmap(){
 
 	// in case hSecton is NULL delete the hbitmap will close the handle to the memory
+#ifdef _WIN32
 	if (Bitmap::hbitmap){
 
 		DeleteObject(Bitmap::hbitmap);
 		Bitmap::hbitmap = NULL;
 	}
+#endif
 
 	if (Bitmap::data && (Bitmap::hbitmap != NULL)){
 		free(Bitmap::data);
@@ -176,7 +193,7 @@ bool Bitmap::loadBitmap24(const char *filename){
 	// read the bitmap information header
 	fread(&(bmih), sizeof(BITMAPINFOHEADER), 1, filePtr);
 
-	Bitmap::bmi = (BITMAPINFO*)LocalAlloc(LPTR, sizeof(BITMAPINFOHEADER));
+	Bitmap::bmi = (BITMAPINFO*)allocZeroed(sizeof(BITMAPINFOHEADER));
 	Bitmap::width = bmih.biWidth;
 	Bitmap::height = bmih.biHeight;
 
@@ -202,7 +219,9 @@ bool Bitmap::loadBitmap24(const char *filename){
 	}
 	// create DIB Section
 	bmi->bmiHeader = bmih;
+#ifdef _WIN32
 	Bitmap::hbitmap = CreateDIBSection(NULL, bmi, DIB_RGB_COLORS, (VOID**)&data, NULL, 0);
+#endif
 
 	// move file pointer to beginning of bitmap data and read in the bitmap image data
 	fseek(filePtr, bmfh.bfOffBits, SEEK_SET);
@@ -295,11 +314,13 @@ bool Bitmap::writeBitmap24(COLORREF *(*RGBMatrix), int height, int width){
 		bmi = NULL;
 	}
 
+#ifdef _WIN32
 	if (hbitmap){
 
 		DeleteObject(hbitmap);
 		hbitmap = NULL;
 	}
+#endif
 
 	if (data && (hbitmap != NULL)){
 		free(data);
@@ -309,7 +330,7 @@ bool Bitmap::writeBitmap24(COLORREF *(*RGBMatrix), int height, int width){
 
 	//LPTR: Allocates fixed memory. The return value is a pointer to the memory object
 	//		and also initializes memory contents to zero
-	bmi = (BITMAPINFO*)LocalAlloc(LPTR, sizeof(BITMAPINFOHEADER));
+	bmi = (BITMAPINFO*)allocZeroed(sizeof(BITMAPINFOHEADER));
 	bmi->bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
 	bmi->bmiHeader.biWidth = width;
 	bmi->bmiHeader.biHeight = height;
@@ -320,7 +341,7 @@ bool Bitmap::writeBitmap24(COLORREF *(*RGBMatrix), int height, int width){
 	bmi->bmiHeader.biClrImportant = 0;
 
 	// allocate enough memory for the bitmap image data
-	Bitmap::data = (unsigned char*)LocalAlloc(LPTR, bmi->bmiHeader.biSizeImage);
+	Bitmap::data = (unsigned char*)allocZeroed(bmi->bmiHeader.biSizeImage);
 
 
 	// make sure bitmap image data was read
@@ -329,7 +350,9 @@ bool Bitmap::writeBitmap24(COLORREF *(*RGBMatrix), int height, int width){
 		return false;
 	}
 
+#ifdef _WIN32
 	Bitmap::hbitmap = CreateDIBSection(NULL, bmi, DIB_RGB_COLORS, (VOID**)&data, NULL, 0);
+#endif
 
 
 	for (int i = 0, h = 0, m = 0; i < bmi->bmiHeader.biSizeImage - paddingByte; i += 3, m += 3) {
@@ -352,6 +375,46 @@ bool Bitmap::writeBitmap24(COLORREF *(*RGBMatrix), int height, int width){
 }
 
 
+bool Bitmap::saveBitmap24(const char *filename, const unsigned char *data, int width, int height){
+
+	int padWidth = 3 * width;
+	while (padWidth % 4 != 0) {
+		padWidth++;
+	}
+
+	BITMAPFILEHEADER bmfh = {};
+	BITMAPINFOHEADER bmih = {};
+
+	bmih.biSize = sizeof(BITMAPINFOHEADER);
+	bmih.biWidth = width;
+	bmih.biHeight = height;
+	bmih.biPlanes = 1;
+	bmih.biBitCount = 24;
+	bmih.biCompression = BI_RGB;
+	bmih.biSizeImage = padWidth * height;
+
+	bmfh.bfType = 0x4D42;
+	bmfh.bfOffBits = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+	bmfh.bfSize = bmfh.bfOffBits + bmih.biSizeImage;
+
+	FILE *filePtr = fopen(filename, "wb");
+	if (filePtr == NULL)
+		return false;
+
+	fwrite(&bmfh, sizeof(BITMAPFILEHEADER), 1, filePtr);
+	fwrite(&bmih, sizeof(BITMAPINFOHEADER), 1, filePtr);
+
+	// the rows of the source buffer are tightly packed, the file rows are padded to a multiple of four
+	const unsigned char padding[3] = { 0, 0, 0 };
+	for (int y = 0; y < height; y++) {
+		fwrite(&data[y * width * 3], 1, width * 3, filePtr);
+		fwrite(padding, 1, padWidth - width * 3, filePtr);
+	}
+
+	fclose(filePtr);
+	return true;
+}
+
 void Bitmap::setPixel24(int x, int y, Color &color){
 
 	
@@ -1,8 +1,56 @@
 #ifndef _BITMAP_H
 #define _BITMAP_H
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#else
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// minimal stand-ins for the windows bitmap types, so textures can be loaded without windows.h
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef uint32_t COLORREF;
+typedef void* HBITMAP;
+
+#define BI_RGB 0L
+#define RGB(r, g, b) ((COLORREF)(((BYTE)(r) | ((WORD)((BYTE)(g)) << 8)) | (((DWORD)(BYTE)(b)) << 16)))
+#define GetRValue(rgb) ((BYTE)(rgb))
+#define GetGValue(rgb) ((BYTE)(((WORD)(rgb)) >> 8))
+#define GetBValue(rgb) ((BYTE)((rgb) >> 16))
+
+#pragma pack(push, 2)
+struct BITMAPFILEHEADER {
+	WORD  bfType;
+	DWORD bfSize;
+	WORD  bfReserved1;
+	WORD  bfReserved2;
+	DWORD bfOffBits;
+};
+#pragma pack(pop)
+
+struct BITMAPINFOHEADER {
+	DWORD biSize;
+	LONG  biWidth;
+	LONG  biHeight;
+	WORD  biPlanes;
+	WORD  biBitCount;
+	DWORD biCompression;
+	DWORD biSizeImage;
+	LONG  biXPelsPerMeter;
+	LONG  biYPelsPerMeter;
+	DWORD biClrUsed;
+	DWORD biClrImportant;
+};
+
+struct BITMAPINFO {
+	BITMAPINFOHEADER bmiHeader;
+};
+#endif
 #include <vector>
 
 #include "Color.h"
@@ -30,6 +78,9 @@ public:
 	void setPixel24(int x, int y, int r, int g, int b);
 	void createNullBitmap(int color);
 
+	// writes a bottom up bgr buffer like the one of a 24 bit dib section to disk
+	static bool saveBitmap24(const char *filename, const unsigned char *data, int width, int height);
+
 private:
 	//variables
 	
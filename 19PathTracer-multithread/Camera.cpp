@@ -2,6 +2,7 @@
 #include <iostream>
 
 #include "Camera.h"
+#include "Random.h"
 
 const Vector3f Camera::WORLD_XAXIS(1.0f, 0.0f, 0.0f);
 const Vector3f Camera::WORLD_YAXIS(0.0f, 1.0f, 0.0f);
@@ -181,6 +182,7 @@ void Orthographic::renderScene(Scene& scene) {
 			color = Color(0, 0, 0);
 
 			for (int i = 0; i < numSamples; i++){
+				ThreadRandom().seed(((uint64_t)y << 32) | (uint32_t)x, i, 0);
 				sp = m_sampler->sampleUnitSquare();
 				ray.origin = Vector3f((float)(x - 0.5 * vp.hres + sp[0]),(float)( y - 0.5 * vp.vres + sp[0]), getPosition()[2])*vp.s;
 				color = color + scene.hitObjects(ray).color;
@@ -235,6 +237,16 @@ void Projection::setFovy(float fovy){
 	m_fovy = fovy;
 }
 
+void Projection::setResolution(int hres, int vres){
+
+	m_hres = hres;
+	m_vres = vres;
+	m_aspectRatio = (float)m_hres / m_vres;
+
+	m_dxCamera = rasterToCamera(1.0, 0.0) - rasterToCamera(0.0, 0.0);
+	m_dyCamera = rasterToCamera(0.0, 1.0) - rasterToCamera(0.0, 0.0);
+}
+
 void Projection::generateRayDifferential(float _px, float _py, RayDifferential *rayDiff){
 
 	Vector3f direction = rasterToCamera(_px, _py);
@@ -285,6 +297,7 @@ void Projection::renderScene(Scene& scene, int t1, int t2) {
 			color = Color(0, 0, 0);
 
 			for (int i = 0; i < numSamples; i++) {
+				ThreadRandom().seed(((uint64_t)y << 32) | (uint32_t)x, i, 0);
 
 				sp = m_sampler->sampleUnitSquare();
 
@@ -368,6 +381,7 @@ void Pinhole::renderScene(Scene& scene, int t1, int t2) {
 		
 			color = Color(0, 0, 0);
 			for (int i = 0; i < numSamples; i++) {
+				ThreadRandom().seed(((uint64_t)y << 32) | (uint32_t)x, i, 0);
 
 				sp = m_sampler->sampleUnitSquare();
 
@@ -450,6 +464,7 @@ void FishEye::renderScene(Scene &scene) {
 			color = Color(0, 0, 0);
 
 			for (int i = 0; i < numSamples; i++){
+				ThreadRandom().seed(((uint64_t)y << 32) | (uint32_t)x, i, 0);
 				sp = m_sampler->sampleUnitSquare();
 				px = vp.s * (x - 0.5f * vp.hres + sp[0]);
 				py = vp.s * (y - 0.5f * vp.vres + sp[1]);
@@ -538,6 +553,7 @@ void Spherical::renderScene(Scene &scene) {
 			color = Color(0.5, 0, 0);
 
 			for (int i = 0; i < numSamples; i++){
+				ThreadRandom().seed(((uint64_t)y << 32) | (uint32_t)x, i, 0);
 				sp = m_sampler->sampleUnitSquare();
 				px = vp.s * (x - 0.5f * vp.hres + sp[0]);
 				py = vp.s * (y - 0.5f * vp.vres + sp[1]);
@@ -614,6 +630,7 @@ void ThinLens::renderScene(Scene &scene){
 			color = Color(0.0, 0.0, 0.0);
 
 			for (int i = 0; i < numSamples; i++){
+				ThreadRandom().seed(((uint64_t)y << 32) | (uint32_t)x, i, 0);
 				sp = m_sampler->sampleUnitSquare();
 				px = vp.s * (x - 0.5f * vp.hres + sp[0]);
 				py = vp.s * (y - 0.5f * vp.vres + sp[1]);
@@ -79,6 +79,7 @@ public:
 	void renderScene(Scene &scene);
 	void renderScene(Scene &scene, int t1, int t2);
 	void setFovy(float fovy);
+	void setResolution(int hres, int vres);
 	Vector3f rasterToCamera(float _px, float _py);
 private:
 	Vector3f m_dxCamera, m_dyCamera;
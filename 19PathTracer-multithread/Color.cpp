@@ -49,7 +49,7 @@ Color Color::operator/(float scalar) const{
 	return Color(r / scalar, g / scalar, b / scalar);
 }
 
-float Color::Max(){
+float Color::Max() const{
 
 	return std::max(r, std::max(g, b));
 }
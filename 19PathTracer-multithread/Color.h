@@ -17,7 +17,7 @@ public:
 	Color operator/(float scalar) const;
 
 	void clamp();
-	float Max();
+	float Max() const;
 	static Color getRandom();
 
 public:
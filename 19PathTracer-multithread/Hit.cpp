@@ -13,6 +13,10 @@ Hit::Hit(){
 	hitObject = false;
 	material = NULL;
 	primitive = NULL;
+	part = NULL;
+	triangle = -1;
+	b1 = 0.0f;
+	b2 = 0.0f;
 
 }
 
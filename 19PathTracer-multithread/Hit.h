@@ -27,6 +27,9 @@ public:
 	Ray originalRay;
 	Ray transformedRay;
 	const Primitive* primitive;
+	Primitive* part;		// closest sub object of a compounded object
+	int triangle;			// index of the closest mesh triangle, -1 if no mesh was hit
+	float b1, b2;			// barycentric coordinates of the hit point on that triangle
 	Material* material;
 	Scene* scene;
 	
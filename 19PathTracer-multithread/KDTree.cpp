@@ -1,10 +1,19 @@
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cmath>
 #include "KDTree.h"
+#include "Statistics.h"
 
 
 KDTree::KDTree(){
-	m_rootNode = NULL;
 	m_costOfIntersection = 80;
 	m_costOfTraversal = 1;
+	m_maximumDepth = 0;
+	m_maximumThreads = 0;
+	m_activeThreads = 0;
+	m_peakThreads = 0;
+	m_statistics = Statistics();
 }
 
 KDTree::~KDTree(){}
@@ -12,231 +21,238 @@ KDTree::~KDTree(){}
 
 //the method that is called from extern to built the tree
 void KDTree::buildTree(const std::vector<std::shared_ptr<Triangle>> &list, const BBox &bbox, int maxDepth){
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
 	//setting the needed information
 	m_boundingBox = bbox;
-	BBox box = BBox(bbox.m_pos, bbox.m_size);
-	box.doubleSize();
+	m_triangles = list;
+	m_nodes.clear();
+	m_triangleBuffer.clear();
+
+	int numberOfPrimitives = (int)list.size();
+	if (maxDepth < 0)
+		maxDepth = (int)(8 + 1.3f * std::log2((float)max(numberOfPrimitives, 1)));
+	m_maximumDepth = min(maxDepth, MaxDepth);
+
+	//the thread calling buildTree counts as one
+	m_maximumThreads = max((int)std::thread::hardware_concurrency() - 1, 0);
+	m_activeThreads = 0;
+	m_peakThreads = 0;
+
+	//the root holds all triangles, the split planes only depend on the triangle bounds
+	BuildNode root;
+	root.primitives.resize(numberOfPrimitives);
+	root.bounds.resize(numberOfPrimitives);
+	root.events.reserve(numberOfPrimitives * 6);
+	root.boundingBox = BBox(Vector3f(FLT_MAX, FLT_MAX, FLT_MAX), Vector3f(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+
+	for (int i = 0; i < numberOfPrimitives; i++){
+
+		root.primitives[i] = i;
+		root.bounds[i] = list[i]->getBounds();
+		root.boundingBox.extend(root.bounds[i].getPos());
+		root.boundingBox.extend(root.bounds[i].getSize());
+
+		createEvents(root.bounds[i], i, root.events);
+	}
 
-	m_maximumDepth = maxDepth;
+	//sorting the events one single time, the children keep the order
+	std::sort(root.events.begin(), root.events.end());
 
-	//the data-structures for the sah heuristic
-	std::vector<std::shared_ptr<KD_Primitive>>	primitives;
-	std::vector<std::shared_ptr<Event>>			events;
+	BBox rootBox = root.boundingBox;
 
-	//building the list of events and setting the additional information to the primitives
-	createEvents(events, primitives, list);
+	BuildOutput output;
+	buildNode(root, 0, output);
 
-	//sorting the events one single time
-	sortEvents(events);
+	m_nodes.swap(output.nodes);
 
-	m_rootNode = buildTree(box, primitives, events, 0);
+	//the leaves read their triangles from the compact buffer in whole blocks, the triangle objects are only needed for shading
+	m_triangleBuffer.reserve((int)output.primitiveIndices.size());
+	for (size_t i = 0; i < m_nodes.size(); i++){
 
-	
+		Node& node = m_nodes[i];
+		if (!node.isLeaf()) continue;
 
+		int offset = node.m_primitivesOffset;
+		node.m_primitivesOffset = m_triangleBuffer.size();
+		for (int j = offset; j < offset + node.numberOfPrimitives(); j++)
+			m_triangleBuffer.push_back(*list[output.primitiveIndices[j]], output.primitiveIndices[j]);
+		m_triangleBuffer.pad();
+	}
+	m_triangles.clear();
+
+	std::chrono::duration<float> seconds = std::chrono::steady_clock::now() - start;
+
+	m_statistics = Statistics();
+	m_statistics.triangles = numberOfPrimitives;
+	m_statistics.nodes = (int)m_nodes.size();
+	m_statistics.threads = 1 + m_peakThreads;
+	m_statistics.seconds = seconds.count();
+	m_statistics.sahCost = numberOfPrimitives > 0 ? computeStatistics(0, rootBox, 0) : 0.0f;
+
+	std::cout << "KDTree: " << m_statistics.triangles << " triangles, " << m_statistics.nodes << " nodes, "
+		<< m_statistics.leaves << " leaves (" << m_statistics.emptyLeaves << " empty), depth " << m_statistics.depth << ", "
+		<< (float)m_statistics.references / max(m_statistics.leaves - m_statistics.emptyLeaves, 1) << " triangles per leaf, SAH cost "
+		<< m_statistics.sahCost << ", built in " << m_statistics.seconds << " s with " << m_statistics.threads << " threads, "
+		<< (m_triangleBuffer.getMemoryUsage() + m_nodes.size() * sizeof(Node)) / 1024 << " KB" << std::endl;
 }
 
+bool KDTree::write(ModelCache::Writer& cache) const{
 
-std::shared_ptr<KDTree::Node> KDTree::buildTree(BBox boundingBox, std::vector<std::shared_ptr<KD_Primitive>> primitives, std::vector<std::shared_ptr<Event>> events, int depth){
-
-	//first termination criteria: have we got some primitives to insert?
-	if (primitives.size() == 0)
-	{
-		//create a empty leaf node
-		return std::shared_ptr<KDTree::Node>(new Node(primitives, this));
-	}
+	cache.writeValue(m_boundingBox);
+	cache.writeValue(m_maximumDepth);
+	cache.writeValue(m_statistics);
+	cache.write(m_nodes);
+	m_triangleBuffer.write(cache);
+	return true;
+}
 
-	//second termination criteria: test if maxDepth has been reached
-	if (depth == m_maximumDepth)
-	{
+bool KDTree::read(ModelCache::Reader& cache, const std::vector<std::shared_ptr<Triangle>>& list){
 
-		
-		//we have to clean up a bit
-		for (unsigned int i = 0; i < events.size(); i++)
-		if (events[i])  events[i].reset();
+	//the leaves only refer to the triangle buffer, the triangles of the list are not needed after a build either
+	m_triangles.clear();
+	if (!cache.readValue(m_boundingBox) || !cache.readValue(m_maximumDepth) || !cache.readValue(m_statistics) ||
+		!cache.read(m_nodes) || !m_triangleBuffer.read(cache) || m_statistics.triangles != (int)list.size() || !isValid((int)list.size())){
 
-		//create a leaf node with the primitives
-		return std::shared_ptr<KDTree::Node>(new Node(primitives, this));
+		m_nodes.clear();
+		m_triangleBuffer.clear();
+		return false;
 	}
 
-	//the values computed by the sah function
-	int	splitAxis;
-	float	splitPosition;
-	int	splitSide;
-
-	//then find the next split-plane
-	float SAHValue;
-	findSplitPlane(boundingBox, (int)primitives.size(), events, splitAxis, splitPosition, SAHValue, splitSide);
+	std::cout << "KDTree: " << m_statistics.triangles << " triangles, " << m_statistics.nodes << " nodes read from the cache, "
+		<< (m_triangleBuffer.getMemoryUsage() + m_nodes.size() * sizeof(Node)) / 1024 << " KB" << std::endl;
+	return true;
+}
 
-	//third termination critera: is it useful to split??
-	if (SAHValue >= m_costOfIntersection*primitives.size())
-	{
-		
+bool KDTree::isValid(int numberOfTriangles) const{
 
-		//clean up
-		for (unsigned int i = 0; i < events.size(); i++)
-		if (events[i])  events[i].reset();
+	if (m_nodes.empty() || m_maximumDepth < 0 || m_maximumDepth > MaxDepth) return false;
 
-		//create a leaf node with the primitives
-		return std::shared_ptr<KDTree::Node>(new Node(primitives, this));
+	for (int i = 0; i < m_triangleBuffer.size(); i++){
+		if (m_triangleBuffer.getId(i) < -1 || m_triangleBuffer.getId(i) >= numberOfTriangles) return false;
 	}
 
+	//the children follow their parent, so the depth of a node is known before its children are reached
+	//every level of interior nodes takes one entry of the traversal stacks
+	std::vector<int> depth(m_nodes.size(), 0);
+	for (size_t i = 0; i < m_nodes.size(); i++){
 
-	//the following steps are needed to conserve the properties of the event list
-	//compare: paper
-	//step 1: classification of the primitives
-	classifyPrimitives(events, primitives, splitAxis, splitPosition, splitSide);
+		const Node& node = m_nodes[i];
+		if (depth[i] >= MaxDepth) return false;
 
+		if (node.isLeaf()){
 
-	//the vectors for step 2 and 3
-	std::vector<std::shared_ptr<Event>> leftOnlyEvents;
-	std::vector<std::shared_ptr<Event>> rightOnlyEvents;
-	std::vector<std::shared_ptr<Event>> leftBothEvents;
-	std::vector<std::shared_ptr<Event>> rightBothEvents;
-
-
-	//step 2: splicing the events
-	spliceEvents(events, leftOnlyEvents, rightOnlyEvents);
+			if (node.m_primitivesOffset < 0 || node.numberOfPrimitives() < 0 || node.numberOfPrimitives() > m_triangleBuffer.size() - node.m_primitivesOffset) return false;
+			continue;
+		}
 
-	//step 3: generate new events
-	generateNewEvents(primitives, leftBothEvents, rightBothEvents, splitAxis, splitPosition);
+		int above = node.aboveChild();
+		if (i + 1 >= m_nodes.size() || above <= (int)i || above >= (int)m_nodes.size()) return false;
 
-	sortEvents(leftBothEvents);
-	sortEvents(rightBothEvents);
+		depth[i + 1] = max(depth[i + 1], depth[i] + 1);
+		depth[above] = max(depth[above], depth[i] + 1);
+	}
 
-	std::vector<std::shared_ptr<Event>> leftFinalEvents;
-	std::vector<std::shared_ptr<Event>> rightFinalEvents;
+	return true;
+}
 
-	//step 4: merging
-	mergeEvents(leftFinalEvents, leftBothEvents, leftOnlyEvents);
-	mergeEvents(rightFinalEvents, rightBothEvents, rightOnlyEvents);
+void KDTree::buildNode(BuildNode& node, int depth, BuildOutput& output){
 
+	//the node is appended to the node array, a leaf is finished at once
+	//the below child of an interior node is built right behind it
+	int nodeIndex = (int)output.nodes.size();
+	output.nodes.push_back(Node());
 
-	std::vector<std::shared_ptr<KD_Primitive>> leftPrimitives;
-	std::vector<std::shared_ptr<KD_Primitive>> rightPrimitives;
+	int numberOfPrimitives = (int)node.primitives.size();
 
-	//step 5: split primitives
-	splitPrimitives(leftPrimitives, rightPrimitives, primitives);
+	//first termination criteria: have we got some primitives to insert?
+	//second termination criteria: test if maxDepth has been reached
+	if (numberOfPrimitives == 0 || depth == m_maximumDepth){
 
-	std::shared_ptr<Node> node = std::shared_ptr<Node>(new Node(splitAxis, splitPosition));
+		output.nodes[nodeIndex].initLeaf(node.primitives, output.primitiveIndices);
+		return;
+	}
 
-	BBox leftBoundingBox = boundingBox;
-	BBox rightBoundingBox = boundingBox;
+	//the values computed by the sah function
+	int	splitAxis = 0;
+	float splitPosition = 0.0f;
+	int	splitSide = 0;
 
-	leftBoundingBox.getSize()[splitAxis] = splitPosition;
-	rightBoundingBox.getPos()[splitAxis] = splitPosition;
+	//then find the next split-plane
+	float SAHValue;
+	findSplitPlane(node.boundingBox, numberOfPrimitives, node.events, splitAxis, splitPosition, SAHValue, splitSide);
 
-	//clearing the vectors
-	events.clear();
-	primitives.clear();
-	leftBothEvents.clear();
-	leftOnlyEvents.clear();
-	rightBothEvents.clear();
-	rightOnlyEvents.clear();
+	//third termination critera: is it useful to split??
+	if (SAHValue >= m_costOfIntersection * numberOfPrimitives){
 
-	node->left = buildTree(leftBoundingBox, leftPrimitives, leftFinalEvents, depth + 1);
-	node->right = buildTree(rightBoundingBox, rightPrimitives, rightFinalEvents, depth + 1);
+		output.nodes[nodeIndex].initLeaf(node.primitives, output.primitiveIndices);
+		return;
+	}
 
-	return node;
-}
+	BuildNode left, right;
+	splitNode(node, splitAxis, splitPosition, splitSide, left, right);
 
-void KDTree::createEvents(std::vector<std::shared_ptr<Event>>& events, std::vector<std::shared_ptr<KD_Primitive>>& primitives, std::vector<std::shared_ptr<Triangle>> list){
+	//the children hold everything they need, release the node before going down
+	std::vector<int>().swap(node.primitives);
+	std::vector<BBox>().swap(node.bounds);
+	std::vector<Event>().swap(node.events);
 
-	std::shared_ptr<Triangle> primitive;
+	//large subtrees on the far side are handed to an other thread while this one goes on with the near side
+	bool parallel = false;
+	if ((int)right.primitives.size() >= MinParallelPrimitives){
 
-	for (unsigned int i = 0; i < list.size(); i++){
+		int active = m_activeThreads;
+		while (active < m_maximumThreads && !m_activeThreads.compare_exchange_weak(active, active + 1));
+		parallel = active < m_maximumThreads;
 
-		//take the next one
-		primitive = list[i];
+		int peak = m_peakThreads;
+		while (parallel && peak < active + 1 && !m_peakThreads.compare_exchange_weak(peak, active + 1));
+	}
 
-		//and make it a kdprimitive
-		std::shared_ptr<KD_Primitive> kdPrimitive = std::shared_ptr<KD_Primitive>(new KD_Primitive(primitive));
+	if (parallel){
 
-		//and store it
-		primitives.push_back(kdPrimitive);
+		BuildOutput rightOutput;
+		std::thread thread(&KDTree::buildNode, this, std::ref(right), depth + 1, std::ref(rightOutput));
 
-		//we need the borders of the primitive
-		BBox primBounds = primitive->getBounds();
+		buildNode(left, depth + 1, output);
+		thread.join();
+		m_activeThreads--;
 
-		//for each dimension
-		for (int j = 0; j < 3; j++)
-		{
-			//look at the bounds in the given dimension
-			float min = primBounds.getPos()[j]  ;
-			float max = primBounds.getSize()[j] ;
+		output.nodes[nodeIndex].initInterior(splitAxis, (int)output.nodes.size(), splitPosition);
+		appendSubtree(output, rightOutput);
 
+	}else{
 
-			//if they are the same, the primitive is perpendicular to that dimension
-			if (min == max)
-			{
-				std::shared_ptr<Event> planarEvent = std::shared_ptr<Event>(new Event(j, min, 1, kdPrimitive));
-				events.push_back(planarEvent);
-			}
-			else
-			{
-				std::shared_ptr<Event> endEvent = std::shared_ptr<Event>(new Event(j, max, 0, kdPrimitive));
-				std::shared_ptr<Event> startEvent = std::shared_ptr<Event>(new Event(j, min, 2, kdPrimitive));
-				events.push_back(endEvent);
-				events.push_back(startEvent);
-			}
-		}
+		buildNode(left, depth + 1, output);
+		output.nodes[nodeIndex].initInterior(splitAxis, (int)output.nodes.size(), splitPosition);
+		buildNode(right, depth + 1, output);
 	}
-
-	
-}
-
-void KDTree::sortEvents(std::vector<std::shared_ptr<Event>>& events){
-
-	quickSort(events, 0, (int)events.size() - 1);
 }
 
+void KDTree::createEvents(const BBox& bounds, int primitive, std::vector<Event>& events){
 
-void KDTree::quickSort(std::vector<std::shared_ptr<Event>>& events, unsigned int leftBorder, unsigned int rightBorder){
-	std::stack<std::pair<int, int> > indices;
+	//for each dimension
+	for (int j = 0; j < 3; j++){
 
-	indices.push(std::make_pair((int)leftBorder, (int)rightBorder));
+		//look at the bounds in the given dimension
+		float min = bounds.m_pos[j];
+		float max = bounds.m_size[j];
 
-	std::pair<int, int> currentBorders;
-	int newLeftBorder; int newRightBorder;
+		//if they are the same, the primitive is perpendicular to that dimension
+		if (min == max){
 
-	int a = 5;
+			events.push_back(Event(j, min, 1, primitive));
 
-	while (!indices.empty())
-	{
-		currentBorders = indices.top();
-		indices.pop();
-		if (currentBorders.first < currentBorders.second)
-		{
-			newLeftBorder = currentBorders.first;
-			newRightBorder = currentBorders.second;
-			int index = newLeftBorder;
-
-			std::shared_ptr<Event> helpEvent;
-			std::shared_ptr<Event> pivot = std::shared_ptr<Event>(events[currentBorders.first]);
-
-			while (index <= newRightBorder)
-			{
-				if (events[index]->less(pivot))
-				{
-					helpEvent = events[newLeftBorder];
-					events[newLeftBorder++] = events[index];
-					events[index++] = helpEvent;
-				}
-				else if (pivot->less(events[index]))
-				{
-					helpEvent = events[newRightBorder];
-					events[newRightBorder--] = events[index];
-					events[index] = helpEvent;
-				}
-				else index++;
-			}
+		}else{
 
-			indices.push(std::make_pair(newRightBorder + 1, currentBorders.second));
-			indices.push(std::make_pair(currentBorders.first, newLeftBorder - 1));
+			events.push_back(Event(j, max, 0, primitive));
+			events.push_back(Event(j, min, 2, primitive));
 		}
 	}
 }
 
-void KDTree::findSplitPlane(BBox boundingBox, int numberOfPrimitives, std::vector<std::shared_ptr<Event>>& events, int& bestAxis, float& bestPosition, float& bestSAHValue, int& side){
+void KDTree::findSplitPlane(const BBox& boundingBox, int numberOfPrimitives, const std::vector<Event>& events, int& bestAxis, float& bestPosition, float& bestSAHValue, int& side){
 	//we need to count the number of primitives on the left, on the plane itself and on the right side, and this for each dimension
 	//these values are stored here
 	int leftCount[3];
@@ -256,51 +272,43 @@ void KDTree::findSplitPlane(BBox boundingBox, int numberOfPrimitives, std::vecto
 	//trying to find better values, so start with the maximum
 	bestSAHValue = FLT_MAX;
 
-	unsigned index = 0;
+	size_t index = 0;
 
 	//testing for each eventposition if we found a better sah value
 	while (index < events.size())
 	{
-		int currentAxis = events[index]->m_axis;
-		float currentPosition = events[index]->m_position;
+		int currentAxis = events[index].m_axis;
+		float currentPosition = events[index].m_position;
 
 		int currentEndings = 0;
 		int currentPlanars = 0;
 		int currentStarts = 0;
 
 		//intercept the cases where several events got the same position on the same axis
-		while (index < events.size() && events[index]->m_position == currentPosition && events[index]->m_axis == currentAxis && events[index]->m_type == 0)
+		while (index < events.size() && events[index].m_position == currentPosition && events[index].m_axis == currentAxis && events[index].m_type == 0)
 		{
-			//look at the next event
 			index++;
-			//and we found an end event
 			currentEndings++;
 		}
 		//the same for type 1 and 2
-		while (index < events.size() && events[index]->m_position == currentPosition && events[index]->m_axis == currentAxis && events[index]->m_type == 1)
+		while (index < events.size() && events[index].m_position == currentPosition && events[index].m_axis == currentAxis && events[index].m_type == 1)
 		{
-			//look at the next event
 			index++;
-			//and we found an planar event
 			currentPlanars++;
 		}
-		while (index < events.size() && events[index]->m_position == currentPosition && events[index]->m_axis == currentAxis && events[index]->m_type == 2)
+		while (index < events.size() && events[index].m_position == currentPosition && events[index].m_axis == currentAxis && events[index].m_type == 2)
 		{
-			//look at the next event
 			index++;
-			//and we found an start event
 			currentStarts++;
 		}
 
-		//now we can compute the wanted numbers
 		//the number of primitives in the plane equals the number of planar events for this location
 		planarCount[currentAxis] = currentPlanars;
 		//the number of primitives on the right is the same as before minus those who ended in the plane and minus those who are in the plane
 		rightCount[currentAxis] -= (currentPlanars + currentEndings);
 
-		//looking for the sah value of this configuration
-		//version 2.0: look only in not flat boundingBoxes
-		if (boundingBox.getPos()[currentAxis] < boundingBox.getSize()[currentAxis])
+		//looking for the sah value of this configuration, only planes inside the box are of interest
+		if (boundingBox.m_pos[currentAxis] < currentPosition && currentPosition < boundingBox.m_size[currentAxis])
 		{
 			unsigned int newSide;
 
@@ -322,31 +330,27 @@ void KDTree::findSplitPlane(BBox boundingBox, int numberOfPrimitives, std::vecto
 	}
 }
 
-float KDTree::computeSAH(BBox boundingBox, unsigned int axis, float position, unsigned int numberOfLeftPrims, unsigned int numberOfPlanarPrims, unsigned int numberOfRightPrims, unsigned int &side){
+float KDTree::computeSAH(const BBox& boundingBox, unsigned int axis, float position, unsigned int numberOfLeftPrims, unsigned int numberOfPlanarPrims, unsigned int numberOfRightPrims, unsigned int &side){
 	
-	//we need the areas of the left and right side, so make two new boxes
-	BBox leftBox = boundingBox;
-	BBox rightBox = boundingBox;
-
-	//and split them
-	leftBox.getSize()[axis] = position;
-	rightBox.getPos()[axis] = position;
-
-	//the boxes compute the areas
-	float leftArea = leftBox.getSurfaceArea();
-	float rightArea = rightBox.getSurfaceArea();
-	float overallArea = boundingBox.getSurfaceArea();
-
-	//compute the parts of left and right
-	leftArea /= overallArea;
-	rightArea /= overallArea;
+	//the areas of the left and right box, the box is cut along the axis so only one extent changes
+	//the factor 2 of the surface area cancels out
+	unsigned int b = (axis + 1) % 3;
+	unsigned int c = (axis + 2) % 3;
+	float extentB = boundingBox.m_size[b] - boundingBox.m_pos[b];
+	float extentC = boundingBox.m_size[c] - boundingBox.m_pos[c];
+	float leftLength = position - boundingBox.m_pos[axis];
+	float rightLength = boundingBox.m_size[axis] - position;
+
+	float overallArea = extentB * extentC + (leftLength + rightLength) * (extentB + extentC);
+	float leftArea = (extentB * extentC + leftLength * (extentB + extentC)) / overallArea;
+	float rightArea = (extentB * extentC + rightLength * (extentB + extentC)) / overallArea;
 
 	//now look at the sah value (note: we get two values since we do not know where to put the primitives in the plane)
 	float leftSAHValue = m_costOfTraversal + m_costOfIntersection * (leftArea * (numberOfLeftPrims + numberOfPlanarPrims) + rightArea * numberOfRightPrims);
 	float rightSAHValue = m_costOfTraversal + m_costOfIntersection * (leftArea * numberOfLeftPrims + rightArea * (numberOfPlanarPrims + numberOfRightPrims));
 
 	//as proposed in the paper: put a bonus if we generate empty boxes
-	if (leftBox.getPos()[axis] < leftBox.getSize()[axis])
+	if (leftLength > 0.0f)
 	{
 		//we can put the plane prims to the left and generate an empty box this way, so the leftValue has to be pushed
 		if (numberOfLeftPrims + numberOfPlanarPrims == 0)
@@ -356,7 +360,7 @@ float KDTree::computeSAH(BBox boundingBox, unsigned int axis, float position, un
 			rightSAHValue *= 0.8f;
 	}
 	//the same for the other side
-	if (rightBox.getPos()[axis] < rightBox.getSize()[axis])
+	if (rightLength > 0.0f)
 	{
 		if (numberOfRightPrims == 0)
 			leftSAHValue *= 0.8f;
@@ -376,283 +380,513 @@ float KDTree::computeSAH(BBox boundingBox, unsigned int axis, float position, un
 	return rightSAHValue;
 }
 
+//the steps of the paper to keep the event lists sorted without sorting them again:
+//classify the primitives, splice the events of the primitives on one side,
+//generate new events for the straddling primitives and merge
+void KDTree::splitNode(BuildNode& node, int axis, float position, int side, BuildNode& left, BuildNode& right){
 
-void KDTree::classifyPrimitives(std::vector<std::shared_ptr<Event>>& events, std::vector<std::shared_ptr<KD_Primitive>>& primitives, int axis, float position, int side)
-{
-	//first set each primitive to both sides
-	for (unsigned int i = 0; i < primitives.size(); i++)
-	{
-		primitives[i]->m_orientation = 1;
-	}
+	int numberOfPrimitives = (int)node.primitives.size();
+
+	left.boundingBox = node.boundingBox;
+	right.boundingBox = node.boundingBox;
+	left.boundingBox.getSize()[axis] = position;
+	right.boundingBox.getPos()[axis] = position;
+
+	//step 1: classification of the primitives, 0 left, 1 both and 2 right
+	std::vector<unsigned char> orientation(numberOfPrimitives, 1);
+
+	for (size_t i = 0; i < node.events.size(); i++){
+
+		const Event& event = node.events[i];
+		if (event.m_axis != axis) continue;
+
+		//the primitive lies entirely on the left if it ends before the plane
+		if (event.m_type == 0 && event.m_position <= position){
+
+			orientation[event.m_primitive] = 0;
 
-	//then look at each event and set the primitives
-	for (unsigned int i = 0; i < events.size(); i++)
-	{
-		//first test if the primitive of the event lies entirely on the left
-		//this happens if the location of the event lies on the left and the event is end
-		if (events[i]->m_position <= position && events[i]->m_axis == axis && events[i]->m_type == 0)
-		{
-			//put the primitive to the left
-			events[i]->m_primitive->m_orientation = 0;
-		}
 		//same for the right side with start events
-		else if (events[i]->m_position >= position && events[i]->m_axis == axis && events[i]->m_type == 2)
-		{
-			//put the primitive to the right
-			events[i]->m_primitive->m_orientation = 2;
-		}
+		}else if (event.m_type == 2 && event.m_position >= position){
+
+			orientation[event.m_primitive] = 2;
+
 		//finally look at the planar events
-		else if (events[i]->m_axis == axis && events[i]->m_type == 1)
-		{
-			if (events[i]->m_position < position || (events[i]->m_position == position && side == 0))
-			{
-				//put the primitive to the left
-				events[i]->m_primitive->m_orientation = 0;
-			}
-			if (events[i]->m_position > position || (events[i]->m_position == position && side == 1))
-			{
-				//put the primitive to the right
-				events[i]->m_primitive->m_orientation = 2;
-			}
+		}else if (event.m_type == 1){
+
+			if (event.m_position < position || (event.m_position == position && side == 0))
+				orientation[event.m_primitive] = 0;
+			if (event.m_position > position || (event.m_position == position && side == 1))
+				orientation[event.m_primitive] = 2;
 		}
 	}
-}
 
-void KDTree::spliceEvents(std::vector<std::shared_ptr<Event>> &events, std::vector<std::shared_ptr<Event>> &leftOnlyEvents, std::vector<std::shared_ptr<Event>> &rightOnlyEvents)
-{
-	//run over the events and put them into the corresponding list
-	for (unsigned int i = 0; i < events.size(); i++)
-	{
-		switch (events[i]->m_primitive->m_orientation)
-		{
-		case 0:			leftOnlyEvents.push_back(events[i]);
+	//step 2: split primitives, the children number their primitives anew
+	std::vector<int> childIndex(numberOfPrimitives);
+	int numberOfLeft = 0, numberOfRight = 0, numberOfBoth = 0;
+	for (int i = 0; i < numberOfPrimitives; i++){
+		numberOfLeft += orientation[i] != 2;
+		numberOfRight += orientation[i] != 0;
+		numberOfBoth += orientation[i] == 1;
+	}
+
+	left.primitives.reserve(numberOfLeft);
+	left.bounds.reserve(numberOfLeft);
+	right.primitives.reserve(numberOfRight);
+	right.bounds.reserve(numberOfRight);
+
+	for (int i = 0; i < numberOfPrimitives; i++){
+
+		switch (orientation[i]){
+		case 0:		childIndex[i] = (int)left.primitives.size();
+			left.primitives.push_back(node.primitives[i]);
+			left.bounds.push_back(node.bounds[i]);
+			break;
+		case 2:		childIndex[i] = (int)right.primitives.size();
+			right.primitives.push_back(node.primitives[i]);
+			right.bounds.push_back(node.bounds[i]);
 			break;
-		case 1:			events[i].reset();
+		}
+	}
+
+	//step 3: splicing the events of the primitives which are only on one side, they stay sorted
+	left.events.reserve(node.events.size());
+	right.events.reserve(node.events.size());
+
+	for (size_t i = 0; i < node.events.size(); i++){
+
+		Event event = node.events[i];
+		switch (orientation[event.m_primitive]){
+		case 0:		event.m_primitive = childIndex[event.m_primitive];
+			left.events.push_back(event);
 			break;
-		case 2:			rightOnlyEvents.push_back(events[i]);
+		case 2:		event.m_primitive = childIndex[event.m_primitive];
+			right.events.push_back(event);
 			break;
 		}
 	}
-}
+	size_t leftOnlyEvents = left.events.size();
+	size_t rightOnlyEvents = right.events.size();
 
-void KDTree::generateNewEvents(std::vector<std::shared_ptr<KD_Primitive>> &primitives, std::vector<std::shared_ptr<Event>> &leftBothEvents, std::vector<std::shared_ptr<Event>> &rightBothEvents, int axis, float position)
-{
-	for (unsigned int i = 0; i < primitives.size(); i++)
-	{
-		if (primitives[i]->m_orientation == 1)
-		{
-			BBox left, right;
-			primitives[i]->m_primitive->clip(axis, position , left, right);
+	//step 4: generate new events for the straddling primitives, clipped to the children
+	for (int i = 0; i < numberOfPrimitives && numberOfBoth > 0; i++){
 
-			//for each dimension
-			for (int j = 0; j < 3; j++)
-			{
+		if (orientation[i] != 1) continue;
 
-				float minLeft = left.getPos()[j] ;
-				float maxLeft = left.getSize()[j];
-				float minRight = right.getPos()[j];
-				float maxRight = right.getSize()[j];
-
-				
-				//if they are the same, the primitive is perpendicular to that dimension
-				if (minLeft == maxLeft)
-				{
-					std::shared_ptr<Event> planarEvent = std::shared_ptr<Event>(new Event(j, minLeft, 1, primitives[i]));
-					leftBothEvents.push_back(planarEvent);
-				}
-				else
-				{
-					std::shared_ptr<Event> endEvent = std::shared_ptr<Event>( new Event(j, maxLeft, 0, primitives[i]));
-					std::shared_ptr<Event> startEvent = std::shared_ptr<Event>( new Event(j, minLeft, 2, primitives[i]));
-					leftBothEvents.push_back(endEvent);
-					leftBothEvents.push_back(startEvent);
-				}
+		int leftPrimitive = (int)left.primitives.size();
+		left.primitives.push_back(node.primitives[i]);
+		left.bounds.push_back(node.bounds[i]);
+		clipPrimitive(node.primitives[i], left.boundingBox, left.bounds.back());
+		createEvents(left.bounds.back(), leftPrimitive, left.events);
 
-				if (minRight == maxRight)
-				{
-					std::shared_ptr<Event> planarEvent = std::shared_ptr<Event>( new Event(j, minRight, 1, primitives[i]));
-					rightBothEvents.push_back(planarEvent);
-				}
-				else
-				{
-					std::shared_ptr<Event> endEvent = std::shared_ptr<Event>( new Event(j, maxRight, 0, primitives[i]));
-					std::shared_ptr<Event> startEvent = std::shared_ptr<Event>(new Event(j, minRight, 2, primitives[i]));
-					rightBothEvents.push_back(endEvent);
-					rightBothEvents.push_back(startEvent);
-				}
-			}
-		}
+		int rightPrimitive = (int)right.primitives.size();
+		right.primitives.push_back(node.primitives[i]);
+		right.bounds.push_back(node.bounds[i]);
+		clipPrimitive(node.primitives[i], right.boundingBox, right.bounds.back());
+		createEvents(right.bounds.back(), rightPrimitive, right.events);
 	}
+
+	//step 5: only the few new events have to be sorted before merging
+	std::sort(left.events.begin() + leftOnlyEvents, left.events.end());
+	std::inplace_merge(left.events.begin(), left.events.begin() + leftOnlyEvents, left.events.end());
+
+	std::sort(right.events.begin() + rightOnlyEvents, right.events.end());
+	std::inplace_merge(right.events.begin(), right.events.begin() + rightOnlyEvents, right.events.end());
 }
 
-void KDTree::mergeEvents(std::vector<std::shared_ptr<Event>> &finalEvents, std::vector<std::shared_ptr<Event>> &primaryEvents, std::vector<std::shared_ptr<Event>> &secondaryEvents)
-{
-	unsigned k = 0, l = 0;
+//perfect splits: the bounds become the bounds of the part of the triangle inside the box
+//so a straddling triangle doesn't drag its whole extent into the children
+void KDTree::clipPrimitive(int primitive, const BBox& boundingBox, BBox& bounds){
 
-	//run over the primitives until one list has been processed
-	while (k < primaryEvents.size() && l < secondaryEvents.size())
-	{
-		if (primaryEvents[k]->less(secondaryEvents[l]))
-		{
-			finalEvents.push_back(primaryEvents[k]);
-			k++;
-		}
-		else
-		{
-			finalEvents.push_back(secondaryEvents[l]);
-			l++;
+	const Triangle* triangle = m_triangles[primitive].get();
+
+	//clip the triangle polygon against the six planes of the box
+	Vector3f polygon[2][9];
+	int count = 3;
+	polygon[0][0] = triangle->m_a;
+	polygon[0][1] = triangle->m_b;
+	polygon[0][2] = triangle->m_c;
+
+	int current = 0;
+	for (int plane = 0; plane < 6 && count > 0; plane++){
+
+		int axis = plane % 3;
+		bool upper = plane >= 3;
+		float position = upper ? boundingBox.m_size[axis] : boundingBox.m_pos[axis];
+
+		Vector3f* in = polygon[current];
+		Vector3f* out = polygon[1 - current];
+		int outCount = 0;
+
+		for (int i = 0; i < count; i++){
+
+			const Vector3f& a = in[i];
+			const Vector3f& b = in[(i + 1) % count];
+			float da = upper ? position - a[axis] : a[axis] - position;
+			float db = upper ? position - b[axis] : b[axis] - position;
+
+			if (da >= 0.0f) out[outCount++] = a;
+			if ((da >= 0.0f) != (db >= 0.0f) && outCount < 9){
+
+				Vector3f point = a + (b - a) * (da / (da - db));
+				point[axis] = position;
+				out[outCount++] = point;
+			}
 		}
+
+		count = outCount;
+		current = 1 - current;
 	}
-	//then process the other to the end
-	while (k < primaryEvents.size())
-	{
-		finalEvents.push_back(primaryEvents[k]);
-		k++;
+
+	//numerical trouble, keep the bounds clipped against the box
+	BBox clipped = bounds;
+	for (int j = 0; j < 3; j++){
+		clipped.m_pos[j] = max(clipped.m_pos[j], boundingBox.m_pos[j]);
+		clipped.m_size[j] = min(clipped.m_size[j], boundingBox.m_size[j]);
 	}
-	while (l < secondaryEvents.size())
-	{
-		finalEvents.push_back(secondaryEvents[l]);
-		l++;
+
+	if (count == 0){
+		bounds = clipped;
+		return;
+	}
+
+	BBox polygonBounds = BBox(polygon[current][0], polygon[current][0]);
+	for (int i = 1; i < count; i++)
+		polygonBounds.extend(polygon[current][i]);
+
+	//the clipped polygon never grows the bounds
+	for (int j = 0; j < 3; j++){
+		bounds.m_pos[j] = min(max(polygonBounds.m_pos[j], clipped.m_pos[j]), clipped.m_size[j]);
+		bounds.m_size[j] = max(min(polygonBounds.m_size[j], clipped.m_size[j]), bounds.m_pos[j]);
 	}
 }
 
+//the subtree is appended behind the nodes of the output, its child and index offsets are moved along
+void KDTree::appendSubtree(BuildOutput& output, const BuildOutput& subtree){
 
-void KDTree::splitPrimitives(std::vector<std::shared_ptr<KD_Primitive>>& leftPrimitives, std::vector<std::shared_ptr<KD_Primitive>>& rightPrimitives, std::vector<std::shared_ptr<KD_Primitive>>& primitives)
-{
-	//running over the primitives and put them into the corresponding lists
-	for (unsigned int i = 0; i < primitives.size(); i++)
-	{
-		switch (primitives[i]->m_orientation)
-		{
-		case 0:				leftPrimitives.push_back(primitives[i]);
-			break;
-		case 1:				leftPrimitives.push_back(primitives[i]);
-			rightPrimitives.push_back(primitives[i]);
-			break;
-		case 2:				rightPrimitives.push_back(primitives[i]);
-			break;
-		}
+	int nodeOffset = (int)output.nodes.size();
+	int indexOffset = (int)output.primitiveIndices.size();
+
+	for (size_t i = 0; i < subtree.nodes.size(); i++){
+
+		Node node = subtree.nodes[i];
+
+		if (!node.isLeaf())
+			node.m_aboveChild += nodeOffset << 2;
+		else
+			node.m_primitivesOffset += indexOffset;
+
+		output.nodes.push_back(node);
 	}
+
+	output.primitiveIndices.insert(output.primitiveIndices.end(), subtree.primitiveIndices.begin(), subtree.primitiveIndices.end());
 }
 
+//counts the leaves and returns the sah cost of the subtree
+float KDTree::computeStatistics(int nodeIndex, BBox boundingBox, int depth){
+
+	const Node& node = m_nodes[nodeIndex];
+	m_statistics.depth = max(m_statistics.depth, depth);
+
+	if (node.isLeaf()){
+
+		m_statistics.leaves++;
+		m_statistics.references += node.numberOfPrimitives();
+		if (node.numberOfPrimitives() == 0) m_statistics.emptyLeaves++;
+
+		return (float)(m_costOfIntersection * node.numberOfPrimitives());
+	}
+
+	BBox leftBox = boundingBox;
+	BBox rightBox = boundingBox;
+	leftBox.getSize()[node.splitAxis()] = node.splitPosition();
+	rightBox.getPos()[node.splitAxis()] = node.splitPosition();
+
+	float leftCost = computeStatistics(nodeIndex + 1, leftBox, depth + 1);
+	float rightCost = computeStatistics(node.aboveChild(), rightBox, depth + 1);
+
+	float area = boundingBox.getSurfaceArea();
+	if (area <= 0.0f)
+		return m_costOfTraversal + max(leftCost, rightCost);
+
+	return m_costOfTraversal + (leftBox.getSurfaceArea() * leftCost + rightBox.getSurfaceArea() * rightCost) / area;
+}
 
 
 bool KDTree::intersectRec(Hit &hit){
 
+	const Ray& ray = hit.transformedRay;
+
 	// intersect the ray with the bounding box of the kdtree
-	
-	
-	if (!m_boundingBox.intersect(hit.transformedRay)){
-		//hit.color = Color(1.0, 0.0, 0.0);
+	float tmin, tmax;
+	if (m_nodes.empty() || !m_boundingBox.intersect(ray, tmin, tmax)){
 		hit.hitObject = false;
 		return false;
 	}
-	
-	float tmin = m_boundingBox.m_tmin;
-	float tmax = m_boundingBox.m_tmax;
+	tmin = tmin - fabsf(tmin * 0.00001f);
+
+	// only hits in front of the hit found so far count, the scene passes the same hit to all primitives
+	float tclosest = hit.t;
+	float b1 = 0.0f, b2 = 0.0f;
+	int triangle = traverse(ray, 0, tmin, tmax, tclosest, b1, b2);
+
+	// find closest triangle
+	hit.hitObject = triangle >= 0;
+	if (hit.hitObject){
+		hit.t = tclosest;
+		hit.triangle = triangle;
+		hit.b1 = b1;
+		hit.b2 = b2;
+	}
 
-	// start traversal from the root node
-	return intersect(m_rootNode, hit.transformedRay, tmin - fabsf(tmin * 0.00001f), tmax, hit);
+	return hit.hitObject;
 }
 
+bool KDTree::occluded(const Ray& ray, float distance){
 
-bool KDTree::intersect(std::shared_ptr<Node> node, const Ray& ray, float min, float max, Hit &hit){
-	
-	// don't do anything for null nodes
-	if (node == NULL){ 
-		
+	float tmin, tmax;
+	if (m_nodes.empty() || !m_boundingBox.intersect(ray, tmin, tmax) || tmin > distance){
 		return false;
 	}
+	tmin = tmin - fabsf(tmin * 0.00001f);
 
-	// if leaf node, then look for intersection with primitives
-	if (node->m_isLeaf){
-		
-		return node->leafIntersect(ray, hit);
-	}
+	float tclosest = distance;
+	float b1, b2;
+	return traverse(ray, 0, tmin, tmax, tclosest, b1, b2, true) >= 0;
+}
 
-	// get near and far child
-	std::shared_ptr<Node> nea;
-	std::shared_ptr<Node> fa;
-	node->getNearFar(ray, nea, fa);
+int KDTree::traverse(const Ray& ray, int nodeIndex, float tmin, float tmax, float& tclosest, float& b1, float& b2, bool anyHit){
 
-	// compute distance to the split plane
-	float dist = node->distanceToSplitPlane(ray);
+	Vector3f invDirection = Vector3f(1.0f / ray.direction[0], 1.0f / ray.direction[1], 1.0f / ray.direction[2]);
+	TriangleBuffer::ShearedRay sheared(ray);
 
-	// the whole interval is on near side
+	// the far children still to visit
+	struct Todo{
+		int node;
+		float tmin, tmax;
+	};
+	Todo todo[MaxDepth];
+	int todoPos = 0;
 
-	if (dist < 0 || dist > max + 1E-4f){
+	int triangle = -1;
 
-		return intersect(nea, ray, min, max, hit);
+	for (;;){
 
-		// whole interval is on far side
-	}
-	else if (dist <= min - 1E-5f){
+		// a closer hit was found in a cell in front of the remaining ones
+		if (tclosest < tmin) break;
 
-		return intersect(fa, ray, min, max, hit);
+		const Node* node = &m_nodes[nodeIndex];
+		STATISTIC(kdTreeNodes, 1);
 
-		// the interval intersects the plane
-	}else{
+		if (!node->isLeaf()){
+
+			// compute distance to the split plane
+			int axis = node->splitAxis();
+			float tplane = (node->splitPosition() - ray.origin[axis]) * invDirection[axis];
+
+			// get near and far child
+			int nea, fa;
+			bool belowFirst = (ray.origin[axis] < node->splitPosition()) || (ray.origin[axis] == node->splitPosition() && ray.direction[axis] <= 0);
+			if (belowFirst){
+				nea = nodeIndex + 1;
+				fa = node->aboveChild();
+			}else{
+				nea = node->aboveChild();
+				fa = nodeIndex + 1;
+			}
 
-		// first test near side
-		if (intersect(nea, ray, min, dist, hit)) return true;
-		
-		// then test the far side
-		return intersect(fa, ray, dist, max, hit);
+			if (tplane > tmax || tplane <= 0){
+				// the whole interval is on near side
+				nodeIndex = nea;
+
+			}else if (tplane < tmin){
+				// whole interval is on far side
+				nodeIndex = fa;
+
+			}else{
+				// the interval intersects the plane, visit the near side first
+				todo[todoPos].node = fa;
+				todo[todoPos].tmin = tplane;
+				todo[todoPos].tmax = tmax;
+				todoPos++;
+
+				nodeIndex = nea;
+				tmax = tplane;
+			}
+
+		}else{
+
+			// look for intersection with the triangles of the leaf, four at a time
+			int slot = m_triangleBuffer.intersect(node->m_primitivesOffset, node->numberOfPrimitives(), sheared, tclosest, b1, b2);
+			if (slot >= 0){
+				triangle = m_triangleBuffer.getId(slot);
+				if (anyHit) break;
+			}
+
+			// take the next cell from the stack
+			if (todoPos == 0) break;
+			todoPos--;
+			nodeIndex = todo[todoPos].node;
+			tmin = todo[todoPos].tmin;
+			tmax = todo[todoPos].tmax;
+		}
 	}
-	return false;
+
+	return triangle;
 }
 
+void KDTree::intersect(RayPacket& packet, Hit* hits){
 
+	int mask = packet.mask;
+	if (m_nodes.empty() || mask == 0) return;
 
+	// the near child is the same for all rays only if their directions have the same signs
+	bool negative[3];
+	for (int axis = 0; axis < 3; axis++){
 
-bool KDTree::Node::leafIntersect(const Ray& ray, Hit &hit){
-	
-	hit.hitObject = false;
-
-	float tmin = hit.t;
-	float tminTree = hit.t;
-	Hit hitTree;
-	hitTree.transformedRay = hit.transformedRay;
-	
-	for (unsigned int i = 0; i < m_primitives.size(); i++){
-						
-		m_primitives[i]->m_primitive->hit(hitTree);
-				
-		if (hitTree.hitObject && hitTree.t < tminTree) {
-				
-				m_tree->m_primitive = m_primitives[i]->m_primitive;	
-				tminTree = hitTree.t;			
+		int signs = packet.direction[axis].signBits() & mask;
+		if (signs != 0 && signs != mask){
+			Accelerator::intersect(packet, hits);
+			return;
 		}
+		negative[axis] = signs != 0;
 	}
-		
-	// find closest triangle
-	if (tminTree < tmin){
-		
-		hit.t = tminTree;
-		hit.hitObject = true;	
+
+	Float4 invDirection[3];
+	for (int axis = 0; axis < 3; axis++){
+
+		invDirection[axis] = Float4(1.0f) / packet.direction[axis];
+		mask &= ~(Float4::IsNan(packet.origin[axis]) | Float4::IsNan(invDirection[axis])).signBits();
 	}
+	TriangleBuffer::ShearedPacket sheared(packet);
 
-	
+	// the part of each ray inside the bounding box, widened a little as the box test of a single ray runs in double
+	Float4 tmin(0.0f), tmax(FLT_MAX);
+	for (int axis = 0; axis < 3; axis++){
 
-	return hit.hitObject;
-	
-}
+		Float4 t0 = (Float4(m_boundingBox.m_pos[axis]) - packet.origin[axis]) * invDirection[axis];
+		Float4 t1 = (Float4(m_boundingBox.m_pos[axis] + m_boundingBox.m_size[axis]) - packet.origin[axis]) * invDirection[axis];
 
-bool KDTree::Node::getNearFar(const Ray &r, std::shared_ptr<KDTree::Node>&nea, std::shared_ptr<KDTree::Node>&fa){
-	if (m_splitPosition >= r.origin[m_splitAxis])
-	{
-		nea = left;
-		fa = right;
+		tmin = Float4::Max(Float4::Min(t0, t1), tmin);
+		tmax = Float4::Min(Float4::Max(t0, t1), tmax);
 	}
-	else
-	{
-		nea = right;
-		fa = left;
+	tmin = Float4::Max(tmin - Float4::Abs(tmin * 0.00001f), Float4(0.0f));
+	tmax = tmax + Float4::Abs(tmax * 0.00001f);
+
+	Float4 tclosest = packet.t;
+	Float4 b1(0.0f), b2(0.0f);
+	int triangle[RayPacket::Size] = { -1, -1, -1, -1 };
+
+	// the far children still to visit
+	struct Todo{
+		int node;
+		Float4 tmin, tmax;
+	};
+	Todo todo[MaxDepth];
+	int todoPos = 0;
+
+	int nodeIndex = 0;
+	for (;;){
+
+		// rays whose interval is empty or behind their closest hit are done with the cell
+		int active = mask & (tmin <= tmax).signBits() & (tmin <= tclosest).signBits();
+
+		if (laneCount(active) == 1){
+
+			// the packet has diverged, the last ray finishes the subtree on its own
+			int i = active == 1 ? 0 : active == 2 ? 1 : active == 4 ? 2 : 3;
+			float t = tclosest[i], u = b1[i], v = b2[i];
+
+			int index = traverse(packet.getRay(i), nodeIndex, tmin[i], tmax[i], t, u, v);
+			if (index >= 0){
+				triangle[i] = index;
+				tclosest.set(i, t);
+				b1.set(i, u);
+				b2.set(i, v);
+			}
+			active = 0;
+		}
+
+		if (active != 0){
+
+			const Node* node = &m_nodes[nodeIndex];
+			STATISTIC(kdTreeNodes, 1);
+
+			if (!node->isLeaf()){
+
+				int axis = node->splitAxis();
+				Float4 tplane = (Float4(node->splitPosition()) - packet.origin[axis]) * invDirection[axis];
+
+				int nea = negative[axis] ? node->aboveChild() : nodeIndex + 1;
+				int fa = negative[axis] ? nodeIndex + 1 : node->aboveChild();
+
+				if (((tplane > tmax).signBits() & active) == active){
+					// all rays leave the cell before they reach the plane
+					nodeIndex = nea;
+
+				}else if (((tplane < tmin).signBits() & active) == active){
+					// all rays enter the cell behind the plane
+					nodeIndex = fa;
+
+				}else{
+					// a nan plane distance keeps the whole interval on both sides
+					todo[todoPos].node = fa;
+					todo[todoPos].tmin = Float4::Max(tplane, tmin);
+					todo[todoPos].tmax = tmax;
+					todoPos++;
+
+					nodeIndex = nea;
+					tmax = Float4::Min(tplane, tmax);
+				}
+				continue;
+			}
+
+			int numberOfPrimitives = node->numberOfPrimitives();
+			for (int i = 0; i < numberOfPrimitives; i++){
+
+				int slot = node->m_primitivesOffset + i;
+
+				int hitMask = m_triangleBuffer.intersect(slot, sheared, active, tclosest, b1, b2);
+				for (int j = 0; j < RayPacket::Size; j++){
+					if (hitMask & (1 << j)) triangle[j] = m_triangleBuffer.getId(slot);
+				}
+			}
+		}
+
+		// take the next cell from the stack
+		if (todoPos == 0) break;
+		todoPos--;
+		nodeIndex = todo[todoPos].node;
+		tmin = todo[todoPos].tmin;
+		tmax = todo[todoPos].tmax;
+	}
+
+	for (int i = 0; i < RayPacket::Size; i++){
+
+		if (triangle[i] < 0) continue;
+
+		Hit hit;
+		hit.t = tclosest[i];
+		hit.transformedRay = packet.getRay(i);
+		hit.triangle = triangle[i];
+		hit.b1 = b1[i];
+		hit.b2 = b2[i];
+		packet.setHit(i, hit, hits);
 	}
-	return true;
 }
 
-float KDTree::Node::distanceToSplitPlane(const Ray &ray){
+void KDTree::Node::initLeaf(const std::vector<int>& primitives, std::vector<int>& primitiveIndices){
+
+	m_flags = 3;
+	m_numberOfPrimitives |= (int)primitives.size() << 2;
 
-	return (m_splitPosition - ray.origin[m_splitAxis]) / ray.direction[m_splitAxis];
-}
\ No newline at end of file
+	m_primitivesOffset = (int)primitiveIndices.size();
+	for (unsigned int i = 0; i < primitives.size(); i++)
+		primitiveIndices.push_back(primitives[i]);
+}
+
+void KDTree::Node::initInterior(int axis, int aboveChild, float splitPosition){
+
+	m_split = splitPosition;
+	m_flags = axis;
+	m_aboveChild |= aboveChild << 2;
+}
@@ -1,110 +1,145 @@
 #ifndef _KDTREE_H
 #define _KDTREE_H
 
-#include <stack>
-#include "scene.h"
+#include <vector>
+#include <atomic>
+#include "Accelerator.h"
+#include "Scene.h"
 #include "Primitive.h"
+#include "TriangleBuffer.h"
 
 
-class KDTree{
+class KDTree : public Accelerator{
 
 public:
 
-	struct KD_Primitive{
-
-		KD_Primitive(std::shared_ptr<Primitive> primitive){
-			m_primitive = primitive;
-		}
-
-		std::shared_ptr<Primitive> m_primitive;
-		int		   m_orientation;
-
+	// 8 byte node, the nodes are stored depth first in one array so the below child follows its parent
+	// the two low bits of the flags hold the split axis or 3 for a leaf, the upper bits hold
+	// the index of the above child or the number of triangles of the leaf, which are consecutive slots of the triangle buffer
+	struct Node{
 
+		void initLeaf(const std::vector<int>& primitives, std::vector<int>& primitiveIndices);
+		void initInterior(int axis, int aboveChild, float splitPosition);
+
+		float splitPosition() const { return m_split; }
+		int numberOfPrimitives() const { return m_numberOfPrimitives >> 2; }
+		int splitAxis() const { return m_flags & 3; }
+		bool isLeaf() const { return (m_flags & 3) == 3; }
+		int aboveChild() const { return m_aboveChild >> 2; }
+
+		union{
+			float m_split;						// interior
+			int m_primitivesOffset;				// leaf
+		};
+
+		union{
+			int m_flags;
+			int m_numberOfPrimitives;
+			int m_aboveChild;
+		};
 	};
 
-	struct Node{
-
-		Node(std::vector<std::shared_ptr<KD_Primitive>> triangles, KDTree *tree){
-			m_primitives = triangles;
-			m_isLeaf = true;
-			m_tree = std::unique_ptr<KDTree>(tree);
-		}
+	// numbers of the last build
+	struct Statistics{
+		int triangles;
+		int nodes;
+		int leaves;
+		int emptyLeaves;
+		int depth;
+		int references;		// triangles referenced by the leaves, straddling triangles count more than once
+		int threads;		// subtree builds running at the same time at most
+		float sahCost;		// expected cost of a ray in units of one traversal step
+		float seconds;
+	};
 
-		Node(int splitAxis, float splitPosition){
-			m_splitAxis = splitAxis;
-			m_splitPosition = splitPosition;
-			m_isLeaf = false;
-		}
+	KDTree();
+	~KDTree();
 
-		
-		int m_splitAxis;
-		float m_splitPosition;
-		std::shared_ptr<Node> left;
-		std::shared_ptr<Node> right;
-		bool m_isLeaf;
-		std::vector<std::shared_ptr<KD_Primitive>>	m_primitives;
-		std::shared_ptr<KDTree> m_tree;
+	void build(const std::vector<std::shared_ptr<Triangle>>& list, const BBox &V){ buildTree(list, V); }
+	bool intersect(Hit &hit){ return intersectRec(hit); }
+	// packet traversal, the near child is picked by the common direction signs of the rays
+	// a packet whose rays disagree on a sign is traced ray by ray, the last ray left in a subtree finishes it alone
+	void intersect(RayPacket& packet, Hit* hits);
+	bool occluded(const Ray& ray, float distance);
+	bool write(ModelCache::Writer& cache) const;
+	bool read(ModelCache::Reader& cache, const std::vector<std::shared_ptr<Triangle>>& list);
+
+	// maxDepth < 0 picks 8 + 1.3 log2(n) like pbrt
+	void buildTree(const std::vector<std::shared_ptr<Triangle>>& list, const BBox &V, int maxDepth = -1);
+	// finds the closest triangle, its index and barycentric coordinates are returned inside the hit
+	bool intersectRec(Hit &hit);
 
-		bool leafIntersect(const Ray& ray, Hit &hit);
-		bool getNearFar(const Ray& ray, std::shared_ptr<Node>& nea, std::shared_ptr<Node>& fa);
-		float distanceToSplitPlane(const Ray& ray);
+	const Statistics& getStatistics() const { return m_statistics; }
 
-		
-	};
+private:
 
+	// event of the sweep, the primitive is an index into the primitives of the node
+	// type 0 is an end event, 1 a planar one and 2 a start event
 	struct Event{
 
-		Event(int axis, float position, int type, std::shared_ptr<KD_Primitive> primitive){
-			m_axis = axis;
-			m_position = position;
-			m_type = type;
-			m_primitive = primitive;
-		}
+		Event(){}
+		Event(int axis, float position, int type, int primitive) : m_position(position), m_primitive(primitive), m_axis((unsigned char)axis), m_type((unsigned char)type) {}
 
-		int m_axis;
 		float m_position;
-		int m_type;
-		std::shared_ptr<KD_Primitive> m_primitive;
-		
-		//comparison method for quicksort
-		inline bool less(std::shared_ptr<Event> rhs){
+		int m_primitive;
+		unsigned char m_axis;
+		unsigned char m_type;
 
-			return m_position < rhs->m_position || (m_position == rhs->m_position && (m_axis < rhs->m_axis || (m_axis == rhs->m_axis && m_type < rhs->m_type)));
+		//comparison method for sorting
+		inline bool operator<(const Event& rhs) const{
+
+			return m_position < rhs.m_position || (m_position == rhs.m_position && (m_axis < rhs.m_axis || (m_axis == rhs.m_axis && m_type < rhs.m_type)));
 		}
 	};
 
-	KDTree();
-	~KDTree();
-	
-	void buildTree(const std::vector<std::shared_ptr<Triangle>>& list, const BBox &V, int maxDepth = 15);
-	bool intersectRec(Hit &hit);
-	
-	// used to get the right material at the render function in the class scene
-	std::shared_ptr<Primitive> m_primitive;
+	// the triangles of a node in the making, their bounds are clipped to the node
+	struct BuildNode{
+		BBox boundingBox;
+		std::vector<int> primitives;
+		std::vector<BBox> bounds;
+		std::vector<Event> events;
+	};
 
-private:
-	
-	std::shared_ptr<Node> buildTree(BBox BBox, std::vector<std::shared_ptr<KD_Primitive>> primitives, std::vector<std::shared_ptr<Event>> events, int depth);
-	void createEvents(std::vector<std::shared_ptr<Event>>& events, std::vector<std::shared_ptr<KD_Primitive>>& primitives, std::vector<std::shared_ptr<Triangle>> list);
-	void sortEvents(std::vector<std::shared_ptr<Event>>& events);
-	void quickSort(std::vector<std::shared_ptr<Event>>& events, unsigned int leftBorder, unsigned int rightBorder);
-	void findSplitPlane(BBox boundingBox, int numberOfPrimitives, std::vector<std::shared_ptr<Event>>& events, int& bestAxis, float& bestPosition, float& bestSAHValue, int& side);
-	float computeSAH(BBox boundingBox, unsigned int axis, float position, unsigned int numberOfLeftPrims, unsigned int numberOfPlanarPrims, unsigned int numberOfRightPrims, unsigned int &side);
-	void classifyPrimitives(std::vector<std::shared_ptr<Event>>& events, std::vector<std::shared_ptr<KD_Primitive>>& primitives, int axis, float position, int side);
-	void spliceEvents(std::vector<std::shared_ptr<Event>>& events, std::vector<std::shared_ptr<Event>>& leftOnlyEvents, std::vector<std::shared_ptr<Event>>& rightOnlyEvents);
-	void generateNewEvents(std::vector<std::shared_ptr<KD_Primitive>>& primitives, std::vector<std::shared_ptr<Event>>& leftBothEvents, std::vector<std::shared_ptr<Event>>& rightBothEvents, int axis, float position);
-	void mergeEvents(std::vector<std::shared_ptr<Event>>& finalEvents, std::vector<std::shared_ptr<Event>>& primaryEvents, std::vector<std::shared_ptr<Event>>& secondaryEvents);
-	void splitPrimitives(std::vector<std::shared_ptr<KD_Primitive>>& leftPrimitives, std::vector<std::shared_ptr<KD_Primitive>>& rightPrimitives, std::vector<std::shared_ptr<KD_Primitive>>& primitives);
-
-	bool intersect(std::shared_ptr<Node> node, const Ray& ray, float min, float max, Hit &hit);
-	//the max depth of the tree
+	// nodes and leaf indices of a subtree, a subtree built by another thread is appended afterwards
+	struct BuildOutput{
+		std::vector<Node> nodes;
+		std::vector<int> primitiveIndices;
+	};
+
+	// the closest triangle in front of tclosest in the subtree of the node or -1, (tmin, tmax) is the part of the ray inside the node
+	// anyHit returns the first triangle found instead
+	int traverse(const Ray& ray, int nodeIndex, float tmin, float tmax, float& tclosest, float& b1, float& b2, bool anyHit = false);
+
+	void buildNode(BuildNode& node, int depth, BuildOutput& output);
+	void createEvents(const BBox& bounds, int primitive, std::vector<Event>& events);
+	void findSplitPlane(const BBox& boundingBox, int numberOfPrimitives, const std::vector<Event>& events, int& bestAxis, float& bestPosition, float& bestSAHValue, int& side);
+	float computeSAH(const BBox& boundingBox, unsigned int axis, float position, unsigned int numberOfLeftPrims, unsigned int numberOfPlanarPrims, unsigned int numberOfRightPrims, unsigned int &side);
+	void splitNode(BuildNode& node, int axis, float position, int side, BuildNode& left, BuildNode& right);
+	void clipPrimitive(int primitive, const BBox& boundingBox, BBox& bounds);
+	void appendSubtree(BuildOutput& output, const BuildOutput& subtree);
+	float computeStatistics(int node, BBox boundingBox, int depth);
+	// checks a tree read from the cache, the traversal trusts the child indices, leaf ranges and triangle ids
+	bool isValid(int numberOfTriangles) const;
+
+	//the max depth of the tree, bounded by the size of the traversal stack
 	int	m_maximumDepth;
+	static const int MaxDepth = 64;
+
+	//subtrees with fewer primitives are built by the thread of the parent
+	static const int MinParallelPrimitives = 4096;
 
 	//the bounding box of the object
 	BBox m_boundingBox;
 
-	//the root node
-	std::shared_ptr<Node> m_rootNode;
+	//the nodes in depth first order, the root is the first one
+	std::vector<Node> m_nodes;
+
+	//the triangles of the leaves in leaf order, every leaf starts a new block
+	//a triangle straddling several leaves has a slot in each
+	TriangleBuffer m_triangleBuffer;
+
+	//the triangles of the mesh while building, the primitives of the build point into this list
+	std::vector<std::shared_ptr<Triangle>> m_triangles;
 
 	//the cost of intersecting a node
 	int	m_costOfIntersection;
@@ -112,9 +147,14 @@ private:
 	//the cost of traversing a node
 	int m_costOfTraversal;
 
-	
+	//subtree builds in flight and the allowed number
+	std::atomic<int> m_activeThreads;
+	std::atomic<int> m_peakThreads;
+	int m_maximumThreads;
+
+	Statistics m_statistics;
 };
 
 
 
-#endif 
\ No newline at end of file
+#endif
@@ -189,7 +189,7 @@ void AreaLight::setObject(Primitive* primitive){
 
 Vector3f AreaLight::getDirection(const Vector3f &hitPoint) {
 	m_samplePoint = m_primitive->sample();					// used in the G function
-	m_lightNormal = m_primitive->getNormal(m_samplePoint);	// used in the G and L function
+	m_lightNormal = m_primitive->getNormal(m_samplePoint);	// used in the G and L function, a sampled point names no triangle, so only analytic lights work here
 	m_wi = (m_samplePoint -hitPoint ).normalize(); 			// used in the G and L function
 
 	return m_wi;
@@ -218,3 +218,41 @@ float AreaLight::pdf(const Hit &hit) const {
 	
 }
 
+Color AreaLight::sample(const Vector3f& position, Vector3f& wi, float& distance, float& pdf) const {
+
+	// a primitive without an area can't be sampled, the density 0 leaves it to the bounces
+	// meshes are among them, a sampled point doesn't name the triangle their hit overloads need
+	float area = m_primitive->getArea();
+	if (area <= 0.0f){
+		wi = Vector3f(0.0f, 0.0f, 0.0f);
+		distance = 0.0f;
+		pdf = 0.0f;
+		return Color(0.0f, 0.0f, 0.0f);
+	}
+
+	Hit lightHit;
+	lightHit.hitPoint = m_primitive->sample();
+
+	Vector3f diff = lightHit.hitPoint - position;
+	distance = diff.magnitude();
+	wi = diff / distance;
+
+	// both sides emit like in the path tracer, the emission is scaled by the pdf of the primitive as there
+	float cosLight = fabs(Vector3f::dot(m_primitive->getNormal(lightHit), wi));
+	pdf = cosLight > 0.0f ? distance * distance / (cosLight * area) : 0.0f;
+
+	return m_primitive->getColor(lightHit) * (1.0 / m_primitive->pdf(lightHit));
+}
+
+float AreaLight::pdf(const Vector3f& position, const Hit& lightHit) const {
+
+	float area = m_primitive->getArea();
+	if (area <= 0.0f) return 0.0f;
+
+	Vector3f diff = lightHit.hitPoint - position;
+	float d2 = Vector3f::dot(diff, diff);
+	float cosLight = fabs(Vector3f::dot(m_primitive->getNormal(lightHit), diff)) / sqrtf(d2);
+
+	return cosLight > 0.0f ? d2 / (cosLight * area) : 0.0f;
+}
+
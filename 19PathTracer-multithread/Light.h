@@ -105,5 +105,10 @@ class AreaLight : public Light {	friend class Matte;public:		AreaLight();
 	Color L(Hit &hit);
 	float G(Hit &hit) const;
 	float pdf(const Hit &hit) const;
+	// stateless sampling for the path tracer, unlike getDirection the render threads can share the light
+	// a point on the light seen from position, returns its emitted radiance and sets the direction, distance and density in solid angle
+	Color sample(const Vector3f& position, Vector3f& wi, float& distance, float& pdf) const;
+	// density in solid angle of sampling the point lightHit of the light from position
+	float pdf(const Vector3f& position, const Hit& lightHit) const;
 		std::shared_ptr<Primitive> m_primitive;private:		std::shared_ptr<Material> m_material;	Vector3f m_samplePoint;	Vector3f m_lightNormal;	Vector3f m_wi;};
 #endif
\ No newline at end of file
@@ -1,8 +1,11 @@
 #include "Material.h"
 #include "Scene.h"
+#include "Utils.h"
+#include "Statistics.h"
 
-Material::Material() : m_generator(std::random_device()()), m_distribution(0.0, 1.0){
+Material::Material(){
 	
+	m_type = Diffuse;
 	m_shinies = 20;
 	m_ambient = Color(1.0, 1.0, 1.0);
 	m_diffuse = Color(1.0, 1.0, 1.0);
@@ -11,12 +14,11 @@ Material::Material() : m_generator(std::random_device()()), m_distribution(0.0,
 
 	colorMapPath = "";
 	bumpMapPath = "";
-
-	std::srand(std::time(NULL));
 }
 
-Material::Material(const Color &ambient, const Color &diffuse, const Color &specular, const int shinies = 20) : m_generator(std::random_device()()),  m_distribution(0.0, 1.0){
+Material::Material(const Color &ambient, const Color &diffuse, const Color &specular, const int shinies = 20){
 
+	m_type = Diffuse;
 	m_ambient = ambient;
 	m_diffuse = diffuse;
 	m_specular = specular;
@@ -25,11 +27,10 @@ Material::Material(const Color &ambient, const Color &diffuse, const Color &spec
 
 	colorMapPath = "";
 	bumpMapPath = "";
-
-	std::srand(std::time(NULL));
 }
 
-Material::Material(const std::shared_ptr<Material> material) : m_ambient(material->m_ambient),
+Material::Material(const std::shared_ptr<Material> material) : m_type(material->m_type),
+												m_ambient(material->m_ambient),
 												m_diffuse(material->m_diffuse),
 												m_specular(material->m_specular),
 												m_shinies(material->m_shinies),										
@@ -84,6 +85,11 @@ void Material::setNormalTexture(ImageTexture* normalMap){
 	m_normalMap = std::shared_ptr<ImageTexture>(normalMap);
 }
 
+int Material::getAttributes() const{
+
+	return m_normalMap ? TangentFrame | TextureCoordinates : 0;
+}
+
 Matrix4f Material::getTBN(const Hit &hit){
 
 	return Matrix4f(hit.tangent[0], hit.tangent[1], hit.tangent[2], 0.0f,
@@ -122,7 +128,7 @@ void Material::setSampler(Sampler* sampler){
 
 float Material::randFloat(){
 
-	return (float)rand() * (1.0 / (float)RAND_MAX);
+	return RandomFloat();
 }
 
 ////////////////////////////////////////////////////Phong//////////////////////////////////////////////////////
@@ -241,8 +247,8 @@ Vector3f Matte::sampleDirection2(Vector3f& normal){
 	Vector3f nt = std::fabs(normal[0]) > std::fabs(normal[1]) ? Vector3f(normal[2], 0, -normal[0]).normalize() : Vector3f(0, -normal[2], normal[1]).normalize();
 	Vector3f nb = Vector3f::cross(normal, nt);
 
-	float r1 = m_distribution(m_generator);
-	float phi = 2 * PI * m_distribution(m_generator);
+	float r1 = RandomFloat();
+	float phi = 2 * PI * RandomFloat();
 	float sinTheta = sqrtf(1 - r1 * r1);
 	float x = sinTheta * cosf(phi);
 	float z = sinTheta * sinf(phi);
@@ -271,17 +277,9 @@ Color Matte::shade(Hit &hit){
 				
 				Vector3f transformedhitPoint = hit.originalRay.origin + hit.originalRay.direction * hit.t;
 				Ray	_ray = Ray(transformedhitPoint + hit.normal * 0.01, wi);
-				bool hitObject = false;
-				float hitParameter;
-
-				for (unsigned int j = 0; j < hit.scene->m_primitives.size(); j++){
-
-					hitObject = hitObject || hit.scene->m_primitives[j]->shadowHit(_ray, hitParameter);
 
-					//no shadow in case the primitive is behind the lightsource
-					if (hitParameter > (_ray.origin - hit.scene->m_lights[i]->m_position).magnitude()) hitObject = false;
-					if (hitObject) break;
-				}
+				//no shadow in case the primitive is behind the lightsource
+				bool hitObject = hit.scene->shadowHit(_ray, (_ray.origin - hit.scene->m_lights[i]->m_position).magnitude());
 
 				if (!hitObject){
 					L = L + (hit.color* m_kd * invPI) * hit.scene->m_lights[i]->L(hit) * lambert;
@@ -318,20 +316,9 @@ Color Matte::shadeAreaLight(Hit &hit) {
 			
 				Vector3f transformedhitPoint = hit.originalRay.origin + hit.originalRay.direction * hit.t;
 				Ray	_ray = Ray(transformedhitPoint + hit.normal * 0.01, wi);
-				bool hitObject = false;
-				float hitParameter;
-
-				for (unsigned int j = 0; j < hit.scene->m_primitives.size(); j++){
 
-					//no shadow hit agains the lightsource
-					if (light->m_primitive == hit.scene->m_primitives[j]) continue;
-
-					hitObject = hitObject || hit.scene->m_primitives[j]->shadowHit(_ray, hitParameter);
-
-					//no shadow in case the primitive is behind the lightsource
-					if (hitParameter > (_ray.origin - light->m_samplePoint).magnitude() ) hitObject = false;				
-					if (hitObject) break;
-				}
+				//no shadow hit agains the lightsource and none behind it
+				bool hitObject = hit.scene->shadowHit(_ray, (_ray.origin - light->m_samplePoint).magnitude(), light->m_primitive.get());
 
 				if (!hitObject){
 					L = L + ((hit.color * invPI * m_kd * light->L(hit) * light->G(hit) * lambert) / light->pdf(hit));
@@ -349,13 +336,12 @@ Color Matte::shadeAreaLight(Hit &hit) {
 
 Color Matte::shadePath(Hit &hit){
 
-	// russian roulette
-	/*float continuationPdf = min(1, hit.color.Max());
-
-	if (randFloat() >= continuationPdf){
+	// without the throughput of the path the roulette goes by the albedo
+	Color pathWeight = Color(1.0, 1.0, 1.0);
+	return shadePath(hit, pathWeight);
+}
 
-		return hit.scene->m_background; // Absorbation
-	}*/
+Color Matte::shadePath(Hit &hit, Color &pathWeight){
 
 	Vector3f newDirection = sampleDirection(hit.normal);
 	float lambert = Vector3f::dot(hit.normal, newDirection);
@@ -364,33 +350,29 @@ Color Matte::shadePath(Hit &hit){
 	hit.originalRay.origin = hit.originalRay.origin + hit.originalRay.direction * hit.t;
 	hit.originalRay.direction = newDirection;
 
-	return f * hit.scene->traceRay(hit.originalRay) * lambert / pdf;
-}
-
-Color Matte::shadePath(Hit &hit, Color &pathWeight){
+	// russian roulette on the throughput after this bounce, the primary ray has depth 1
+	Color weight = pathWeight * f * lambert / pdf;
+	float continuation = hit.scene->continuationProbability(weight, hit.originalRay.depth - 1);
+	if (continuation < 1.0f){
 
-	// russian roulette
-	/*float continuationPdf = min(1, hit.color.Max());
+		if (randFloat() >= continuation){
 
-	if (randFloat() >= continuationPdf){
-
-		return hit.scene->m_background; // Absorbation
-	}*/
-
-	Vector3f newDirection = sampleDirection(hit.normal);
-	float lambert = Vector3f::dot(hit.normal, newDirection);
-	float pdf = max(1e-6f, max(0, Vector3f::dot(hit.normal, newDirection)) * invPI);
-	Color f = hit.color * invPI * m_kd;
-	hit.originalRay.origin = hit.originalRay.origin + hit.originalRay.direction * hit.t;
-	hit.originalRay.direction = newDirection;
+			STATISTIC(rouletteStops, 1);
+			STATISTIC(bouncesSaved, hit.scene->m_maximumDepth - hit.originalRay.depth);
+			return Color(0.0, 0.0, 0.0); // Absorbation
+		}
+		f = f / continuation;
+		weight = weight / continuation;
+	}
 
-	return f * hit.scene->traceRay(hit.originalRay, pathWeight) * lambert / pdf;
+	return f * hit.scene->traceRay(hit.originalRay, weight) * lambert / pdf;
 
 }
 
 ////////////////////////////////////////////////////Reflective//////////////////////////////////////////////////////
 Reflective::Reflective( ) : Material(){
 
+	m_type = Specular;
 	m_reflectionColor = Color(1.0, 1.0, 1.0);
 	m_frensel = 0.5;
 
@@ -399,6 +381,7 @@ Reflective::Reflective( ) : Material(){
 
 Reflective::Reflective(const Color &ambient, const Color &diffuse, const Color &specular) : Material(ambient, diffuse, specular){
 
+	m_type = Specular;
 	m_reflectionColor = Color(1.0, 1.0, 1.0);
 	m_frensel = 0.5;
 
@@ -407,6 +390,7 @@ Reflective::Reflective(const Color &ambient, const Color &diffuse, const Color &
 
 Reflective::Reflective(const std::shared_ptr<Material> material) : Material(material){
 
+	m_type = Specular;
 	m_reflectionColor = Color(1.0, 1.0, 1.0);
 	m_frensel = 0.5;
 
@@ -467,11 +451,11 @@ Color Reflective::shade(Hit &hit){
 	return hit.color + brdf * hit.scene->traceRay(hit.originalRay) * Vector3f::dot(incidentRay, hit.normal);	
 }
 ////////////////////////////////////////////////////Emissive//////////////////////////////////////////////////////
-Emissive::Emissive() : Material(), m_ls(1.0) { }
+Emissive::Emissive() : Material(), m_ls(1.0) { m_type = Light; }
 
-Emissive::Emissive(const Color &ambient, const Color &diffuse, const Color &specular) : Material(ambient, diffuse, specular), m_ls(1.0){ }
+Emissive::Emissive(const Color &ambient, const Color &diffuse, const Color &specular) : Material(ambient, diffuse, specular), m_ls(1.0){ m_type = Light; }
 
-Emissive::Emissive(const std::shared_ptr<Material> material) : Material(material){ }
+Emissive::Emissive(const std::shared_ptr<Material> material) : Material(material){ m_type = Light; }
 
 Emissive::~Emissive(){}
 
@@ -519,7 +503,7 @@ Color Emissive::shadePath(Hit &hit){
 
 	for (unsigned int i = 0; i < hit.scene->m_lights.size(); i++) {
 		AreaLight* light = static_cast<AreaLight*>(hit.scene->m_lights[i].get());
-		if (light->m_primitive == hit.scene->m_primitive){
+		if (light->m_primitive.get() == hit.primitive){
 
 			return hit.color *(1.0 / light->pdf(hit));
 		}
@@ -529,7 +513,7 @@ Color Emissive::shadePath(Hit &hit){
 Color Emissive::shadePath(Hit &hit, Color &pathWeight){
 	for (unsigned int i = 0; i < hit.scene->m_lights.size(); i++) {
 		AreaLight* light = static_cast<AreaLight*>(hit.scene->m_lights[i].get());
-		if (light->m_primitive == hit.scene->m_primitive){
+		if (light->m_primitive.get() == hit.primitive){
 
 			return hit.color *(1.0 / light->pdf(hit));
 		}
@@ -23,6 +23,12 @@ class Material{
 	
 
 public:
+
+	// how the path tracer treats the surface, it branches on the type instead of casting the material
+	enum Type { Diffuse, Specular, Light };
+	// attributes of a hit the shading reads besides the point, normal and colour, the scene computes no others
+	enum Attribute { TangentFrame = 1, TextureCoordinates = 2 };
+
 	Material();
 	Material(const Color &ambient, const Color &diffuse, const Color &specular, const int shinies);
 	Material(const std::shared_ptr<Material> material);
@@ -42,6 +48,10 @@ public:
 
 	void setShinies(const int shinies);
 
+	Type getType() const { return m_type; }
+	// or of the attributes, only a normal map needs any
+	int getAttributes() const;
+
 	virtual Color shade(Hit &hit) = 0;
 	virtual Color shadeAreaLight(Hit &hit);
 	virtual Color shadePath(Hit &hit);
@@ -54,6 +64,7 @@ public:
 	Vector3f Bump(Hit &hit);
 
 protected:
+	Type m_type;
 	Color m_ambient;
 	Color m_diffuse;
 	Color m_specular;
@@ -65,8 +76,6 @@ protected:
 	Matrix4f getTBN(const Hit &hit);
 
 	float randFloat();
-	std::default_random_engine m_generator;
-	std::uniform_real_distribution<float> m_distribution;
 
 private:
 	std::string colorMapPath;
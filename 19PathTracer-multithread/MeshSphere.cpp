@@ -1,5 +1,4 @@
-#include "MeshSPhere.h"
-#include "KDTree.h"
+#include "MeshSphere.h"
 
 MeshSphere::MeshSphere(float radius, bool generateTexels, bool generateNormals, bool generateTangents, bool  generateNormalDerivatives) : Primitive(){
 
@@ -17,6 +16,7 @@ MeshSphere::MeshSphere(float radius, bool generateTexels, bool generateNormals,
 
 	m_defaultColor = true;
 	m_isInitialized = false;
+	m_acceleratorType = KDTreeAccelerator;
 	m_uResolution = 49;
 	m_vResolution = 49;
 
@@ -321,8 +321,8 @@ void MeshSphere::buildMesh(){
 	normalsDv.clear();
 
 	calcBounds();
-	m_KDTree = std::unique_ptr<KDTree>(new KDTree());
-	m_KDTree->buildTree(m_triangles, box);
+	m_accelerator = Accelerator::create(m_acceleratorType);
+	m_accelerator->build(m_triangles, box);
 
 	m_isInitialized = true;
 }
@@ -637,10 +637,43 @@ void MeshSphere::calcBounds(){
 	bounds = true;
 }
 
+bool MeshSphere::getBoundingBox(BBox& boundingBox){
+
+	//the box of the mesh is kept as (min, extent)
+	if (!bounds) return false;
+
+	boundingBox = BBox(box.m_pos, box.m_pos + box.m_size);
+	return true;
+}
+
 void MeshSphere::hit(Hit &hit){
 	// find the nearest intersection
-	m_KDTree->intersectRec(hit);
+	m_accelerator->intersect(hit);
+
+}
+
+void MeshSphere::hit(RayPacket& packet, Hit* hits){
 
+	m_accelerator->intersect(packet, hits);
+}
+
+bool MeshSphere::shadowHit(Ray &ray, float &hitParameter){
+
+	Hit	hitShadow;
+	hitShadow.transformedRay = ray;
+	hit(hitShadow);
+
+	hitParameter = hitShadow.t;
+	return hitShadow.hitObject;
+}
+
+bool MeshSphere::occluded(const Ray& ray, float distance){
+
+	return m_accelerator->occluded(ray, distance);
+}
+
+void MeshSphere::setAccelerator(AcceleratorType type){
+	m_acceleratorType = type;
 }
 
 void MeshSphere::setColor(Color color){
@@ -649,19 +682,24 @@ void MeshSphere::setColor(Color color){
 }
 
 
+// a position alone doesn't tell which triangle was hit, the scene uses the hit based overloads
 Color MeshSphere::getColor(const Vector3f& pos){
 
+	return m_color;
+}
+
+Color MeshSphere::getColor(const Hit& hit){
+
 	// use one texture for the whole model
 	if (m_texture){
 
-		m_KDTree->m_primitive->m_texture = m_texture;
-		return m_KDTree->m_primitive->getColor(pos);
+		return m_triangles[hit.triangle]->getColor(hit, m_texture);
 
 		// use one texture per mesh
 		// maybe the texture isn't at the path of the mlt file, then a nulltexure will created
-	}else if (m_KDTree->m_primitive->m_texture && m_useTexture){
+	}else if (m_triangles[hit.triangle]->m_texture && m_useTexture){
 
-		return m_KDTree->m_primitive->getColor(pos);
+		return m_triangles[hit.triangle]->getColor(hit);
 
 		// use one color for the whole model
 	}else if (!m_defaultColor) {
@@ -672,21 +710,31 @@ Color MeshSphere::getColor(const Vector3f& pos){
 		// the value is different for every mesh
 	}else{
 
-		return m_KDTree->m_primitive->m_color;
+		return m_triangles[hit.triangle]->m_color;
 	}
 
 }
 
 std::pair<float, float> MeshSphere::getUV(const Vector3f& pos){
 
-	return m_KDTree->m_primitive->getUV(pos);
+	return std::make_pair(0.0f, 0.0f);
+}
+
+std::pair<float, float> MeshSphere::getUV(const Hit& hit){
+
+	return m_triangles[hit.triangle]->getUV(hit);
 }
 
 Vector3f MeshSphere::getNormal(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshSphere::getNormal(const Hit& hit){
+
 	if (m_hasNormals){
 
-		return (m_KDTree->m_primitive->getNormal(pos)).normalize();
+		return (m_triangles[hit.triangle]->getNormal(hit)).normalize();
 
 	}else{
 
@@ -696,9 +744,14 @@ Vector3f MeshSphere::getNormal(const Vector3f& pos){
 
 Vector3f MeshSphere::getTangent(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshSphere::getTangent(const Hit& hit){
+
 	if (m_hasTangents){
 
-		return (m_KDTree->m_primitive->getTangent(pos)).normalize();
+		return (m_triangles[hit.triangle]->getTangent(hit)).normalize();
 
 	}else{
 
@@ -708,9 +761,14 @@ Vector3f MeshSphere::getTangent(const Vector3f& pos){
 
 Vector3f MeshSphere::getBiTangent(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshSphere::getBiTangent(const Hit& hit){
+
 	if (m_hasTangents){
 
-		return (m_KDTree->m_primitive->getBiTangent(pos)).normalize();
+		return (m_triangles[hit.triangle]->getBiTangent(hit)).normalize();
 
 	}else{
 
@@ -720,9 +778,14 @@ Vector3f MeshSphere::getBiTangent(const Vector3f& pos){
 
 Vector3f MeshSphere::getNormalDu(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshSphere::getNormalDu(const Hit& hit){
+
 	if (m_hasNormalDerivatives){
 
-		return (m_KDTree->m_primitive->getNormalDu(pos)).normalize();
+		return (m_triangles[hit.triangle]->getNormalDu(hit)).normalize();
 
 	}else{
 
@@ -732,9 +795,14 @@ Vector3f MeshSphere::getNormalDu(const Vector3f& pos){
 
 Vector3f MeshSphere::getNormalDv(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshSphere::getNormalDv(const Hit& hit){
+
 	if (m_hasNormalDerivatives){
 
-		return (m_KDTree->m_primitive->getNormalDv(pos)).normalize();
+		return (m_triangles[hit.triangle]->getNormalDv(hit)).normalize();
 
 	}else{
 
@@ -2,8 +2,8 @@
 #define _MESHSPHERE_H
 
 #include "Primitive.h"
+#include "Accelerator.h"
 
-class KDTree;
 
 class MeshSphere : public Primitive{
 
@@ -14,6 +14,10 @@ public:
 	~MeshSphere();
 
 	void hit(Hit &hit);
+	void hit(RayPacket& packet, Hit* hits);
+	bool shadowHit(Ray &ray, float &hitParameter);
+	bool occluded(const Ray& ray, float distance);
+	bool getBoundingBox(BBox& boundingBox);
 	Color getColor(const Vector3f& Pos);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
@@ -21,10 +25,19 @@ public:
 	Vector3f getNormalDu(const Vector3f& pos);
 	Vector3f getNormalDv(const Vector3f& pos);
 	std::pair <float, float> getUV(const Vector3f& a_pos);
+	Color getColor(const Hit& hit);
+	Vector3f getNormal(const Hit& hit);
+	Vector3f getTangent(const Hit& hit);
+	Vector3f getBiTangent(const Hit& hit);
+	Vector3f getNormalDu(const Hit& hit);
+	Vector3f getNormalDv(const Hit& hit);
+	std::pair <float, float> getUV(const Hit& hit);
 
 	void setColor(Color color);
 
 	void setPrecision(int uResolution, int vResolution);
+	// picks the structure built by buildMesh, the kd tree by default
+	void setAccelerator(AcceleratorType type);
 	void buildMesh();
 
 	void generateNormals();
@@ -33,7 +46,8 @@ public:
 
 private:
 
-	std::shared_ptr<KDTree> m_KDTree;
+	std::shared_ptr<Accelerator> m_accelerator;
+	AcceleratorType m_acceleratorType;
 	std::vector<std::shared_ptr<Triangle>>	m_triangles;
 	bool m_defaultColor;
 	void calcBounds();
@@ -1,5 +1,4 @@
 #include "MeshSpiral.h"
-#include "KDTree.h"
 
 MeshSpiral::MeshSpiral(float radius, float tubeRadius, int numRotations, float length, bool repeatTexture, bool generateTexels, bool generateNormals, bool generateTangents) : Primitive(){
 
@@ -21,6 +20,7 @@ MeshSpiral::MeshSpiral(float radius, float tubeRadius, int numRotations, float l
 
 	m_defaultColor = true;
 	m_isInitialized = false;
+	m_acceleratorType = KDTreeAccelerator;
 	m_mainSegments = 49;
 	m_tubeSegments = 49;
 
@@ -306,8 +306,8 @@ void MeshSpiral::buildMesh(){
 	
 
 	calcBounds();
-	m_KDTree = std::unique_ptr<KDTree>(new KDTree());
-	m_KDTree->buildTree(m_triangles, box);
+	m_accelerator = Accelerator::create(m_acceleratorType);
+	m_accelerator->build(m_triangles, box);
 
 	m_isInitialized = true;
 }
@@ -381,15 +381,48 @@ void MeshSpiral::calcBounds(){
 	bounds = true;
 }
 
+bool MeshSpiral::getBoundingBox(BBox& boundingBox){
+
+	//the box of the mesh is kept as (min, extent)
+	if (!bounds) return false;
+
+	boundingBox = BBox(box.m_pos, box.m_pos + box.m_size);
+	return true;
+}
+
 void MeshSpiral::hit(Hit &hit){
 
 	
 
 	// find the nearest intersection
-	m_KDTree->intersectRec(hit);
+	m_accelerator->intersect(hit);
 	
 }
 
+void MeshSpiral::hit(RayPacket& packet, Hit* hits){
+
+	m_accelerator->intersect(packet, hits);
+}
+
+bool MeshSpiral::shadowHit(Ray &ray, float &hitParameter){
+
+	Hit	hitShadow;
+	hitShadow.transformedRay = ray;
+	hit(hitShadow);
+
+	hitParameter = hitShadow.t;
+	return hitShadow.hitObject;
+}
+
+bool MeshSpiral::occluded(const Ray& ray, float distance){
+
+	return m_accelerator->occluded(ray, distance);
+}
+
+void MeshSpiral::setAccelerator(AcceleratorType type){
+	m_acceleratorType = type;
+}
+
 void MeshSpiral::setColor(Color color){
 	m_color = color;
 	m_defaultColor = false;
@@ -400,21 +433,26 @@ void MeshSpiral::repeatTexture(bool repeatTexture){
 	m_repeatTexture = repeatTexture;
 }
 
+// a position alone doesn't tell which triangle was hit, the scene uses the hit based overloads
 Color MeshSpiral::getColor(const Vector3f& a_pos){
 
+	return m_color;
+}
+
+Color MeshSpiral::getColor(const Hit& hit){
+
 	
 
 	// use one texture for the whole model
 	if (m_texture){
 
-		m_KDTree->m_primitive->m_texture = m_texture;
-		return m_KDTree->m_primitive->getColor(a_pos);
+		return m_triangles[hit.triangle]->getColor(hit, m_texture);
 
 		// use one texture per mesh
 		// maybe the texture isn't at the path of the mlt file, then a nulltexure will created
-	}else if (m_KDTree->m_primitive->m_texture && m_useTexture){
+	}else if (m_triangles[hit.triangle]->m_texture && m_useTexture){
 
-		return m_KDTree->m_primitive->getColor(a_pos);
+		return m_triangles[hit.triangle]->getColor(hit);
 
 		// use one color for the whole model
 	}else if (!m_defaultColor) {
@@ -425,21 +463,31 @@ Color MeshSpiral::getColor(const Vector3f& a_pos){
 		// the value is different for every mesh
 	}else{
 
-		return m_KDTree->m_primitive->m_color;
+		return m_triangles[hit.triangle]->m_color;
 	}
 
 }
 
 std::pair<float, float> MeshSpiral::getUV(const Vector3f& a_pos){
 
-	return m_KDTree->m_primitive->getUV(a_pos);
+	return std::make_pair(0.0f, 0.0f);
+}
+
+std::pair<float, float> MeshSpiral::getUV(const Hit& hit){
+
+	return m_triangles[hit.triangle]->getUV(hit);
 }
 
 Vector3f MeshSpiral::getNormal(const Vector3f& a_pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshSpiral::getNormal(const Hit& hit){
+
 	if (m_hasNormals){
 
-		return (m_KDTree->m_primitive->getNormal(a_pos)).normalize();
+		return (m_triangles[hit.triangle]->getNormal(hit)).normalize();
 
 	}else{
 
@@ -449,9 +497,14 @@ Vector3f MeshSpiral::getNormal(const Vector3f& a_pos){
 
 Vector3f MeshSpiral::getTangent(const Vector3f& a_pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshSpiral::getTangent(const Hit& hit){
+
 	if (m_hasTangents){
 
-		return (m_KDTree->m_primitive->getTangent(a_pos)).normalize();
+		return (m_triangles[hit.triangle]->getTangent(hit)).normalize();
 
 	}else{
 
@@ -461,9 +514,14 @@ Vector3f MeshSpiral::getTangent(const Vector3f& a_pos){
 
 Vector3f MeshSpiral::getBiTangent(const Vector3f& a_pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshSpiral::getBiTangent(const Hit& hit){
+
 	if (m_hasTangents){
 
-		return (m_KDTree->m_primitive->getBiTangent(a_pos)).normalize();
+		return (m_triangles[hit.triangle]->getBiTangent(hit)).normalize();
 	}else{
 
 		return Vector3f(0.0, 0.0, 0.0);
@@ -473,9 +531,14 @@ Vector3f MeshSpiral::getBiTangent(const Vector3f& a_pos){
 
 Vector3f MeshSpiral::getNormalDu(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshSpiral::getNormalDu(const Hit& hit){
+
 	if (m_hasNormalDerivatives){
 
-		return (m_KDTree->m_primitive->getNormalDu(pos)).normalize();
+		return (m_triangles[hit.triangle]->getNormalDu(hit)).normalize();
 
 	}else{
 
@@ -485,9 +548,14 @@ Vector3f MeshSpiral::getNormalDu(const Vector3f& pos){
 
 Vector3f MeshSpiral::getNormalDv(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshSpiral::getNormalDv(const Hit& hit){
+
 	if (m_hasNormalDerivatives){
 
-		return (m_KDTree->m_primitive->getNormalDv(pos)).normalize();
+		return (m_triangles[hit.triangle]->getNormalDv(hit)).normalize();
 
 	}else{
 
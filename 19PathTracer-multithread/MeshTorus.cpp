@@ -1,5 +1,4 @@
 #include "MeshTorus.h"
-#include "KDTree.h"
 
 MeshTorus::MeshTorus(float radius, float tubeRadius, bool generateTexels, bool generateNormals, bool generateTangents, bool  generateNormalDerivatives) : Primitive(){
 
@@ -17,6 +16,7 @@ MeshTorus::MeshTorus(float radius, float tubeRadius, bool generateTexels, bool g
 
 	m_defaultColor = true;
 	m_isInitialized = false;
+	m_acceleratorType = KDTreeAccelerator;
 	m_mainSegments = 25;
 	m_tubeSegments = 25;
 
@@ -316,8 +316,8 @@ void MeshTorus::buildMesh(){
 	normalsDv.clear();
 
 	calcBounds();
-	m_KDTree = std::unique_ptr<KDTree>(new KDTree());
-	m_KDTree->buildTree(m_triangles, box);
+	m_accelerator = Accelerator::create(m_acceleratorType);
+	m_accelerator->build(m_triangles, box);
 
 	m_isInitialized = true;
 }
@@ -680,10 +680,43 @@ void MeshTorus::calcBounds(){
 	bounds = true;
 }
 
+bool MeshTorus::getBoundingBox(BBox& boundingBox){
+
+	//the box of the mesh is kept as (min, extent)
+	if (!bounds) return false;
+
+	boundingBox = BBox(box.m_pos, box.m_pos + box.m_size);
+	return true;
+}
+
 void MeshTorus::hit(Hit &hit){
 	// find the nearest intersection
-	m_KDTree->intersectRec(hit);
+	m_accelerator->intersect(hit);
+
+}
+
+void MeshTorus::hit(RayPacket& packet, Hit* hits){
 
+	m_accelerator->intersect(packet, hits);
+}
+
+bool MeshTorus::shadowHit(Ray &ray, float &hitParameter){
+
+	Hit	hitShadow;
+	hitShadow.transformedRay = ray;
+	hit(hitShadow);
+
+	hitParameter = hitShadow.t;
+	return hitShadow.hitObject;
+}
+
+bool MeshTorus::occluded(const Ray& ray, float distance){
+
+	return m_accelerator->occluded(ray, distance);
+}
+
+void MeshTorus::setAccelerator(AcceleratorType type){
+	m_acceleratorType = type;
 }
 
 void MeshTorus::setColor(Color color){
@@ -692,19 +725,24 @@ void MeshTorus::setColor(Color color){
 }
 
 
+// a position alone doesn't tell which triangle was hit, the scene uses the hit based overloads
 Color MeshTorus::getColor(const Vector3f& pos){
 
+	return m_color;
+}
+
+Color MeshTorus::getColor(const Hit& hit){
+
 	// use one texture for the whole model
 	if (m_texture){
 
-		m_KDTree->m_primitive->m_texture = m_texture;
-		return m_KDTree->m_primitive->getColor(pos);
+		return m_triangles[hit.triangle]->getColor(hit, m_texture);
 
 	// use one texture per mesh
 	// maybe the texture isn't at the path of the mlt file, then a nulltexure will created
-	}else if (m_KDTree->m_primitive->m_texture && m_useTexture){
+	}else if (m_triangles[hit.triangle]->m_texture && m_useTexture){
 
-		return m_KDTree->m_primitive->getColor(pos);
+		return m_triangles[hit.triangle]->getColor(hit);
 
 	// use one color for the whole model
 	}else if (!m_defaultColor) {
@@ -715,21 +753,31 @@ Color MeshTorus::getColor(const Vector3f& pos){
 	// the value is different for every mesh
 	}else{
 
-		return m_KDTree->m_primitive->m_color;
+		return m_triangles[hit.triangle]->m_color;
 	}
 
 }
 
 std::pair<float, float> MeshTorus::getUV(const Vector3f& pos){
 
-	return m_KDTree->m_primitive->getUV(pos);
+	return std::make_pair(0.0f, 0.0f);
+}
+
+std::pair<float, float> MeshTorus::getUV(const Hit& hit){
+
+	return m_triangles[hit.triangle]->getUV(hit);
 }
 
 Vector3f MeshTorus::getNormal(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshTorus::getNormal(const Hit& hit){
+
 	if (m_hasNormals){
 
-		return (m_KDTree->m_primitive->getNormal(pos)).normalize();
+		return (m_triangles[hit.triangle]->getNormal(hit)).normalize();
 
 	}else{
 
@@ -739,9 +787,14 @@ Vector3f MeshTorus::getNormal(const Vector3f& pos){
 
 Vector3f MeshTorus::getTangent(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshTorus::getTangent(const Hit& hit){
+
 	if (m_hasTangents){
 
-		return (m_KDTree->m_primitive->getTangent(pos)).normalize();
+		return (m_triangles[hit.triangle]->getTangent(hit)).normalize();
 
 	}else{
 
@@ -751,9 +804,14 @@ Vector3f MeshTorus::getTangent(const Vector3f& pos){
 
 Vector3f MeshTorus::getBiTangent(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshTorus::getBiTangent(const Hit& hit){
+
 	if (m_hasTangents){
 
-		return (m_KDTree->m_primitive->getBiTangent(pos)).normalize();
+		return (m_triangles[hit.triangle]->getBiTangent(hit)).normalize();
 
 	}else{
 
@@ -763,9 +821,14 @@ Vector3f MeshTorus::getBiTangent(const Vector3f& pos){
 
 Vector3f MeshTorus::getNormalDu(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshTorus::getNormalDu(const Hit& hit){
+
 	if (m_hasNormalDerivatives){
 
-		return (m_KDTree->m_primitive->getNormalDu(pos)).normalize();
+		return (m_triangles[hit.triangle]->getNormalDu(hit)).normalize();
 
 	}else{
 
@@ -775,9 +838,14 @@ Vector3f MeshTorus::getNormalDu(const Vector3f& pos){
 
 Vector3f MeshTorus::getNormalDv(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f MeshTorus::getNormalDv(const Hit& hit){
+
 	if (m_hasNormalDerivatives){
 
-		return (m_KDTree->m_primitive->getNormalDv(pos)).normalize();
+		return (m_triangles[hit.triangle]->getNormalDv(hit)).normalize();
 
 	}else{
 
@@ -1,5 +1,4 @@
 #include "Model.h"
-#include "KDTree.h"
 
 Model::Model() : Primitive() {
 
@@ -9,6 +8,8 @@ Model::Model() : Primitive() {
 	m_hasTangents = false;
 	m_hasNormalDerivatives = false;
 	m_defaultColor = true;
+	m_useCache = false;
+	m_acceleratorType = KDTreeAccelerator;
 	
 	m_texture = NULL;
 	m_material = NULL;
@@ -30,19 +31,30 @@ void Model::setColor(Color color){
 
 void Model::hit(Hit &hit){
 	// find the nearest intersection
-	m_KDTree->intersectRec(hit);
+	m_accelerator->intersect(hit);
 	
 }
 
-bool Model::shadowHit(Ray &ray){
+void Model::hit(RayPacket& packet, Hit* hits){
+
+	m_accelerator->intersect(packet, hits);
+}
+
+bool Model::shadowHit(Ray &ray, float &hitParameter){
 
 	Hit	hitShadow;
 	hitShadow.transformedRay = ray;
 	hit(hitShadow);
 
+	hitParameter = hitShadow.t;
 	return hitShadow.hitObject;
 }
 
+bool Model::occluded(const Ray& ray, float distance){
+
+	return m_accelerator->occluded(ray, distance);
+}
+
 void Model::calcBounds(){
 
 	Vector3f p1 = Vector3f(xmin, ymin, zmin);
@@ -52,23 +64,47 @@ void Model::calcBounds(){
 	Model::bounds = true;
 }
 
+bool Model::getBoundingBox(BBox& boundingBox){
+
+	//the box of the mesh is kept as (min, extent)
+	if (!bounds) return false;
+
+	boundingBox = BBox(box.m_pos, box.m_pos + box.m_size);
+	return true;
+}
+
 std::pair <float, float> Model::getUV(const Vector3f& pos){
-	return m_KDTree->m_primitive->getUV(pos);
+
+	return std::make_pair(0.0f, 0.0f);
 }
 
+std::pair <float, float> Model::getUV(const Hit& hit){
+	return m_triangles[hit.triangle]->getUV(hit);
+}
+
+// a position alone doesn't tell which triangle was hit, the scene uses the hit based overloads
 Color Model::getColor(const Vector3f& pos){
+
+	return m_color;
+}
+
+Color Model::getColor(const Hit& hit){
+
+	return getColor(hit, m_useTexture);
+}
+
+Color Model::getColor(const Hit& hit, bool useTexture){
 	
 	// use one texture for the whole model
 	if (m_texture){
 		
-		m_KDTree->m_primitive->m_texture = m_texture;
-		return m_KDTree->m_primitive->getColor(pos);
+		return m_triangles[hit.triangle]->getColor(hit, m_texture);
 
 	// use one texture per mesh
 	// maybe the texture isn't at the path of the mlt file, then a nulltexure will created
-	}else if (m_KDTree->m_primitive->m_texture && m_useTexture){
+	}else if (m_triangles[hit.triangle]->m_texture && useTexture){
 
-		return m_KDTree->m_primitive->getColor(pos);
+		return m_triangles[hit.triangle]->getColor(hit);
 
     // use one color for the whole model
 	}else if (!m_defaultColor) {
@@ -79,16 +115,21 @@ Color Model::getColor(const Vector3f& pos){
 	// the value is different for every mesh
 	}else{
 		
-		return m_KDTree->m_primitive->m_color;
+		return m_triangles[hit.triangle]->m_color;
 	}
 
 }
 
 Vector3f  Model::getNormal(const Vector3f& pos){
+
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f  Model::getNormal(const Hit& hit){
 	
 	if (m_hasNormals){
 
-		return (m_KDTree->m_primitive->getNormal(pos)).normalize();
+		return (m_triangles[hit.triangle]->getNormal(hit)).normalize();
 		
 	}else{
 
@@ -99,9 +140,14 @@ Vector3f  Model::getNormal(const Vector3f& pos){
 
 Vector3f Model::getTangent(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f Model::getTangent(const Hit& hit){
+
 	if (m_hasTangents){
 
-			return (m_KDTree->m_primitive->getTangent(pos)).normalize();
+			return (m_triangles[hit.triangle]->getTangent(hit)).normalize();
 
 	}else{
 
@@ -110,10 +156,15 @@ Vector3f Model::getTangent(const Vector3f& pos){
 }
 
 Vector3f Model::getBiTangent(const Vector3f& pos){
+
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f Model::getBiTangent(const Hit& hit){
 	
 	if (m_hasTangents){
 
-			return (m_KDTree->m_primitive->getBiTangent(pos)).normalize();
+			return (m_triangles[hit.triangle]->getBiTangent(hit)).normalize();
 	}else{
 
 		return Vector3f(0.0, 0.0, 0.0);
@@ -122,9 +173,14 @@ Vector3f Model::getBiTangent(const Vector3f& pos){
 
 Vector3f  Model::getNormalDu(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f  Model::getNormalDu(const Hit& hit){
+
 	if (m_hasNormalDerivatives){
 
-		return (m_KDTree->m_primitive->getNormalDu(pos)).normalize();
+		return (m_triangles[hit.triangle]->getNormalDu(hit)).normalize();
 	}else{
 
 		return Vector3f(0.0, 0.0, 0.0);
@@ -132,9 +188,14 @@ Vector3f  Model::getNormalDu(const Vector3f& pos){
 }
 Vector3f  Model::getNormalDv(const Vector3f& pos){
 
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f  Model::getNormalDv(const Hit& hit){
+
 	if (m_hasNormalDerivatives){
 
-		return (m_KDTree->m_primitive->getNormalDv(pos)).normalize();
+		return (m_triangles[hit.triangle]->getNormalDv(hit)).normalize();
 
 	}else{
 
@@ -154,13 +215,18 @@ std::shared_ptr<Material>  Model::getMaterialMesh(){
 
 std::shared_ptr<Material> Model::getMaterial(){
 
+	return m_material;
+}
+
+std::shared_ptr<Material> Model::getMaterial(const Hit& hit){
+
 	if (m_material){
 
 		return m_material;
 
 	}else{
 		
-		return m_KDTree->m_primitive->m_material;
+		return m_triangles[hit.triangle]->m_material;
 	}
 }
 
@@ -174,7 +240,7 @@ bool Model::loadObject(const char* filename, bool cull, bool smooth){
 	return loadObject(filename, Vector3f(0.0, 0.0, 1.0), 0.0, Vector3f(0.0, 0.0, 0.0), 1.0, cull, smooth);
 }
 
-bool Model::loadObject(const char* a_filename, Vector3f &rotate, float degree, Vector3f &translate, float scale, bool cull, bool smooth){
+bool Model::loadObject(const char* a_filename, const Vector3f &rotate, float degree, const Vector3f &translate, float scale, bool cull, bool smooth){
 
 	std::string filename(a_filename);
 
@@ -185,8 +251,85 @@ bool Model::loadObject(const char* a_filename, Vector3f &rotate, float degree, V
 		m_modelDirectory = filename.substr(0, index);
 	}
 
+	//the parsed faces sorted by mesh, and the names and sizes of the meshes, an empty name for a mesh without material
+	std::vector<std::array<int, 10>> parsedFaces;
+	const std::array<int, 10>* face = NULL;
+	size_t numberOfFaces = 0;
+	std::vector<std::string> meshNames;
+	std::vector<int> meshSizes;
+
+	//the file is cached as it is, the acceleration structure also depends on the transformation and the triangle flags
+	ModelCache::Key key;
+	m_cachePath.clear();
+	if (m_useCache && ModelCache::GetKey(filename, key)){
+
+		m_cachePath = filename;
+		m_cacheKey = key;
+		for (int i = 0; i < 3; i++){
+			m_cacheKey.rotate[i] = rotate[i];
+			m_cacheKey.translate[i] = translate[i];
+		}
+		m_cacheKey.degree = degree;
+		m_cacheKey.scale = scale;
+		m_cacheKey.cull = cull;
+		m_cacheKey.smooth = smooth;
+	}
+
+	//the faces of the cache are used where the file is mapped, only the vertices are copied into the model
+	ModelCache::Reader cache;
+	if (!m_cachePath.empty() && cache.open(ModelCache::GetPath(m_cachePath, ""), key) && readCache(cache, face, numberOfFaces, meshNames, meshSizes)){
+
+		std::cout << "Read " << filename << " from the cache" << std::endl;
+
+	}else{
+
+		if (!parseObject(a_filename, parsedFaces, meshNames, meshSizes)) return false;
+
+		face = parsedFaces.empty() ? NULL : &parsedFaces[0];
+		numberOfFaces = parsedFaces.size();
+
+		if (!m_cachePath.empty() && !writeCache(key, parsedFaces, meshNames, meshSizes))
+			std::cout << "Could not write the cache of " << filename << std::endl;
+	}
+
+	Matrix4f rotMtx;
+	rotMtx.rotate(rotate, degree);
+
+	for (size_t i = 0; i < m_positions.size(); i++){
+
+		Vector3f position = rotMtx * m_positions[i];
+		m_positions[i] = Vector3f((position[0] * scale) + translate[0], (position[1] * scale) + translate[1], (position[2] * scale) + translate[2]);
+	}
+
+	for (size_t i = 0; i < m_normals.size(); i++){
+
+		Vector3f normal = rotMtx * m_normals[i];
+		m_normals[i] = Vector3f(normal[0], normal[1], normal[2]);
+	}
+
+	m_numberOfMeshes = meshSizes.size();
+	m_numberOfVertices = m_positions.size();
+	m_numberOfTriangles = numberOfFaces;
+
+	for (int j = 0; j < m_numberOfMeshes; j++){
+
+		if (meshNames[j].empty()){
+
+			meshes.push_back(std::shared_ptr<Mesh>(new Mesh(meshSizes[j], this)));
+
+		}else{
+
+			meshes.push_back(std::shared_ptr<Mesh>(new Mesh("newmtl " + meshNames[j], meshSizes[j], this)));
+		}
+	}
+
+	createMeshes(face, cull, smooth);
+
+	return true;
+}
+
+bool Model::parseObject(const char* a_filename, std::vector<std::array<int, 10>>& face, std::vector<std::string>& meshNames, std::vector<int>& meshSizes){
 
-	std::vector<std::array<int, 10>> face;
 	std::map<std::string, int> name;
 	std::vector <float> tmpVertexBuffer;
 
@@ -201,9 +344,6 @@ bool Model::loadObject(const char* a_filename, Vector3f &rotate, float degree, V
 		return false;
 	}
 
-	Matrix4f rotMtx;
-	rotMtx.rotate(rotate, degree);
-
 	int tmp = 0;
 
 	while (fscanf(pFile, "%s", buffer) != EOF){
@@ -232,10 +372,7 @@ bool Model::loadObject(const char* a_filename, Vector3f &rotate, float degree, V
 						  fgets(buffer, sizeof(buffer), pFile);
 						  sscanf(buffer, "%f %f %f", &tmpx, &tmpy, &tmpz);
 
-						  Vector3f position = Vector3f(tmpx, tmpy, tmpz);
-						  position = rotMtx * position;
-
-						  m_positions.push_back(Vector3f((position[0] * scale) + translate[0], (position[1] * scale) + translate[1], (position[2] * scale) + translate[2]));
+						  m_positions.push_back(Vector3f(tmpx, tmpy, tmpz));
 
 						  break;
 
@@ -257,11 +394,7 @@ bool Model::loadObject(const char* a_filename, Vector3f &rotate, float degree, V
 				fgets(buffer, sizeof(buffer), pFile);
 				sscanf(buffer, "%f %f %f", &tmpx, &tmpy, &tmpz);
 
-				Vector3f normal = Vector3f(tmpx, tmpy, tmpz);
-				Matrix4f rotMtx;
-				rotMtx.rotate(rotate, degree);
-				normal = rotMtx * normal;
-				m_normals.push_back(Vector3f(normal[0], normal[1], normal[2]));
+				m_normals.push_back(Vector3f(tmpx, tmpy, tmpz));
 				break;
 
 			}default:{
@@ -353,10 +486,6 @@ bool Model::loadObject(const char* a_filename, Vector3f &rotate, float degree, V
 
 
 
-	m_numberOfMeshes = dup.size();
-	m_numberOfVertices = m_positions.size();
-	m_numberOfTriangles = face.size();
-
 	std::map<int, int>::const_iterator iterDup = dup.begin();
 
 	for (iterDup; iterDup != dup.end(); iterDup++){
@@ -364,7 +493,8 @@ bool Model::loadObject(const char* a_filename, Vector3f &rotate, float degree, V
 
 		if (name.empty()){
 
-			meshes.push_back(std::shared_ptr<Mesh>(new Mesh(iterDup->second, this)));
+			meshNames.push_back("");
+			meshSizes.push_back(iterDup->second);
 
 		}
 		else{
@@ -374,7 +504,8 @@ bool Model::loadObject(const char* a_filename, Vector3f &rotate, float degree, V
 
 				if (iterDup->first == iterName->second){
 
-					meshes.push_back(std::shared_ptr<Mesh>(new Mesh("newmtl " + iterName->first, iterDup->second, this)));
+					meshNames.push_back(iterName->first);
+					meshSizes.push_back(iterDup->second);
 				}
 			}
 
@@ -384,6 +515,71 @@ bool Model::loadObject(const char* a_filename, Vector3f &rotate, float degree, V
 	dup.clear();
 	name.clear();
 
+	return true;
+}
+
+bool Model::readCache(ModelCache::Reader& cache, const std::array<int, 10>*& face, size_t& numberOfFaces, std::vector<std::string>& meshNames, std::vector<int>& meshSizes){
+
+	int hasMaterials = 0;
+	size_t numberOfMeshes = 0;
+	bool read = cache.read(m_positions) && cache.read(m_normals) && cache.read(m_texels) && cache.read(m_mltPath) && cache.readValue(hasMaterials);
+
+	face = read ? cache.read<std::array<int, 10>>(numberOfFaces) : NULL;
+	read = face && cache.read(meshSizes) && cache.readValue(numberOfMeshes) && numberOfMeshes == meshSizes.size();
+
+	meshNames.resize(read ? numberOfMeshes : 0);
+	for (size_t j = 0; j < meshNames.size() && read; j++)
+		read = cache.read(meshNames[j]);
+
+	//a damaged file must not index past the vertices
+	size_t faces = 0;
+	for (size_t j = 0; j < meshSizes.size() && read; j++)
+		faces += meshSizes[j];
+	read = read && faces <= numberOfFaces;
+
+	for (size_t i = 0; i < numberOfFaces && read; i++){
+		for (int k = 0; k < 3; k++){
+			read = read && face[i][k] >= 1 && face[i][k] <= (int)m_positions.size();
+			read = read && (m_texels.empty() || (face[i][3 + k] >= 1 && face[i][3 + k] <= (int)m_texels.size()));
+			read = read && (m_normals.empty() || (face[i][6 + k] >= 1 && face[i][6 + k] <= (int)m_normals.size()));
+		}
+	}
+
+	if (!read){
+
+		m_positions.clear();
+		m_normals.clear();
+		m_texels.clear();
+		m_mltPath.clear();
+		meshNames.clear();
+		meshSizes.clear();
+		return false;
+	}
+
+	m_hasMaterials = hasMaterials != 0;
+	return true;
+}
+
+bool Model::writeCache(const ModelCache::Key& key, const std::vector<std::array<int, 10>>& face, const std::vector<std::string>& meshNames, const std::vector<int>& meshSizes){
+
+	ModelCache::Writer cache(key);
+
+	cache.write(m_positions);
+	cache.write(m_normals);
+	cache.write(m_texels);
+	cache.write(m_mltPath);
+	cache.writeValue((int)m_hasMaterials);
+	cache.write(face);
+	cache.write(meshSizes);
+	cache.writeValue(meshNames.size());
+	for (size_t j = 0; j < meshNames.size(); j++)
+		cache.write(meshNames[j]);
+
+	return cache.save(ModelCache::GetPath(m_cachePath, ""));
+}
+
+void Model::createMeshes(const std::array<int, 10>* face, bool cull, bool smooth){
+
 	for (int j = 0; j < m_numberOfMeshes; j++){
 
 		if (m_material){
@@ -511,17 +707,22 @@ bool Model::loadObject(const char* a_filename, Vector3f &rotate, float degree, V
 		std::cout << "Number of faces: " << m_numberOfTriangles << std::endl;
 		std::cout << "Number of Meshes: " << m_numberOfMeshes << std::endl;
 		calcBounds();
+}
 
 
-	return true;
-}
 
 
+void Model::setAccelerator(AcceleratorType type){
+	m_acceleratorType = type;
+}
 
+void Model::setCache(bool useCache){
+	m_useCache = useCache;
+}
 
-void Model::buildKDTree(){
+void Model::buildAccelerator(){
 
-	std::cout << "Build KDTree!" << std::endl;
+	std::cout << "Build acceleration structure!" << std::endl;
 	
 
 	for (int j = 0; j < meshes.size(); j++){
@@ -538,10 +739,27 @@ void Model::buildKDTree(){
 		std::cout << m_triangles[i]->m_texture << std::endl;
 	}*/
 
-	m_KDTree = std::unique_ptr<KDTree>(new KDTree());
-	m_KDTree->buildTree(m_triangles, box);
+	m_accelerator = Accelerator::create(m_acceleratorType);
+
+	//a structure cached for the same load is read instead of built
+	ModelCache::Key key = m_cacheKey;
+	key.content = 1 + m_acceleratorType;
+	std::string path = ModelCache::GetPath(m_cachePath, m_acceleratorType == BVHAccelerator ? "bvh" : "kdtree");
+
+	ModelCache::Reader cache;
+	if (!m_cachePath.empty() && cache.open(path, key) && m_accelerator->read(cache, m_triangles)){
+
+		std::cout << "Finished acceleration structure!" << std::endl;
+		return;
+	}
+
+	m_accelerator->build(m_triangles, box);
+
+	ModelCache::Writer writer(key);
+	if (!m_cachePath.empty() && m_accelerator->write(writer) && !writer.save(path))
+		std::cout << "Could not write " << path << std::endl;
 
-	std::cout << "Finished KDTree!" << std::endl;
+	std::cout << "Finished acceleration structure!" << std::endl;
 
 }
 
@@ -8,11 +8,11 @@
 #include <memory>
 
 #include "Primitive.h"
+#include "Accelerator.h"
 #include "Vector.h"
 
 
 class Mesh;
-class KDTree;
 
 class Model :public Primitive {
 
@@ -23,7 +23,10 @@ public:
 	~Model();
 
 	void hit(Hit &hit);
-	bool shadowHit(Ray &ray);
+	void hit(RayPacket& packet, Hit* hits);
+	bool shadowHit(Ray &ray, float &hitParameter);
+	bool occluded(const Ray& ray, float distance);
+	bool getBoundingBox(BBox& boundingBox);
 	Color getColor(const Vector3f& Pos);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
@@ -32,22 +35,36 @@ public:
 	Vector3f getNormalDv(const Vector3f& pos);
 	std::pair <float, float> getUV(const Vector3f& a_pos);
 	std::shared_ptr<Material>  getMaterial();
+	std::shared_ptr<Material>  getMaterial(const Hit& hit);
 	std::shared_ptr<Material>  getMaterialMesh();
+	Color getColor(const Hit& hit);
+	Color getColor(const Hit& hit, bool useTexture);
+	Vector3f getNormal(const Hit& hit);
+	Vector3f getTangent(const Hit& hit);
+	Vector3f getBiTangent(const Hit& hit);
+	Vector3f getNormalDu(const Hit& hit);
+	Vector3f getNormalDv(const Hit& hit);
+	std::pair <float, float> getUV(const Hit& hit);
 
 	void setColor(Color color);
 
 	bool loadObject(const char* filename, bool cull, bool smooth);
-	bool loadObject(const char* filename, Vector3f &rotate, float degree, Vector3f &translate, float scale, bool cull, bool smooth);
+	bool loadObject(const char* filename, const Vector3f &rotate, float degree, const Vector3f &translate, float scale, bool cull, bool smooth);
 
 	void generateNormals();
 	void generateTangents();
 	void generateNormalDerivatives();
 
-	void buildKDTree();
+	// picks the structure built by buildAccelerator, the kd tree by default
+	void setAccelerator(AcceleratorType type);
+	void buildAccelerator();
+	// keep the parsed file and the acceleration structure in a binary cache next to the obj file, set before loading
+	void setCache(bool useCache);
 
 private:
 
-	std::shared_ptr<KDTree> m_KDTree;
+	std::shared_ptr<Accelerator> m_accelerator;
+	AcceleratorType m_acceleratorType;
 	std::vector<std::shared_ptr<Triangle>>	m_triangles;
 	std::string m_mltPath;
 	std::string m_modelDirectory;
@@ -74,7 +91,20 @@ private:
 	std::vector<Vector3f> m_normals;
 	std::vector<Vector2f> m_texels;
 
+	bool m_useCache;
+	// the obj file of the cache, empty if the model isn't cached
+	std::string m_cachePath;
+	// the key of the acceleration structure
+	ModelCache::Key m_cacheKey;
+
 	void calcBounds();
+	// the vertices are stored as they are in the file, loadObject transforms them afterwards
+	bool parseObject(const char* filename, std::vector<std::array<int, 10>>& face, std::vector<std::string>& meshNames, std::vector<int>& meshSizes);
+	// the faces stay in the mapped file
+	bool readCache(ModelCache::Reader& cache, const std::array<int, 10>*& face, size_t& numberOfFaces, std::vector<std::string>& meshNames, std::vector<int>& meshSizes);
+	bool writeCache(const ModelCache::Key& key, const std::vector<std::array<int, 10>>& face, const std::vector<std::string>& meshNames, const std::vector<int>& meshSizes);
+	// the triangles of the meshes from the faces sorted by mesh
+	void createMeshes(const std::array<int, 10>* face, bool cull, bool smooth);
 };
 
 
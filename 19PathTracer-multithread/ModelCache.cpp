@@ -0,0 +1,181 @@
+#include <cstring>
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "ModelCache.h"
+
+
+ModelCache::Key::Key(){
+
+	//the padding is compared too
+	memset(this, 0, sizeof(Key));
+	magic = Magic;
+	version = Version;
+}
+
+bool ModelCache::GetKey(const std::string& filename, Key& key){
+
+	struct stat status;
+	if (stat(filename.c_str(), &status) != 0) return false;
+
+	key.fileSize = (int64_t)status.st_size;
+	key.fileTime = (int64_t)status.st_mtime;
+	return true;
+}
+
+std::string ModelCache::GetPath(const std::string& filename, const std::string& content){
+
+	return content.empty() ? filename + ".cache" : filename + "." + content + ".cache";
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+ModelCache::Writer::Writer(const Key& key){
+
+	append(&key, sizeof(Key));
+}
+
+void ModelCache::Writer::append(const void* data, size_t size){
+
+	if (size > 0)
+		m_data.insert(m_data.end(), static_cast<const char*>(data), static_cast<const char*>(data) + size);
+
+	m_data.resize((m_data.size() + Alignment - 1) / Alignment * Alignment, 0);
+}
+
+bool ModelCache::Writer::save(const std::string& path) const{
+
+	std::string temporary = path + ".tmp";
+
+	FILE* file = fopen(temporary.c_str(), "wb");
+	if (!file) return false;
+
+	bool written = fwrite(&m_data[0], 1, m_data.size(), file) == m_data.size();
+	written = fclose(file) == 0 && written;
+
+	//rename doesn't replace an existing file everywhere
+	remove(path.c_str());
+	if (!written || rename(temporary.c_str(), path.c_str()) != 0){
+		remove(temporary.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+ModelCache::Reader::Reader(){
+
+	m_data = NULL;
+	m_size = 0;
+	m_position = 0;
+
+#ifdef _WIN32
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = NULL;
+#endif
+}
+
+ModelCache::Reader::~Reader(){
+
+	close();
+}
+
+bool ModelCache::Reader::open(const std::string& path, const Key& key){
+
+	close();
+
+#ifdef _WIN32
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size) || size.QuadPart < (LONGLONG)sizeof(Key)){
+		close();
+		return false;
+	}
+
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping) m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	m_size = (size_t)size.QuadPart;
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0) return false;
+
+	struct stat status;
+	if (fstat(file, &status) != 0 || status.st_size < (off_t)sizeof(Key)){
+		::close(file);
+		return false;
+	}
+
+	//the mapping stays valid after the file is closed
+	void* data = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+	if (data != MAP_FAILED) m_data = static_cast<const char*>(data);
+	m_size = (size_t)status.st_size;
+#endif
+
+	if (!m_data || memcmp(m_data, &key, sizeof(Key)) != 0){
+		close();
+		return false;
+	}
+
+	m_position = (sizeof(Key) + Alignment - 1) / Alignment * Alignment;
+	return true;
+}
+
+void ModelCache::Reader::close(){
+
+#ifdef _WIN32
+	if (m_data) UnmapViewOfFile(m_data);
+	if (m_mapping) CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+	m_mapping = NULL;
+	m_file = INVALID_HANDLE_VALUE;
+#else
+	if (m_data) munmap(const_cast<char*>(m_data), m_size);
+#endif
+
+	m_data = NULL;
+	m_size = 0;
+	m_position = 0;
+}
+
+const void* ModelCache::Reader::next(size_t elementSize, size_t& count){
+
+	count = 0;
+	if (!m_data || m_size - m_position < sizeof(Header)) return NULL;
+
+	const Header& header = *reinterpret_cast<const Header*>(m_data + m_position);
+	size_t start = m_position + (sizeof(Header) + Alignment - 1) / Alignment * Alignment;
+
+	//a truncated file or another layout of the type
+	if (header.elementSize != elementSize || start > m_size || header.count > (m_size - start) / elementSize){
+		m_position = m_size;
+		return NULL;
+	}
+
+	count = (size_t)header.count;
+	m_position = start + (count * elementSize + Alignment - 1) / Alignment * Alignment;
+	if (m_position > m_size) m_position = m_size;
+
+	return m_data + start;
+}
+
+bool ModelCache::Reader::read(std::string& text){
+
+	size_t count;
+	const char* array = read<char>(count);
+	if (!array) return false;
+
+	text.assign(array, count);
+	return true;
+}
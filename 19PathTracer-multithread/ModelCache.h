@@ -0,0 +1,144 @@
+#ifndef _MODELCACHE_H
+#define _MODELCACHE_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+// binary cache of a model next to its obj file, written by the first load and mapped into memory by the following ones
+// filename.obj.cache holds the parsed vertices and faces, filename.obj.kdtree.cache and filename.obj.bvh.cache the flattened trees
+// every file starts with the key of the load, so a cache of another version, file or transformation is not used
+// the file is a list of arrays of plain data, each one aligned to 16 bytes, so they can be used where they are mapped
+class ModelCache{
+
+public:
+
+	static const uint32_t Magic = 0x434d5450;	// "PTMC"
+	// to be raised with every change of the layout or of the data the loader and the builds produce
+	static const uint32_t Version = 2;
+
+	// what the content of a cache depends on, the obj file is compared by size and time of its last change
+	struct Key{
+
+		Key();
+
+		uint32_t magic;
+		uint32_t version;
+		uint32_t content;
+		uint32_t pad;
+		int64_t fileSize;
+		int64_t fileTime;
+		float rotate[3];
+		float degree;
+		float translate[3];
+		float scale;
+		int32_t cull;
+		int32_t smooth;
+	};
+
+	// the key of a load of the file, false if it doesn't exist
+	static bool GetKey(const std::string& filename, Key& key);
+	// the cache of the content next to the file, "" is the geometry, otherwise the name of the structure
+	static std::string GetPath(const std::string& filename, const std::string& content);
+
+	// collects the arrays in memory, save writes them at once
+	class Writer{
+
+	public:
+
+		Writer(const Key& key);
+
+		template <typename T> void write(const T* data, size_t count);
+		template <typename T> void write(const std::vector<T>& data){ write(data.empty() ? (const T*)NULL : &data[0], data.size()); }
+		void write(const std::string& text){ write(text.c_str(), text.size()); }
+		template <typename T> void writeValue(const T& value){ write(&value, 1); }
+
+		// the file is written under another name and renamed at the end, a reader never sees half of it
+		bool save(const std::string& path) const;
+
+	private:
+
+		void append(const void* data, size_t size);
+
+		std::vector<char> m_data;
+	};
+
+	// maps a cache file into memory, the arrays stay valid until the reader is destroyed
+	class Reader{
+
+	public:
+
+		Reader();
+		~Reader();
+
+		// false if the file doesn't exist or was written for another key
+		bool open(const std::string& path, const Key& key);
+
+		// the next array where it is mapped, NULL once a read failed or if the array holds another type
+		template <typename T> const T* read(size_t& count);
+		template <typename T> bool read(std::vector<T>& data);
+		bool read(std::string& text);
+		template <typename T> bool readValue(T& value);
+
+	private:
+
+		// the next array of elements of the size, every read after a failed one fails too
+		const void* next(size_t elementSize, size_t& count);
+		void close();
+
+		const char* m_data;
+		size_t m_size;
+		size_t m_position;
+
+#ifdef _WIN32
+		void* m_file;
+		void* m_mapping;
+#endif
+	};
+
+private:
+
+	static const size_t Alignment = 16;
+
+	// in front of every array
+	struct Header{
+		uint64_t count;
+		uint32_t elementSize;
+		uint32_t pad;
+	};
+};
+
+
+template <typename T> void ModelCache::Writer::write(const T* data, size_t count){
+
+	Header header = { count, (uint32_t)sizeof(T), 0 };
+	append(&header, sizeof(Header));
+	append(data, count * sizeof(T));
+}
+
+template <typename T> const T* ModelCache::Reader::read(size_t& count){
+
+	return static_cast<const T*>(next(sizeof(T), count));
+}
+
+template <typename T> bool ModelCache::Reader::read(std::vector<T>& data){
+
+	size_t count;
+	const T* array = read<T>(count);
+	if (!array) return false;
+
+	data.assign(array, array + count);
+	return true;
+}
+
+template <typename T> bool ModelCache::Reader::readValue(T& value){
+
+	size_t count;
+	const T* array = read<T>(count);
+	if (!array || count != 1) return false;
+
+	value = *array;
+	return true;
+}
+
+#endif
@@ -2,8 +2,15 @@
 #include <random>
 #include <iostream>
 #include "Model.h"
+#include "TriangleBuffer.h"
+#include "Utils.h"
 
 bool BBox::intersect(const Ray& a_ray) {
+
+	return intersect(a_ray, m_tmin, m_tmax);
+}
+
+bool BBox::intersect(const Ray& a_ray, float& tmin, float& tmax) const {
 	double ox = a_ray.origin[0]; double oy = a_ray.origin[1]; double oz = a_ray.origin[2];
 	double dx = a_ray.direction[0]; double dy = a_ray.direction[1]; double dz = a_ray.direction[2];
 
@@ -60,8 +67,8 @@ bool BBox::intersect(const Ray& a_ray) {
 		t1 = tz_max;
 
 	if (t0 < t1 && t1 > 0.0001){
-		m_tmin = t0;
-		m_tmax = t1;
+		tmin = t0;
+		tmax = t1;
 		return true;
 	}
 	return false;
@@ -93,6 +100,35 @@ BBox &Primitive::getBounds(){
 	return box;
 }
 
+bool Primitive::getBoundingBox(BBox& boundingBox){
+
+	return false;
+}
+
+bool Primitive::occluded(const Ray& ray, float distance){
+
+	Ray shadowRay = ray;
+	float hitParameter;
+	return shadowHit(shadowRay, hitParameter) && hitParameter <= distance;
+}
+
+void Primitive::hit(RayPacket& packet, Hit* hits){
+
+	for (int i = 0; i < RayPacket::Size; i++){
+
+		if (!(packet.mask & (1 << i))) continue;
+
+		Hit hitLane;
+		hitLane.originalRay = packet.getRay(i);
+		hitLane.transformedRay = hitLane.originalRay;
+		hitLane.t = packet.t[i];
+		hit(hitLane);
+
+		if (hitLane.hitObject && hitLane.t < packet.t[i])
+			packet.setHit(i, hitLane, hits);
+	}
+}
+
 void Primitive::clip(int axis, float position, BBox& leftBoundingBox, BBox& rightBoundingBox){
 	//clearing the boxes
 	leftBoundingBox = getBounds();
@@ -165,6 +201,51 @@ Vector3f Primitive::getNormalDv(const Vector3f& pos){
 	return Vector3f(0.0, 0.0, 0.0);
 }
 
+Vector3f Primitive::getNormal(const Hit& hit){
+
+	return getNormal(hit.hitPoint);
+}
+
+Vector3f Primitive::getTangent(const Hit& hit){
+
+	return getTangent(hit.hitPoint);
+}
+
+Vector3f Primitive::getBiTangent(const Hit& hit){
+
+	return getBiTangent(hit.hitPoint);
+}
+
+Vector3f Primitive::getNormalDu(const Hit& hit){
+
+	return getNormalDu(hit.hitPoint);
+}
+
+Vector3f Primitive::getNormalDv(const Hit& hit){
+
+	return getNormalDv(hit.hitPoint);
+}
+
+std::pair <float, float> Primitive::getUV(const Hit& hit){
+
+	return getUV(hit.hitPoint);
+}
+
+Color Primitive::getColor(const Hit& hit){
+
+	return getColor(hit.hitPoint);
+}
+
+Color Primitive::getColor(const Hit& hit, bool useTexture){
+
+	return getColor(hit);
+}
+
+std::shared_ptr<Material> Primitive::getMaterial(const Hit& hit){
+
+	return getMaterial();
+}
+
 Vector3f Primitive::sample(void){
 
 	return Vector3f(0.0, 0.0, 0.0);
@@ -173,8 +254,16 @@ Vector3f Primitive::sample(void){
 float Primitive::pdf(const Hit &hit){
 	return 0.0;
 }
+
+float Primitive::getArea(){
+	return 0.0;
+}
 //////////////////////////////////////////////////////////////////////////////////////////////////
-Instance::Instance(Primitive *primitive){
+Instance::Instance(Primitive *primitive) : Instance(std::shared_ptr<Primitive>(primitive)){
+
+}
+
+Instance::Instance(const std::shared_ptr<Primitive>& primitive){
 
 	T.identity();
 	invT.identity();
@@ -185,8 +274,9 @@ Instance::Instance(Primitive *primitive){
 
 	m_color = primitive->m_color;
 	m_defaultColor = true;
+	m_scaled = false;
 	m_useTexture = primitive->m_useTexture;
-	m_primitive = std::shared_ptr<Primitive>(primitive);
+	m_primitive = primitive;
 	
 }
 
@@ -233,6 +323,7 @@ void Instance::scale(float a, float b, float c){
 	if (a == 0) a = 1.0f;
 	if (b == 0) b = 1.0f;
 	if (c == 0) c = 1.0f;
+	if (a != 1.0f || b != 1.0f || c != 1.0f) m_scaled = true;
 
 	T[0][0] = T[0][0] * a;  T[1][0] = T[1][0] * b; T[2][0] = T[2][0] * c;
 	T[0][1] = T[0][1] * a;  T[1][1] = T[1][1] * b; T[2][1] = T[2][1] * c;
@@ -248,31 +339,128 @@ void Instance::scale(float a, float b, float c){
 void Instance::hit(Hit &hit){
 
 	hit.transformedRay.origin = invT * (Vector4f(hit.originalRay.origin, 1.0));
-	hit.transformedRay.direction = (invT * Vector4f(hit.originalRay.direction, 0.0)).normalize();
+	Vector3f direction = invT * Vector4f(hit.originalRay.direction, 0.0);
+	hit.transformedRay.direction = direction.normalize();
 
-	if (m_primitive->bounds && !m_primitive->box.intersect(hit.transformedRay)){
+	//the primitive may be shared by other instances and threads, so the box of it is only read
+	float tmin, tmax;
+	if (m_primitive->bounds && !m_primitive->box.intersect(hit.transformedRay, tmin, tmax)){
 
 		//hit.hitObject = false;
 		return;
-	}else{
+	}else if (!m_scaled){
 		
 		m_primitive->hit(hit);
 		
+	}else{
+
+		//the primitive measures t along the normalized direction, the scene along the one of the original ray
+		//so the hits of differently scaled instances stay comparable
+		float t = hit.t;
+		float length = direction.magnitude();
+		hit.t = t * length;
+
+		m_primitive->hit(hit);
+
+		if (hit.hitObject){
+
+			//hitPoint = origin + direction * t stays the point in the space of the primitive
+			hit.t = hit.t / length;
+			hit.transformedRay.direction = direction;
+
+		}else{
+
+			hit.t = t;
+		}
 	}
 	
 }
 
 bool Instance::shadowHit(Ray &ray, float &hitParameter){
 
-	Ray transformedRay = Ray(invT * (Vector4f(ray.origin, 1.0)), (invT * Vector4f(ray.direction, 0.0)).normalize());
+	//the callers compare hitParameter with distances along the original ray, so it is converted back like in hit
+	Vector3f direction = invT * Vector4f(ray.direction, 0.0);
+	float length = direction.magnitude();
+	Ray transformedRay = Ray(invT * (Vector4f(ray.origin, 1.0)), direction.normalize());
 
-	if (m_primitive->bounds && !m_primitive->box.intersect(transformedRay)){
+	float tmin, tmax;
+	if (m_primitive->bounds && !m_primitive->box.intersect(transformedRay, tmin, tmax)){
 		
 		return false;
 
-	}else{
+	}else if (m_primitive->shadowHit(transformedRay, hitParameter)){
+
+		if (m_scaled) hitParameter = hitParameter / length;
+		return true;
+	}
+
+	return false;
+}
+
+bool Instance::occluded(const Ray& ray, float distance){
+
+	//the direction is normalized again, the distance along it grows with the length it had
+	Vector3f direction = invT * Vector4f(ray.direction, 0.0);
+	float length = direction.magnitude();
+	Ray transformedRay = Ray(invT * (Vector4f(ray.origin, 1.0)), direction / length);
+
+	float tmin, tmax;
+	if (m_primitive->bounds && !m_primitive->box.intersect(transformedRay, tmin, tmax)){
+
+		return false;
+	}
+
+	return m_primitive->occluded(transformedRay, distance * length);
+}
+
+void Instance::hit(RayPacket& packet, Hit* hits){
+
+	//the same arithmetic as for a single ray, the directions are normalized again
+	RayPacket transformed;
+	for (int i = 0; i < 3; i++){
+
+		transformed.origin[i] = packet.origin[0] * invT[i][0] + packet.origin[1] * invT[i][1] + packet.origin[2] * invT[i][2] + Float4(1.0f) * invT[i][3];
+		transformed.direction[i] = packet.direction[0] * invT[i][0] + packet.direction[1] * invT[i][1] + packet.direction[2] * invT[i][2] + Float4(0.0f) * invT[i][3];
+	}
+
+	Float4 invMagnitude = Float4(1.0f) / Float4::Sqrt(transformed.direction[0] * transformed.direction[0] + transformed.direction[1] * transformed.direction[1] + transformed.direction[2] * transformed.direction[2]);
+	for (int i = 0; i < 3; i++)
+		transformed.direction[i] = transformed.direction[i] * invMagnitude;
+
+	transformed.mask = packet.mask;
+	transformed.t = m_scaled ? packet.t / invMagnitude : packet.t;
+
+	if (m_primitive->bounds){
+
+		for (int i = 0; i < RayPacket::Size; i++){
+
+			float tmin, tmax;
+			if ((transformed.mask & (1 << i)) && !m_primitive->box.intersect(transformed.getRay(i), tmin, tmax))
+				transformed.mask &= ~(1 << i);
+		}
+	}
+
+	if (transformed.mask == 0) return;
+
+	Float4 t = transformed.t;
+	m_primitive->hit(transformed, hits);
+
+	if (!m_scaled){
+
+		packet.t = transformed.t;
+		return;
+	}
+
+	//like for a single ray, the lanes with a hit get t and the direction of the original ray
+	int closer = (transformed.t < t).signBits() & transformed.mask;
+	t = transformed.t * invMagnitude;
+	for (int i = 0; i < RayPacket::Size; i++){
 
-		return m_primitive->shadowHit(transformedRay, hitParameter);
+		if (closer & (1 << i)){
+			packet.t.set(i, t[i]);
+			hits[i].t = t[i];
+			hits[i].transformedRay.direction = hits[i].transformedRay.direction / invMagnitude[i];
+		}
 	}
 }
 
@@ -379,6 +567,86 @@ std::pair<float, float> Instance::getUV(const Vector3f& pos){
 	return m_primitive->getUV(pos);
 }
 
+Color Instance::getColor(const Hit& hit){
+
+	return getColor(hit, m_useTexture);
+}
+
+Color Instance::getColor(const Hit& hit, bool useTexture){
+
+	if (useTexture){
+
+		if (m_texture){
+
+			if (m_texture->getProcedural()){
+
+				return static_cast<ProceduralTexture*>(m_texture.get())->getColor(hit.hitPoint);
+
+			}else{
+
+				std::pair <float, float> uv = getUV(hit);
+				return static_cast<ImageTexture*>(m_texture.get())->getTexel(uv.first, uv.second, hit.hitPoint);
+			}
+		}
+
+		return m_primitive->getColor(hit);
+
+	}else if (!m_defaultColor){
+
+		return m_color;
+
+	}else{
+
+		//the primitive may be shared by the instances of all threads, so its texture is switched off without writing to it
+		return m_primitive->getColor(hit, false);
+	}
+}
+
+std::shared_ptr<Material> Instance::getMaterial(const Hit& hit){
+
+	if (m_material){
+
+		return m_material;
+
+	}else{
+
+		return m_primitive->getMaterial(hit);
+	}
+}
+
+Vector3f Instance::getNormal(const Hit& hit){
+
+	//a scale stretches the normal
+	if (m_scaled) return (m_primitive->getNormal(hit) * invT).normalize();
+
+	return m_primitive->getNormal(hit) * invT;
+}
+
+Vector3f Instance::getTangent(const Hit& hit){
+
+	return  m_primitive->getTangent(hit) * invT;
+}
+
+Vector3f Instance::getBiTangent(const Hit& hit){
+
+	return   m_primitive->getBiTangent(hit) * invT;
+}
+
+Vector3f Instance::getNormalDu(const Hit& hit){
+
+	return  m_primitive->getNormalDu(hit) * invT;
+}
+
+Vector3f Instance::getNormalDv(const Hit& hit){
+
+	return  m_primitive->getNormalDv(hit) * invT;
+}
+
+std::pair<float, float> Instance::getUV(const Hit& hit){
+
+	return m_primitive->getUV(hit);
+}
+
 BBox &Instance::getBounds(){
 
 	return m_primitive->getBounds();
@@ -389,10 +657,24 @@ void Instance::calcBounds(){
 	m_primitive->calcBounds();
 }
 
+bool Instance::getBoundingBox(BBox& boundingBox){
+
+	BBox local;
+	if (!m_primitive->getBoundingBox(local)) return false;
+
+	//the box around the transformed corners of the local box
+	boundingBox = BBox(Vector3f(FLT_MAX, FLT_MAX, FLT_MAX), Vector3f(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+	for (int i = 0; i < 8; i++){
+
+		Vector3f corner((i & 1) ? local.m_size[0] : local.m_pos[0], (i & 2) ? local.m_size[1] : local.m_pos[1], (i & 4) ? local.m_size[2] : local.m_pos[2]);
+		boundingBox.extend(T * Vector4f(corner, 1.0));
+	}
+	return true;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////
 CompoundedObject::CompoundedObject() : Primitive(){
 
-	m_primitive = NULL;
 	m_seperate = false;
 	calcBounds();
 }
@@ -413,6 +695,11 @@ void CompoundedObject::hit(Hit &hit){
 	//to avoid transforming to another local space from a following subobject
 	//it will be necessary to store the transformation
 	Ray ray;
+
+	//the closest subobject is stored inside the hit, the object itself stays untouched while rendering
+	Primitive* part = NULL;
+	int triangle = -1;
+	float b1 = 0.0f, b2 = 0.0f;
 	
 	for (unsigned int i = 0; i < m_primitives.size(); i++){
 
@@ -422,7 +709,10 @@ void CompoundedObject::hit(Hit &hit){
 
 		if (hitCompoundenObject.hitObject && hitCompoundenObject.t < tminCompoundenObject) {
 			
-			m_primitive = m_primitives[i];
+			part = m_primitives[i].get();
+			triangle = hitCompoundenObject.triangle;
+			b1 = hitCompoundenObject.b1;
+			b2 = hitCompoundenObject.b2;
 			tminCompoundenObject = hitCompoundenObject.t;	
 			ray = hitCompoundenObject.transformedRay;
 		}	
@@ -434,6 +724,10 @@ void CompoundedObject::hit(Hit &hit){
 		hit.t = tminCompoundenObject;
 		hit.hitObject = true;
 		hit.transformedRay = ray;
+		hit.part = part;
+		hit.triangle = triangle;
+		hit.b1 = b1;
+		hit.b2 = b2;
 	}	
 }
 
@@ -450,13 +744,19 @@ bool CompoundedObject::shadowHit(Ray &ray, float &hitParameter){
 	return hitObject;
 }
 
+bool CompoundedObject::occluded(const Ray& ray, float distance){
+
+	for (unsigned int i = 0; i < m_primitives.size(); i++){
+
+		if (m_primitives[i]->occluded(ray, distance)) return true;
+	}
+
+	return false;
+}
+
 Color CompoundedObject::getColor(const Vector3f& pos){
 	
-	if (m_primitive && m_seperate){
-		
-		return m_primitive->getColor(pos);
-
-	}else if (m_texture){
+	if (m_texture){
 
 		
 
@@ -478,76 +778,88 @@ Color CompoundedObject::getColor(const Vector3f& pos){
 
 Vector3f CompoundedObject::getNormal(const Vector3f& pos){
 
-	if (m_primitive){
+	return Vector3f(0.0, 0.0, 0.0);
+}
 
-		return m_primitive->getNormal(pos) ;
+Vector3f CompoundedObject::getTangent(const Vector3f& pos){
 
-	}else{
+	return Vector3f(0.0, 0.0, 0.0);
+}
 
-		return Vector3f(0.0, 0.0, 0.0);
-	}
+Vector3f CompoundedObject::getBiTangent(const Vector3f& pos){
+
+	return Vector3f(0.0, 0.0, 0.0);
 }
 
-Vector3f CompoundedObject::getTangent(const Vector3f& pos){
+Vector3f CompoundedObject::getNormalDu(const Vector3f& pos){
+
+	return Vector3f(0.0, 0.0, 0.0);
+}
+Vector3f CompoundedObject::getNormalDv(const Vector3f& pos){
 
-	if (m_primitive){
+	return Vector3f(0.0, 0.0, 0.0);
+}
 
-		return m_primitive->getTangent(pos);
+std::pair <float, float> CompoundedObject::getUV(const Vector3f& a_pos){
 
-	}else{
+	float u = 0.0;
+	float v = 1.0;
 
-		return Vector3f(0.0, 0.0, 0.0);
-	}
+	return std::make_pair(u, v);
 }
 
-Vector3f CompoundedObject::getBiTangent(const Vector3f& pos){
+Color CompoundedObject::getColor(const Hit& hit){
 
-	if (m_primitive){
+	if (hit.part && m_seperate){
 
-		return m_primitive->getBiTangent(pos);
+		return hit.part->getColor(hit);
 
-	}else{
+	}else if (m_texture){
 
-		return Vector3f(0.0, 0.0, 0.0);
-	}
-}
+		if (m_texture->getProcedural()){
 
-Vector3f CompoundedObject::getNormalDu(const Vector3f& pos){
+			return static_cast<ProceduralTexture*>(m_texture.get())->getColor(hit.hitPoint);
 
-	if (m_primitive){
+		}else{
 
-		return m_primitive->getNormalDu(pos);
+			std::pair <float, float> uv = getUV(hit);
+			return static_cast<ImageTexture*>(m_texture.get())->getTexel(uv.first, uv.second, hit.hitPoint);
+		}
 
 	}else{
 
-		return Vector3f(0.0, 0.0, 0.0);
+		return m_color;
 	}
 }
-Vector3f CompoundedObject::getNormalDv(const Vector3f& pos){
 
-	if (m_primitive){
+Vector3f CompoundedObject::getNormal(const Hit& hit){
 
-		return m_primitive->getNormalDv(pos);
+	return hit.part ? hit.part->getNormal(hit) : Vector3f(0.0, 0.0, 0.0);
+}
 
-	}else{
+Vector3f CompoundedObject::getTangent(const Hit& hit){
 
-		return Vector3f(0.0, 0.0, 0.0);
-	}
+	return hit.part ? hit.part->getTangent(hit) : Vector3f(0.0, 0.0, 0.0);
 }
 
-std::pair <float, float> CompoundedObject::getUV(const Vector3f& a_pos){
+Vector3f CompoundedObject::getBiTangent(const Hit& hit){
 
-	if (m_primitive){
+	return hit.part ? hit.part->getBiTangent(hit) : Vector3f(0.0, 0.0, 0.0);
+}
 
-		return m_primitive->getUV(a_pos);
+Vector3f CompoundedObject::getNormalDu(const Hit& hit){
 
-	}else{
+	return hit.part ? hit.part->getNormalDu(hit) : Vector3f(0.0, 0.0, 0.0);
+}
 
-		float u = 0.0;
-		float v = 1.0;
+Vector3f CompoundedObject::getNormalDv(const Hit& hit){
 
-		return std::make_pair(u, v);
-	}
+	return hit.part ? hit.part->getNormalDv(hit) : Vector3f(0.0, 0.0, 0.0);
+}
+
+std::pair <float, float> CompoundedObject::getUV(const Hit& hit){
+
+	return hit.part ? hit.part->getUV(hit) : getUV(hit.hitPoint);
 }
 
 void CompoundedObject::calcBounds(){
@@ -555,6 +867,22 @@ void CompoundedObject::calcBounds(){
 	CompoundedObject::bounds = false;
 }
 
+bool CompoundedObject::getBoundingBox(BBox& boundingBox){
+
+	if (m_primitives.empty()) return false;
+
+	boundingBox = BBox(Vector3f(FLT_MAX, FLT_MAX, FLT_MAX), Vector3f(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+	for (unsigned int i = 0; i < m_primitives.size(); i++){
+
+		BBox part;
+		if (!m_primitives[i]->getBoundingBox(part)) return false;
+
+		boundingBox.extend(part.m_pos);
+		boundingBox.extend(part.m_size);
+	}
+	return true;
+}
+
 
 
 void CompoundedObject::setTextureAll(Texture* texture){
@@ -567,14 +895,7 @@ void CompoundedObject::setTextureAll(Texture* texture){
 
 std::shared_ptr<Texture> CompoundedObject::getTexture(){
 	
-	if (m_primitive && m_seperate && m_primitive->getTexture()){
-		
-			return m_primitive->getTexture();
-
-	}else{
-		
-		return m_texture;
-	}
+	return m_texture;
 }
 
 
@@ -595,11 +916,16 @@ void CompoundedObject::setColorAll(const Color& color){
 
 std::shared_ptr<Material> CompoundedObject::getMaterial(){
 	
-	if (m_primitive && m_seperate && m_primitive->getMaterial()){
-			return m_primitive->getMaterial();	
+	return m_material;
+}
+
+std::shared_ptr<Material> CompoundedObject::getMaterial(const Hit& hit){
+
+	if (hit.part && m_seperate && hit.part->getMaterial(hit)){
+			return hit.part->getMaterial(hit);
 
 	}else{
-		
+
 		return m_material;
 	}
 }
@@ -627,8 +953,7 @@ Triangle::Triangle(const Vector3f &a_V1,
 	m_hasNormals = false;
 	m_hasTangents = false;
 	m_hasNormalDerivatives = false;
-	m_edge1 = m_b - m_a;
-	m_edge2 = m_c - m_a;
+	m_hasTextureCoords = false;
 
 	Vector3f crossProd = Vector3f::cross(m_b - m_a, m_c - m_a);
 	abc = crossProd.magnitude();
@@ -650,8 +975,7 @@ Triangle::Triangle(const Vector3f &a_V1,
 	m_hasNormals = false;
 	m_hasTangents = false;
 	m_hasNormalDerivatives = false;
-	m_edge1 = m_b - m_a;
-	m_edge2 = m_c - m_a;
+	m_hasTextureCoords = false;
 
 	Vector3f crossProd = Vector3f::cross(m_b - m_a, m_c - m_a);
 	abc = crossProd.magnitude();
@@ -677,47 +1001,70 @@ void Triangle::calcBounds(){
 	Triangle::bounds = true;
 }
 
-// Mller Trumbore algorithm
+bool Triangle::getBoundingBox(BBox& boundingBox){
+
+	boundingBox = getBounds();
+	return true;
+}
+
+// watertight test of Woop, Benthin and Wald, the same one the acceleration structures run on blocks of triangles
 void Triangle::hit(Hit &hit){
 
-	//determinat of the triangle
-	Vector3f P = Vector3f::cross(hit.transformedRay.direction, m_edge2);
-	float det = Vector3f::dot(P, m_edge1);
+	TriangleBuffer::ShearedRay ray(hit.transformedRay);
 
-	if (!m_cull){
+	Float4 A[3], B[3], C[3], shear[3];
+	for (int j = 0; j < 3; j++){
+		A[j] = Float4(m_a[ray.k[j]]) - Float4(ray.origin[ray.k[j]]);
+		B[j] = Float4(m_b[ray.k[j]]) - Float4(ray.origin[ray.k[j]]);
+		C[j] = Float4(m_c[ray.k[j]]) - Float4(ray.origin[ray.k[j]]);
+		shear[j] = Float4(ray.shear[j]);
+	}
 
-		if (fabs(det) < 0.0001f) return;
+	Float4 t(FLT_MAX), b1(0.0f), b2(0.0f);
+	if (TriangleBuffer::Intersect(A, B, C, shear, Float4::Mask(m_cull ? 1 : 0), 1, t, b1, b2)){
 
-	}else{
+		hit.t = t[0];
+		hit.b1 = b1[0];
+		hit.b2 = b2[0];
+		hit.hitObject = true;
+	}
+}
+
+int Triangle::intersect(const RayPacket& packet, int mask, Float4& t, Float4& b1, Float4& b2) const{
 
-		if (det < 0.0001f) return;
+	//the triangle is the same for all rays
+	Float4 a[3], b[3], c[3];
+	for (int i = 0; i < 3; i++){
+		a[i] = Float4(m_a[i]);
+		b[i] = Float4(m_b[i]);
+		c[i] = Float4(m_c[i]);
 	}
 
-	float inv_det = 1.0f / det;
+	TriangleBuffer::ShearedPacket sheared(packet);
+	Float4 A[3], B[3], C[3];
+	sheared.permute(a, A);
+	sheared.permute(b, B);
+	sheared.permute(c, C);
 
-	// Barycentric Coefficients 
-	Vector3f T = hit.transformedRay.origin - Triangle::m_a;
+	return TriangleBuffer::Intersect(A, B, C, sheared.shear, Float4::Mask(m_cull ? RayPacket::AllLanes : 0), mask, t, b1, b2);
+}
 
-	// the intersection lies outside of the triangle
-	float u = Vector3f::dot(T, P) * inv_det;
-	if (u < 0.0 || u > 1.0) return;
+void Triangle::hit(RayPacket& packet, Hit* hits){
 
-	// prepare to test v parameter
-	Vector3f Q = Vector3f::cross(T, m_edge1);
+	Float4 t = packet.t, b1(0.0f), b2(0.0f);
+	int hitMask = intersect(packet, packet.mask, t, b1, b2);
 
-	// the intersection is outside the triangle
-	float v = Vector3f::dot(hit.transformedRay.direction, Q) * inv_det;
-	if (v < 0 || u + v > 1) return;
+	for (int i = 0; i < RayPacket::Size; i++){
 
-	float result = -1.0;
-	result = Vector3f::dot(m_edge2, Q) * inv_det;
+		if (!(hitMask & (1 << i))) continue;
 
-	if (result > 0.0){
-		
-		hit.t = result;
-		hit.hitObject = true;
+		Hit hitLane;
+		hitLane.t = t[i];
+		hitLane.transformedRay = packet.getRay(i);
+		hitLane.b1 = b1[i];
+		hitLane.b2 = b2[i];
+		packet.setHit(i, hitLane, hits);
 	}
-	return;
 }
 
 bool Triangle::shadowHit(Ray &ray, float &hitParameter){
@@ -896,6 +1243,93 @@ Vector3f Triangle::getNormalDv(const Vector3f& pos){
 	}
 }
 
+Color Triangle::getColor(const Hit& hit){
+
+	return getColor(hit, m_texture);
+}
+
+// the color of the triangle as if it used the given texture, a model uses this for its model wide texture
+Color Triangle::getColor(const Hit& hit, const std::shared_ptr<Texture>& texture){
+
+	if (texture && m_hasTextureCoords){
+
+		if (texture->getProcedural()){
+
+			return static_cast<ProceduralTexture*>(texture.get())->getColor(hit.hitPoint);
+
+		}else{
+
+			std::pair <float, float> uv = getUV(hit);
+			return static_cast<ImageTexture*>(texture.get())->getTexel(uv.first, uv.second, hit.hitPoint);
+		}
+
+	}else{
+
+		return m_color;
+	}
+}
+
+// the hit point is a * (1 - b1 - b2) + b * b1 + c * b2
+std::pair <float, float> Triangle::getUV(const Hit& hit){
+
+	float b0 = 1.0f - hit.b1 - hit.b2;
+
+	float u = m_uv1[0] * b0 + m_uv2[0] * hit.b1 + m_uv3[0] * hit.b2;
+	float v = m_uv1[1] * b0 + m_uv2[1] * hit.b1 + m_uv3[1] * hit.b2;
+
+	return std::make_pair(u, v);
+}
+
+Vector3f Triangle::getNormal(const Hit& hit){
+
+	if (m_smooth && m_hasNormals){
+
+		return (m_n1 * (1.0f - hit.b1 - hit.b2) + m_n2 * hit.b1 + m_n3 * hit.b2).normalize();
+	}
+
+	return m_normal;
+}
+
+Vector3f Triangle::getTangent(const Hit& hit){
+
+	if (m_hasTangents){
+
+		return (m_t1 * (1.0f - hit.b1 - hit.b2) + m_t2 * hit.b1 + m_t3 * hit.b2).normalize();
+	}
+
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f Triangle::getBiTangent(const Hit& hit){
+
+	if (m_hasTangents){
+
+		return (m_bt1 * (1.0f - hit.b1 - hit.b2) + m_bt2 * hit.b1 + m_bt3 * hit.b2).normalize();
+	}
+
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f Triangle::getNormalDu(const Hit& hit){
+
+	if (m_hasNormalDerivatives){
+
+		return (m_nDu1 * (1.0f - hit.b1 - hit.b2) + m_nDu2 * hit.b1 + m_nDu3 * hit.b2).normalize();
+	}
+
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
+Vector3f Triangle::getNormalDv(const Hit& hit){
+
+	if (m_hasNormalDerivatives){
+
+		return (m_nDv1 * (1.0f - hit.b1 - hit.b2) + m_nDv2 * hit.b1 + m_nDv3 * hit.b2).normalize();
+	}
+
+	return Vector3f(0.0, 0.0, 0.0);
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////
 Sphere::Sphere() : Primitive(){
 
@@ -936,10 +1370,10 @@ void Sphere::hit(Hit &hit) {
 	//----------------------------------
 	float result = -1.0;
 
-	result = b - sqrt(d);
+	result = b - sqrtf(d);
 	if (result < 0.0){
 
-		result = b + sqrt(d);
+		result = b + sqrtf(d);
 	}
 
 	if (result > 0.0){
@@ -953,6 +1387,37 @@ void Sphere::hit(Hit &hit) {
 	return;
 }
 
+void Sphere::hit(RayPacket& packet, Hit* hits){
+
+	Float4 Lx = Float4(m_centre[0]) - packet.origin[0];
+	Float4 Ly = Float4(m_centre[1]) - packet.origin[1];
+	Float4 Lz = Float4(m_centre[2]) - packet.origin[2];
+
+	Float4 b = Lx * packet.direction[0] + Ly * packet.direction[1] + Lz * packet.direction[2];
+	Float4 c = (Lx * Lx + Ly * Ly + Lz * Lz) - m_sqRadius;
+	Float4 d = b * b - c;
+
+	//0.00001f lies just below the double the single ray test compares with, so > keeps the same lanes
+	Float4 valid = d > Float4(0.00001f);
+	if (!(valid.signBits() & packet.mask)) return;
+
+	Float4 root = Float4::Sqrt(d);
+	Float4 result = b - root;
+	result = Float4::Select(result < Float4(0.0f), b + root, result);
+
+	int hitMask = (valid & (result > Float4(0.0f)) & (result < packet.t)).signBits() & packet.mask;
+
+	for (int i = 0; i < RayPacket::Size; i++){
+
+		if (!(hitMask & (1 << i))) continue;
+
+		Hit hitLane;
+		hitLane.t = result[i];
+		hitLane.transformedRay = packet.getRay(i);
+		packet.setHit(i, hitLane, hits);
+	}
+}
+
 bool Sphere::shadowHit(Ray &ray, float &hitParameter){
 
 	Hit	hitShadow;
@@ -970,6 +1435,12 @@ void Sphere::calcBounds(){
 	Sphere::bounds = true;
 }
 
+bool Sphere::getBoundingBox(BBox& boundingBox){
+
+	boundingBox = BBox(m_centre - Vector3f(m_radius, m_radius, m_radius), m_centre + Vector3f(m_radius, m_radius, m_radius));
+	return true;
+}
+
 std::pair <float, float>  Sphere::getUV(const Vector3f& pos){
 
 	//transform the hitPoint to the local system of the sphere (pos - m_centre)
@@ -1210,6 +1681,12 @@ void Disk::calcBounds(){
 	Disk::bounds = false;
 }
 
+bool Disk::getBoundingBox(BBox& boundingBox){
+
+	boundingBox = BBox(m_center - Vector3f(m_radius, m_radius, m_radius), m_center + Vector3f(m_radius, m_radius, m_radius));
+	return true;
+}
+
 std::pair <float, float>  Disk::getUV(const Vector3f& pos){
 
 	float x =  pos[0];
@@ -1313,6 +1790,12 @@ void Annulus::calcBounds(){
 	Annulus::bounds = false;
 }
 
+bool Annulus::getBoundingBox(BBox& boundingBox){
+
+	boundingBox = BBox(m_center - Vector3f(m_outerRadius, m_outerRadius, m_outerRadius), m_center + Vector3f(m_outerRadius, m_outerRadius, m_outerRadius));
+	return true;
+}
+
 std::pair <float, float>  Annulus::getUV(const Vector3f& pos){
 
 
@@ -1538,6 +2021,14 @@ void Torus::calcBounds(){
 	
 }
 
+bool Torus::getBoundingBox(BBox& boundingBox){
+
+	//the torus lies around the y axis
+	float extent = m_radius + m_tubeRadius;
+	boundingBox = BBox(Vector3f(-extent, -m_tubeRadius, -extent), Vector3f(extent, m_tubeRadius, extent));
+	return true;
+}
+
 std::pair <float, float>  Torus::getUV(const Vector3f& pos){
 
 	float mainAngle = atan2(pos[2], pos[0]) + 1.5 * PI;
@@ -1711,6 +2202,12 @@ void Cube::calcBounds(){
 	Cube::bounds = false;
 }
 
+bool Cube::getBoundingBox(BBox& boundingBox){
+
+	boundingBox = BBox(m_pos, m_size);
+	return true;
+}
+
 // http://www.cs.utah.edu/~awilliam/box/ 
 void Cube::hit(Hit &hit){
 
@@ -1886,6 +2383,13 @@ void AABB::calcBounds() {
 	AABB::bounds = false;
 }
 
+bool AABB::getBoundingBox(BBox& boundingBox){
+
+	//m_pos is the centre and m_size the half extent
+	boundingBox = BBox(m_pos - m_size, m_pos + m_size);
+	return true;
+}
+
 void AABB::hit(Hit &hit) {
 
 	float rayMinTime = 0.0;
@@ -1945,53 +2449,42 @@ void AABB::hit(Hit &hit) {
 	else
 		collisionTime = rayMinTime;
 
-	Vector3f intersectionPoint = hit.transformedRay.origin + hit.transformedRay.direction * collisionTime;
+	hit.t = collisionTime;
+	hit.hitObject = true;
+}
+
+bool AABB::shadowHit(Ray &ray, float &hitParameter) {
+
+	Hit	hitShadow;
+	hitShadow.transformedRay = ray;
+	hit(hitShadow);
+	hitParameter = hitShadow.t;
+	return hitShadow.hitObject;
+}
+
+Vector3f AABB::getNormal(const Vector3f& a_pos) {
 
 	// figure out the surface normal by figuring out which axis we are closest to
+	// the hit point is enough, so several rays can hit the box before their normals are needed
 	float closestDist = FLT_MAX;
 	Vector3f normal;
-	float u = 0.0f;
-	float v = 0.0f;
 	for (int axis = 0; axis < 3; ++axis){
 
-		float distFromPos = abs(m_pos[axis] - intersectionPoint[axis]);
+		float distFromPos = abs(m_pos[axis] - a_pos[axis]);
 		float distFromEdge = abs(distFromPos - m_size[axis]);
 
 		if (distFromEdge < closestDist){
 
 			closestDist = distFromEdge;
 			normal = { 0.0f, 0.0f, 0.0f };
-			if (intersectionPoint[axis] < m_pos[axis])
+			if (a_pos[axis] < m_pos[axis])
 				normal[axis] = -1.0;
 			else
 				normal[axis] = 1.0;
 		}
 	}
 
-	// make sure normal is facing opposite of ray direction.
-	// this is for if we are hitting the object from the inside / back side.
-	/*if (Vector3f::dot(normal, hit.transformedRay.direction) > 0.0f)
-		normal = -normal;*/
-
-
-	hit.t = collisionTime;
-	hit.hitObject = true;
-	m_normal = normal;
-}
-
-bool AABB::shadowHit(Ray &ray, float &hitParameter) {
-
-	Hit	hitShadow;
-	hitShadow.transformedRay = ray;
-	hit(hitShadow);
-	hitParameter = hitShadow.t;
-	return hitShadow.hitObject;
-}
-
-Vector3f AABB::getNormal(const Vector3f& a_pos) {
-
-	//calaculated at the hit function
-	return m_normal;
+	return normal;
 }
 
 
@@ -2077,6 +2570,15 @@ void Quad::calcBounds(){
 	bounds = false;
 }
 
+bool Quad::getBoundingBox(BBox& boundingBox){
+
+	boundingBox = BBox(m_pos, m_pos);
+	boundingBox.extend(m_pos + m_a);
+	boundingBox.extend(m_pos + m_b);
+	boundingBox.extend(m_pos + m_a + m_b);
+	return true;
+}
+
 void  Quad::hit(Hit &hit){
 	
 	float result = Vector3f::dot(m_pos - hit.transformedRay.origin, m_normal) / Vector3f::dot(hit.transformedRay.direction, m_normal);
@@ -2108,6 +2610,36 @@ void  Quad::hit(Hit &hit){
 	hit.hitObject = true;
 }
 
+void Quad::hit(RayPacket& packet, Hit* hits){
+
+	Float4 result = ((Float4(m_pos[0]) - packet.origin[0]) * m_normal[0] + (Float4(m_pos[1]) - packet.origin[1]) * m_normal[1] + (Float4(m_pos[2]) - packet.origin[2]) * m_normal[2]) /
+		(packet.direction[0] * m_normal[0] + packet.direction[1] * m_normal[1] + packet.direction[2] * m_normal[2]);
+
+	//0.0001f lies just below the double the single ray test compares with
+	Float4 valid = (result > Float4(0.0001f)) & (result < packet.t);
+	if (!(valid.signBits() & packet.mask)) return;
+
+	Float4 dx = (packet.origin[0] + result * packet.direction[0]) - m_pos[0];
+	Float4 dy = (packet.origin[1] + result * packet.direction[1]) - m_pos[1];
+	Float4 dz = (packet.origin[2] + result * packet.direction[2]) - m_pos[2];
+
+	Float4 ddota = dx * m_a[0] + dy * m_a[1] + dz * m_a[2];
+	Float4 ddotb = dx * m_b[0] + dy * m_b[1] + dz * m_b[2];
+	valid = valid & (ddota >= Float4(0.0f)) & (ddota <= Float4(m_sqA)) & (ddotb >= Float4(0.0f)) & (ddotb <= Float4(m_sqB));
+
+	int hitMask = valid.signBits() & packet.mask;
+
+	for (int i = 0; i < RayPacket::Size; i++){
+
+		if (!(hitMask & (1 << i))) continue;
+
+		Hit hitLane;
+		hitLane.t = result[i];
+		hitLane.transformedRay = packet.getRay(i);
+		packet.setHit(i, hitLane, hits);
+	}
+}
+
 bool Quad::shadowHit(Ray &ray, float &hitParameter){
 
 	Hit	hitShadow;
@@ -2188,6 +2720,11 @@ float Quad::pdf(const Hit &hit){
 	
 	return m_invArea;
 }
+
+float Quad::getArea(){
+
+	return m_area;
+}
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 QuadCC::QuadCC() {
 
@@ -2200,6 +2737,9 @@ QuadCC::QuadCC(const Vector3f& a, const Vector3f& b, const Vector3f& c, const Ve
 	m_normal = Vector3f::cross(e1, e2).normalize();
 	
 	m_invArea = 1.0 / (e1.magnitude() * e2.magnitude());
+
+	m_areaABC = 0.5f * Vector3f::cross(m_b - m_a, m_c - m_a).magnitude();
+	m_areaACD = 0.5f * Vector3f::cross(m_c - m_a, m_d - m_a).magnitude();
 }
 
 QuadCC::~QuadCC() {
@@ -2210,6 +2750,15 @@ void QuadCC::calcBounds() {
 	QuadCC::bounds = false;
 }
 
+bool QuadCC::getBoundingBox(BBox& boundingBox){
+
+	boundingBox = BBox(m_a, m_a);
+	boundingBox.extend(m_b);
+	boundingBox.extend(m_c);
+	boundingBox.extend(m_d);
+	return true;
+}
+
 void QuadCC::flipNormal() {
 	m_normal = -m_normal;
 }
@@ -2288,6 +2837,68 @@ void QuadCC::hit(Hit &hit) {
 	hit.hitObject = true;
 }
 
+void QuadCC::hit(RayPacket& packet, Hit* hits) {
+
+	const Float4* o = packet.origin;
+	const Float4* dir = packet.direction;
+
+	Float4 pa[3], pb[3], pc[3], pd[3];
+	for (int i = 0; i < 3; i++) {
+		pa[i] = Float4(m_a[i]) - o[i];
+		pb[i] = Float4(m_b[i]) - o[i];
+		pc[i] = Float4(m_c[i]) - o[i];
+		pd[i] = Float4(m_d[i]) - o[i];
+	}
+
+	// both triangles are tested, each lane picks the one on its side of the diagonal
+	Float4 mx = pc[1] * dir[2] - pc[2] * dir[1];
+	Float4 my = pc[2] * dir[0] - pc[0] * dir[2];
+	Float4 mz = pc[0] * dir[1] - pc[1] * dir[0];
+	Float4 v = pa[0] * mx + pa[1] * my + pa[2] * mz;
+	Float4 abc = v >= Float4(0.0f);
+
+	// triangle abc
+	Float4 u1 = -(pb[0] * mx + pb[1] * my + pb[2] * mz);
+	Float4 w1 = (dir[1] * pb[2] - dir[2] * pb[1]) * pa[0] + (dir[2] * pb[0] - dir[0] * pb[2]) * pa[1] + (dir[0] * pb[1] - dir[1] * pb[0]) * pa[2];
+
+	// triangle dac
+	Float4 u2 = pd[0] * mx + pd[1] * my + pd[2] * mz;
+	Float4 w2 = (dir[1] * pa[2] - dir[2] * pa[1]) * pd[0] + (dir[2] * pa[0] - dir[0] * pa[2]) * pd[1] + (dir[0] * pa[1] - dir[1] * pa[0]) * pd[2];
+
+	Float4 u = Float4::Select(abc, u1, u2);
+	Float4 w = Float4::Select(abc, w1, w2);
+	v = Float4::Select(abc, v, -v);
+
+	Float4 valid = (u >= Float4(0.0f)) & (w >= Float4(0.0f));
+	if (!(valid.signBits() & packet.mask)) return;
+
+	Float4 denom = Float4(1.0f) / (u + v + w);
+	u = u * denom;
+	v = v * denom;
+	w = w * denom;
+
+	Float4 r[3];
+	for (int i = 0; i < 3; i++)
+		r[i] = (u * m_a[i] + v * Float4::Select(abc, Float4(m_b[i]), Float4(m_d[i]))) + w * m_c[i];
+
+	// the time from the first axis the ray is not parallel to
+	Float4 t = (r[2] - o[2]) / dir[2];
+	t = Float4::Select(Float4::Abs(dir[1]) > Float4(0.0f), (r[1] - o[1]) / dir[1], t);
+	t = Float4::Select(Float4::Abs(dir[0]) > Float4(0.0f), (r[0] - o[0]) / dir[0], t);
+
+	int hitMask = (valid & (t >= Float4(0.0f)) & (t < packet.t)).signBits() & packet.mask;
+
+	for (int i = 0; i < RayPacket::Size; i++) {
+
+		if (!(hitMask & (1 << i))) continue;
+
+		Hit hitLane;
+		hitLane.t = t[i];
+		hitLane.transformedRay = packet.getRay(i);
+		packet.setHit(i, hitLane, hits);
+	}
+}
+
 bool QuadCC::shadowHit(Ray &ray, float &hitParameter) {
 	Hit	hitShadow;
 	hitShadow.transformedRay = ray;
@@ -2324,6 +2935,26 @@ std::pair <float, float> QuadCC::getUV(const Vector3f& pos) {
 float QuadCC::pdf(const Hit &hit) {
 	return m_invArea;
 }
+
+Vector3f QuadCC::sample() {
+
+	// a triangle by its area and a uniform point in it, m_invArea is the scale of the emission and not the density of these points
+	float u = RandomFloat();
+	float v = RandomFloat();
+	if (u + v > 1.0f) {
+		u = 1.0f - u;
+		v = 1.0f - v;
+	}
+
+	if (RandomFloat() * (m_areaABC + m_areaACD) < m_areaABC)
+		return m_a + (m_b - m_a) * u + (m_c - m_a) * v;
+
+	return m_a + (m_c - m_a) * u + (m_d - m_a) * v;
+}
+
+float QuadCC::getArea() {
+	return m_areaABC + m_areaACD;
+}
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 OpenCylinder::OpenCylinder() : Primitive(){
 
@@ -2355,6 +2986,12 @@ void OpenCylinder::calcBounds(){
 	OpenCylinder::bounds = false;
 }
 
+bool OpenCylinder::getBoundingBox(BBox& boundingBox){
+
+	boundingBox = BBox(Vector3f(-(float)m_radius, (float)m_bottom, -(float)m_radius), Vector3f((float)m_radius, (float)m_top, (float)m_radius));
+	return true;
+}
+
 void  OpenCylinder::hit(Hit &hit){
 
 	double ox = hit.transformedRay.origin[0];
@@ -2386,17 +3023,6 @@ void  OpenCylinder::hit(Hit &hit){
 
 			if (yhit > m_bottom && yhit < m_top) {
 				hit.t = result;
-
-	
-				m_normal = Vector3f( (ox + result * dx) * m_invRadius, 0.0, (oz + result * dz) * m_invRadius);
-				// test for hitting from inside
-				Vector3f::dot(-hit.transformedRay.direction, m_normal);
-				if (Vector3f::dot(hit.transformedRay.direction, m_normal) > 0.0){
-
-					m_normal = -m_normal;
-				}
-
-				hit.t = result;
 				hit.hitObject = true;
 				return;
 				
@@ -2409,16 +3035,6 @@ void  OpenCylinder::hit(Hit &hit){
 			double yhit = oy + result * dy;
 
 			if (yhit > m_bottom && yhit < m_top) {
-				hit.t = result;
-
-				m_normal = Vector3f((ox + result * dx) * m_invRadius, 0.0, (oz + result * dz) * m_invRadius);
-				// test for hitting inside surface
-				if (Vector3f::dot(hit.transformedRay.direction, m_normal) > 0.0){
-
-					m_normal = -m_normal;
-				}
-
-				
 				hit.t = result;
 				hit.hitObject = true;
 				return;
@@ -2439,8 +3055,19 @@ bool OpenCylinder::shadowHit(Ray &ray, float &hitParameter){
 }
 
 Vector3f OpenCylinder::getNormal(const Vector3f& a_pos){
-		//calaculated at the hit function
-		return m_normal;
+
+	return Vector3f(a_pos[0] * m_invRadius, 0.0, a_pos[2] * m_invRadius);
+}
+
+Vector3f OpenCylinder::getNormal(const Hit& hit){
+
+	// test for hitting the inside surface
+	Vector3f normal = getNormal(hit.hitPoint);
+	if (Vector3f::dot(hit.transformedRay.direction, normal) > 0.0){
+
+		normal = -normal;
+	}
+	return normal;
 }
 
 
@@ -2504,6 +3131,12 @@ void OpenCone::calcBounds(){
 	OpenCone::bounds = false;
 }
 
+bool OpenCone::getBoundingBox(BBox& boundingBox){
+
+	boundingBox = BBox(m_center + Vector3f(-(float)m_radius, 0.0f, -(float)m_radius), m_center + Vector3f((float)m_radius, (float)m_height, (float)m_radius));
+	return true;
+}
+
 void OpenCone::hit(Hit &hit){
 
 	double A = hit.transformedRay.origin[0] - m_center[0];
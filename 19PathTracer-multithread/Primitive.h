@@ -14,6 +14,7 @@
 #include "Color.h"
 #include "Hit.h"
 #include "Ray.h"
+#include "RayPacket.h"
 #include "Sampler.h"
 
 class BBox{
@@ -48,6 +49,8 @@ public:
 
 
 	bool intersect(const Ray &ray);
+	// leaves the box untouched, for concurrent traversals
+	bool intersect(const Ray &ray, float& tmin, float& tmax) const;
 
 	Vector3f m_pos, m_size;
 	float m_tmin, m_tmax;
@@ -71,6 +74,15 @@ public:
 
 	virtual void hit(Hit &hit) = 0;
 	virtual bool shadowHit(Ray &ray, float &hitParameter) = 0;
+	// true if the ray hits the primitive within distance, the traversal may stop at the first blocker it finds
+	// the default uses shadowHit, which is enough for the analytic primitives
+	virtual bool occluded(const Ray& ray, float distance);
+	// packet version of hit, the lanes of packet.mask with a hit in front of packet.t lower it and update their hit record
+	// the default traces the lanes one by one
+	virtual void hit(RayPacket& packet, Hit* hits);
+	// attributes at a position, only the analytic primitives can tell them from the point alone
+	// meshes, models and compounded objects need the part or triangle of the hit record, given a position they return zero vectors, a fixed uv or their plain color
+	// instances forward to their primitive, so the same holds for an instance of a mesh, the render uses the hit overloads below
 	virtual Vector3f getNormal(const Vector3f& pos) = 0;
 	virtual Vector3f getTangent(const Vector3f& pos) = 0;
 	virtual Vector3f getBiTangent(const Vector3f& pos) = 0;
@@ -78,16 +90,35 @@ public:
 	virtual Vector3f getNormalDv(const Vector3f& pos) = 0;
 	virtual std::pair <float, float> getUV(const Vector3f& a_pos) = 0;
 
+	// attributes at a hit of this primitive, meshes and compounded objects find the hit part inside the hit record
+	// the default implementations use the hit point
+	virtual Vector3f getNormal(const Hit& hit);
+	virtual Vector3f getTangent(const Hit& hit);
+	virtual Vector3f getBiTangent(const Hit& hit);
+	virtual Vector3f getNormalDu(const Hit& hit);
+	virtual Vector3f getNormalDv(const Hit& hit);
+	virtual std::pair <float, float> getUV(const Hit& hit);
+	virtual Color getColor(const Hit& hit);
+	// the color as if m_useTexture were useTexture, an instance uses this to read a shared primitive without its texture
+	// only the primitives that check m_useTexture override it, the others color the same either way
+	virtual Color getColor(const Hit& hit, bool useTexture);
+	virtual std::shared_ptr<Material> getMaterial(const Hit& hit);
+
 	virtual BBox& getBounds();
+	// (min, max) box in the space of the rays passed to hit, false for unbounded primitives
+	virtual bool getBoundingBox(BBox& boundingBox);
 	virtual void setTexture(Texture* texture);
 	virtual std::shared_ptr<Texture> getTexture();
 	virtual void setMaterial(Material* material);
 	virtual std::shared_ptr<Material> getMaterial();
 	virtual void setColor(Color color);
+	// not valid for meshes either, see the position attributes above
 	virtual Color getColor(const Vector3f& pos);
 	
 	virtual Vector3f sample(void);
 	virtual float pdf(const Hit &hit);
+	// surface area sample() picks its points from uniformly, 0 if the primitive can not be sampled
+	virtual float getArea();
 
 	BBox box;
 
@@ -111,10 +142,16 @@ class Instance : public Primitive {
 public:
 
 	Instance(Primitive *primitive);
-	Instance::~Instance();
+	// the primitive is shared with the other instances of it, only the transformation and the material are the own ones
+	Instance(const std::shared_ptr<Primitive>& primitive);
+	~Instance();
 
 	void hit(Hit &hit);
 	bool shadowHit(Ray &ray, float &hitParameter);
+	// the distance is scaled into the space of the primitive
+	bool occluded(const Ray& ray, float distance);
+	void hit(RayPacket& packet, Hit* hits);
+	bool getBoundingBox(BBox& boundingBox);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
 	Vector3f getBiTangent(const Vector3f& pos);
@@ -124,6 +161,15 @@ public:
 	std::shared_ptr<Texture> getTexture();
 	std::shared_ptr<Material> getMaterial();
 	Color getColor(const Vector3f& pos);
+	Vector3f getNormal(const Hit& hit);
+	Vector3f getTangent(const Hit& hit);
+	Vector3f getBiTangent(const Hit& hit);
+	Vector3f getNormalDu(const Hit& hit);
+	Vector3f getNormalDv(const Hit& hit);
+	std::pair <float, float> getUV(const Hit& hit);
+	Color getColor(const Hit& hit);
+	Color getColor(const Hit& hit, bool useTexture);
+	std::shared_ptr<Material> getMaterial(const Hit& hit);
 	BBox& getBounds();
 
 	void setColor(Color color);
@@ -141,6 +187,8 @@ private:
 
 	void calcBounds();
 	bool m_defaultColor;
+	// with a scale the transformed direction is no longer of unit length, the t of the primitive is converted back
+	bool m_scaled;
 };
 
 /////////////////////////////////////////////////////////////////////////////
@@ -157,6 +205,8 @@ class CompoundedObject : public Primitive {
 
 	void hit(Hit &hit);
 	bool shadowHit(Ray &ray, float &hitParameter);
+	bool occluded(const Ray& ray, float distance);
+	bool getBoundingBox(BBox& boundingBox);
 	Color getColor(const Vector3f& pos);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
@@ -164,6 +214,14 @@ class CompoundedObject : public Primitive {
 	Vector3f getNormalDu(const Vector3f& pos);
 	Vector3f getNormalDv(const Vector3f& pos);
 	std::pair <float, float> getUV(const Vector3f& a_pos);
+	Color getColor(const Hit& hit);
+	Vector3f getNormal(const Hit& hit);
+	Vector3f getTangent(const Hit& hit);
+	Vector3f getBiTangent(const Hit& hit);
+	Vector3f getNormalDu(const Hit& hit);
+	Vector3f getNormalDv(const Hit& hit);
+	std::pair <float, float> getUV(const Hit& hit);
+	std::shared_ptr<Material> getMaterial(const Hit& hit);
 
 	void setColorAll(const Color& color);
 	void setTextureAll(Texture* texture);
@@ -182,7 +240,6 @@ private:
 	
 	void calcBounds();
 
-	std::shared_ptr<Primitive> m_primitive;
 	bool m_seperate;
 	
 };
@@ -190,6 +247,9 @@ private:
 class Triangle : public Primitive{
 
 	friend class Mesh;
+	friend class KDTree;
+	friend class BVH;
+	friend class TriangleBuffer;
 
 public:
 	Triangle(const Vector3f &a_V1, const Vector3f &a_V2, const Vector3f &a_V3);
@@ -198,6 +258,10 @@ public:
 
 	void hit(Hit &hit);
 	bool shadowHit(Ray &ray, float &hitParameter);
+	void hit(RayPacket& packet, Hit* hits);
+	// the lanes of mask hitting the triangle in front of t, t, b1 and b2 of these lanes are replaced
+	int intersect(const RayPacket& packet, int mask, Float4& t, Float4& b1, Float4& b2) const;
+	bool getBoundingBox(BBox& boundingBox);
 	Color getColor(const Vector3f& a_pos);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
@@ -206,6 +270,16 @@ public:
 	Vector3f getNormalDv(const Vector3f& pos);
 	std::pair <float, float> getUV(const Vector3f& a_pos);
 
+	// interpolated with the barycentric coordinates of the hit
+	Color getColor(const Hit& hit);
+	Color getColor(const Hit& hit, const std::shared_ptr<Texture>& texture);
+	Vector3f getNormal(const Hit& hit);
+	Vector3f getTangent(const Hit& hit);
+	Vector3f getBiTangent(const Hit& hit);
+	Vector3f getNormalDu(const Hit& hit);
+	Vector3f getNormalDv(const Hit& hit);
+	std::pair <float, float> getUV(const Hit& hit);
+
 	void setUV(const Vector2f &uv1, const Vector2f &uv2, const Vector2f &uv3){
 		m_uv1 = uv1; m_uv2 = uv2; m_uv3 = uv3;
 		m_hasTextureCoords = true;
@@ -239,7 +313,6 @@ public:
 private:
 
 	Vector3f m_a, m_b, m_c;
-	Vector3f m_edge1, m_edge2;
 	Vector2f m_uv1, m_uv2, m_uv3;
 	
 	//smooth shading
@@ -296,6 +369,7 @@ public:
 
 	void hit(Hit &hit);
 	bool shadowHit(Ray &ray, float &hitParameter);
+	bool getBoundingBox(BBox& boundingBox);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
 	Vector3f getBiTangent(const Vector3f& pos);
@@ -322,6 +396,7 @@ public:
 
 	void hit(Hit &hit);
 	bool shadowHit(Ray &ray, float &hitParameter);
+	bool getBoundingBox(BBox& boundingBox);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
 	Vector3f getBiTangent(const Vector3f& pos);
@@ -341,6 +416,9 @@ private:
 };
 //////////////////////////////////////////////////////////////////////////////////////////////////
 class Sphere : public Primitive{
+
+	friend class PrimitiveBuffer;
+
 public:
 
 	Sphere();
@@ -349,6 +427,8 @@ public:
 
 	void hit(Hit &hit);
 	bool shadowHit(Ray &ray, float &hitParameter);
+	void hit(RayPacket& packet, Hit* hits);
+	bool getBoundingBox(BBox& boundingBox);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
 	Vector3f getBiTangent(const Vector3f& pos);
@@ -376,6 +456,7 @@ public:
 
 	void hit(Hit &hit);
 	bool shadowHit(Ray &ray, float &hitParameter);
+	bool getBoundingBox(BBox& boundingBox);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
 	Vector3f getBiTangent(const Vector3f& a_pos);
@@ -401,6 +482,7 @@ public:
 
 	void hit(Hit &hit);
 	bool shadowHit(Ray &ray, float &hitParameter);
+	bool getBoundingBox(BBox& boundingBox);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
 	Vector3f getBiTangent(const Vector3f& pos);
@@ -426,6 +508,7 @@ public:
 
 	void hit(Hit &hit);
 	bool shadowHit(Ray &ray, float &hitParameter);
+	bool getBoundingBox(BBox& boundingBox);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
 	Vector3f getBiTangent(const Vector3f& pos);
@@ -451,6 +534,8 @@ public:
 
 	void hit(Hit &hit);
 	bool shadowHit(Ray &ray, float &hitParameter);
+	void hit(RayPacket& packet, Hit* hits);
+	bool getBoundingBox(BBox& boundingBox);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
 	Vector3f getBiTangent(const Vector3f& pos);
@@ -463,6 +548,7 @@ public:
 	void setSampler(Sampler* sampler);
 	Vector3f sample();
 	float pdf(const Hit &hit);
+	float getArea();
 private:
 
 	void calcBounds();
@@ -487,6 +573,8 @@ private:
 //////////////////////////////////////////////////////////////////////////////////////////////////
 class QuadCC : public Primitive {
 
+	friend class PrimitiveBuffer;
+
 public:
 	QuadCC();
 	QuadCC(const Vector3f& a, const Vector3f& b, const Vector3f& c, const Vector3f& d);
@@ -494,6 +582,8 @@ public:
 
 	void hit(Hit &hit);
 	bool shadowHit(Ray &ray, float &hitParameter);
+	void hit(RayPacket& packet, Hit* hits);
+	bool getBoundingBox(BBox& boundingBox);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
 	Vector3f getBiTangent(const Vector3f& pos);
@@ -502,12 +592,16 @@ public:
 	std::pair <float, float> getUV(const Vector3f& a_pos);
 	void flipNormal();
 	float pdf(const Hit &hit);
+	Vector3f sample();
+	float getArea();
 private:
 
 	void calcBounds();
 
 	Vector3f m_a, m_b, m_c, m_d;
 	float m_invArea;
+	//the triangles abc and acd the quad is hit as
+	float m_areaABC, m_areaACD;
 };
 //////////////////////////////////////////////////////////////////////////////////////////////////
 class OpenCylinder : public Primitive{
@@ -520,12 +614,14 @@ public:
 
 	void hit(Hit &hit);
 	bool shadowHit(Ray &ray, float &hitParameter);
+	bool getBoundingBox(BBox& boundingBox);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
 	Vector3f getBiTangent(const Vector3f& pos);
 	Vector3f getNormalDu(const Vector3f& pos);
 	Vector3f getNormalDv(const Vector3f& pos);
 	std::pair <float, float> getUV(const Vector3f& a_pos);
+	Vector3f getNormal(const Hit& hit);
 
 private:
 
@@ -547,6 +643,7 @@ public:
 
 	void hit(Hit &hit);
 	bool shadowHit(Ray &ray, float &hitParameter);
+	bool getBoundingBox(BBox& boundingBox);
 	Vector3f getNormal(const Vector3f& pos);
 	Vector3f getTangent(const Vector3f& pos);
 	Vector3f getBiTangent(const Vector3f& pos);
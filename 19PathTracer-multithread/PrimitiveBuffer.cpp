@@ -0,0 +1,194 @@
+#include <cmath>
+#include <typeinfo>
+#include "PrimitiveBuffer.h"
+#include "Primitive.h"
+
+
+PrimitiveBuffer::Kind PrimitiveBuffer::GetKind(const Primitive* primitive){
+
+	if (typeid(*primitive) == typeid(Sphere)) return Spheres;
+	if (typeid(*primitive) == typeid(QuadCC)) return Quads;
+
+	return Generic;
+}
+
+void PrimitiveBuffer::clear(){
+
+	m_spheres.clear();
+	m_quads.clear();
+	m_numberOfSpheres = 0;
+	m_numberOfQuads = 0;
+}
+
+int PrimitiveBuffer::push_back(Primitive* primitive){
+
+	//a new block starts with empty lanes, the tests leave out the lanes behind the last primitive of a run
+	if (GetKind(primitive) == Spheres){
+
+		const Sphere& sphere = *static_cast<Sphere*>(primitive);
+
+		if (m_numberOfSpheres % BlockSize == 0){
+
+			SphereBlock block;
+			for (int i = 0; i < 3; i++)
+				block.centre[i] = Float4(0.0f);
+			block.sqRadius = Float4(0.0f);
+			m_spheres.push_back(block);
+		}
+
+		SphereBlock& block = m_spheres.back();
+		int lane = m_numberOfSpheres % BlockSize;
+		for (int i = 0; i < 3; i++)
+			block.centre[i].set(lane, sphere.m_centre[i]);
+		block.sqRadius.set(lane, sphere.m_sqRadius);
+
+		return m_numberOfSpheres++;
+	}
+
+	const QuadCC& quad = *static_cast<QuadCC*>(primitive);
+
+	if (m_numberOfQuads % BlockSize == 0){
+
+		QuadBlock block;
+		for (int i = 0; i < 3; i++){
+			block.a[i] = Float4(0.0f);
+			block.b[i] = Float4(0.0f);
+			block.c[i] = Float4(0.0f);
+			block.d[i] = Float4(0.0f);
+		}
+		m_quads.push_back(block);
+	}
+
+	QuadBlock& block = m_quads.back();
+	int lane = m_numberOfQuads % BlockSize;
+	for (int i = 0; i < 3; i++){
+		block.a[i].set(lane, quad.m_a[i]);
+		block.b[i].set(lane, quad.m_b[i]);
+		block.c[i].set(lane, quad.m_c[i]);
+		block.d[i].set(lane, quad.m_d[i]);
+	}
+
+	return m_numberOfQuads++;
+}
+
+void PrimitiveBuffer::pad(Kind kind){
+
+	int& size = kind == Spheres ? m_numberOfSpheres : m_numberOfQuads;
+	size = (size + BlockSize - 1) / BlockSize * BlockSize;
+}
+
+size_t PrimitiveBuffer::getMemoryUsage() const{
+
+	return m_spheres.capacity() * sizeof(SphereBlock) + m_quads.capacity() * sizeof(QuadBlock);
+}
+
+int PrimitiveBuffer::intersect(Kind kind, int slot, int count, const Ray& ray, float& t) const{
+
+	int closest = -1;
+
+	for (int first = 0; first < count; first += BlockSize){
+
+		int block = (slot + first) / BlockSize;
+		int lanes = count - first < BlockSize ? (1 << (count - first)) - 1 : (1 << BlockSize) - 1;
+
+		Float4 distance;
+		int hitMask = lanes & (kind == Spheres ? Intersect(m_spheres[block], ray, distance) : Intersect(m_quads[block], ray, distance));
+
+		//the lanes in the order of the primitives, so of two at the same distance the first one is kept like in the scene loop
+		for (int i = 0; hitMask && i < BlockSize; i++){
+
+			if ((hitMask & (1 << i)) && distance[i] < t){
+				t = distance[i];
+				closest = first + i;
+			}
+		}
+	}
+
+	return closest;
+}
+
+bool PrimitiveBuffer::occluded(Kind kind, int slot, int count, const Ray& ray, float distance, int skip) const{
+
+	for (int first = 0; first < count; first += BlockSize){
+
+		int block = (slot + first) / BlockSize;
+		int lanes = count - first < BlockSize ? (1 << (count - first)) - 1 : (1 << BlockSize) - 1;
+		if (skip >= first && skip < first + BlockSize) lanes &= ~(1 << (skip - first));
+
+		Float4 t;
+		int hitMask = lanes & (kind == Spheres ? Intersect(m_spheres[block], ray, t) : Intersect(m_quads[block], ray, t));
+
+		if (hitMask && ((t <= Float4(distance)).signBits() & hitMask)) return true;
+	}
+
+	return false;
+}
+
+int PrimitiveBuffer::Intersect(const SphereBlock& block, const Ray& ray, Float4& t){
+
+	//the arithmetic of Sphere::hit for a packet, with the spheres in the lanes instead of the rays
+	Float4 Lx = block.centre[0] - Float4(ray.origin[0]);
+	Float4 Ly = block.centre[1] - Float4(ray.origin[1]);
+	Float4 Lz = block.centre[2] - Float4(ray.origin[2]);
+
+	Float4 b = Lx * ray.direction[0] + Ly * ray.direction[1] + Lz * ray.direction[2];
+	Float4 c = (Lx * Lx + Ly * Ly + Lz * Lz) - block.sqRadius;
+	Float4 d = b * b - c;
+
+	Float4 valid = d > Float4(0.00001f);
+	if (!valid.signBits()) return 0;
+
+	Float4 root = Float4::Sqrt(d);
+	t = b - root;
+	t = Float4::Select(t < Float4(0.0f), b + root, t);
+
+	return (valid & (t > Float4(0.0f))).signBits();
+}
+
+int PrimitiveBuffer::Intersect(const QuadBlock& block, const Ray& ray, Float4& t){
+
+	//the arithmetic of QuadCC::hit for a packet, with the quads in the lanes instead of the rays
+	Float4 o[3], dir[3];
+	Float4 pa[3], pb[3], pc[3], pd[3];
+	for (int i = 0; i < 3; i++){
+		o[i] = Float4(ray.origin[i]);
+		dir[i] = Float4(ray.direction[i]);
+		pa[i] = block.a[i] - o[i];
+		pb[i] = block.b[i] - o[i];
+		pc[i] = block.c[i] - o[i];
+		pd[i] = block.d[i] - o[i];
+	}
+
+	Float4 mx = pc[1] * dir[2] - pc[2] * dir[1];
+	Float4 my = pc[2] * dir[0] - pc[0] * dir[2];
+	Float4 mz = pc[0] * dir[1] - pc[1] * dir[0];
+	Float4 v = pa[0] * mx + pa[1] * my + pa[2] * mz;
+	Float4 abc = v >= Float4(0.0f);
+
+	// triangle abc
+	Float4 u1 = -(pb[0] * mx + pb[1] * my + pb[2] * mz);
+	Float4 w1 = (dir[1] * pb[2] - dir[2] * pb[1]) * pa[0] + (dir[2] * pb[0] - dir[0] * pb[2]) * pa[1] + (dir[0] * pb[1] - dir[1] * pb[0]) * pa[2];
+
+	// triangle dac
+	Float4 u2 = pd[0] * mx + pd[1] * my + pd[2] * mz;
+	Float4 w2 = (dir[1] * pa[2] - dir[2] * pa[1]) * pd[0] + (dir[2] * pa[0] - dir[0] * pa[2]) * pd[1] + (dir[0] * pa[1] - dir[1] * pa[0]) * pd[2];
+
+	Float4 u = Float4::Select(abc, u1, u2);
+	Float4 w = Float4::Select(abc, w1, w2);
+	v = Float4::Select(abc, v, -v);
+
+	Float4 valid = (u >= Float4(0.0f)) & (w >= Float4(0.0f));
+	if (!valid.signBits()) return 0;
+
+	Float4 denom = Float4(1.0f) / (u + v + w);
+	u = u * denom;
+	v = v * denom;
+	w = w * denom;
+
+	// the time from the first axis the ray is not parallel to, the same axis for all lanes
+	int axis = fabsf(ray.direction[0]) > 0.0f ? 0 : fabsf(ray.direction[1]) > 0.0f ? 1 : 2;
+	Float4 r = (u * block.a[axis] + v * Float4::Select(abc, block.b[axis], block.d[axis])) + w * block.c[axis];
+	t = (r - o[axis]) / dir[axis];
+
+	return (valid & (t >= Float4(0.0f))).signBits();
+}
@@ -0,0 +1,64 @@
+#ifndef _PRIMITIVEBUFFER_H
+#define _PRIMITIVEBUFFER_H
+
+#include <vector>
+#include "SIMD.h"
+#include "Ray.h"
+
+class Primitive;
+
+// the spheres and quads of the scene kept by type in blocks of four like the triangles of the TriangleBuffer
+// one test intersects a ray with the four primitives of a block, without a virtual call for each of them
+// the scene copies a run of primitives of the same type into consecutive slots, every run starts a new block
+class PrimitiveBuffer{
+
+public:
+
+	static const int BlockSize = 4;
+
+	// the types with a block layout, the others are intersected through Primitive::hit
+	enum Kind { Generic, Spheres, Quads };
+
+	struct SphereBlock{
+		Float4 centre[3];
+		Float4 sqRadius;
+	};
+
+	// the corners of QuadCC, the test picks one of the triangles abc and acd by the side of the diagonal ac
+	struct QuadBlock{
+		Float4 a[3];
+		Float4 b[3];
+		Float4 c[3];
+		Float4 d[3];
+	};
+
+	// Generic for the subclasses too, they may intersect differently
+	static Kind GetKind(const Primitive* primitive);
+
+	void clear();
+	// appends a slot of the kind for the primitive and returns it
+	int push_back(Primitive* primitive);
+	// lets the next slot of the kind start a new block
+	void pad(Kind kind);
+
+	// tests the count primitives of the kind from the first slot of a block on, the index of the closest one in front of t
+	// counted from that slot is returned or -1, t is replaced for it
+	int intersect(Kind kind, int slot, int count, const Ray& ray, float& t) const;
+	// true if one of them but the one at index skip is hit within distance
+	bool occluded(Kind kind, int slot, int count, const Ray& ray, float distance, int skip) const;
+
+	size_t getMemoryUsage() const;
+
+private:
+
+	// the lanes of the block hit in front of the ray origin, t gets the distance of every lane
+	static int Intersect(const SphereBlock& block, const Ray& ray, Float4& t);
+	static int Intersect(const QuadBlock& block, const Ray& ray, Float4& t);
+
+	std::vector<SphereBlock> m_spheres;
+	std::vector<QuadBlock> m_quads;
+	int m_numberOfSpheres = 0;
+	int m_numberOfQuads = 0;
+};
+
+#endif
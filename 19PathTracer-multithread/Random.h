@@ -0,0 +1,83 @@
+#ifndef _RANDOM_GENERATOR_H
+#define _RANDOM_GENERATOR_H
+
+#include <stdint.h>
+
+// PCG32 (XSH RR) by Melissa O'Neill, 64 bit state and 32 bit output
+class Random {
+
+public:
+
+	Random() { seed(0, 0, 0); }
+	Random(uint64_t pixel, uint32_t sample, uint64_t seed) { this->seed(pixel, sample, seed); }
+
+	// restart the stream for one sample of one pixel, the same triple always gives the same numbers
+	void seed(uint64_t pixel, uint32_t sample, uint64_t seed) {
+
+		uint64_t key = splitMix64(splitMix64(seed ^ pixel) + sample);
+
+		m_pixel = pixel ^ seed;
+		m_sample = sample;
+		m_dimension = 0;
+
+		m_state = 0;
+		m_inc = (splitMix64(key) << 1) | 1;
+		nextUInt();
+		m_state += key;
+		nextUInt();
+	}
+
+	uint32_t nextUInt() {
+
+		uint64_t oldstate = m_state;
+		m_state = oldstate * 6364136223846793005ULL + m_inc;
+		uint32_t xorshifted = (uint32_t)(((oldstate >> 18) ^ oldstate) >> 27);
+		uint32_t rot = (uint32_t)(oldstate >> 59);
+		return (xorshifted >> rot) | (xorshifted << ((-(int32_t)rot) & 31));
+	}
+
+	// unbiased integer in [0, bound)
+	uint32_t nextUInt(uint32_t bound) {
+
+		uint32_t threshold = (0u - bound) % bound;
+		for (;;) {
+			uint32_t r = nextUInt();
+			if (r >= threshold)
+				return r % bound;
+		}
+	}
+
+	// from 0 to 1, 1 excluded
+	float nextFloat() {
+		return (nextUInt() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// the samplers use pixel, sample and dimension to walk their precomputed sets without shared counters
+	uint64_t getPixel() const { return m_pixel; }
+	uint32_t getSample() const { return m_sample; }
+	uint32_t nextDimension() { return m_dimension++; }
+
+	static uint64_t splitMix64(uint64_t x) {
+
+		x += 0x9E3779B97F4A7C15ULL;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+
+private:
+
+	uint64_t m_state;
+	uint64_t m_inc;
+	uint64_t m_pixel;
+	uint32_t m_sample;
+	uint32_t m_dimension;
+};
+
+// generator of the calling thread, the render workers reseed it for every pixel sample
+inline Random& ThreadRandom() {
+	static thread_local Random random;
+	return random;
+}
+
+#endif // _RANDOM_GENERATOR_H
@@ -0,0 +1,39 @@
+#include <cfloat>
+#include "RayPacket.h"
+#include "Hit.h"
+
+RayPacket::RayPacket(){
+
+	for (int i = 0; i < 3; i++){
+		origin[i] = Float4(0.0f);
+		direction[i] = Float4(0.0f);
+	}
+	t = Float4(FLT_MAX);
+	mask = 0;
+}
+
+void RayPacket::setRay(int lane, const Ray& ray){
+
+	for (int i = 0; i < 3; i++){
+		origin[i].set(lane, ray.origin[i]);
+		direction[i].set(lane, ray.direction[i]);
+	}
+	mask |= 1 << lane;
+}
+
+Ray RayPacket::getRay(int lane) const{
+
+	return Ray(Vector3f(origin[0][lane], origin[1][lane], origin[2][lane]), Vector3f(direction[0][lane], direction[1][lane], direction[2][lane]));
+}
+
+void RayPacket::setHit(int lane, const Hit& hit, Hit* hits){
+
+	t.set(lane, (float)hit.t);
+
+	hits[lane].t = hit.t;
+	hits[lane].transformedRay = hit.transformedRay;
+	hits[lane].part = hit.part;
+	hits[lane].triangle = hit.triangle;
+	hits[lane].b1 = hit.b1;
+	hits[lane].b2 = hit.b2;
+}
@@ -0,0 +1,33 @@
+#ifndef _RAYPACKET_H
+#define _RAYPACKET_H
+
+#include "SIMD.h"
+#include "Ray.h"
+
+class Hit;
+
+// four coherent rays in structure of arrays layout, the camera traces the samples of a pixel together
+class RayPacket{
+
+public:
+
+	static const int Size = 4;
+	static const int AllLanes = (1 << Size) - 1;
+
+	RayPacket();
+
+	void setRay(int lane, const Ray& ray);
+	Ray getRay(int lane) const;
+
+	// lowers t of the lane and keeps the parts of the hit the scene restores for the closest primitive
+	void setHit(int lane, const Hit& hit, Hit* hits);
+
+	Float4 origin[3];
+	Float4 direction[3];
+	// closest hit of each lane so far, only hits in front of it count
+	Float4 t;
+	// the lanes still traced, bit i for lane i
+	int mask;
+};
+
+#endif
@@ -0,0 +1,1110 @@
+#include <iostream>
+#include <map>
+#include <string>
+#include <stdio.h>
+#include <algorithm>
+
+#include "TVector3.h"
+#include "Render.h"
+#include "Model.h"
+#include "Wavefront.h"
+
+//=================================================================================
+// User tweakable parameters - Scenes	Globals
+//=================================================================================
+// image size
+size_t c_imageWidth = 512;
+size_t c_imageHeight = 512;
+
+// sampling parameters
+size_t c_samplesPerPixel = 10000;
+size_t c_numBounces = 5;
+uint64_t c_seed = 0;
+AcceleratorType c_accelerator = KDTreeAccelerator;
+const float c_rayBounceEpsilon = 0.001f;
+const float c_radianceScale = 0.003f;
+bool c_packets = false;
+bool c_nextEventEstimation = true;
+bool c_wavefront = false;
+bool c_sortRays = false;
+bool c_modelCache = true;
+
+// multithreaded rendering
+std::vector<TPixelRGBF32> g_pixels;
+unsigned char *g_pixels2 = NULL;
+
+Projection *camera;
+Scene *scene;
+
+Render task;
+
+//=================================================================================
+void TileQueue::push(int tile) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_tiles.push_back(tile);
+}
+
+bool TileQueue::pop(int& tile) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_tiles.empty()) return false;
+	tile = m_tiles.front();
+	m_tiles.pop_front();
+	return true;
+}
+
+bool TileQueue::steal(int& tile) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_tiles.empty()) return false;
+	tile = m_tiles.back();
+	m_tiles.pop_back();
+	return true;
+}
+
+//=================================================================================
+// interleave the lower 16 bits of x and y
+static unsigned int mortonCode(unsigned int x, unsigned int y) {
+
+	x = (x | (x << 8)) & 0x00FF00FF;
+	x = (x | (x << 4)) & 0x0F0F0F0F;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+
+	y = (y | (y << 8)) & 0x00FF00FF;
+	y = (y | (y << 4)) & 0x0F0F0F0F;
+	y = (y | (y << 2)) & 0x33333333;
+	y = (y | (y << 1)) & 0x55555555;
+
+	return x | (y << 1);
+}
+
+Render::Render() : m_cancel(false), m_finished(false), m_tilesDone(0), m_passTilesDone(0), m_passNumber(0), m_samplesDone(0) {
+
+}
+
+Render::~Render() {
+	cancel();
+}
+
+void Render::setTileSize(int tileSize) {
+	m_tileSize = max(1, tileSize);
+}
+
+void Render::setTileOrder(TileOrder order) {
+	m_order = order;
+}
+
+void Render::setSamplesPerPass(int samples) {
+	m_samplesPerPass = max(1, samples);
+}
+
+void Render::setTimeBudget(float seconds) {
+	m_timeBudget = seconds;
+}
+
+void Render::setAdaptiveThreshold(float error) {
+	m_adaptiveThreshold = error;
+}
+
+void Render::createTiles() {
+
+	int tilesX = ((int)c_imageWidth + m_tileSize - 1) / m_tileSize;
+	int tilesY = ((int)c_imageHeight + m_tileSize - 1) / m_tileSize;
+
+	std::vector<std::pair<float, int>> keys;
+	for (int ty = 0; ty < tilesY; ty++) {
+		for (int tx = 0; tx < tilesX; tx++) {
+
+			float key;
+			if (m_order == Spiral) {
+				// rings around the centre, counter clockwise inside a ring
+				float dx = tx + 0.5f - tilesX * 0.5f;
+				float dy = ty + 0.5f - tilesY * 0.5f;
+				float ring = std::floor(max(std::abs(dx), std::abs(dy)));
+				key = ring * 8.0f + (std::atan2(dy, dx) + (float)PI) / (float)TWO_PI;
+			}else {
+				key = (float)mortonCode(tx, ty);
+			}
+			keys.push_back(std::make_pair(key, ty * tilesX + tx));
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+
+	m_tiles.clear();
+	for (size_t i = 0; i < keys.size(); i++) {
+		int tx = keys[i].second % tilesX;
+		int ty = keys[i].second / tilesX;
+
+		Tile tile;
+		tile.x0 = tx * m_tileSize;
+		tile.y0 = ty * m_tileSize;
+		tile.x1 = min(tile.x0 + m_tileSize, (int)c_imageWidth);
+		tile.y1 = min(tile.y0 + m_tileSize, (int)c_imageHeight);
+		tile.seconds = 0.0f;
+		tile.active = true;
+		m_tiles.push_back(tile);
+	}
+}
+
+void Render::start(size_t numThreads, std::vector<TPixelRGBF32> & pixels, unsigned char* pixels2) {
+
+	cancel();
+
+	m_pixels = &pixels;
+	m_pixels2 = pixels2;
+	numThreads = max(numThreads, (size_t)1);
+
+	createTiles();
+
+	m_queues.clear();
+	for (size_t i = 0; i < numThreads; i++) {
+		m_queues.push_back(std::unique_ptr<TileQueue>(new TileQueue()));
+	}
+
+	m_steals.assign(numThreads, 0);
+	m_tilesDone = 0;
+	m_samplesDone = 0;
+	m_passEnd = 0;
+	m_finished = false;
+	m_startTime = std::chrono::steady_clock::now();
+
+	m_estimates.assign(c_imageWidth * c_imageHeight, PixelEstimate());
+
+	m_statistics = TraceStatistics();
+#if TRACE_STATISTICS
+	m_cost.assign(c_imageWidth * c_imageHeight, 0.0f);
+#endif
+	m_cancel = false;
+	startPass();
+
+	m_threads.resize(numThreads);
+	for (size_t i = 0; i < numThreads; i++) {
+		m_threads[i] = std::thread(&Render::run, this, i);
+	}
+}
+
+void Render::cancel() {
+
+	m_cancel = true;
+	wakeWorkers();
+	wait();
+}
+
+void Render::restart() {
+
+	cancel();
+	if (m_pixels) {
+		start(m_queues.size(), *m_pixels, m_pixels2);
+	}
+}
+
+void Render::wait() {
+
+	for (std::thread& t : m_threads) {
+		if (t.joinable()) t.join();
+	}
+	m_threads.clear();
+}
+
+bool Render::isFinished() const {
+	return m_finished;
+}
+
+size_t Render::getTileCount() const {
+
+	size_t passes = 0;
+	for (size_t samples = 0; samples < c_samplesPerPixel; samples += getPassSize(samples)) {
+		passes++;
+	}
+	return m_tiles.size() * passes;
+}
+
+size_t Render::getPassSize(size_t samplesDone) const {
+
+	// a single pass if it covers the frame, otherwise the first passes double the samples so a preview appears at once
+	// small passes are slower, the rays of a pixel share less of the caches
+	if ((size_t)m_samplesPerPass >= c_samplesPerPixel) return c_samplesPerPixel;
+	return max((size_t)1, min(samplesDone, (size_t)m_samplesPerPass));
+}
+
+void Render::startPass() {
+
+	// tiles whose pixels all converged are left out
+	size_t activeTiles = 0;
+	for (size_t i = 0; i < m_tiles.size(); i++) {
+		if (m_tiles[i].active) activeTiles++;
+	}
+
+	// the budget is checked between passes, so every pixel ends with the same number of samples
+	std::chrono::duration<float> seconds = std::chrono::steady_clock::now() - m_startTime;
+	m_samplesDone = m_passEnd;
+	if (activeTiles == 0 || m_passEnd >= c_samplesPerPixel || (m_timeBudget > 0.0f && m_passEnd > 0 && seconds.count() >= m_timeBudget)) {
+		m_finished = true;
+		wakeWorkers();
+		return;
+	}
+
+	m_passStart = m_passEnd;
+	m_passEnd = min(m_passStart + getPassSize(m_passStart), c_samplesPerPixel);
+	m_passTileCount = activeTiles;
+	m_passTilesDone = 0;
+
+	// every thread gets a contiguous run of the curve, thieves take from the far end
+	size_t numThreads = m_queues.size();
+	size_t queued = 0;
+	for (size_t i = 0; i < m_tiles.size(); i++) {
+		if (m_tiles[i].active) m_queues[queued++ * numThreads / activeTiles]->push((int)i);
+	}
+	wakeWorkers();
+}
+
+void Render::wakeWorkers() {
+
+	// changed under the lock, so a worker between its check and its wait doesn't miss it
+	std::lock_guard<std::mutex> lock(m_passMutex);
+	m_passNumber++;
+	m_passChanged.notify_all();
+}
+
+uint64_t Render::getSamplesTaken() const {
+
+	uint64_t samples = 0;
+	for (size_t i = 0; i < m_estimates.size(); i++) {
+		samples += m_estimates[i].samples;
+	}
+	return samples;
+}
+
+void Render::run(size_t thread) {
+
+	int tile;
+	while (!m_cancel && !m_finished) {
+
+		// read before the queues, a pass queued after it wakes the wait below
+		size_t passNumber = m_passNumber;
+		if (!m_queues[thread]->pop(tile)) {
+
+			// own queue is empty, steal from the others
+			bool stolen = false;
+			for (size_t i = 1; i < m_queues.size() && !stolen; i++) {
+				stolen = m_queues[(thread + i) % m_queues.size()]->steal(tile);
+			}
+			if (!stolen) {
+				// the others still render the last tiles of the pass, sleep until the next one is queued
+				std::unique_lock<std::mutex> lock(m_passMutex);
+				m_passChanged.wait(lock, [&] { return m_cancel || m_finished || m_passNumber != passNumber; });
+				continue;
+			}
+			m_steals[thread]++;
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (!renderTile(m_tiles[tile])) break;
+		std::chrono::duration<float> seconds = std::chrono::steady_clock::now() - start;
+
+		m_tiles[tile].seconds += seconds.count();
+		m_tilesDone++;
+
+		// the worker finishing the last tile of a pass starts the next one
+		if (++m_passTilesDone == m_passTileCount) startPass();
+	}
+
+#if TRACE_STATISTICS
+	// the counters of the thread go to the frame once, not on every increment
+	std::lock_guard<std::mutex> lock(m_statisticsMutex);
+	m_statistics.add(ThreadStatistics());
+	ThreadStatistics() = TraceStatistics();
+#endif
+}
+
+bool Render::renderTile(Tile& tile) {
+
+	if (c_wavefront) {
+		if (!renderWavefront(tile)) return false;
+	}else {
+
+		for (int y = tile.y0; y < tile.y1; ++y) {
+			for (int x = tile.x0; x < tile.x1; ++x) {
+
+				if (m_cancel) {
+					return false;
+				}
+
+				size_t index = y * c_imageWidth + x;
+
+#if TRACE_STATISTICS
+				uint64_t cost = ThreadStatistics().cost();
+#endif
+
+				// render the pixel by taking multiple samples and incrementally averaging them
+				size_t samplesAtOnce = c_packets ? RayPacket::Size : 1;
+				for (size_t i = m_passStart; i < m_passEnd; i += samplesAtOnce) {
+
+					size_t count = min(samplesAtOnce, m_passEnd - i);
+					float u[RayPacket::Size], v[RayPacket::Size];
+					Random streams[RayPacket::Size];
+					Color colors[RayPacket::Size];
+
+					for (size_t j = 0; j < count; ++j) {
+						// every sample gets its own stream, so the image doesn't depend on the thread which renders it
+						ThreadRandom().seed(index, (uint32_t)(i + j), c_seed);
+
+						float jitterX = JITTER_AA() ? RandomFloat() : 0.5f;
+						float jitterY = JITTER_AA() ? RandomFloat() : 0.5f;
+						u[j] = ((float)x + jitterX);
+						v[j] = ((float)y + jitterY);
+						streams[j] = ThreadRandom();
+					}
+
+					if (c_packets) {
+						RenderPixelPacket(u, v, streams, count, colors);
+					}else {
+						RenderPixel(u[0], v[0], colors[0]);
+					}
+
+					for (size_t j = 0; j < count; ++j) {
+						addSample(index, colors[j]);
+					}
+				}
+
+#if TRACE_STATISTICS
+				m_cost[index] += float(ThreadStatistics().cost() - cost);
+#endif
+			}
+		}
+	}
+
+	if (m_adaptiveThreshold > 0.0f && m_passEnd >= MinAdaptiveSamples) {
+		tile.active = getRelativeError(tile) >= m_adaptiveThreshold;
+	}
+
+	resolveTile(tile);
+	return true;
+}
+
+bool Render::renderWavefront(const Tile& tile) {
+
+	// the batches of one thread reuse their memory from tile to tile
+	static thread_local Wavefront wavefront;
+
+	for (int y = tile.y0; y < tile.y1; ++y) {
+		for (int x = tile.x0; x < tile.x1; ++x) {
+
+			if (m_cancel) {
+				wavefront.clear();
+				return false;
+			}
+
+			size_t index = y * c_imageWidth + x;
+			for (size_t i = m_passStart; i < m_passEnd; i++) {
+
+				// the same streams and primary rays as the samples of renderTile
+				ThreadRandom().seed(index, (uint32_t)i, c_seed);
+
+				float jitterX = JITTER_AA() ? RandomFloat() : 0.5f;
+				float jitterY = JITTER_AA() ? RandomFloat() : 0.5f;
+				Ray ray(camera->getPosition(), camera->rasterToCamera((float)x + jitterX, (float)y + jitterY));
+				wavefront.addSample(index, ray, ThreadRandom());
+
+				if (wavefront.isFull()) traceWavefront(wavefront);
+			}
+		}
+	}
+
+	traceWavefront(wavefront);
+	return true;
+}
+
+void Render::traceWavefront(Wavefront& wavefront) {
+
+	wavefront.trace();
+
+	// in the order the samples were added, so the sums of the pixels are the same as those of renderTile
+	for (size_t i = 0; i < wavefront.size(); i++) {
+		addSample(wavefront.getPixel(i), wavefront.getColor(i));
+#if TRACE_STATISTICS
+		m_cost[wavefront.getPixel(i)] += wavefront.getCost(i);
+#endif
+	}
+	wavefront.clear();
+}
+
+void Render::addSample(size_t index, const Color& color) {
+
+	TPixelRGBF32 sample;
+	sample[0] = color.r; sample[1] = color.g; sample[2] = color.b;
+
+	(*m_pixels)[index] += sample;
+	//pixels[index] += (sample - pixels[index]) / float(i + 1.0f);
+
+	m_estimates[index].add(0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b);
+}
+
+float Render::getRelativeError(const Tile& tile) const {
+
+	// root mean square of the standard errors of the pixels relative to their means, dark pixels against a floor
+	// a bright light in the tile must not hide the noise of the pixels around it
+	double squaredError = 0.0;
+	for (int y = tile.y0; y < tile.y1; ++y) {
+		for (int x = tile.x0; x < tile.x1; ++x) {
+
+			const PixelEstimate& estimate = m_estimates[y * c_imageWidth + x];
+			double mean = max(estimate.mean, 0.1f);
+			squaredError += estimate.varianceOfMean() / (mean * mean);
+		}
+	}
+
+	double pixels = double(tile.x1 - tile.x0) * double(tile.y1 - tile.y0);
+	return (float)sqrt(squaredError / pixels);
+}
+
+void Render::resolveTile(const Tile& tile) {
+
+	std::vector<TPixelRGBF32> & pixels = *m_pixels;
+	unsigned char* pixels2 = m_pixels2;
+
+	for (int y = tile.y0; y < tile.y1; ++y) {
+		for (int x = tile.x0; x < tile.x1; ++x) {
+
+			size_t index = y * c_imageWidth + x;
+			uint32_t samples = max(m_estimates[index].samples, (uint32_t)1);
+			for (size_t j = 0; j < 3; j++) {
+				pixels2[index * 3 + j] = uint8(Clamp((pixels[index][2 - j] / (samples)), 0.0f, 1.0f)* 255.0f);
+				//pixels2[index * 3 + j] = uint8(Clamp(powf(pixels[index][2 - j], 1.0f / 2.2f)* 255.0f, 0.0f, 255.0f));
+			}
+		}
+	}
+}
+
+void Render::reportTiles() const {
+
+	if (m_tiles.empty()) return;
+
+	float total = 0.0f, minSeconds = FLT_MAX, maxSeconds = 0.0f;
+	size_t slowest = 0;
+	for (size_t i = 0; i < m_tiles.size(); i++) {
+		total += m_tiles[i].seconds;
+		minSeconds = min(minSeconds, m_tiles[i].seconds);
+		if (m_tiles[i].seconds > maxSeconds) {
+			maxSeconds = m_tiles[i].seconds;
+			slowest = i;
+		}
+	}
+
+	size_t steals = 0;
+	for (size_t i = 0; i < m_steals.size(); i++) {
+		steals += m_steals[i];
+	}
+
+	printf("tiles:           %d x %d px, %d tiles, %d stolen\n", m_tileSize, m_tileSize, (int)m_tiles.size(), (int)steals);
+	printf("tile time:       min %0.2f ms, avg %0.2f ms, max %0.2f ms at (%d, %d)\n", minSeconds * 1000.0f,
+		total / m_tiles.size() * 1000.0f, maxSeconds * 1000.0f, m_tiles[slowest].x0, m_tiles[slowest].y0);
+}
+
+void Render::reportStatistics() const {
+
+#if TRACE_STATISTICS
+	const TraceStatistics& s = m_statistics;
+	double rays = double(s.primaryRays + s.bounceRays + s.shadowRays);
+	if (rays == 0.0) return;
+
+	printf("rays:            %llu primary, %llu bounce, %llu shadow\n", (unsigned long long)s.primaryRays,
+		(unsigned long long)s.bounceRays, (unsigned long long)s.shadowRays);
+	printf("per ray:         %0.2f kd tree nodes, %0.2f bvh nodes, %0.2f triangle tests, %0.2f primitive hits\n",
+		s.kdTreeNodes / rays, s.bvhNodes / rays, s.triangleTests / rays, s.primitiveHits / rays);
+	if (s.rouletteStops > 0) {
+		printf("roulette:        %llu paths stopped, %llu bounces saved (%0.1f%% of the bounce rays)\n", (unsigned long long)s.rouletteStops,
+			(unsigned long long)s.bouncesSaved, 100.0 * s.bouncesSaved / double(s.bounceRays + s.bouncesSaved));
+	}
+#endif
+}
+
+// blue for 0, over green to red for the largest value, stored as bgr like the render buffer
+static void colorRamp(const std::vector<float>& values, std::vector<unsigned char>& data) {
+
+	float maxValue = 0.0f;
+	for (size_t i = 0; i < values.size(); i++) {
+		maxValue = max(maxValue, values[i]);
+	}
+
+	data.resize(values.size() * 3);
+	for (size_t i = 0; i < values.size(); i++) {
+
+		float c = maxValue > 0.0f ? values[i] / maxValue : 0.0f;
+		float r = Clamp(2.0f * c - 1.0f, 0.0f, 1.0f);
+		float g = 1.0f - fabsf(2.0f * c - 1.0f);
+		float b = Clamp(1.0f - 2.0f * c, 0.0f, 1.0f);
+
+		data[i * 3 + 0] = uint8(b * 255.0f);
+		data[i * 3 + 1] = uint8(g * 255.0f);
+		data[i * 3 + 2] = uint8(r * 255.0f);
+	}
+}
+
+bool Render::getHeatmap(std::vector<unsigned char>& data) const {
+
+	if (m_cost.empty()) return false;
+
+	colorRamp(m_cost, data);
+	return true;
+}
+
+bool Render::getSampleMap(std::vector<unsigned char>& data) const {
+
+	if (m_adaptiveThreshold <= 0.0f || m_estimates.empty()) return false;
+
+	std::vector<float> samples(m_estimates.size());
+	for (size_t i = 0; i < m_estimates.size(); i++) {
+		samples[i] = (float)m_estimates[i].samples;
+	}
+	colorRamp(samples, data);
+	return true;
+}
+
+//=================================================================================
+Color L_out(const Vector3f& outDir, size_t bouncesLeft, const Hit& hit) {
+
+	// if no bounces left, return the ray miss color
+	if (bouncesLeft == 0)
+		return Color(0.0, 0.0, 0.0);
+
+	Material* material = hit.material;
+
+	Color ret = material && material->getType() == Material::Light ? Color(1.0, 1.0, 1.0) : Color(0.0, 0.0, 0.0);
+
+	Vector3f normal = hit.normal;
+	Vector3f intersectionPoint = hit.hitPoint;
+	Color diffuse = hit.color;
+
+	// add in random recursive samples for global illumination
+	{
+#if COSINE_WEIGHTED_HEMISPHERE_SAMPLES()
+		Vector3f transformedhitPoint = hit.originalRay.origin + hit.originalRay.direction * hit.t;
+		Vector3f newRayDir = CosineSampleHemisphere(normal);
+		Vector3f newRayOrigin = transformedhitPoint + newRayDir * c_rayBounceEpsilon;
+
+		Ray ray(newRayOrigin, newRayDir);
+		STATISTIC(bounceRays, 1);
+		Hit hit = scene->hitObjects2(ray);
+		if (hit.hitObject) {
+			ret = ret + L_out(-newRayDir, bouncesLeft - 1, hit) * diffuse;
+		}else {
+			ret = ret + Color(0.0, 0.0, 0.0) * diffuse;
+		}
+#else
+		// this point is in  eyespace
+		Vector3f transformedhitPoint = hit.originalRay.origin + hit.originalRay.direction * hit.t;
+		Vector3f newRayDir = UniformSampleHemisphere(normal);
+		Vector3f newRayOrigin = transformedhitPoint + newRayDir * c_rayBounceEpsilon;
+
+		Ray ray(newRayOrigin, newRayDir);
+		STATISTIC(bounceRays, 1);
+		Hit hit = scene->hitObjects2(ray);
+
+		if (hit.hitObject) {
+			ret = ret + L_out(-newRayDir, bouncesLeft - 1, hit) * diffuse * Vector3f::dot(newRayDir, normal) * 2.0f ;
+		}else {
+			ret = ret + Color(0.0, 0.0, 0.0) * diffuse * Vector3f::dot(newRayDir, normal) * 2.0f;
+		}
+#endif
+	}
+	return ret;
+}
+
+
+//=================================================================================
+// density in solid angle of the bounce direction at a diffuse point
+static float BouncePdf(float cosine) {
+#if COSINE_WEIGHTED_HEMISPHERE_SAMPLES()
+	return cosine * float(invPI);
+#else
+	return 0.5f * float(invPI);
+#endif
+}
+
+static float PowerHeuristic(float pdf, float otherPdf) {
+	return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+//=================================================================================
+const AreaLight* FindLight(const Hit& hit) {
+
+	for (unsigned int i = 0; i < scene->m_lights.size(); i++) {
+		const AreaLight* light = static_cast<AreaLight*>(scene->m_lights[i].get());
+		if (light->m_primitive.get() == hit.primitive)
+			return light;
+	}
+	return NULL;
+}
+
+//=================================================================================
+Color L_emitted(const AreaLight* light, const Hit& hit, float bouncePdf) {
+
+	Color Le = hit.color * (1.0 / light->pdf(hit));
+
+	// the light sampling at the point the bounce started from could have found this point as well
+	if (c_nextEventEstimation && bouncePdf > 0.0f) {
+		float lightPdf = light->pdf(hit.originalRay.origin, hit) / scene->m_lights.size();
+		if (lightPdf > 0.0f && lightPdf < FLT_MAX) Le = Le * PowerHeuristic(bouncePdf, lightPdf);
+	}
+	return Le;
+}
+
+//=================================================================================
+bool SampleLight(const Vector3f& position, const Vector3f& normal, Ray& shadowRay, float& distance, const Primitive*& lightPrimitive, Color& radiance) {
+
+	size_t numberOfLights = scene->m_lights.size();
+	if (numberOfLights == 0)
+		return false;
+
+	size_t index = min(size_t(RandomFloat() * numberOfLights), numberOfLights - 1);
+	const AreaLight* light = static_cast<AreaLight*>(scene->m_lights[index].get());
+
+	Vector3f wi;
+	float lightPdf;
+	Color Le = light->sample(position, wi, distance, lightPdf);
+
+	// lights without an area or a finite density can't be sampled, they are only found by the bounces
+	float cosine = Vector3f::dot(normal, wi);
+	if (!(lightPdf > 0.0f && lightPdf < FLT_MAX) || cosine <= 0.0f)
+		return false;
+
+	shadowRay = Ray(position + normal * c_rayBounceEpsilon, wi);
+	distance -= 2.0f * c_rayBounceEpsilon;
+	lightPrimitive = light->m_primitive.get();
+
+	// weighted against finding the same point of the light with the bounce
+	float pdf = lightPdf / numberOfLights;
+	radiance = Le * (cosine * float(invPI) / pdf * PowerHeuristic(pdf, BouncePdf(cosine)));
+	return true;
+}
+
+//=================================================================================
+bool NextBounce(const Hit& hit, Material::Type type, size_t bouncesLeft, const Vector3f& position, Color& throughput, float& bouncePdf, Ray& ray) {
+
+	const Vector3f& normal = hit.normal;
+
+	// russian roulette once the path made the bounces of the scene minimum, a dark path most likely ends here
+	// the paths that go on are weighted up by the probability, so the image stays unbiased
+	Color weight = throughput * hit.color;
+	float continuation = scene->continuationProbability(weight, int(c_numBounces - bouncesLeft));
+	if (continuation < 1.0f) {
+		if (RandomFloat() >= continuation) {
+			STATISTIC(rouletteStops, 1);
+			STATISTIC(bouncesSaved, bouncesLeft - 1);
+			return false;
+		}
+		weight = weight / continuation;
+	}
+
+	// add in random recursive samples for global illumination
+	Vector3f newRayOrigin;
+	Vector3f newRayDir;
+
+	if (type == Material::Specular) {
+
+		float dot = Vector3f::dot(hit.originalRay.direction, normal);
+		newRayDir = hit.originalRay.direction - (normal  * 2.0f * dot);
+		newRayOrigin = dot < 0 ? position + normal * c_rayBounceEpsilon : position - normal * c_rayBounceEpsilon;
+		bouncePdf = 0.0f;
+	}else {
+
+#if COSINE_WEIGHTED_HEMISPHERE_SAMPLES()
+		newRayDir = CosineSampleHemisphere(normal);
+#else
+		newRayDir = UniformSampleHemisphere(normal);
+		weight = weight * (Vector3f::dot(normal, newRayDir) * 2.0f);
+#endif
+		newRayOrigin = position + newRayDir * c_rayBounceEpsilon;
+		bouncePdf = BouncePdf(Vector3f::dot(normal, newRayDir));
+	}
+
+	throughput = weight;
+	ray = Ray(newRayOrigin, newRayDir);
+	return true;
+}
+
+//=================================================================================
+Color L_out2(size_t bouncesLeft, const Hit& firstHit) {
+
+	// all the path carries from one bounce to the next, the bounces share one hit record
+	Color L(0.0, 0.0, 0.0);
+	Color throughput(1.0, 1.0, 1.0);
+	float bouncePdf = 0.0f;		// density of the direction of the bounce that found the hit, 0 for the camera ray and mirrors
+	const Hit* current = &firstHit;
+	Hit bounceHit;
+
+	// with no bounces left the ray counts as a miss
+	for (; bouncesLeft > 0; bouncesLeft--) {
+
+		const Hit& hit = *current;
+		Material::Type type = hit.material ? hit.material->getType() : Material::Diffuse;
+
+		// an emissive surface without a light is lit like any other
+		const AreaLight* light = type == Material::Light ? FindLight(hit) : NULL;
+		if (light) {
+			L = L + throughput * L_emitted(light, hit, bouncePdf);
+			break;
+		}
+
+		// a light found by the last bounce counts for nothing, the path ends without tracing it
+		if (bouncesLeft == 1)
+			break;
+
+		// this point is in  eyespace
+		Vector3f position = hit.originalRay.origin + hit.originalRay.direction * hit.t;
+
+		if (c_nextEventEstimation && type != Material::Specular) {
+
+			Ray shadowRay;
+			float distance;
+			const Primitive* lightPrimitive;
+			Color radiance;
+			if (SampleLight(position, hit.normal, shadowRay, distance, lightPrimitive, radiance) && !scene->shadowHit(shadowRay, distance, lightPrimitive))
+				L = L + throughput * hit.color * radiance;
+		}
+
+		Ray ray;
+		if (!NextBounce(hit, type, bouncesLeft, position, throughput, bouncePdf, ray))
+			break;
+
+		STATISTIC(bounceRays, 1);
+		if (!scene->hitObjects2(ray, bounceHit))
+			break;
+		current = &bounceHit;
+	}
+
+	return L;
+}
+
+//=================================================================================
+Color L_in(const Vector3f& rayPos, const Vector3f& rayDir) {
+
+	Ray ray(rayPos, rayDir);
+	return L_in(scene->hitObjects2(ray));
+}
+
+//=================================================================================
+Color L_in(const Hit& hit) {
+
+	if (!hit.hitObject)
+		return Color(0.0, 0.0, 0.0);
+
+	return L_out2(c_numBounces, hit) * c_radianceScale;
+}
+
+
+//=================================================================================
+Color RenderPixel(float u, float v, Color& color) {
+	 STATISTIC(primaryRays, 1);
+	 color = L_in(camera->getPosition(), camera->rasterToCamera(u, v));
+	 return color;
+}
+
+//=================================================================================
+void RenderPixelPacket(const float* u, const float* v, Random* streams, size_t count, Color* colors) {
+
+	RayPacket packet;
+	for (size_t j = 0; j < count; ++j) {
+		packet.setRay((int)j, Ray(camera->getPosition(), camera->rasterToCamera(u[j], v[j])));
+	}
+
+	STATISTIC(primaryRays, count);
+
+	Hit hits[RayPacket::Size];
+	scene->hitObjects2(packet, hits);
+
+	// the bounces diverge, they are traced one by one with the stream of their sample
+	for (size_t j = 0; j < count; ++j) {
+		ThreadRandom() = streams[j];
+		colors[j] = L_in(hits[j]);
+	}
+}
+
+//=================================================================================
+void createCornellBox() {
+
+	int numSample = 100;
+
+	Vector3f camPos(278.0f, 273.0f, -800.0f);
+	Vector3f target(278.0f, 273.0f, 0.0f);
+	Vector3f up(0, 1.0, 0.0);
+	camera = new Projection(camPos, target, up);
+
+	Sampler* samplerMatte = new MultiJittered(numSample, 83);
+	samplerMatte->mapSamplesToHemisphere(1.0);
+
+
+	Vector3f p0, a, b;
+	// box dimensions
+	double width = 552.8f;   	// x direction
+	double height = 548.8f;  	// y direction
+	double depth = 559.2f;	// z direction
+
+	scene = new Scene(ViewPlane(300, 300, 1.0), Color(0.0, 0.0, 0.0));
+
+	Emissive* emissiveMat = new Emissive();
+	emissiveMat->setScaleRadiance(100.0);
+	emissiveMat->setColor(Color(1.0, 1.0, 1.0));
+
+	Matte* matte1 = new Matte();
+	matte1->setKa(0.25);
+	matte1->setKd(0.6);
+	matte1->setSampler(samplerMatte);
+
+	Reflective *reflective = new Reflective();
+	reflective->setReflectionColor(1.0);
+	reflective->setFrensel(0.4);
+
+	QuadCC* light = new QuadCC(Vector3f(343.0f, 548.6f, 227.0f + 45.0f), Vector3f(343.0f, 548.6f, 332.0f + 45.0f), Vector3f(213.0f, 548.6f, 332.0f + 45.0f), Vector3f(213.0f, 548.6f, 227.0f + 45.0f));
+	light->setMaterial(emissiveMat);
+	light->setColor(Color(1.0, 1.0, 1.0));
+	scene->addPrimitive(light);
+
+	p0 = Vector3f(width, height, 0.0); a = Vector3f(0.0, 0.0, depth); b = Vector3f(-width, 0.0, 0.0);
+	QuadCC* ceiling = new QuadCC(Vector3f(556.0f, 548.8f, 0.0f), Vector3f(556.0f, 548.8f, 559.2f), Vector3f(0.0f, 548.8f, 559.2f), Vector3f(0.0f, 548.8f, 0.0f));
+	ceiling->setMaterial(emissiveMat);
+	ceiling->setColor(Color(0.7f, 0.7f, 0.7f));
+	scene->addPrimitive(ceiling);
+
+	AreaLight* areaLight = new AreaLight;
+	areaLight->setObject(light);
+	areaLight->setShadows(true);
+	scene->addLight(areaLight);
+
+	QuadCC* leftWall = new QuadCC(Vector3f(0.0f, 0.0f, 559.2f), Vector3f(0.0f, 0.0f, 0.0f), Vector3f(0.0f, 548.8f, 0.0f), Vector3f(0.0f, 548.8f, 559.2f));
+	leftWall->setMaterial(matte1);
+	leftWall->setColor(Color(0.2f, 0.7f, 0.2f));  // green
+	scene->addPrimitive(leftWall);
+
+	QuadCC* floor = new QuadCC(Vector3f(552.8f, 0.0f, 0.0f), Vector3f(0.0f, 0.0f, 0.0f), Vector3f(0.0f, 0.0f, 559.2f), Vector3f(549.6f, 0.0f, 559.2f));
+	floor->setMaterial(matte1);
+	floor->setColor(Color(0.7f, 0.7f, 0.7f));
+	scene->addPrimitive(floor);
+
+	QuadCC* rightWall = new QuadCC(Vector3f(552.8f, 0.0f, 0.0f), Vector3f(549.6f, 0.0f, 559.2f), Vector3f(556.0f, 548.8f, 559.2f), Vector3f(556.0f, 548.8f, 0.0f));
+	rightWall->setMaterial(matte1);
+	rightWall->setColor(Color(0.7f, 0.2f, 0.2f));  // red
+	scene->addPrimitive(rightWall);
+
+	QuadCC* backWall = new QuadCC(Vector3f(549.6f, 0.0f, 559.2f), Vector3f(0.0f, 0.0f, 559.2f), Vector3f(0.0f, 548.8f, 559.2f), Vector3f(556.0f, 548.8f, 559.2f));
+	backWall->setMaterial(matte1);
+	backWall->setColor(Color(0.7f, 0.7f, 0.7f));
+	scene->addPrimitive(backWall);
+
+	Sphere* sphere = new Sphere(Vector3f(185.5f, 225.5f, 169.0f), 60);
+	sphere->setMaterial(reflective);
+	sphere->setColor(Color(1.0f, 1.0f, 1.0f));
+	scene->addPrimitive(sphere);
+
+	AABB* smallBox = new AABB(Vector3f(0.0, 0.0, 0.0), Vector3f(82.5f, 82.5f, 82.5f));
+	smallBox->setMaterial(matte1);
+	smallBox->setColor(Color(0.7f, 0.7f, 0.7f));
+
+	Instance* _smallBox = new Instance(smallBox);
+	_smallBox->rotate(Vector3f(0.0, 1.0, 0.0), -17.0f);
+	_smallBox->translate(185.5f, 82.5f, 169.0f);
+	scene->addPrimitive(_smallBox);
+
+	AABB* largeBox = new AABB(Vector3f(0.0, 0.0, 0.0), Vector3f(82.5f, 165.0f, 82.5f));
+	largeBox->setMaterial(matte1);
+	largeBox->setColor(Color(0.7f, 0.7f, 0.7f));
+
+	Instance* _largeBox = new Instance(largeBox);
+	_largeBox->rotate(Vector3f(0.0, 1.0, 0.0), 107.0f );
+	_largeBox->translate(368.5f, 165.0f, 351.25);
+	scene->addPrimitive(_largeBox);
+
+	scene->finalize();
+}
+
+//=================================================================================
+// plain text scene description, one statement per line, '#' starts a comment
+//
+// camera     ex ey ez  tx ty tz
+// matte      name kd ka
+// reflective name reflectionColor frensel
+// emissive   name radiance
+// light      material  ax ay az  bx by bz  cx cy cz  dx dy dz  r g b
+// quad       material  ax ay az  bx by bz  cx cy cz  dx dy dz  r g b
+// sphere     material  cx cy cz  radius  r g b
+// box        material  sx sy sz  rotateY  tx ty tz  r g b
+// obj        material  filename  scale  rotateY  tx ty tz  r g b  [kdtree|bvh]	(material "-" keeps the mtl materials)
+// instance   material  filename  scale  rotateY  tx ty tz  r g b  [kdtree|bvh]	(like obj, but every file is loaded and built once and shared by its instances)
+bool loadScene(const char* filename) {
+
+	FILE * pFile = fopen(filename, "r");
+	if (pFile == NULL){
+		std::cout << "Scene file not found: " << filename << std::endl;
+		return false;
+	}
+
+	std::map<std::string, Material*> materials;
+	// the models of the instance statements by filename and acceleration structure
+	std::map<std::string, std::shared_ptr<Model>> models;
+	int numSample = 100;
+
+	Sampler* samplerMatte = new MultiJittered(numSample, 83);
+	samplerMatte->mapSamplesToHemisphere(1.0);
+
+	scene = new Scene(ViewPlane(300, 300, 1.0), Color(0.0, 0.0, 0.0));
+	camera = NULL;
+
+	char buffer[512], keyword[64], name[64], path[256], accelerator[64];
+	float v[16];
+	int line = 0, fields;
+
+	while (fgets(buffer, sizeof(buffer), pFile) != NULL){
+		line++;
+
+		if (sscanf(buffer, "%63s", keyword) != 1 || keyword[0] == '#') continue;
+
+		std::string key(keyword);
+
+		if (key == "camera" && sscanf(buffer, "%*s %f %f %f %f %f %f", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) == 6){
+
+			camera = new Projection(Vector3f(v[0], v[1], v[2]), Vector3f(v[3], v[4], v[5]), Vector3f(0.0, 1.0, 0.0));
+
+		}else if (key == "matte" && sscanf(buffer, "%*s %63s %f %f", name, &v[0], &v[1]) == 3){
+
+			Matte* matte = new Matte();
+			matte->setKd(v[0]);
+			matte->setKa(v[1]);
+			matte->setSampler(samplerMatte);
+			materials[name] = matte;
+
+		}else if (key == "reflective" && sscanf(buffer, "%*s %63s %f %f", name, &v[0], &v[1]) == 3){
+
+			Reflective *reflective = new Reflective();
+			reflective->setReflectionColor(v[0]);
+			reflective->setFrensel(v[1]);
+			materials[name] = reflective;
+
+		}else if (key == "emissive" && sscanf(buffer, "%*s %63s %f", name, &v[0]) == 2){
+
+			Emissive* emissive = new Emissive();
+			emissive->setScaleRadiance(v[0]);
+			emissive->setColor(Color(1.0, 1.0, 1.0));
+			materials[name] = emissive;
+
+		}else if ((key == "light" || key == "quad") && sscanf(buffer, "%*s %63s %f %f %f %f %f %f %f %f %f %f %f %f %f %f %f", name,
+			&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9], &v[10], &v[11], &v[12], &v[13], &v[14]) == 16 && materials.count(name)){
+
+			QuadCC* quad = new QuadCC(Vector3f(v[0], v[1], v[2]), Vector3f(v[3], v[4], v[5]), Vector3f(v[6], v[7], v[8]), Vector3f(v[9], v[10], v[11]));
+			quad->setMaterial(materials[name]);
+			quad->setColor(Color(v[12], v[13], v[14]));
+			scene->addPrimitive(quad);
+
+			if (key == "light"){
+				AreaLight* areaLight = new AreaLight;
+				areaLight->setObject(quad);
+				areaLight->setShadows(true);
+				scene->addLight(areaLight);
+			}
+
+		}else if (key == "sphere" && sscanf(buffer, "%*s %63s %f %f %f %f %f %f %f", name, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]) == 8 && materials.count(name)){
+
+			Sphere* sphere = new Sphere(Vector3f(v[0], v[1], v[2]), v[3]);
+			sphere->setMaterial(materials[name]);
+			sphere->setColor(Color(v[4], v[5], v[6]));
+			scene->addPrimitive(sphere);
+
+		}else if (key == "box" && sscanf(buffer, "%*s %63s %f %f %f %f %f %f %f %f %f %f", name,
+			&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9]) == 11 && materials.count(name)){
+
+			AABB* box = new AABB(Vector3f(0.0, 0.0, 0.0), Vector3f(v[0], v[1], v[2]));
+			box->setMaterial(materials[name]);
+			box->setColor(Color(v[7], v[8], v[9]));
+
+			Instance* instance = new Instance(box);
+			instance->rotate(Vector3f(0.0, 1.0, 0.0), v[3]);
+			instance->translate(v[4], v[5], v[6]);
+			scene->addPrimitive(instance);
+
+		}else if (key == "roulette" && sscanf(buffer, "%*s %63s", name) == 1){
+
+			// the bounces every path makes before russian roulette, or off
+			if (std::string(name) == "off") scene->setRussianRoulette(-1);
+			else scene->setRussianRoulette(atoi(name));
+
+		}else if (key == "obj" && (fields = sscanf(buffer, "%*s %63s %255s %f %f %f %f %f %f %f %f %63s", name, path,
+			&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], accelerator)) >= 10 && (materials.count(name) || std::string(name) == "-")){
+
+			AcceleratorType type = c_accelerator;
+			if (fields == 11 && !Accelerator::parseType(accelerator, type)){
+				std::cout << "Invalid acceleration structure at line " << line << ": " << accelerator << std::endl;
+				fclose(pFile);
+				return false;
+			}
+
+			Model* model = new Model();
+			model->setCache(c_modelCache);
+			//filename,rotation, translation, cull backface, smooth shading
+			if (!model->loadObject(path, Vector3f(0.0, 1.0, 0.0), v[1], Vector3f(v[2], v[3], v[4]), v[0], false, true)){
+				std::cout << "Could not load " << path << std::endl;
+				fclose(pFile);
+				return false;
+			}
+			model->setAccelerator(type);
+			model->buildAccelerator();
+
+			if (materials.count(name)){
+				model->setMaterial(materials[name]);
+				model->setColor(Color(v[5], v[6], v[7]));
+			}
+			scene->addPrimitive(model);
+
+		}else if (key == "instance" && (fields = sscanf(buffer, "%*s %63s %255s %f %f %f %f %f %f %f %f %63s", name, path,
+			&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], accelerator)) >= 10 && (materials.count(name) || std::string(name) == "-")){
+
+			AcceleratorType type = c_accelerator;
+			if (fields == 11 && !Accelerator::parseType(accelerator, type)){
+				std::cout << "Invalid acceleration structure at line " << line << ": " << accelerator << std::endl;
+				fclose(pFile);
+				return false;
+			}
+
+			std::shared_ptr<Model>& model = models[std::string(path) + " " + std::to_string((int)type)];
+			if (!model){
+
+				//the model stays in the space of the file, the instances place it
+				model = std::make_shared<Model>();
+				model->setCache(c_modelCache);
+				if (!model->loadObject(path, Vector3f(0.0, 1.0, 0.0), 0.0f, Vector3f(0.0, 0.0, 0.0), 1.0f, false, true)){
+					std::cout << "Could not load " << path << std::endl;
+					fclose(pFile);
+					return false;
+				}
+				model->setAccelerator(type);
+				model->buildAccelerator();
+			}
+
+			Instance* instance = new Instance(model);
+			instance->scale(v[0], v[0], v[0]);
+			//Instance::rotate turns the other way than loadObject, the angle means the same as for obj
+			instance->rotate(Vector3f(0.0, 1.0, 0.0), -v[1]);
+			instance->translate(v[2], v[3], v[4]);
+
+			if (materials.count(name)){
+				instance->setMaterial(materials[name]);
+				instance->setColor(Color(v[5], v[6], v[7]));
+			}
+			scene->addPrimitive(instance);
+
+		}else {
+
+			std::cout << "Invalid scene statement at line " << line << ": " << buffer;
+			fclose(pFile);
+			return false;
+		}
+	}
+	fclose(pFile);
+
+	if (!camera){
+		std::cout << "Scene has no camera" << std::endl;
+		return false;
+	}
+
+	scene->finalize();
+
+	return true;
+}
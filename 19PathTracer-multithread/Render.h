@@ -0,0 +1,240 @@
+#ifndef _RENDER_H
+#define _RENDER_H
+
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+#include <cfloat>
+
+#include "Utils.h"
+#include "Camera.h"
+#include "Scene.h"
+#include "Accelerator.h"
+#include "Statistics.h"
+
+#define COSINE_WEIGHTED_HEMISPHERE_SAMPLES() 1
+#define JITTER_AA() 1
+
+//=================================================================================
+// User tweakable parameters - Scenes	Globals
+//=================================================================================
+// image size
+extern size_t c_imageWidth;
+extern size_t c_imageHeight;
+
+// sampling parameters
+extern size_t c_samplesPerPixel;
+extern size_t c_numBounces;
+extern uint64_t c_seed;
+
+// acceleration structure of the meshes unless the scene file picks one
+extern AcceleratorType c_accelerator;
+extern const float c_rayBounceEpsilon;
+// the path radiance is scaled by this for the display
+extern const float c_radianceScale;
+
+// trace the primary rays of four samples of a pixel as one packet
+extern bool c_packets;
+
+// sample the area lights directly at every diffuse point and weight them against the bounces with multiple importance sampling
+extern bool c_nextEventEstimation;
+
+// trace the samples of a tile in wavefront batches instead of one path after the other, the image is the same
+extern bool c_wavefront;
+// sort the bounce rays of a wavefront batch by direction octant and origin cell before they are traced
+extern bool c_sortRays;
+
+// keep the parsed obj files and their acceleration structures in binary caches next to them
+extern bool c_modelCache;
+
+// multithreaded rendering
+extern std::vector<TPixelRGBF32> g_pixels;
+extern unsigned char *g_pixels2;
+
+extern Projection *camera;
+extern Scene *scene;
+
+// order in which the tiles are handed out, spiral starts in the middle of the image
+enum TileOrder { Morton, Spiral };
+
+class Wavefront;
+
+struct Tile {
+	int x0, y0, x1, y1;
+	float seconds;			// render time of all passes so far
+	bool active;			// still takes samples, adaptive sampling stops converged tiles
+};
+
+// running mean and variance of the luminance of the samples of a pixel, updated with Welford's algorithm
+struct PixelEstimate {
+
+	uint32_t samples = 0;
+	float mean = 0.0f;
+	float m2 = 0.0f;
+
+	void add(float value) {
+
+		samples++;
+		float delta = value - mean;
+		mean += delta / samples;
+		m2 += delta * (value - mean);
+	}
+
+	// the squared standard error of the mean
+	float varianceOfMean() const {
+		return samples < 2 ? FLT_MAX : m2 / (samples - 1) / samples;
+	}
+};
+
+// per thread tile deque, the owner pops from the front and other threads steal from the back
+class TileQueue {
+
+public:
+	void push(int tile);
+	bool pop(int& tile);
+	bool steal(int& tile);
+
+private:
+	std::deque<int> m_tiles;
+	std::mutex m_mutex;
+};
+
+// progressive renderer, every pass adds a few samples to all pixels of the frame, so the whole image converges evenly
+// pixels accumulates the hdr sums of the samples, pixels2 gets the average of a tile when a pass over it is done
+// the tiles of a pass are disjoint, each is written by one worker without locks
+class Render {
+
+public:
+	Render();
+	~Render();
+
+	void setTileSize(int tileSize);
+	void setTileOrder(TileOrder order);
+	// samples per pixel added by one pass once the passes have doubled up to it, the frame ends with c_samplesPerPixel
+	void setSamplesPerPass(int samples);
+	// the frame also ends after the pass running when the budget is spent, 0 for no limit
+	void setTimeBudget(float seconds);
+	// a tile stops taking samples once the relative error of its pixels falls below the threshold
+	// the later passes only visit the noisy tiles, 0 gives every pixel c_samplesPerPixel
+	// single pixels are not stopped, with a few samples a pixel that has seen no light at all looks converged
+	void setAdaptiveThreshold(float error);
+
+	// starts rendering one frame into the buffers, returns immediately
+	void start(size_t numThreads, std::vector<TPixelRGBF32> & pixels, unsigned char* pixels2);
+	// stops all workers after their current pixel and waits for them
+	void cancel();
+	// cancel and start again with the same buffers, the buffers are not cleared
+	void restart();
+	// blocks until the frame is done
+	void wait();
+
+	bool isFinished() const;
+	// progress in tiles of all passes
+	size_t getTilesDone() const { return m_tilesDone; }
+	size_t getTileCount() const;
+	// samples every pixel has after the finished passes, unless its tile converged before
+	size_t getSamplesDone() const { return m_samplesDone; }
+	// samples of all pixels
+	uint64_t getSamplesTaken() const;
+	const std::vector<Tile>& getTiles() const { return m_tiles; }
+	void reportTiles() const;
+
+	// frame totals of the traversal counters, they stay zero unless built with TRACE_STATISTICS
+	const TraceStatistics& getStatistics() const { return m_statistics; }
+	void reportStatistics() const;
+	// the traversal work of every pixel from blue to red, in the layout of the render buffer
+	// returns false if the counters are compiled out
+	bool getHeatmap(std::vector<unsigned char>& data) const;
+	// the samples of every pixel in the same colours, returns false without adaptive sampling
+	bool getSampleMap(std::vector<unsigned char>& data) const;
+
+private:
+
+	void createTiles();
+	// queues the tiles of the next pass, or ends the frame
+	void startPass();
+	// wakes the idle workers after a pass was queued, the frame ended or was cancelled
+	void wakeWorkers();
+	size_t getPassSize(size_t samplesDone) const;
+	void run(size_t thread);
+	bool renderTile(Tile& tile);
+	// the samples of the pass over the tile in wavefront batches
+	bool renderWavefront(const Tile& tile);
+	void traceWavefront(Wavefront& wavefront);
+	// adds a sample to the sum and the estimate of the pixel
+	void addSample(size_t index, const Color& color);
+	// the averages of the tile for the display buffer
+	void resolveTile(const Tile& tile);
+	float getRelativeError(const Tile& tile) const;
+
+	int m_tileSize = 16;
+	TileOrder m_order = Morton;
+	int m_samplesPerPass = 16;
+	float m_timeBudget = 0.0f;
+	float m_adaptiveThreshold = 0.0f;
+
+	// the error estimate of fewer samples is too unreliable to stop a tile
+	static const uint32_t MinAdaptiveSamples = 64;
+
+	std::vector<Tile> m_tiles;
+	std::vector<std::unique_ptr<TileQueue>> m_queues;
+	std::vector<std::thread> m_threads;
+	std::vector<size_t> m_steals;
+
+	std::vector<TPixelRGBF32>* m_pixels = NULL;
+	unsigned char* m_pixels2 = NULL;
+
+	std::atomic<bool> m_cancel;
+	std::atomic<bool> m_finished;
+	std::atomic<size_t> m_tilesDone;
+
+	// samples of the running pass, set before its tiles are queued
+	size_t m_passStart = 0;
+	size_t m_passEnd = 0;
+	size_t m_passTileCount = 0;
+	std::atomic<size_t> m_passTilesDone;
+	// raised by every wake up, idle workers sleep until it changes
+	std::atomic<size_t> m_passNumber;
+	std::mutex m_passMutex;
+	std::condition_variable m_passChanged;
+	std::atomic<size_t> m_samplesDone;
+	std::chrono::steady_clock::time_point m_startTime;
+
+	TraceStatistics m_statistics;
+	std::mutex m_statisticsMutex;
+	std::vector<float> m_cost;
+	std::vector<PixelEstimate> m_estimates;
+};
+extern Render task;
+
+Color L_out(const Vector3f& outDir, size_t bouncesLeft, const Hit& hit);
+// follows the path from the first hit in a loop, the material types decide how it goes on
+Color L_out2(size_t bouncesLeft, const Hit& firstHit);
+
+// the steps of a path at one hit, shared by L_out2 and the wavefront tracer so both make the same image
+// the area light whose primitive was hit, NULL for emissive surfaces without a light
+const AreaLight* FindLight(const Hit& hit);
+// radiance of a light found by a bounce of density bouncePdf, 0 for the camera ray and mirrors
+Color L_emitted(const AreaLight* light, const Hit& hit, float bouncePdf);
+// a point on a random light for the diffuse point at position, sets the shadow ray to it and the radiance that arrives
+// unless the ray is blocked, without the colour of the surface, false if the light can not reach the point
+bool SampleLight(const Vector3f& position, const Vector3f& normal, Ray& shadowRay, float& distance, const Primitive*& lightPrimitive, Color& radiance);
+// russian roulette and the ray of the next bounce, throughput and bouncePdf are updated for it, false if the path ends
+bool NextBounce(const Hit& hit, Material::Type type, size_t bouncesLeft, const Vector3f& position, Color& throughput, float& bouncePdf, Ray& ray);
+Color L_in(const Vector3f& rayPos, const Vector3f& rayDir);
+Color L_in(const Hit& hit);
+Color RenderPixel(float u, float v, Color& color);
+// the streams continue the random numbers of each sample after its primary ray
+void RenderPixelPacket(const float* u, const float* v, Random* streams, size_t count, Color* colors);
+
+// scene setup shared by the window and the batch renderer
+void createCornellBox();
+bool loadScene(const char* filename);
+
+#endif // _RENDER_H
@@ -14,6 +14,7 @@
 #include <cmath>
 
 #include "STimer.h"
+#include "Random.h"
 #include "Camera.h"
 #include "Vector.h"
 #include "Color.h"
@@ -73,21 +74,7 @@ class RenderTask :  public Stoppable2 {
 public:
 
 	float RandomFloat() {
-
-		/*
-		// Xorshift random number algorithm invented by George Marsaglia
-		static uint32_t rng_state = 0xf2eec0de;
-		rng_state ^= (rng_state << 13);
-		rng_state ^= (rng_state >> 17);
-		rng_state ^= (rng_state << 5);
-		return float(rng_state) * (1.0f / 4294967296.0f);
-		*/
-
-		// alternately, using a standard c++ prng
-		static std::random_device rd;
-		static std::mt19937 mt(rd());
-		static std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-		return dist(mt);
+		return ThreadRandom().nextFloat();
 	}
 
 
@@ -0,0 +1,114 @@
+#ifndef _SIMD_H
+#define _SIMD_H
+
+#include <cmath>
+#include <stdint.h>
+
+// sse2 is part of every x64 target, other targets get the plain c++ version below
+// defining SIMD_SCALAR builds the plain version everywhere, for comparing both
+#if !defined(SIMD_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SIMD_SSE 1
+#include <emmintrin.h>
+#else
+#define SIMD_SSE 0
+#endif
+
+
+// four floats processed together, comparisons set all bits of the lanes where they hold
+class Float4{
+
+public:
+
+#if SIMD_SSE
+
+	Float4() {}
+	Float4(float value) : m(_mm_set1_ps(value)) {}
+	Float4(__m128 value) : m(value) {}
+
+	float operator[](int lane) const { return f[lane]; }
+	void set(int lane, float value) { f[lane] = value; }
+
+	Float4 operator+(const Float4& rhs) const { return _mm_add_ps(m, rhs.m); }
+	Float4 operator-(const Float4& rhs) const { return _mm_sub_ps(m, rhs.m); }
+	Float4 operator*(const Float4& rhs) const { return _mm_mul_ps(m, rhs.m); }
+	Float4 operator/(const Float4& rhs) const { return _mm_div_ps(m, rhs.m); }
+	Float4 operator-() const { return _mm_xor_ps(m, _mm_set1_ps(-0.0f)); }
+
+	Float4 operator<(const Float4& rhs) const { return _mm_cmplt_ps(m, rhs.m); }
+	Float4 operator<=(const Float4& rhs) const { return _mm_cmple_ps(m, rhs.m); }
+	Float4 operator>(const Float4& rhs) const { return _mm_cmpgt_ps(m, rhs.m); }
+	Float4 operator>=(const Float4& rhs) const { return _mm_cmpge_ps(m, rhs.m); }
+	Float4 operator==(const Float4& rhs) const { return _mm_cmpeq_ps(m, rhs.m); }
+	Float4 operator&(const Float4& rhs) const { return _mm_and_ps(m, rhs.m); }
+	Float4 operator|(const Float4& rhs) const { return _mm_or_ps(m, rhs.m); }
+
+	// bit i is the sign bit of lane i, for a comparison it is set where the comparison holds
+	int signBits() const { return _mm_movemask_ps(m); }
+
+	// min and max return the second argument if one of them is a nan
+	static Float4 Min(const Float4& a, const Float4& b) { return _mm_min_ps(a.m, b.m); }
+	static Float4 Max(const Float4& a, const Float4& b) { return _mm_max_ps(a.m, b.m); }
+	static Float4 Abs(const Float4& a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.m); }
+	static Float4 Sqrt(const Float4& a) { return _mm_sqrt_ps(a.m); }
+	static Float4 IsNan(const Float4& a) { return _mm_cmpunord_ps(a.m, a.m); }
+	// a where the mask is set, otherwise b
+	static Float4 Select(const Float4& mask, const Float4& a, const Float4& b) { return _mm_or_ps(_mm_and_ps(mask.m, a.m), _mm_andnot_ps(mask.m, b.m)); }
+	// the mask of the lanes whose bit is set in bits
+	static Float4 Mask(int bits) { return _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_and_si128(_mm_set1_epi32(bits), _mm_setr_epi32(1, 2, 4, 8)), _mm_setzero_si128())); }
+
+	union{
+		__m128 m;
+		float f[4];
+	};
+
+#else
+
+	Float4() {}
+	Float4(float value) { for (int i = 0; i < 4; i++) f[i] = value; }
+
+	float operator[](int lane) const { return f[lane]; }
+	void set(int lane, float value) { f[lane] = value; }
+
+	Float4 operator+(const Float4& rhs) const { Float4 r; for (int i = 0; i < 4; i++) r.f[i] = f[i] + rhs.f[i]; return r; }
+	Float4 operator-(const Float4& rhs) const { Float4 r; for (int i = 0; i < 4; i++) r.f[i] = f[i] - rhs.f[i]; return r; }
+	Float4 operator*(const Float4& rhs) const { Float4 r; for (int i = 0; i < 4; i++) r.f[i] = f[i] * rhs.f[i]; return r; }
+	Float4 operator/(const Float4& rhs) const { Float4 r; for (int i = 0; i < 4; i++) r.f[i] = f[i] / rhs.f[i]; return r; }
+	Float4 operator-() const { Float4 r; for (int i = 0; i < 4; i++) r.f[i] = -f[i]; return r; }
+
+	Float4 operator<(const Float4& rhs) const { Float4 r; for (int i = 0; i < 4; i++) r.setLane(i, f[i] < rhs.f[i]); return r; }
+	Float4 operator<=(const Float4& rhs) const { Float4 r; for (int i = 0; i < 4; i++) r.setLane(i, f[i] <= rhs.f[i]); return r; }
+	Float4 operator>(const Float4& rhs) const { Float4 r; for (int i = 0; i < 4; i++) r.setLane(i, f[i] > rhs.f[i]); return r; }
+	Float4 operator>=(const Float4& rhs) const { Float4 r; for (int i = 0; i < 4; i++) r.setLane(i, f[i] >= rhs.f[i]); return r; }
+	Float4 operator==(const Float4& rhs) const { Float4 r; for (int i = 0; i < 4; i++) r.setLane(i, f[i] == rhs.f[i]); return r; }
+	Float4 operator&(const Float4& rhs) const { Float4 r; for (int i = 0; i < 4; i++) r.u[i] = u[i] & rhs.u[i]; return r; }
+	Float4 operator|(const Float4& rhs) const { Float4 r; for (int i = 0; i < 4; i++) r.u[i] = u[i] | rhs.u[i]; return r; }
+
+	int signBits() const { int bits = 0; for (int i = 0; i < 4; i++) bits |= (u[i] >> 31) << i; return bits; }
+
+	static Float4 Min(const Float4& a, const Float4& b) { Float4 r; for (int i = 0; i < 4; i++) r.f[i] = a.f[i] < b.f[i] ? a.f[i] : b.f[i]; return r; }
+	static Float4 Max(const Float4& a, const Float4& b) { Float4 r; for (int i = 0; i < 4; i++) r.f[i] = a.f[i] > b.f[i] ? a.f[i] : b.f[i]; return r; }
+	static Float4 Abs(const Float4& a) { Float4 r; for (int i = 0; i < 4; i++) r.f[i] = fabsf(a.f[i]); return r; }
+	static Float4 Sqrt(const Float4& a) { Float4 r; for (int i = 0; i < 4; i++) r.f[i] = sqrtf(a.f[i]); return r; }
+	static Float4 IsNan(const Float4& a) { Float4 r; for (int i = 0; i < 4; i++) r.setLane(i, a.f[i] != a.f[i]); return r; }
+	static Float4 Select(const Float4& mask, const Float4& a, const Float4& b) { Float4 r; for (int i = 0; i < 4; i++) r.u[i] = (mask.u[i] & a.u[i]) | (~mask.u[i] & b.u[i]); return r; }
+	static Float4 Mask(int bits) { Float4 r; for (int i = 0; i < 4; i++) r.setLane(i, (bits >> i) & 1); return r; }
+
+	union{
+		float f[4];
+		uint32_t u[4];
+	};
+
+private:
+
+	void setLane(int lane, bool value) { u[lane] = value ? 0xFFFFFFFFu : 0u; }
+
+#endif
+};
+
+// number of set bits of a lane mask
+inline int laneCount(int mask) {
+
+	return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+}
+
+#endif
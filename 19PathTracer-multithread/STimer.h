@@ -2,8 +2,13 @@
 #define _STIMER_H
 
 #include <stdio.h>
+#include <string.h>
 #include <chrono>
 
+#ifndef _WIN32
+#define sprintf_s snprintf
+#endif
+
 struct STimer
 {
     STimer ()
@@ -98,7 +103,7 @@ struct STimer
             printf("\nRendering took %s\n", timeString);
     }
  
-    std::chrono::steady_clock::time_point   m_start;
+    std::chrono::high_resolution_clock::time_point   m_start;
     int                                     m_lastMessageLength;
 };
 
@@ -9,18 +9,10 @@ Sampler::Sampler(){
 
 	m_numSamples = 4;
 	m_numSets = 83;
-	m_countSquare = 0;
-	m_countDisk = 0;
-	m_countSphere = 0;
-	m_countHemisphere = 0;
-	m_countOneSet = 0;
-	m_count2 = 0;
-	m_jump = 0;
+	m_random.seed(m_numSamples, m_numSets, 0);
 
 	m_samples.reserve(m_numSamples * m_numSets);
 	
-
-	std::srand(std::time(NULL));
 	setupShuffledIndices();
 }
 
@@ -28,18 +20,10 @@ Sampler::Sampler(const int numSamples, const int numSets){
 
 	m_numSamples = numSamples;
 	m_numSets = numSets;
-	m_countSquare = 0;
-	m_countDisk = 0;
-	m_countSphere = 0;
-	m_countHemisphere = 0;
-	m_countOneSet = 0;
-	m_count2 = 0;
-	m_jump = 0;
+	m_random.seed(m_numSamples, m_numSets, 0);
 
 	m_samples.reserve(m_numSamples * m_numSets);
 	
-
-	std::srand(std::time(NULL));
 	setupShuffledIndices();
 }
 
@@ -60,7 +44,8 @@ void Sampler::setupShuffledIndices(){
 	}
 
 	for (int p = 0; p < m_numSets; p++) {
-		random_shuffle(indices.begin(), indices.end());
+		for (int j = m_numSamples - 1; j > 0; j--)
+			std::swap(indices[j], indices[m_random.nextUInt(j + 1)]);
 
 		for (int j = 0; j < m_numSamples; j++)
 			m_shuffledIndices.push_back(indices[j]);
@@ -70,7 +55,7 @@ void Sampler::setupShuffledIndices(){
 void Sampler::shuffleXcoordinates() {
 	for (int p = 0; p < m_numSets; p++)
 	for (int i = 0; i < m_numSamples - 1; i++) {
-		int target = rand() % m_numSamples + p * m_numSamples;
+		int target = m_random.nextUInt(m_numSamples) + p * m_numSamples;
 		float temp = m_samples[i + p * m_numSamples + 1][0];
 		m_samples[i + p * m_numSamples + 1][0] = m_samples[target][0];
 		m_samples[target][0] = temp;
@@ -80,51 +65,41 @@ void Sampler::shuffleXcoordinates() {
 void Sampler::shuffleYcoordinates() {
 	for (int p = 0; p < m_numSets; p++)
 	for (int i = 0; i < m_numSamples - 1; i++) {
-		int target = rand() % m_numSamples + p * m_numSamples;
+		int target = m_random.nextUInt(m_numSamples) + p * m_numSamples;
 		float temp = m_samples[i + p * m_numSamples + 1][1];
 		m_samples[i + p * m_numSamples + 1][1] = m_samples[target][1];
 		m_samples[target][1] = temp;
 	}
 }
 
-Vector2f Sampler::sampleUnitSquare(){
-	int tmp2 = rand() % m_numSets;
-	if (m_countSquare % m_numSamples == 0)  								// start of a new pixel
-		m_jump = tmp2 * m_numSamples;				// random index jump initialised to zero in constructor
+// the set is picked from pixel and dimension of the thread's stream and the sample number walks through it,
+// so the samples of one pixel stay stratified without counters shared between the threads
+int Sampler::sampleIndex(){
+	Random& random = ThreadRandom();
+	uint32_t dimension = random.nextDimension();
 
-	//Vector2f tmp = (m_samples[m_jump + m_shuffledIndices[m_jump + m_count++ % m_numSamples]]);
-	
-	int tmp = m_jump + m_shuffledIndices[m_jump + m_countSquare++ % m_numSamples];
-	return (m_samples[tmp]);
+	int jump = (int)(Random::splitMix64(random.getPixel() * 0x9E3779B97F4A7C15ULL + dimension) % m_numSets) * m_numSamples;
+	return jump + m_shuffledIndices[jump + random.getSample() % m_numSamples];
+}
+
+Vector2f Sampler::sampleUnitSquare(){
+	return (m_samples[sampleIndex()]);
 }
 
 Vector2f Sampler::sampleOneSet(void) {
-	return(m_samples[m_countOneSet++ % m_numSamples]);
+	return(m_samples[ThreadRandom().getSample() % m_numSamples]);
 }
 
 Vector2f Sampler::sampleUnitDisk() {
-	if (m_countDisk % m_numSamples == 0)
-		m_jump = (rand() % m_numSets) * m_numSamples;
-
-	Vector2f tmp = (m_diskSamples[m_jump + m_shuffledIndices[m_jump + m_countDisk++ % m_numSamples]]);
-
-	//std::cout << tmp[0] << "  " << tmp[1] << std::endl;
-
-	return tmp;
+	return (m_diskSamples[sampleIndex()]);
 }
 
 Vector3f Sampler::sampleHemisphere() {
-	if (m_countHemisphere % m_numSamples == 0)  									// start of a new pixel
-		m_jump = (rand() % m_numSets) * m_numSamples;
-
-	return (m_hemisphereSamples[m_jump + m_shuffledIndices[m_jump + m_countHemisphere++ % m_numSamples]]);
+	return (m_hemisphereSamples[sampleIndex()]);
 }
 
 Vector3f Sampler::sampleSphere() {
-	if (m_countSphere % m_numSamples == 0)  									// start of a new pixel
-		m_jump = (rand() % m_numSets) * m_numSamples;
-
-	return (m_sphereSamples[m_jump + m_shuffledIndices[m_jump + m_countSphere++ % m_numSamples]]);
+	return (m_sphereSamples[sampleIndex()]);
 }
 
 void Sampler::mapSamplesToUnitDisk() {
@@ -206,7 +181,7 @@ void Sampler::mapSamplesToSphere() {
 
 float Sampler::randFloat(){
 
-	return (float)rand() * (1.0 / (float)RAND_MAX);
+	return m_random.nextFloat();
 }
 
 float Sampler::randFloat(int l, float h){
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include "Vector.h"
+#include "Random.h"
 
 class Sampler{
 public:
@@ -38,18 +39,13 @@ protected:
 	std::vector<Vector2f>	m_diskSamples;			// sample points on a unit disk
 	std::vector<Vector3f> 	m_hemisphereSamples;	// sample points on a unit hemisphere
 	std::vector<Vector3f> 	m_sphereSamples;		// sample points on a unit sphere
-	unsigned long 			m_countSquare;			// the current number of sample points used
-	unsigned long 			m_countDisk;
-	unsigned long 			m_countSphere;
-	unsigned long 			m_countHemisphere;
-	unsigned long 			m_countOneSet;
-	unsigned long 			m_count2;				// the current number of sample points used
-	int 					m_jump;					// random index jump
 	std::vector<int>		m_shuffledIndices;		// shuffled samples array indices
+	Random					m_random;				// only used while the sets are generated
 	
 private:
 
 	void setupShuffledIndices();	
+	int sampleIndex();
 	
 };
 //////////////////////////////////////Regular////////////////////////////////////////////////////////////
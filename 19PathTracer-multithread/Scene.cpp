@@ -1,8 +1,11 @@
 #include <iostream>
+#include <algorithm>
 
-#include "scene.h"
+#include "Scene.h"
+#include "Utils.h"
+#include "Statistics.h"
 
-Scene::Scene() : m_generator(std::random_device()()), m_distribution(0.0, 1.0){
+Scene::Scene(){
 
 	m_vp = ViewPlane();
 	m_background = Color(0.0, 0.0, 0.0);
@@ -11,17 +14,16 @@ Scene::Scene() : m_generator(std::random_device()()), m_distribution(0.0, 1.0){
 	m_maximumDepth = 0;
 	m_ambient = std::unique_ptr<AmbientLight>(new AmbientLight());
 	m_tracer = Tracer::Whitted;
+	m_rouletteDepth = 3;
 	
 	try {
 		m_bitmap = std::unique_ptr<Bitmap>( new Bitmap(m_vp.vres, m_vp.hres, 24));
 	}catch (const char* e) {
 		std::cout << "Could not load Scene bitmap!" << std::endl;
 	}	
-
-	std::srand(std::time(NULL));
 }
 
-Scene::Scene(const ViewPlane &vp, const Color &background) : m_generator(std::random_device()()), m_distribution(0.0, 1.0){
+Scene::Scene(const ViewPlane &vp, const Color &background){
 
 	m_vp = vp;
 	m_background = background;
@@ -30,18 +32,241 @@ Scene::Scene(const ViewPlane &vp, const Color &background) : m_generator(std::ra
 	m_maximumDepth = 0;
 	m_ambient = std::unique_ptr<AmbientLight>(new AmbientLight());
 	m_tracer = Tracer::Whitted;
+	m_rouletteDepth = 3;
 
 	try {
 		m_bitmap = std::unique_ptr<Bitmap>( new Bitmap(vp.vres, vp.hres, 24));
 	}catch (const char* e) {
 		std::cout << "Could not load Scene bitmap!" << std::endl;
 	}
-
-	std::srand(std::time(NULL));
 }
 
 void Scene::addPrimitive(Primitive* primitive) {
 	m_primitives.push_back(std::shared_ptr<Primitive>(primitive));
+	m_unboundedPrimitives.push_back(primitive);
+}
+
+void Scene::finalize() {
+
+	std::vector<Primitive*> bounded;
+	std::vector<BBox> bounds;
+	m_unboundedPrimitives.clear();
+
+	for (unsigned int j = 0; j < m_primitives.size(); j++) {
+
+		BBox box;
+		if (m_primitives[j]->getBoundingBox(box)) {
+			bounded.push_back(m_primitives[j].get());
+			bounds.push_back(box);
+		}else {
+			m_unboundedPrimitives.push_back(m_primitives[j].get());
+		}
+	}
+
+	m_bvh.build(bounds);
+
+	const std::vector<int>& order = m_bvh.getPrimitiveIndices();
+	m_boundedPrimitives.resize(order.size());
+	for (unsigned int i = 0; i < order.size(); i++)
+		m_boundedPrimitives[i] = bounded[order[i]];
+
+	//the order inside a leaf is free, the primitives of a kind are moved together so each kind is one run
+	m_runs.assign(m_boundedPrimitives.size(), Run());
+	m_primitiveBuffer.clear();
+	int grouped = 0;
+
+	m_bvh.visitLeaves([&](int first, int count) {
+
+		std::vector<Primitive*>::iterator leaf = m_boundedPrimitives.begin() + first;
+		std::stable_sort(leaf, leaf + count, [](const Primitive* a, const Primitive* b) {
+			return PrimitiveBuffer::GetKind(a) < PrimitiveBuffer::GetKind(b);
+		});
+
+		for (int i = first; i < first + count; i += m_runs[i].count) {
+
+			Run& run = m_runs[i];
+			run.kind = PrimitiveBuffer::GetKind(m_boundedPrimitives[i]);
+			run.count = 1;
+			while (i + run.count < first + count && PrimitiveBuffer::GetKind(m_boundedPrimitives[i + run.count]) == run.kind)
+				run.count++;
+
+			if (run.kind == PrimitiveBuffer::Generic) continue;
+
+			m_primitiveBuffer.pad(run.kind);
+			run.slot = m_primitiveBuffer.push_back(m_boundedPrimitives[i]);
+			for (int j = i + 1; j < i + run.count; j++)
+				m_primitiveBuffer.push_back(m_boundedPrimitives[j]);
+			grouped += run.count;
+		}
+	});
+
+	std::cout << "Scene: " << m_boundedPrimitives.size() << " primitives in the BVH, " << m_unboundedPrimitives.size() << " unbounded, "
+		<< grouped << " spheres and quads in blocks" << std::endl;
+}
+
+Primitive* Scene::closestHit(const Ray& ray, Hit& hit) {
+
+	float tmin = FLT_MAX;
+	Primitive* closest = NULL;
+
+	//the following primitives overwrite the hit record, keep the part of the closest one
+	Ray transformedRay;
+	Primitive* part = NULL;
+	int triangle = -1;
+	float b1 = 0.0f, b2 = 0.0f;
+
+	hit.originalRay = ray;
+
+	auto intersect = [&](Primitive* primitive) {
+
+		hit.transformedRay = ray;
+		primitive->hit(hit);
+		STATISTIC(primitiveHits, 1);
+
+		if (hit.hitObject && hit.t < tmin) {
+			tmin = hit.t;
+			closest = primitive;
+			transformedRay = hit.transformedRay;
+			part = hit.part;
+			triangle = hit.triangle;
+			b1 = hit.b1;
+			b2 = hit.b2;
+		}
+	};
+
+	for (unsigned int j = 0; j < m_unboundedPrimitives.size(); j++)
+		intersect(m_unboundedPrimitives[j]);
+
+	//tmin is lowered by the hits, so the traversal skips everything behind the closest hit
+	m_bvh.traverseLeaves(ray, tmin, [&](int first, int count, float&) {
+
+		for (int i = first; i < first + count; i += m_runs[i].count) {
+
+			const Run& run = m_runs[i];
+			if (run.kind == PrimitiveBuffer::Generic) {
+				for (int j = i; j < i + run.count; j++)
+					intersect(m_boundedPrimitives[j]);
+				continue;
+			}
+
+			STATISTIC(primitiveHits, run.count);
+
+			//the same record as a virtual hit of the primitive would leave
+			float t = tmin;
+			int j = m_primitiveBuffer.intersect(run.kind, run.slot, run.count, ray, t);
+			if (j >= 0) {
+				tmin = t;
+				hit.t = t;
+				closest = m_boundedPrimitives[i + j];
+				transformedRay = ray;
+				part = hit.part;
+				triangle = hit.triangle;
+				b1 = hit.b1;
+				b2 = hit.b2;
+			}
+		}
+		return false;
+	});
+
+	hit.hitObject = closest != NULL;
+	if (closest) {
+		hit.t = tmin;
+		hit.transformedRay = transformedRay;
+		hit.part = part;
+		hit.triangle = triangle;
+		hit.b1 = b1;
+		hit.b2 = b2;
+	}
+
+	return closest;
+}
+
+void Scene::closestHit(RayPacket& packet, Hit* hits, Primitive** closest) {
+
+	int mask = packet.mask;
+	packet.t = Float4(FLT_MAX);
+
+	for (int i = 0; i < RayPacket::Size; i++) {
+		hits[i].originalRay = packet.getRay(i);
+		closest[i] = NULL;
+	}
+
+	auto intersect = [&](Primitive* primitive, int lanes) {
+
+		Float4 t = packet.t;
+		packet.mask = lanes;
+
+		STATISTIC(primitiveHits, 1);
+
+		//a single ray left, testing it alone is cheaper than a packet with three empty lanes
+		if (laneCount(lanes) > 1)
+			primitive->hit(packet, hits);
+		else
+			primitive->Primitive::hit(packet, hits);
+
+		int closer = (packet.t < t).signBits() & lanes;
+		for (int i = 0; i < RayPacket::Size; i++) {
+			if (closer & (1 << i)) closest[i] = primitive;
+		}
+	};
+
+	for (unsigned int j = 0; j < m_unboundedPrimitives.size(); j++)
+		intersect(m_unboundedPrimitives[j], mask);
+
+	packet.mask = mask;
+	m_bvh.traverse(packet, [&](int i, int lanes) {
+		intersect(m_boundedPrimitives[i], lanes);
+	});
+	packet.mask = mask;
+
+	for (int i = 0; i < RayPacket::Size; i++)
+		hits[i].hitObject = closest[i] != NULL;
+}
+
+bool Scene::shadowHit(const Ray& ray, float distance, const Primitive* ignore) {
+
+	Ray shadowRay = ray;
+	float tmax = distance;
+	bool hitObject = false;
+
+	STATISTIC(shadowRays, 1);
+
+	auto intersect = [&](Primitive* primitive) {
+
+		STATISTIC(primitiveHits, 1);
+
+		//no shadow in case the primitive is behind the lightsource
+		hitObject = primitive != ignore && primitive->occluded(shadowRay, distance);
+		return hitObject;
+	};
+
+	for (unsigned int j = 0; j < m_unboundedPrimitives.size(); j++)
+		if (intersect(m_unboundedPrimitives[j])) return true;
+
+	m_bvh.traverseLeaves(shadowRay, tmax, [&](int first, int count, float&) {
+
+		for (int i = first; i < first + count; i += m_runs[i].count) {
+
+			const Run& run = m_runs[i];
+			if (run.kind == PrimitiveBuffer::Generic) {
+				for (int j = i; j < i + run.count; j++)
+					if (intersect(m_boundedPrimitives[j])) return true;
+				continue;
+			}
+
+			STATISTIC(primitiveHits, run.count);
+
+			int skip = -1;
+			for (int j = 0; ignore && j < run.count; j++)
+				if (m_boundedPrimitives[i + j] == ignore) skip = j;
+
+			hitObject = m_primitiveBuffer.occluded(run.kind, run.slot, run.count, shadowRay, distance, skip);
+			if (hitObject) return true;
+		}
+		return false;
+	});
+
+	return hitObject;
 }
 
 void Scene::addLight(Light* light) {
@@ -52,7 +277,7 @@ void Scene::setAmbientLight(AmbientLight *ambient){
 	m_ambient = std::unique_ptr<AmbientLight>(ambient);
 }
 
-void Scene::setPixel(const int x, const int y, Color& color)const {
+void Scene::setPixel(const int x, const int y, Color color)const {
 
 	color.clamp();
 
@@ -73,6 +298,19 @@ void Scene::setDepth(int depth){
 	m_maximumDepth = depth;
 }
 
+void Scene::setRussianRoulette(int minDepth){
+
+	m_rouletteDepth = minDepth;
+}
+
+float Scene::continuationProbability(const Color& throughput, int bounces) const{
+
+	if (m_rouletteDepth < 0 || bounces < m_rouletteDepth) return 1.0f;
+
+	// a path that still carries most of its energy always goes on, a dark one rarely
+	return min(1.0f, max(throughput.Max(), 0.0f));
+}
+
 void Scene::setTracer(Tracer tracer){
 
 	m_tracer = tracer;
@@ -90,118 +328,114 @@ ViewPlane Scene::getViewPlane(){
 
 Hit Scene::hitObjects2(Ray& _ray) {
 
-	float	 tmin = FLT_MAX;
 	Hit		 hit;
-	
-	hit.scene= this;
-	hit.originalRay = _ray;
+	hitObjects2(_ray, hit);
+	return hit;
+}
 
-	Ray ray;
-	int index = 0;
-	bool hitObject = false;
+bool Scene::hitObjects2(const Ray& ray, Hit& hit) {
 
-	 Primitive* primitive = NULL;
+	//some primitives test against the t of the record and only write the parts they use, clear what the last bounce left
+	hit.scene = this;
+	hit.t = FLT_MAX;
+	hit.part = NULL;
+	hit.triangle = -1;
 
-	for (unsigned int j = 0; j < m_primitives.size(); j++) {
-		hit.transformedRay = _ray;
-		m_primitives[j]->hit(hit);
+	Primitive* primitive = closestHit(ray, hit);
 
-		if (hit.hitObject && hit.t < tmin) {
-			tmin = hit.t;
-			index = j;
-			ray = hit.transformedRay;
-			hitObject = true;
-			primitive = m_primitives[j].get();
-		}
+	if (primitive)
+		setHitAttributes(hit, primitive);
 
+	return primitive != NULL;
+}
+
+void Scene::hitObjects2(RayPacket& packet, Hit* hits) {
+
+	Primitive* closest[RayPacket::Size];
+
+	for (int i = 0; i < RayPacket::Size; i++)
+		hits[i].scene = this;
+
+	closestHit(packet, hits, closest);
+
+	for (int i = 0; i < RayPacket::Size; i++) {
+		if (closest[i])
+			setHitAttributes(hits[i], closest[i]);
 	}
+}
+
+void Scene::setHitAttributes(Hit& hit, Primitive* primitive) {
 
-	if (hitObject ) {
-		//calculate the hitpoint an other hit parameters inside the hit function to speed up the rendering
-		hit.hitPoint = ray.origin + ray.direction * tmin;	
-		hit.normal = primitive->getNormal(hit.hitPoint);
-		hit.color = primitive->getColor(hit.hitPoint);
-		hit.material = primitive->getMaterial().get();
-		hit.primitive = primitive;
-		hit.hitObject = true;
+	//calculate the hitpoint an other hit parameters inside the hit function to speed up the rendering
+	hit.hitPoint = hit.transformedRay.origin + hit.transformedRay.direction * hit.t;
+	hit.normal = primitive->getNormal(hit);
+	hit.color = primitive->getColor(hit);
+	hit.material = primitive->getMaterial(hit).get();
+	hit.primitive = primitive;
+}
+
+void Scene::setShadingAttributes(Hit& hit, Primitive* primitive, int attributes) {
+
+	if (attributes & Material::TangentFrame) {
+		hit.tangent = primitive->getTangent(hit);
+		hit.bitangent = primitive->getBiTangent(hit);
 	}
 
-	return hit;
+	//needed for normal mapping and texturing traiangle meshes
+	if (attributes & Material::TextureCoordinates) {
+		std::pair <float, float> uv = primitive->getUV(hit);
+		hit.u = uv.first;
+		hit.v = uv.second;
+	}
 }
 
 Hit Scene::hitObjects(Ray& _ray)  {
+
+	return hitObjects(_ray, Color(1.0, 1.0, 1.0));
+}
+
+Hit Scene::hitObjects(Ray& _ray, Color pathWeight)  {
 	
 	if (m_tracer == Tracer::PathTracerIt){
 		
 		return pathTracerIt(_ray);
 	}
 
-	float	 tmin = FLT_MAX;
 	Hit		 hit;
 	
 	hit.color = m_background;
 	hit.scene = this;
-	hit.originalRay = _ray;
-	m_primitive = NULL;
-	//after the for loop the hit.transformedRay is transformed to next local space of the primitive
-	//to avoid transforming to another space from a following primitive
-	//it will be necessary to store the transformation
-	Ray ray;
 
-	bool hitObject = false;
-
-	for (unsigned int j = 0; j < m_primitives.size(); j++){
-		hit.transformedRay = _ray;
-		
-		m_primitives[j]->hit(hit);
-
-		if (hit.hitObject && hit.t < tmin) {
+	//the hit point is computed in the space of the closest primitive, closestHit keeps its transformed ray
+	Primitive* primitive = closestHit(_ray, hit);
 
-			tmin = hit.t;
-			m_primitive = m_primitives[j];
-			ray = hit.transformedRay;
-			hitObject = true;
+	if (primitive){
+			//the tangent frame and the uv are only looked up for the materials that read them
+			setHitAttributes(hit, primitive);
 
-		}
-	}
+			if (hit.material){
 
-	if (hitObject){
-			hit.t = tmin;
-			hit.hitPoint = ray.origin + ray.direction * tmin;
-			hit.color = m_primitive->getColor(hit.hitPoint);
-			hit.normal = m_primitive->getNormal(hit.hitPoint);
-			hit.tangent = m_primitive->getTangent(hit.hitPoint);
-			hit.bitangent = m_primitive->getBiTangent(hit.hitPoint);
-
-			//needed for normal mapping and texturing traiangle meshes
-			std::pair <float, float> uv = m_primitive->getUV(hit.hitPoint);
-			hit.u = uv.first;
-			hit.v = uv.second;
-			
-			if (m_primitive->getMaterial()){
+				setShadingAttributes(hit, primitive, hit.material->getAttributes());
 
 				//to do trigger the funktion through a tracer pointer
 				switch (m_tracer) {
 				
 					case Whitted:
-						hit.color = m_primitive->getMaterial()->shade(hit);
+						hit.color = hit.material->shade(hit);
 						break;
 					case AreaLighting:
-						hit.color = m_primitive->getMaterial()->shadeAreaLight(hit);
+						hit.color = hit.material->shadeAreaLight(hit);
 						break;
 					case PathTracer:
-						//if m_primitive a lightsource the emissive material will return a color != Color(0.0, 0.0, 0.0)
+						//if primitive a lightsource the emissive material will return a color != Color(0.0, 0.0, 0.0)
 						//and the recursion will break with a color != Color(0.0, 0.0, 0.0)
-						hit.color = m_primitive->getMaterial()->shadePath(hit);
+						hit.color = hit.material->shadePath(hit, pathWeight);
 						break;
 					case PathTracerIt:
 						hit.color = pathTracerIt(_ray).color;
 						break;
 				}
 
-			}else{
-				
-				hit.color = m_primitive->getColor(hit.hitPoint);	
 			}
 	}
 	
@@ -230,7 +464,7 @@ Color Scene::traceRay(Ray& ray, Color pathWeight){
 
 	}else{
 
-		return hitObjects(ray).color;
+		return hitObjects(ray, pathWeight).color;
 	}
 }
 
@@ -256,8 +490,8 @@ Vector3f Scene::sampleDirection2(Vector3f& normal){
 	Vector3f nt = std::fabs(normal[0]) > std::fabs(normal[1]) ? Vector3f(normal[2], 0, -normal[0]).normalize() : Vector3f(0, -normal[2], normal[1]).normalize();
 	Vector3f nb = Vector3f::cross(normal, nt);
 
-	float r1 = m_distribution(m_generator);
-	float phi = 2 * PI * m_distribution(m_generator);
+	float r1 = RandomFloat();
+	float phi = 2 * PI * RandomFloat();
 	float sinTheta = sqrtf(1 - r1 * r1);
 	float x = sinTheta * cosf(phi);
 	float z = sinTheta * sinf(phi);
@@ -276,14 +510,10 @@ Hit Scene::pathTracerIt(Ray& primaryRay){
 
 	Ray ray = primaryRay;
 	
-	float	 tmin = FLT_MAX;
 	Hit		 hit;
 
 	hit.color = m_background;
 	hit.scene = this;
-	hit.originalRay = ray;
-	m_primitive = NULL;
-	bool hitObject = false;
 
 	float cosAtCamera = Vector3f::dot(ray.direction, Vector3f(0.0, 0.0, 1.0).normalize());
 	Color pathWeight = Color(1.0, 1.0, 1.0) ;
@@ -293,50 +523,47 @@ Hit Scene::pathTracerIt(Ray& primaryRay){
 	int maxPathLength = m_maximumDepth;
 	for (int i = 0; i < maxPathLength; i++){
 
-		for (unsigned int j = 0; j < m_primitives.size(); j++){
-			hit.transformedRay = ray;
-			m_primitives[j]->hit(hit);
-
-			if (hit.hitObject && hit.t < tmin) {
-				tmin = hit.t;
-				m_primitive = m_primitives[j];
-				hitObject = true;
-			}
-		}
+		Primitive* primitive = closestHit(ray, hit);
 
-		if (!hitObject){
+		if (!primitive){
 			
 			hit.color = m_background;
 			break;
 
 		}else{
 
-			hit.t = FLT_MAX;
-			hit.hitPoint = ray.origin + ray.direction * tmin;
-			hit.normal = m_primitive->getNormal(hit.hitPoint);
-			hitColor = m_primitive->getColor(hit.hitPoint);
+			hit.hitPoint = ray.origin + ray.direction * hit.t;
+			hit.normal = primitive->getNormal(hit);
+			hitColor = primitive->getColor(hit);
 			
 			AreaLight* light = static_cast<AreaLight*>(m_lights[0].get());
 			
-			if (light->m_primitive == m_primitive ){
+			if (light->m_primitive.get() == primitive ){
 				
 				hit.color = pathWeight * hitColor * (1.0 / light->pdf(hit));
 				break;
 			}
 
-			/*float continuationPdf = min(1, hitColor.Max());
-			if (m_distribution(m_generator) >= continuationPdf){
-
-				hit.color = m_background; // Absorbation
-				break;
-			}*/
-			
 			Vector3f newDirection = sampleDirection(hit.normal);
 			float pdf = max(1e-6f, max(0, Vector3f::dot(hit.normal, newDirection)) * invPI);
 			float lambert = Vector3f::dot(hit.normal, newDirection);
 			pathWeight = pathWeight * hitColor *  (lambert / pdf) * invPI  * 0.6;
 			ray = Ray(hit.hitPoint, newDirection);
 
+			// russian roulette on the throughput, the surviving paths carry the energy of the absorbed ones
+			float continuation = continuationProbability(pathWeight, i);
+			if (continuation < 1.0f){
+
+				if (RandomFloat() >= continuation){
+
+					STATISTIC(rouletteStops, 1);
+					STATISTIC(bouncesSaved, maxPathLength - i - 1);
+					hit.color = Color(0.0, 0.0, 0.0); // Absorbation
+					break;
+				}
+				pathWeight = pathWeight / continuation;
+			}
+
 		}
 
 	}
@@ -13,6 +13,8 @@
 #include "Bitmap.h"
 #include "Primitive.h"
 #include "Light.h"
+#include "BVH.h"
+#include "PrimitiveBuffer.h"
 
 
 
@@ -32,21 +34,44 @@ public:
 	Scene(const ViewPlane &vp, const Color &background);
 
 	void addPrimitive(Primitive* primitive);
+	// builds the bounding volume hierarchy over the primitives, primitives added later are tested one by one
+	void finalize();
 	
 	void addLight(Light* light);
 	Hit hitObjects(Ray& ray);
+	// pathWeight is the throughput of the path up to the ray, the path tracer decides on russian roulette with it
+	Hit hitObjects(Ray& ray, Color pathWeight);
 	Hit hitObjects2(Ray& ray);
+	// the same into a hit record the caller keeps, the path tracer reuses one for all bounces of a path
+	bool hitObjects2(const Ray& ray, Hit& hit);
+	// packet version for coherent rays, hits[i] is the hit of lane i of packet.mask
+	void hitObjects2(RayPacket& packet, Hit* hits);
 
 	Hit pathTracerIt(Ray& primaryRay);
 
+	// (min, max) box of the bounded primitives
+	BBox getBounds() const { return m_bvh.getRootBounds(); }
+
+	// closest primitive along the ray or NULL, the hit keeps t, the transformed ray and the hit part of it
+	Primitive* closestHit(const Ray& ray, Hit& hit);
+	// true if a primitive other than ignore is hit within distance
+	bool shadowHit(const Ray& ray, float distance, const Primitive* ignore = NULL);
+	// packet version of closestHit, closest[i] is the primitive of lane i or NULL
+	void closestHit(RayPacket& packet, Hit* hits, Primitive** closest);
+
 	Color traceRay(Ray& ray);
 	Color traceRay(Ray& ray, Color pathWeight);
 	
 
-	void setPixel(const int x, const int y, Color& color) const;
+	void setPixel(const int x, const int y, Color color) const;
 	void setDepth(int depth);
 	void setAmbientLight(AmbientLight *ambient);
 	void setTracer(Tracer tracer);
+	// paths that made minDepth bounces go on with the probability of their throughput, a negative depth turns it off
+	void setRussianRoulette(int minDepth);
+	int getRussianRoulette() const { return m_rouletteDepth; }
+	// probability to trace one more bounce of a path with this throughput after the given bounces, 1 if roulette does not apply
+	float continuationProbability(const Color& throughput, int bounces) const;
 
 	std::shared_ptr<Bitmap> getBitmap();
 	ViewPlane getViewPlane();
@@ -55,7 +80,6 @@ public:
 
 
 
-	std::shared_ptr<Primitive> m_primitive;
 	std::vector<std::shared_ptr<Primitive>>	m_primitives;
 	std::vector<std::unique_ptr<Light>>	m_lights;
 	std::unique_ptr<AmbientLight> m_ambient;
@@ -67,14 +91,34 @@ public:
 	std::shared_ptr<Scene> m_scene;
 	int m_maximumDepth;
 	Tracer m_tracer;
+	int m_rouletteDepth;
 
 
 	std::shared_ptr<Sampler> m_sampler;
-	std::default_random_engine m_generator;
-	std::uniform_real_distribution<float> m_distribution;
-	Vector3f Scene::sampleDirection(Vector3f& normal);
-	Vector3f Scene::sampleDirection2(Vector3f& normal);
-	
+	Vector3f sampleDirection(Vector3f& normal);
+	Vector3f sampleDirection2(Vector3f& normal);
+
+private:
+
+	//hit point, normal, color and material of a hit found by closestHit
+	void setHitAttributes(Hit& hit, Primitive* primitive);
+	//the attributes of Material::Attribute a material asks for on top of them
+	void setShadingAttributes(Hit& hit, Primitive* primitive, int attributes);
+
+	//the bounded primitives in the leaf order of the bvh, planes and the like are tested for every ray
+	BVH m_bvh;
+	std::vector<Primitive*> m_boundedPrimitives;
+
+	//primitives of one kind next to each other in a leaf, the spheres and quads are copied into the primitive buffer
+	//count and slot are set for the first position of the run
+	struct Run{
+		PrimitiveBuffer::Kind kind;
+		int count;
+		int slot;
+	};
+	std::vector<Run> m_runs;
+	PrimitiveBuffer m_primitiveBuffer;
+	std::vector<Primitive*> m_unboundedPrimitives;
 };
 
 #endif // _SCENE_H
\ No newline at end of file
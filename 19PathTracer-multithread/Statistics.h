@@ -0,0 +1,56 @@
+#ifndef _STATISTICS_H
+#define _STATISTICS_H
+
+#include <stdint.h>
+
+// defining TRACE_STATISTICS as 1 counts the work of the traversal, without it the counters are compiled out
+#ifndef TRACE_STATISTICS
+#define TRACE_STATISTICS 0
+#endif
+
+// counters of one thread, the render workers add theirs to the frame totals when they finish
+struct TraceStatistics {
+
+	uint64_t primaryRays = 0;
+	uint64_t bounceRays = 0;
+	uint64_t shadowRays = 0;
+	uint64_t kdTreeNodes = 0;		// nodes visited in the kd trees of the meshes
+	uint64_t bvhNodes = 0;			// nodes visited in the scene and mesh bvhs
+	uint64_t triangleTests = 0;		// ray triangle tests in the leaves, a packet counts each of its active rays
+	uint64_t primitiveHits = 0;		// hit and shadowHit calls of the scene primitives
+	uint64_t rouletteStops = 0;		// paths ended by russian roulette
+	uint64_t bouncesSaved = 0;		// bounces the stopped paths had left, fewer were traced if they left the scene
+
+	void add(const TraceStatistics& statistics) {
+
+		primaryRays += statistics.primaryRays;
+		bounceRays += statistics.bounceRays;
+		shadowRays += statistics.shadowRays;
+		kdTreeNodes += statistics.kdTreeNodes;
+		bvhNodes += statistics.bvhNodes;
+		triangleTests += statistics.triangleTests;
+		primitiveHits += statistics.primitiveHits;
+		rouletteStops += statistics.rouletteStops;
+		bouncesSaved += statistics.bouncesSaved;
+	}
+
+	// the work of the heatmap, in traversal steps and tests
+	uint64_t cost() const { return kdTreeNodes + bvhNodes + triangleTests + primitiveHits; }
+};
+
+#if TRACE_STATISTICS
+
+inline TraceStatistics& ThreadStatistics() {
+	static thread_local TraceStatistics statistics;
+	return statistics;
+}
+
+#define STATISTIC(counter, n) (ThreadStatistics().counter += (n))
+
+#else
+
+#define STATISTIC(counter, n) ((void)0)
+
+#endif
+
+#endif // _STATISTICS_H
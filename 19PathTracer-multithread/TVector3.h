@@ -205,14 +205,14 @@ inline Vector3f CosineSampleHemisphere(const Vector3f& normal){
 inline Vector3f CosineSampleHemisphere2(const Vector3f& normal) {
 
 	float rand = RandomFloat();
-	float r = std::sqrtf(rand);
+	float r = std::sqrt(rand);
 	float theta = RandomFloat() * 2.0f * c_pi;
 
-	float x = r * std::cosf(theta);
-	float y = r * std::sinf(theta);
+	float x = r * std::cos(theta);
+	float y = r * std::sin(theta);
 
 	// Project z up to the unit hemisphere
-	float z = std::sqrtf(1.0f - x * x - y * y);
+	float z = std::sqrt(1.0f - x * x - y * y);
 
 	// Find an axis that is not parallel to normal to cut all direction wich are close to the horizone of the sphere
 	Vector3f majorAxis = abs(normal[0]) < 0.57735026919f ? Vector3f(1, 0, 0) : abs(normal[1]) < 0.57735026919f ? Vector3f(0, 1, 0) : Vector3f(0, 0, 1);
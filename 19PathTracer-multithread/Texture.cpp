@@ -1,5 +1,7 @@
+#ifdef _WIN32
 #include <windows.h>
 #include <atlstr.h> 
+#endif
 #include <iostream>
 #include "Texture.h"
 #include "Primitive.h"
@@ -0,0 +1,264 @@
+#include <cmath>
+#include <algorithm>
+#include "TriangleBuffer.h"
+#include "Primitive.h"
+#include "Statistics.h"
+
+
+TriangleBuffer::ShearedRay::ShearedRay(const Ray& ray){
+
+	const Vector3f& d = ray.direction;
+
+	//the largest component of the direction becomes z, so the shear never divides by a small number
+	int kz = fabsf(d[0]) > fabsf(d[1]) ? (fabsf(d[0]) > fabsf(d[2]) ? 0 : 2) : (fabsf(d[1]) > fabsf(d[2]) ? 1 : 2);
+	int kx = kz == 2 ? 0 : kz + 1;
+	int ky = kx == 2 ? 0 : kx + 1;
+
+	//keep the winding, so the front faces are the ones with positive areas
+	if (d[kz] < 0.0f) std::swap(kx, ky);
+
+	k[0] = kx;
+	k[1] = ky;
+	k[2] = kz;
+
+	for (int i = 0; i < 3; i++)
+		origin[i] = ray.origin[i];
+
+	shear[0] = d[kx] / d[kz];
+	shear[1] = d[ky] / d[kz];
+	shear[2] = 1.0f / d[kz];
+}
+
+TriangleBuffer::ShearedPacket::ShearedPacket(const RayPacket& packet){
+
+	//the lanes are prepared one by one, so every ray gets the same values as on its own
+	for (int i = 0; i < RayPacket::Size; i++){
+
+		ShearedRay ray(packet.getRay(i));
+		for (int j = 0; j < 3; j++){
+
+			origin[j].set(i, ray.origin[ray.k[j]]);
+			shear[j].set(i, ray.shear[j]);
+			axis[j][0].set(i, ray.k[j] == 0 ? -1.0f : 0.0f);
+			axis[j][1].set(i, ray.k[j] == 1 ? -1.0f : 0.0f);
+		}
+	}
+
+	//the sign bits became full lane masks
+	for (int j = 0; j < 3; j++){
+		axis[j][0] = Float4::Mask(axis[j][0].signBits());
+		axis[j][1] = Float4::Mask(axis[j][1].signBits());
+	}
+}
+
+void TriangleBuffer::ShearedPacket::permute(const Float4 point[3], Float4 permuted[3]) const{
+
+	for (int j = 0; j < 3; j++)
+		permuted[j] = Float4::Select(axis[j][0], point[0], Float4::Select(axis[j][1], point[1], point[2])) - origin[j];
+}
+
+
+TriangleBuffer::TriangleBuffer(){
+	m_size = 0;
+}
+
+void TriangleBuffer::clear(){
+
+	m_blocks.clear();
+	m_ids.clear();
+	m_cull.clear();
+	m_size = 0;
+}
+
+void TriangleBuffer::write(ModelCache::Writer& cache) const{
+
+	cache.writeValue(m_size);
+	cache.write(m_blocks);
+	cache.write(m_ids);
+	cache.write(m_cull);
+}
+
+bool TriangleBuffer::read(ModelCache::Reader& cache){
+
+	clear();
+	//a test reads whole blocks and their cull bits
+	if (cache.readValue(m_size) && cache.read(m_blocks) && cache.read(m_ids) && cache.read(m_cull) && m_size >= 0 && m_ids.size() == (size_t)m_size &&
+		m_blocks.size() * BlockSize >= (size_t)m_size && m_cull.size() >= m_blocks.size()) return true;
+
+	clear();
+	return false;
+}
+
+void TriangleBuffer::reserve(int numberOfTriangles){
+
+	m_blocks.reserve((numberOfTriangles + BlockSize - 1) / BlockSize);
+	m_ids.reserve(numberOfTriangles);
+	m_cull.reserve((numberOfTriangles + BlockSize - 1) / BlockSize);
+}
+
+void TriangleBuffer::push_back(const Triangle& triangle, int id){
+
+	//a new block starts with empty lanes, the tests leave out the lanes behind the last triangle of a leaf
+	if (m_size % BlockSize == 0){
+
+		Block block;
+		for (int i = 0; i < 3; i++){
+			block.a[i] = Float4(0.0f);
+			block.b[i] = Float4(0.0f);
+			block.c[i] = Float4(0.0f);
+		}
+		m_blocks.push_back(block);
+		m_cull.push_back(0);
+	}
+
+	m_ids.push_back(id);
+	if (triangle.m_cull)
+		m_cull.back() |= 1 << (m_size % BlockSize);
+	set(m_size++, triangle);
+}
+
+void TriangleBuffer::pad(){
+
+	while (m_size % BlockSize != 0){
+		m_ids.push_back(-1);
+		m_size++;
+	}
+}
+
+void TriangleBuffer::set(int slot, const Triangle& triangle){
+
+	Block& block = m_blocks[slot / BlockSize];
+	int lane = slot % BlockSize;
+
+	for (int i = 0; i < 3; i++){
+		block.a[i].set(lane, triangle.m_a[i]);
+		block.b[i].set(lane, triangle.m_b[i]);
+		block.c[i].set(lane, triangle.m_c[i]);
+	}
+}
+
+size_t TriangleBuffer::getMemoryUsage() const{
+
+	return m_blocks.capacity() * sizeof(Block) + m_ids.capacity() * sizeof(int) + m_cull.capacity();
+}
+
+int TriangleBuffer::intersect(int slot, int count, const ShearedRay& ray, float& t, float& b1, float& b2) const{
+
+	Float4 origin[3], shear[3];
+	for (int j = 0; j < 3; j++){
+		origin[j] = Float4(ray.origin[ray.k[j]]);
+		shear[j] = Float4(ray.shear[j]);
+	}
+
+	STATISTIC(triangleTests, count);
+
+	int closest = -1;
+	for (int first = slot; first < slot + count; first += BlockSize){
+
+		const Block& block = m_blocks[first / BlockSize];
+		int mask = (1 << min(slot + count - first, BlockSize)) - 1;
+
+		//one ray against the four triangles of the block
+		Float4 A[3], B[3], C[3];
+		for (int j = 0; j < 3; j++){
+			A[j] = block.a[ray.k[j]] - origin[j];
+			B[j] = block.b[ray.k[j]] - origin[j];
+			C[j] = block.c[ray.k[j]] - origin[j];
+		}
+
+		Float4 tBlock(t), u(0.0f), v(0.0f);
+		int hitMask = Intersect(A, B, C, shear, Float4::Mask(m_cull[first / BlockSize]), mask, tBlock, u, v);
+
+		//the closest triangle of the block, the first one if several are equally close
+		for (int i = 0; i < BlockSize; i++){
+
+			if ((hitMask & (1 << i)) && tBlock[i] < t){
+				t = tBlock[i];
+				b1 = u[i];
+				b2 = v[i];
+				closest = first + i;
+			}
+		}
+	}
+
+	return closest;
+}
+
+int TriangleBuffer::intersect(int slot, const ShearedPacket& packet, int mask, Float4& t, Float4& b1, Float4& b2) const{
+
+	STATISTIC(triangleTests, laneCount(mask));
+
+	const Block& block = m_blocks[slot / BlockSize];
+	int lane = slot % BlockSize;
+
+	//the triangle is the same for all rays
+	Float4 a[3], b[3], c[3];
+	for (int i = 0; i < 3; i++){
+		a[i] = Float4(block.a[i][lane]);
+		b[i] = Float4(block.b[i][lane]);
+		c[i] = Float4(block.c[i][lane]);
+	}
+
+	Float4 A[3], B[3], C[3];
+	packet.permute(a, A);
+	packet.permute(b, B);
+	packet.permute(c, C);
+
+	Float4 cull = Float4::Mask((m_cull[slot / BlockSize] >> lane) & 1 ? RayPacket::AllLanes : 0);
+	return Intersect(A, B, C, packet.shear, cull, mask, t, b1, b2);
+}
+
+int TriangleBuffer::Intersect(const Float4 A[3], const Float4 B[3], const Float4 C[3], const Float4 shear[3], const Float4& cull, int mask, Float4& t, Float4& b1, Float4& b2){
+
+	//shear the vertices, the ray then starts at the origin and points along z
+	Float4 Ax = A[0] - shear[0] * A[2];
+	Float4 Ay = A[1] - shear[1] * A[2];
+	Float4 Bx = B[0] - shear[0] * B[2];
+	Float4 By = B[1] - shear[1] * B[2];
+	Float4 Cx = C[0] - shear[0] * C[2];
+	Float4 Cy = C[1] - shear[1] * C[2];
+
+	//the scaled barycentric coordinates are the signed areas between the ray and the edges
+	Float4 U = Cx * By - Cy * Bx;
+	Float4 V = Ax * Cy - Ay * Cx;
+	Float4 W = Bx * Ay - By * Ax;
+
+	//a ray through an edge is decided in double, so both triangles of the edge agree on it
+	Float4 zero(0.0f);
+	int onEdge = ((U == zero) | (V == zero) | (W == zero)).signBits() & mask;
+	for (int i = 0; i < BlockSize && onEdge; i++){
+
+		if (!(onEdge & (1 << i))) continue;
+
+		U.set(i, (float)((double)Cx[i] * By[i] - (double)Cy[i] * Bx[i]));
+		V.set(i, (float)((double)Ax[i] * Cy[i] - (double)Ay[i] * Cx[i]));
+		W.set(i, (float)((double)Bx[i] * Ay[i] - (double)By[i] * Ax[i]));
+	}
+
+	//the ray passes the triangle if the areas don't differ in sign, back faces have negative ones
+	Float4 negative = (U < zero) | (V < zero) | (W < zero);
+	Float4 positive = (U > zero) | (V > zero) | (W > zero);
+	Float4 det = U + V + W;
+
+	int valid = mask & ~((negative & positive) | (negative & cull) | (det == zero)).signBits();
+	if (!valid) return 0;
+
+	//the distance along the ray interpolated from the sheared z of the vertices
+	Float4 Az = shear[2] * A[2];
+	Float4 Bz = shear[2] * B[2];
+	Float4 Cz = shear[2] * C[2];
+	Float4 T = U * Az + V * Bz + W * Cz;
+
+	Float4 inv_det = Float4(1.0f) / det;
+	Float4 result = T * inv_det;
+	valid &= ((result > zero) & (result < t)).signBits();
+
+	if (valid){
+
+		Float4 lanes = Float4::Mask(valid);
+		t = Float4::Select(lanes, result, t);
+		b1 = Float4::Select(lanes, V * inv_det, b1);
+		b2 = Float4::Select(lanes, W * inv_det, b2);
+	}
+	return valid;
+}
@@ -0,0 +1,92 @@
+#ifndef _TRIANGLEBUFFER_H
+#define _TRIANGLEBUFFER_H
+
+#include <vector>
+#include "SIMD.h"
+#include "Ray.h"
+#include "RayPacket.h"
+#include "ModelCache.h"
+
+class Triangle;
+
+// the part of the triangles the traversal needs, the three vertices, stored apart from the shading attributes
+// which stay in the Triangle objects and are looked up by the index of the hit triangle
+// slot i is lane i % 4 of block i / 4, one test intersects a ray with the four triangles of a block
+class TriangleBuffer{
+
+public:
+
+	static const int BlockSize = 4;
+
+	// 144 bytes for four triangles, a Triangle object alone is more than twice that size
+	// the vertices are kept instead of edges, so triangles sharing an edge see exactly the same edge
+	struct Block{
+		Float4 a[3];
+		Float4 b[3];
+		Float4 c[3];
+	};
+
+	// a ray prepared for the watertight test, the axes are permuted so kz is the largest direction component
+	// and the ray is sheared to point along it, the test then works on the triangles projected along kz
+	struct ShearedRay{
+
+		ShearedRay(const Ray& ray);
+
+		int k[3];				// kx, ky, kz
+		float origin[3];		// not permuted
+		float shear[3];			// Sx, Sy, Sz
+	};
+
+	// the same for the rays of a packet, every lane can have its own permutation
+	struct ShearedPacket{
+
+		ShearedPacket(const RayPacket& packet);
+
+		// the components of a point in the permuted axes of each lane, moved to the ray origins
+		void permute(const Float4 point[3], Float4 permuted[3]) const;
+
+		Float4 origin[3];		// permuted
+		Float4 shear[3];
+		Float4 axis[3][2];		// lanes whose permuted axis j is x or y, the others take z
+	};
+
+	TriangleBuffer();
+
+	void clear();
+	void reserve(int numberOfTriangles);
+	// appends a slot, id is what the hits report for the triangle
+	void push_back(const Triangle& triangle, int id);
+	// lets the next slot start a new block, a leaf starting there is tested with whole blocks
+	void pad();
+	// copies the vertices again after the triangle moved
+	void set(int slot, const Triangle& triangle);
+
+	int size() const { return m_size; }
+	int getId(int slot) const { return m_ids[slot]; }
+	size_t getMemoryUsage() const;
+
+	// the slots as they are for the model cache
+	void write(ModelCache::Writer& cache) const;
+	bool read(ModelCache::Reader& cache);
+
+	// tests the count triangles from the first slot of a block on, the slot of the closest one in front of t is returned or -1
+	// t, b1 and b2 are replaced for this slot
+	int intersect(int slot, int count, const ShearedRay& ray, float& t, float& b1, float& b2) const;
+	// the lanes of mask hitting the triangle of the slot in front of t, t, b1 and b2 of these lanes are replaced
+	int intersect(int slot, const ShearedPacket& packet, int mask, Float4& t, Float4& b1, Float4& b2) const;
+
+	// watertight ray triangle test of Woop, Benthin and Wald on four lanes, every lane is one ray against one triangle
+	// the vertices are moved to the ray origin and permuted, cull is set for the lanes whose back faces are skipped
+	// the lanes of mask hitting in front of t are returned
+	static int Intersect(const Float4 A[3], const Float4 B[3], const Float4 C[3], const Float4 shear[3], const Float4& cull, int mask, Float4& t, Float4& b1, Float4& b2);
+
+private:
+
+	std::vector<Block> m_blocks;
+	std::vector<int> m_ids;
+	// back face culling, one bit for each lane of a block
+	std::vector<unsigned char> m_cull;
+	int m_size;
+};
+
+#endif
@@ -3,6 +3,8 @@
 #include <stdint.h>
 #include <array>
 
+#include "Random.h"
+
 typedef uint8_t uint8;
 typedef std::array<uint8, 3> TPixelBGRU8;
 typedef std::array<float, 3> TPixelRGBF32;
@@ -20,27 +22,13 @@ inline float Clamp(float v, float min, float max) {
 }
 
 //=================================================================================
-// from 0 to 1
-float RandomFloat() {
-
-	/*
-	// Xorshift random number algorithm invented by George Marsaglia
-	static uint32_t rng_state = 0xf2eec0de;
-	rng_state ^= (rng_state << 13);
-	rng_state ^= (rng_state >> 17);
-	rng_state ^= (rng_state << 5);
-	return float(rng_state) * (1.0f / 4294967296.0f);
-	*/
-
-	// alternately, using a standard c++ prng
-	static std::random_device rd;
-	static std::mt19937 mt(rd());
-	static std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-	return dist(mt);
+// from 0 to 1, drawn from the stream of the calling thread
+inline float RandomFloat() {
+	return ThreadRandom().nextFloat();
 }
 
 //=================================================================================
-float RandomFloat(float min, float max) {
+inline float RandomFloat(float min, float max) {
 
 	return min + (max - min) * RandomFloat();
 }
\ No newline at end of file
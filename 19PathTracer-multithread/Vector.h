@@ -15,6 +15,16 @@
 #define	invTWO_PI  0.1591549430918953358
 #define eps 0.0001
 
+#ifndef _WIN32
+#include <type_traits>
+// windows.h brings min and max in as macros, these cover the same mixed argument calls
+template <typename T, typename U>
+inline typename std::common_type<T, U>::type min(T a, U b) { return (a < b) ? a : b; }
+
+template <typename T, typename U>
+inline typename std::common_type<T, U>::type max(T a, U b) { return (a > b) ? a : b; }
+#endif
+
 class Vector2f {
 
 	friend Vector2f operator-(const Vector2f &v);
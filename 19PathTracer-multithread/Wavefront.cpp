@@ -0,0 +1,240 @@
+#include <algorithm>
+#include "Wavefront.h"
+#include "Render.h"
+#include "Statistics.h"
+
+
+// the counters only exist with TRACE_STATISTICS, the costs of the paths stay 0 without them
+static uint64_t traversalCost() {
+
+#if TRACE_STATISTICS
+	return ThreadStatistics().cost();
+#else
+	return 0;
+#endif
+}
+
+void Wavefront::addSample(size_t pixel, const Ray& ray, const Random& random) {
+
+	Path path;
+	path.ray = ray;
+	path.L = Color(0.0, 0.0, 0.0);
+	path.throughput = Color(1.0, 1.0, 1.0);
+	path.bouncePdf = 0.0f;
+	path.bouncesLeft = c_numBounces;
+	path.pixel = pixel;
+	path.cost = 0.0f;
+	path.random = random;
+
+	m_paths.push_back(path);
+}
+
+Color Wavefront::getColor(size_t path) const {
+
+	return m_paths[path].L * c_radianceScale;
+}
+
+void Wavefront::clear() {
+
+	m_paths.clear();
+}
+
+void Wavefront::trace() {
+
+	extendPrimary();
+
+	while (!m_active.empty()) {
+
+		sortHits();
+		shadeLights();
+		shade(SpecularQueue);
+		shade(DiffuseQueue);
+		traceShadowRays();
+		extend();
+	}
+}
+
+void Wavefront::extendPrimary() {
+
+	// the records of the last batch would hold the t of its hits
+	m_hits.assign(m_paths.size(), Hit());
+	m_active.clear();
+
+	// the camera rays of neighbouring samples are coherent, with packets they are traced four at a time
+	size_t samplesAtOnce = c_packets ? RayPacket::Size : 1;
+	for (size_t first = 0; first < m_paths.size(); first += samplesAtOnce) {
+
+		size_t count = min(samplesAtOnce, m_paths.size() - first);
+		STATISTIC(primaryRays, count);
+		uint64_t cost = traversalCost();
+
+		if (c_packets) {
+			RayPacket packet;
+			for (size_t j = 0; j < count; ++j) {
+				packet.setRay((int)j, m_paths[first + j].ray);
+			}
+			scene->hitObjects2(packet, &m_hits[first]);
+		}else {
+			scene->hitObjects2(m_paths[first].ray, m_hits[first]);
+		}
+
+		// the work of a packet is shared by its rays
+		float share = float(traversalCost() - cost) / count;
+		for (size_t j = first; j < first + count; ++j) {
+			m_paths[j].cost += share;
+			if (m_hits[j].hitObject) m_active.push_back((int)j);
+		}
+	}
+}
+
+void Wavefront::extend() {
+
+	if (c_sortRays) sortRays();
+
+	size_t live = 0;
+	for (size_t i = 0; i < m_active.size(); i++) {
+
+		int p = m_active[i];
+		Path& path = m_paths[p];
+
+		STATISTIC(bounceRays, 1);
+		uint64_t cost = traversalCost();
+		bool hit = scene->hitObjects2(path.ray, m_hits[p]);
+		path.cost += float(traversalCost() - cost);
+
+		if (hit) m_active[live++] = p;
+	}
+	m_active.resize(live);
+}
+
+// spreads the lower 10 bits of v to every third bit
+static uint32_t expandBits(uint32_t v) {
+
+	v = (v | (v << 16)) & 0x030000FF;
+	v = (v | (v << 8)) & 0x0300F00F;
+	v = (v | (v << 4)) & 0x030C30C3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+void Wavefront::sortRays() {
+
+	// cells of the bounds of the scene, the origins on planes outside go to the border cells
+	BBox bounds = scene->getBounds();
+	Vector3f origin = bounds.getPos();
+	Vector3f scale = bounds.getSize() - origin;
+	for (int i = 0; i < 3; i++) {
+		scale[i] = scale[i] > 0.0f ? 1024.0f / scale[i] : 0.0f;
+	}
+
+	m_keys.resize(m_active.size());
+	for (size_t i = 0; i < m_active.size(); i++) {
+
+		const Ray& ray = m_paths[m_active[i]].ray;
+
+		uint32_t cell[3];
+		for (int j = 0; j < 3; j++) {
+			cell[j] = (uint32_t)Clamp((ray.origin[j] - origin[j]) * scale[j], 0.0f, 1023.0f);
+		}
+
+		// the rays of one octant take the same order of the children in the trees
+		uint32_t octant = (ray.direction[0] < 0.0f) | (ray.direction[1] < 0.0f) << 1 | (ray.direction[2] < 0.0f) << 2;
+		uint32_t key = octant << 29 | (expandBits(cell[0]) | expandBits(cell[1]) << 1 | expandBits(cell[2]) << 2) >> 1;
+
+		m_keys[i] = (uint64_t)key << 32 | (uint32_t)m_active[i];
+	}
+
+	std::sort(m_keys.begin(), m_keys.end());
+
+	for (size_t i = 0; i < m_keys.size(); i++) {
+		m_active[i] = (int)(m_keys[i] & 0xFFFFFFFF);
+	}
+}
+
+void Wavefront::sortHits() {
+
+	for (int i = 0; i < NumberOfQueues; i++) {
+		m_queues[i].clear();
+	}
+
+	for (size_t i = 0; i < m_active.size(); i++) {
+
+		int p = m_active[i];
+		const Material* material = m_hits[p].material;
+		Material::Type type = material ? material->getType() : Material::Diffuse;
+
+		m_queues[type == Material::Light ? LightQueue : type == Material::Specular ? SpecularQueue : DiffuseQueue].push_back(p);
+	}
+	m_active.clear();
+}
+
+void Wavefront::shadeLights() {
+
+	for (size_t i = 0; i < m_queues[LightQueue].size(); i++) {
+
+		int p = m_queues[LightQueue][i];
+		Path& path = m_paths[p];
+
+		// an emissive surface without a light is lit like any other
+		const AreaLight* light = FindLight(m_hits[p]);
+		if (light) {
+			path.L = path.L + path.throughput * L_emitted(light, m_hits[p], path.bouncePdf);
+		}else {
+			m_queues[DiffuseQueue].push_back(p);
+		}
+	}
+}
+
+void Wavefront::shade(Queue queue) {
+
+	Material::Type type = queue == SpecularQueue ? Material::Specular : Material::Diffuse;
+
+	for (size_t i = 0; i < m_queues[queue].size(); i++) {
+
+		int p = m_queues[queue][i];
+		Path& path = m_paths[p];
+		const Hit& hit = m_hits[p];
+
+		// a light found by the last bounce counts for nothing, the path ends without tracing it
+		if (path.bouncesLeft == 1)
+			continue;
+
+		ThreadRandom() = path.random;
+
+		Vector3f position = hit.originalRay.origin + hit.originalRay.direction * hit.t;
+
+		if (c_nextEventEstimation && type != Material::Specular) {
+
+			ShadowRay shadowRay;
+			Color radiance;
+			if (SampleLight(position, hit.normal, shadowRay.ray, shadowRay.distance, shadowRay.light, radiance)) {
+				shadowRay.radiance = path.throughput * hit.color * radiance;
+				shadowRay.path = p;
+				m_shadowRays.push_back(shadowRay);
+			}
+		}
+
+		if (NextBounce(hit, type, path.bouncesLeft, position, path.throughput, path.bouncePdf, path.ray)) {
+			path.bouncesLeft--;
+			m_active.push_back(p);
+		}
+
+		path.random = ThreadRandom();
+	}
+}
+
+void Wavefront::traceShadowRays() {
+
+	for (size_t i = 0; i < m_shadowRays.size(); i++) {
+
+		const ShadowRay& shadowRay = m_shadowRays[i];
+		Path& path = m_paths[shadowRay.path];
+
+		uint64_t cost = traversalCost();
+		if (!scene->shadowHit(shadowRay.ray, shadowRay.distance, shadowRay.light)) {
+			path.L = path.L + shadowRay.radiance;
+		}
+		path.cost += float(traversalCost() - cost);
+	}
+	m_shadowRays.clear();
+}
@@ -0,0 +1,86 @@
+#ifndef _WAVEFRONT_H
+#define _WAVEFRONT_H
+
+#include <vector>
+#include <stdint.h>
+#include "Hit.h"
+#include "Ray.h"
+#include "Color.h"
+#include "Random.h"
+
+class Primitive;
+
+// path tracer for a batch of samples that extends all their paths together, one bounce at a time
+// each bounce intersects the rays of all live paths, sorts the hits into queues by the type of their material,
+// shades every queue in one go and traces the shadow rays of the light sampling in a pass of their own
+// a path takes the steps of L_out2 with its own random stream, so the image is the same as the one of the megakernel
+class Wavefront{
+
+public:
+
+	// the batch is traced once it holds this many samples, more only cost memory
+	static const size_t MaxPaths = 4096;
+
+	// a sample of the pixel with its primary ray, random continues the stream of the sample after the ray
+	void addSample(size_t pixel, const Ray& ray, const Random& random);
+	bool isFull() const { return m_paths.size() >= MaxPaths; }
+	size_t size() const { return m_paths.size(); }
+
+	// traces all paths of the batch until they end
+	void trace();
+
+	size_t getPixel(size_t path) const { return m_paths[path].pixel; }
+	// radiance of the sample, scaled like L_in
+	Color getColor(size_t path) const;
+	// traversal work of the path, 0 unless built with TRACE_STATISTICS
+	float getCost(size_t path) const { return m_paths[path].cost; }
+
+	void clear();
+
+private:
+
+	// all a path carries from one bounce to the next, its hit is kept in m_hits
+	struct Path{
+		Ray ray;
+		Color L;
+		Color throughput;
+		float bouncePdf;		// density of the bounce that found the hit, 0 for the camera ray and mirrors
+		size_t bouncesLeft;
+		size_t pixel;
+		float cost;
+		Random random;
+	};
+
+	// a shadow ray of the light sampling, the radiance is added to the path unless the ray is blocked
+	struct ShadowRay{
+		Ray ray;
+		float distance;
+		const Primitive* light;
+		Color radiance;			// with the throughput of the path and the colour of the surface
+		int path;
+	};
+
+	// the path tracer treats Matte, Phong and the other materials without a type of their own alike
+	enum Queue { LightQueue, SpecularQueue, DiffuseQueue, NumberOfQueues };
+
+	void extendPrimary();
+	void extend();
+	// orders the rays of m_active by the octant of their direction and the cell of their origin along a morton curve
+	void sortRays();
+	void sortHits();
+	void shadeLights();
+	void shade(Queue queue);
+	void traceShadowRays();
+
+	std::vector<Path> m_paths;
+	std::vector<Hit> m_hits;
+
+	// indices of the paths with a hit to shade, and of those with a new ray to trace after the shading
+	std::vector<int> m_active;
+	std::vector<int> m_queues[NumberOfQueues];
+	// sort key in the high half and path index in the low half
+	std::vector<uint64_t> m_keys;
+	std::vector<ShadowRay> m_shadowRays;
+};
+
+#endif
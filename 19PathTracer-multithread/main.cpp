@@ -1,3 +1,4 @@
+#ifdef _WIN32
 #include <atomic>
 #include <vector>
 #include <thread>
@@ -15,6 +16,7 @@
 #include "Primitive.h"
 #include "Camera.h"
 #include "Scene.h"
+#include "Render.h"
 
 POINT g_OldCursorPos;
 void ProcessInput(HWND hWnd);
@@ -34,313 +36,20 @@ enum DIRECTION {
 
 #define FORCE_SINGLE_THREAD() 0
 
-#define COSINE_WEIGHTED_HEMISPHERE_SAMPLES() 1
-#define JITTER_AA() 1
 #define RENDER_SCENE() 3
 
-//=================================================================================
-// User tweakable parameters - Scenes	Globals
-//=================================================================================
 const UINT WM_APP_MY_THREAD_UPDATE = WM_APP + 0;
-// image size
-const size_t c_imageWidth = 512;
-const size_t c_imageHeight = 512;
-
-// sampling parameters
-size_t c_samplesPerPixel = 10000;
-const size_t c_numBounces = 5;
-const float c_rayBounceEpsilon = 0.001f;
 
-// multithreaded rendering
-std::vector<TPixelRGBF32> g_pixels;
-unsigned char *g_pixels2 = NULL;
-
-std::vector<std::thread> threads;
 size_t numThreads;
 STimer timer;
+bool frameReported = false;
 
 HBITMAP hbitmap;
-Projection *camera;
-Scene *scene;
 
 void restartTask(HWND hWnd);
-std::mutex mutex;
-bool waitAllThreads = false;
-bool finishedAllThreads = false;
-
-Color RenderPixel(float u, float v, Color& color);
 
 RenderTask *renderTask;
 
-float RandomFloat2() {
-
-	/*
-	// Xorshift random number algorithm invented by George Marsaglia
-	static uint32_t rng_state = 0xf2eec0de;
-	rng_state ^= (rng_state << 13);
-	rng_state ^= (rng_state >> 17);
-	rng_state ^= (rng_state << 5);
-	return float(rng_state) * (1.0f / 4294967296.0f);
-	*/
-
-	// alternately, using a standard c++ prng
-	static std::random_device rd;
-	static std::mt19937 mt(rd());
-	static std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-	return dist(mt);
-}
-
-class Stoppable {
-
-	std::promise<void> exitSignal;
-	std::future<void> futureObj;
-
-public:
-	Stoppable() : futureObj(exitSignal.get_future()) {
-
-	}
-
-	Stoppable(Stoppable && obj) : exitSignal(std::move(obj.exitSignal)), futureObj(std::move(obj.futureObj)) {
-
-		//std::cout << "Move Constructor is called" << std::endl;
-	}
-
-	Stoppable & operator=(Stoppable && obj) {
-		//std::cout << "Move Assignment is called" << std::endl;
-		exitSignal = std::move(obj.exitSignal);
-		futureObj = std::move(obj.futureObj);
-		return *this;
-	}
-
-	// Task need to provide defination  for this function
-	// It will be called by thread function
-	virtual void run(STimer& timer, std::vector<TPixelRGBF32> & pixels, unsigned char*&data) = 0;
-
-	// Thread function to be executed by thread
-	void operator()(STimer& timer, std::vector<TPixelRGBF32> & pixels, unsigned char*&data) {
-		run(timer, pixels, data);
-	}
-
-	//Checks if thread is requested to stop
-	bool stopRequested() {
-
-		// checks if value in future object is available
-		if (futureObj.wait_for(std::chrono::milliseconds(0)) == std::future_status::timeout)
-			return false;
-		return true;
-	}
-
-	// Request the thread to stop by setting value in promise object
-	void stop() {
-		exitSignal.set_value();
-	}
-};
-
-class Render : public Stoppable {
-
-	int currentRowIndex = 0;
-	bool m_wait = false;
-	bool m_finished = false;
-
-public:
-
-	int getCurrentRowIndex() { return currentRowIndex; }
-	void reset() { currentRowIndex = 0; m_finished = false;  m_wait = false; }
-	void setWaiting() { m_wait = true; }
-	void setFinished() { m_finished = true; }
-	bool isFinished() { return m_finished; }
-
-	// Function to be executed by thread function
-	void run(STimer& timer, std::vector<TPixelRGBF32> & pixels, unsigned char* &pixels2) {
-
-		// Check if thread is requested to stop ?
-		while (stopRequested() == false) {
-
-			mutex.lock();
-			waitAllThreads = m_wait;
-			mutex.unlock();
-
-			// each thread grabs a pixel at a time and renders it
-			currentRowIndex = min(currentRowIndex, c_imageHeight);
-			size_t rowIndex = currentRowIndex++;
-
-			bool firstThread = rowIndex == 0;
-			int lastPercent = -1;
-
-			while (((rowIndex < c_imageHeight && !m_finished && !m_wait))) {
-
-				for (size_t x = 0, k = 0; x < c_imageWidth; ++x, k = k + 3) {
-
-					if (m_wait) {
-						break;
-					}
-
-					// render the pixel by taking multiple samples and incrementally averaging them
-					for (size_t i = 0; i < c_samplesPerPixel; ++i) {
-						float jitterX = JITTER_AA() ? RandomFloat2() : 0.5f;
-						float jitterY = JITTER_AA() ? RandomFloat2() : 0.5f;
-						float u = ((float)x + jitterX);
-						float v = ((float)rowIndex + jitterY);
-						Color color;
-						
-						RenderPixel(u, v, color);
-						TPixelRGBF32 sample;
-						sample[0] = color.r; sample[1] = color.g; sample[2] = color.b;
-
-						pixels[rowIndex * c_imageWidth + x] += sample;
-						//pixels[rowIndex * c_imageWidth + x] += (sample - pixels[rowIndex * c_imageWidth + x]) / float(i + 1.0f);
-					}
-
-					for (size_t j = 0; j < 3; j++) {
-						pixels2[rowIndex * c_imageWidth * 3 + k + j] = uint8(Clamp((pixels[rowIndex * c_imageWidth + x][2 - j] / (c_samplesPerPixel)), 0.0f, 1.0f)* 255.0f);
-						//pixels2[rowIndex * c_imageWidth * 3 + k + j] = uint8(Clamp(powf(pixels[rowIndex * c_imageWidth + x][2 - j], 1.0f / 2.2f)* 255.0f, 0.0f, 255.0f));
-					}
-				}
-				// move to next row
-				rowIndex = currentRowIndex++;
-			}// rendering
-
-			mutex.lock();
-			finishedAllThreads = (currentRowIndex - 1) == c_imageHeight;
-			mutex.unlock();
-		}// stop requested
-	}// end run
-};
-Render task;
-//=================================================================================
-Color L_out(const Vector3f& outDir, size_t bouncesLeft, const Hit& hit) {
-
-	// if no bounces left, return the ray miss color
-	if (bouncesLeft == 0)
-		return Color(0.0, 0.0, 0.0);
-
-	Material* material = hit.material;
-
-	Color ret = dynamic_cast<Emissive*>(material) ? Color(1.0, 1.0, 1.0) : Color(0.0, 0.0, 0.0);
-
-	Vector3f normal = hit.normal;
-	Vector3f intersectionPoint = hit.hitPoint;
-	Color diffuse = hit.color;
-	 
-	// add in random recursive samples for global illumination
-	{
-#if COSINE_WEIGHTED_HEMISPHERE_SAMPLES()
-		Vector3f transformedhitPoint = hit.originalRay.origin + hit.originalRay.direction * hit.t;
-		Vector3f newRayDir = CosineSampleHemisphere(normal);
-		Vector3f newRayOrigin = transformedhitPoint + newRayDir * c_rayBounceEpsilon;
-
-		Hit hit = scene->hitObjects2(Ray(newRayOrigin, newRayDir));
-		if (hit.hitObject) {
-			ret = ret + L_out(-newRayDir, bouncesLeft - 1, hit) * diffuse;
-		}else {
-			ret = ret + Color(0.0, 0.0, 0.0) * diffuse;
-		}		
-#else
-		// this point is in  eyespace 
-		Vector3f transformedhitPoint = hit.originalRay.origin + hit.originalRay.direction * hit.t;
-		Vector3f newRayDir = UniformSampleHemisphere(normal);
-		Vector3f newRayOrigin = transformedhitPoint + newRayDir * c_rayBounceEpsilon;
-
-		Hit hit = scene->hitObjects2(Ray(newRayOrigin, newRayDir));
-
-		if (hit.hitObject) {
-			ret = ret + L_out(-newRayDir, bouncesLeft - 1, hit) * diffuse * Vector3f::dot(newRayDir, normal) * 2.0f ;
-		}else {
-			ret = ret + Color(0.0, 0.0, 0.0) * diffuse * Vector3f::dot(newRayDir, normal) * 2.0f;
-		}		
-#endif
-	}
-	return ret;
-}
-
-
-//=================================================================================
-Color L_out2(size_t bouncesLeft, const Hit& hit) {
-
-	// if no bounces left, return the ray miss color
-	if (bouncesLeft == 0)
-		return Color(0.0, 0.0, 0.0);
-
-	Material* material = hit.material;
-	
-	if (dynamic_cast<Emissive*>(material)) {
-		for (unsigned int i = 0; i < hit.scene->m_lights.size(); i++) {
-			AreaLight* light = static_cast<AreaLight*>(hit.scene->m_lights[i].get());
-			if (light->m_primitive.get() == hit.primitive) {
-				return hit.color *(1.0 / light->pdf(hit));
-			}
-		}
-	}
-
-	Vector3f normal = hit.normal;
-	Vector3f intersectionPoint = hit.hitPoint;
-	Color diffuse = hit.color;
-	
-
-	// add in random recursive samples for global illumination
-	{
-#if COSINE_WEIGHTED_HEMISPHERE_SAMPLES()
-		// this point is in  eyespace 
-		Vector3f transformedhitPoint = hit.originalRay.origin + hit.originalRay.direction * hit.t;
-		Vector3f newRayOrigin;
-		Vector3f newRayDir;
-
-		if (dynamic_cast<Reflective*>(material)) {
-			float dot = Vector3f::dot(hit.originalRay.direction, normal);
-			newRayDir = hit.originalRay.direction - (normal  * 2.0f * dot);
-			newRayOrigin = dot < 0 ? transformedhitPoint + normal * c_rayBounceEpsilon : transformedhitPoint - normal * c_rayBounceEpsilon;
-		}else {
-			newRayDir = CosineSampleHemisphere(normal);
-			newRayOrigin = transformedhitPoint + newRayDir * c_rayBounceEpsilon;			
-		}
-
-		Hit hit = scene->hitObjects2(Ray(newRayOrigin, newRayDir));
-		return hit.hitObject ? L_out2(bouncesLeft - 1, hit) * diffuse : Color(0.0, 0.0, 0.0);
-
-#else
-		// this point is in  eyespace 
-		Vector3f transformedhitPoint = hit.originalRay.origin + hit.originalRay.direction * hit.t;
-		Vector3f newRayOrigin;
-		Vector3f newRayDir;
-
-		if(dynamic_cast<Reflective*>(material)){
-		
-			float dot = Vector3f::dot(hit.originalRay.direction, normal);
-			newRayDir = hit.originalRay.direction - (normal  * 2.0f * dot);
-			newRayOrigin  = dot < 0 ? transformedhitPoint + normal * 0.01 : transformedhitPoint - normal * 0.01;			
-		}else{
-
-			newRayDir = UniformSampleHemisphere(normal);
-			newRayOrigin = transformedhitPoint + newRayDir * c_rayBounceEpsilon;
-
-			float lambert = Vector3f::dot(normal, newRayDir);
-			float pdf = max(1e-6f, max(0, Vector3f::dot(normal, newRayDir)));
-			diffuse = diffuse * lambert * 2.0;			
-		}
-			
-		Hit hit = scene->hitObjects2(Ray(newRayOrigin, newRayDir));
-		return hit.hitObject ? L_out2(bouncesLeft - 1, hit) * diffuse : Color(0.0, 0.0, 0.0);	
-#endif
-	}
-}
-
-//=================================================================================
-Color L_in(const Vector3f& rayPos, const Vector3f& rayDir) {
-
-	Hit hit = scene->hitObjects2(Ray(rayPos, rayDir));
-
-	if (!hit.hitObject)
-		return Color(0.0, 0.0, 0.0);
-	
-	return L_out2(c_numBounces, hit) * 0.003;
-}
-
-
-//=================================================================================
-Color RenderPixel(float u, float v, Color& color) {
-	 color = L_in(camera->getPosition(), camera->rasterToCamera(u, v));
-	 return color;
-}
 //=================================================================================
 LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParma, LPARAM lParam);
 
@@ -400,105 +109,13 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 	UpdateWindow(hwnd);
 
 
-	int numSample = 100;
-
-	Vector3f camPos(278.0f, 273.0f, -800.0f);
-	Vector3f target(278.0f, 273.0f, 0.0f);
-	Vector3f up(0, 1.0, 0.0);
-	camera = new Projection(camPos, target, up);
-
-	Sampler* samplerMatte = new MultiJittered(numSample, 83);
-	samplerMatte->mapSamplesToHemisphere(1.0);
-
-
-	Vector3f p0, a, b;
-	// box dimensions
-	double width = 552.8f;   	// x direction
-	double height = 548.8f;  	// y direction
-	double depth = 559.2f;	// z direction
-
-	scene = new Scene(ViewPlane(300, 300, 1.0), Color(0.0, 0.0, 0.0));
-
-	Emissive* emissiveMat = new Emissive();
-	emissiveMat->setScaleRadiance(100.0);
-	emissiveMat->setColor(Color(1.0, 1.0, 1.0));
-
-	Matte* matte1 = new Matte();
-	matte1->setKa(0.25);
-	matte1->setKd(0.6);
-	matte1->setSampler(samplerMatte);
-	
-	Reflective *reflective = new Reflective();
-	reflective->setReflectionColor(1.0);
-	reflective->setFrensel(0.4);
-
-	QuadCC* light = new QuadCC(Vector3f(343.0f, 548.6f, 227.0f + 45.0f), Vector3f(343.0f, 548.6f, 332.0f + 45.0f), Vector3f(213.0f, 548.6f, 332.0f + 45.0f), Vector3f(213.0f, 548.6f, 227.0f + 45.0f));
-	light->setMaterial(emissiveMat);
-	light->setColor(Color(1.0, 1.0, 1.0));
-	scene->addPrimitive(light);
-
-	p0 = Vector3f(width, height, 0.0); a = Vector3f(0.0, 0.0, depth); b = Vector3f(-width, 0.0, 0.0);
-	QuadCC* ceiling = new QuadCC(Vector3f(556.0f, 548.8f, 0.0f), Vector3f(556.0f, 548.8f, 559.2f), Vector3f(0.0f, 548.8f, 559.2f), Vector3f(0.0f, 548.8f, 0.0f));
-	ceiling->setMaterial(emissiveMat);
-	ceiling->setColor(Color(0.7f, 0.7f, 0.7f));
-	scene->addPrimitive(ceiling);
-
-	AreaLight* areaLight = new AreaLight;
-	areaLight->setObject(light);
-	areaLight->setShadows(true);
-	scene->addLight(areaLight);
-
-	QuadCC* leftWall = new QuadCC(Vector3f(0.0f, 0.0f, 559.2f), Vector3f(0.0f, 0.0f, 0.0f), Vector3f(0.0f, 548.8f, 0.0f), Vector3f(0.0f, 548.8f, 559.2f));
-	leftWall->setMaterial(matte1);
-	leftWall->setColor(Color(0.2f, 0.7f, 0.2f));  // green
-	scene->addPrimitive(leftWall);
-
-	QuadCC* floor = new QuadCC(Vector3f(552.8f, 0.0f, 0.0f), Vector3f(0.0f, 0.0f, 0.0f), Vector3f(0.0f, 0.0f, 559.2f), Vector3f(549.6f, 0.0f, 559.2f));
-	floor->setMaterial(matte1);
-	floor->setColor(Color(0.7f, 0.7f, 0.7f));
-	scene->addPrimitive(floor);
-
-	QuadCC* rightWall = new QuadCC(Vector3f(552.8f, 0.0f, 0.0f), Vector3f(549.6f, 0.0f, 559.2f), Vector3f(556.0f, 548.8f, 559.2f), Vector3f(556.0f, 548.8f, 0.0f));
-	rightWall->setMaterial(matte1);
-	rightWall->setColor(Color(0.7f, 0.2f, 0.2f));  // red
-	scene->addPrimitive(rightWall);
-	
-	QuadCC* backWall = new QuadCC(Vector3f(549.6f, 0.0f, 559.2f), Vector3f(0.0f, 0.0f, 559.2f), Vector3f(0.0f, 548.8f, 559.2f), Vector3f(556.0f, 548.8f, 559.2f));
-	backWall->setMaterial(matte1);
-	backWall->setColor(Color(0.7f, 0.7f, 0.7f));
-	scene->addPrimitive(backWall);
-	
-	Sphere* sphere = new Sphere(Vector3f(185.5f, 225.5f, 169.0f), 60);
-	sphere->setMaterial(reflective);
-	sphere->setColor(Color(1.0f, 1.0f, 1.0f));
-	scene->addPrimitive(sphere);
-
-	AABB* smallBox = new AABB(Vector3f(0.0, 0.0, 0.0), Vector3f(82.5f, 82.5f, 82.5f));
-	smallBox->setMaterial(matte1);
-	smallBox->setColor(Color(0.7f, 0.7f, 0.7f));
-
-	Instance* _smallBox = new Instance(smallBox);
-	_smallBox->rotate(Vector3f(0.0, 1.0, 0.0), -17.0f);
-	_smallBox->translate(185.5f, 82.5f, 169.0f);
-	scene->addPrimitive(_smallBox);
-
-	AABB* largeBox = new AABB(Vector3f(0.0, 0.0, 0.0), Vector3f(82.5f, 165.0f, 82.5f));
-	largeBox->setMaterial(matte1);
-	largeBox->setColor(Color(0.7f, 0.7f, 0.7f));
-
-	Instance* _largeBox = new Instance(largeBox);
-	_largeBox->rotate(Vector3f(0.0, 1.0, 0.0), 107.0f );
-	_largeBox->translate(368.5f, 165.0f, 351.25);
-	scene->addPrimitive(_largeBox);
+	createCornellBox();
 
 	// report the params
 	numThreads = FORCE_SINGLE_THREAD() ? 1 : std::thread::hardware_concurrency();
 	std::cout << std::string("Using ") + std::to_string(numThreads) + std::string(" threads.") << std::endl;
 
-	threads.resize(numThreads);
-	for (std::thread& t : threads) {
-		t = std::thread([&]() { task.run(std::ref(timer), std::ref(g_pixels), std::ref(g_pixels2)); });
-	}
+	task.start(numThreads, g_pixels, g_pixels2);
 
 	renderTask = new RenderTask();
 
@@ -507,12 +124,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 		if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
 			if (msg.message == WM_QUIT) {
 
-				task.setWaiting();
-				while (!waitAllThreads) {
-					std::this_thread::yield();
-				}
-
-				task.stop();
+				task.cancel();
 				break;
 			}
 			TranslateMessage(&msg);
@@ -521,11 +133,12 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 		}else {
 			
 			ProcessInput(hwnd);
-			if (finishedAllThreads) {
+			if (task.isFinished()) {
 
-				if (!task.isFinished()) {
-					task.setFinished();
+				if (!frameReported) {
+					frameReported = true;
 					timer.Report();
+					task.reportTiles();
 					PostMessage(hwnd, WM_APP_MY_THREAD_UPDATE, NULL, 0);
 				}
 
@@ -540,9 +153,6 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 		} // end If messages waiting
 	} // end while
 
-	for (std::thread& t : threads) {
-		t.join();
-	}
 	return msg.wParam;
 }
 
@@ -624,6 +234,26 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 		} case 'M': {
 			restartTask(hWnd);
 			break;
+		} case 'P': {
+			c_packets = !c_packets;
+			std::cout << "ray packets " << (c_packets ? "on" : "off") << std::endl;
+			restartTask(hWnd);
+			break;
+		} case 'L': {
+			c_nextEventEstimation = !c_nextEventEstimation;
+			std::cout << "light sampling " << (c_nextEventEstimation ? "on" : "off") << std::endl;
+			restartTask(hWnd);
+			break;
+		} case 'F': {
+			c_wavefront = !c_wavefront;
+			std::cout << "wavefront " << (c_wavefront ? "on" : "off") << std::endl;
+			restartTask(hWnd);
+			break;
+		} case 'R': {
+			c_sortRays = !c_sortRays;
+			std::cout << "ray sorting " << (c_sortRays ? "on" : "off") << std::endl;
+			restartTask(hWnd);
+			break;
 		} case 'K': {
 			PostMessage(hWnd, WM_APP_MY_THREAD_UPDATE, NULL, 0);
 			break;
@@ -678,21 +308,15 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
 void restartTask(HWND hWnd) {
 
-	task.setWaiting();
-
-	while (!waitAllThreads) {
-		std::this_thread::yield();
-	}
-
+	task.cancel();
 
 	std::fill(g_pixels.begin(), g_pixels.end(), TPixelRGBF32{0.0, 0.0, 0.0});
-	memset(g_pixels2, 0, 512 *512 * 3 * sizeof(unsigned char));
+	memset(g_pixels2, 0, c_imageWidth * c_imageHeight * 3 * sizeof(unsigned char));
 
 	InvalidateRect(hWnd, NULL, true);
-	task.reset();
-	waitAllThreads = false;
-	finishedAllThreads = false;
+	frameReported = false;
 	timer.Restart();
+	task.restart();
 
 }
 
@@ -732,6 +356,9 @@ void ProcessInput(HWND hWnd) {
 
 		if (Direction > 0 || X != 0.0f || Y != 0.0f) {
 
+			// the workers read the camera, stop them before it changes
+			task.cancel();
+
 			// Rotate camera
 			if (X || Y) {
 				camera->rotate(X, Y);
@@ -761,4 +388,5 @@ void setCursortoMiddle(HWND hwnd) {
 
 	GetClientRect(hwnd, &rect);
 	SetCursorPos(rect.right / 2, rect.bottom / 2);
-}
\ No newline at end of file
+}
+#endif